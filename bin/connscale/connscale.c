@@ -1361,6 +1361,7 @@ int main(int argc, char **argv)
 	int verbose = 0;
 	int ifname_specified = 0;
 	unsigned int i;
+	struct uinet_global_cfg cfg;
 	struct test_config default_active_test = {
 		.num = 0,
 		.name = "default active test",
@@ -1616,7 +1617,9 @@ int main(int argc, char **argv)
 	/*
 	 * Take care not to do to access the UINET API before this point.
 	 */
-	uinet_init(1, 5100*1024, 0);
+	uinet_default_cfg(&cfg);
+	cfg.nmbclusters = 5100*1024;
+	uinet_init(&cfg, NULL);
 
 	for (i = 0; i < num_tests; i++) {
 		test = &tests[i];
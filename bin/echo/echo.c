@@ -494,7 +494,7 @@ int main (int argc, char **argv)
 	}
 	
 	
-	uinet_init(1, 128*1024, NULL);
+	uinet_init(NULL, NULL);
 	uinet_install_sighandlers();
 
 	current_uinst = uinet_instance_default();
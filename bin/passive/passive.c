@@ -1226,7 +1226,7 @@ usage(const char *progname)
 	printf("    -P                   put interface into Promiscuous INET mode\n");
 	printf("    -p port              listen port [0, 65535]\n");
 	printf("    -s                   periodically print stats for interface\n");
-	printf("    -t iftype            interface type [netmap, pcap]\n");
+	printf("    -t iftype            interface type [netmap, pcap, pcapfile]\n");
 	printf("    -v                   be verbose\n");
 }
 
@@ -1252,6 +1252,7 @@ int main (int argc, char **argv)
 	struct uinet_in_addr tmpinaddr;
 	int ifnetmap_count = 0;
 	int ifpcap_count = 0;
+	int ifpcapfile_count = 0;
 	struct content_type *contype;
 
 	memset(interfaces, 0, sizeof(interfaces));
@@ -1363,6 +1364,8 @@ int main (int argc, char **argv)
 				interfaces[num_interfaces - 1].type = UINET_IFTYPE_NETMAP;
 			} else if (0 == strcmp(optarg, "pcap")) {
 				interfaces[num_interfaces - 1].type = UINET_IFTYPE_PCAP;
+			} else if (0 == strcmp(optarg, "pcapfile")) {
+				interfaces[num_interfaces - 1].type = UINET_IFTYPE_PCAPFILE;
 			} else {
 				printf("Unknown interface type %s\n", optarg);
 				return (1);
@@ -1419,7 +1422,7 @@ int main (int argc, char **argv)
 	}
 	
 	
-	uinet_init(1, 128*1024, NULL);
+	uinet_init(NULL, NULL);
 	uinet_install_sighandlers();
 
 	for (i = 0; i < num_interfaces; i++) {
@@ -1436,6 +1439,11 @@ int main (int argc, char **argv)
 			interfaces[i].instance = ifpcap_count;
 			ifpcap_count++;
 			break;
+		case UINET_IFTYPE_PCAPFILE:
+			interfaces[i].alias_prefix = "pcapfile";
+			interfaces[i].instance = ifpcapfile_count;
+			ifpcapfile_count++;
+			break;
 		default:
 			printf("Unknown interface type %d\n", interfaces[i].type);
 			return (1);
@@ -224,7 +224,7 @@ int main(int argc, char **argv)
 	}
 
 	if (!use_malloc) {
-		uinet_init(1, 128*1024, 0);
+		uinet_init(NULL, NULL);
 		printf("Creating pool of %d elements\n", pool_size);
 		pool = uinet_pool_create("test pool", alloc_size, NULL, NULL, NULL, NULL, UINET_POOL_ALIGN_PTR, 0);
 		if (NULL == pool) {
@@ -937,7 +937,7 @@ int main (int argc, char **argv)
 		return (1);
 	}
 	
-	uinet_init(1, 128*1024, NULL);
+	uinet_init(NULL, NULL);
 	uinet_install_sighandlers();
 
 	for (i = 0; i < num_ifs; i++) {
@@ -44,7 +44,15 @@ char *uinet_inet_ntoa(struct uinet_in_addr in, char *buf, unsigned int size);
 const char *uinet_inet_ntop(int af, const void *src, char *dst, unsigned int size);
 int   uinet_inet_pton(int af, const char *src, void *dst);
 int   uinet_inet6_enabled(void);
-int   uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_cfg *inst_cfg);
+void  uinet_default_cfg(struct uinet_global_cfg *cfg);
+
+/*
+ *  Initialize the stack.  If cfg is NULL, the defaults from
+ *  uinet_default_cfg() are used.  cfg->hz sets the clock tick rate, which
+ *  is the granularity of all stack timers, and is limited to the range
+ *  UINET_HZ_MIN to UINET_HZ_MAX.
+ */
+int   uinet_init(struct uinet_global_cfg *cfg, struct uinet_instance_cfg *inst_cfg);
 int   uinet_initialize_thread(void);
 void  uinet_install_sighandlers(void);
 int   uinet_interface_add_alias(uinet_instance_t uinst, const char *name, const char *addr, const char *braddr, const char *mask);
@@ -134,6 +142,12 @@ const char * uinet_mbuf_data(const struct uinet_mbuf *);
 size_t uinet_mbuf_len(const struct uinet_mbuf *);
 int uinet_if_xmit(uinet_if_t uif, const char *buf, int len);
 
+/*
+ *  Lock profiling.  When the library is built with LOCK_PROFILING, these
+ *  start and stop collection of per-site lock hold and wait times, which
+ *  are read through the debug.lock.prof sysctls.  Otherwise enabling
+ *  returns EOPNOTSUPP.  The file name is ignored.
+ */
 int uinet_lock_log_set_file(const char *file);
 int uinet_lock_log_enable(void);
 int uinet_lock_log_disable(void);
@@ -149,7 +163,41 @@ int uinet_lock_log_disable(void);
  *
  *  		UINET_IFTYPE_NETMAP - vale<n>:<m> or <hostifname> or
  *  		    <hostifname>:<qno>, where queue 0 is implied by
- *		    a configstr of <hostifname>
+ *		    a configstr of <hostifname>, or
+ *		    <hostifname>:*[@<cpu>[,<cpu>...]], which opens all
+ *		    hardware queues and runs a receive/transmit thread
+ *		    pair for each one.  The queue threads are bound to
+ *		    the cpus in the list (reused round-robin if there are
+ *		    more queues than cpus), or to consecutive cpus
+ *		    starting at cpu if no list is given.
+ *
+ *		UINET_IFTYPE_AFPACKET - <hostifname>.  Linux only.  Packets
+ *		    are received via a TPACKET_V3 mmap ring and handed to
+ *		    the stack without copying, and transmitted via a
+ *		    TPACKET_V2 mmap ring.
+ *
+ *		UINET_IFTYPE_PCAPFILE - <filename>[:batch=<n>][:realtime]
+ *		    [:vclock].
+ *		    Replays a pcap or pcapng capture of ethernet frames.
+ *		    The file is mapped into memory and packet data is
+ *		    handed to the stack without copying.  Replay starts
+ *		    when the interface is brought up and runs as fast as
+ *		    possible, <n> packets per batch (default 64), unless
+ *		    realtime is given, in which case the capture
+ *		    timestamps are used to pace delivery.  Transmitted
+ *		    packets are dropped.  The achieved rate is printed
+ *		    when the end of the file is reached.  With vclock,
+ *		    the stack's clock is driven by the capture timestamps
+ *		    for the duration of the replay instead of by wall
+ *		    clock time, so protocol timers behave the same at any
+ *		    replay speed.  The clock is shared by all instances.
+ *
+ *		UINET_IFTYPE_MEMLINK - <linkname>.  The first two
+ *		    interfaces created with the same <linkname>, in the
+ *		    same or different instances, are connected to each
+ *		    other by an in-process ethernet link.  Frames are
+ *		    passed between them through lock-free rings without
+ *		    copying.
  *
  *  alias	is any user-supplied string, or NULL.  If a string is supplied,
  *	        it must be unique among all the other aliases and driver-assigned
@@ -160,8 +208,14 @@ int uinet_lock_log_disable(void);
  *		the same connection domain will be searched.
  *
  *  cpu		is the cpu number on which to perform stack processing on
- *		packets received on ifname.  -1 means leave it up to the
- *		scheduler.
+ *		packets received on ifname.  -1 means use a cpu local to
+ *		the host NIC's NUMA node when there is more than one node
+ *		and the NIC's node is known, and otherwise leave it up to
+ *		the scheduler.
+ *
+ *  		For multi-queue interfaces, the batch event handler (see
+ *  		uinet_if_set_batch_event_handler()) is invoked
+ *  		independently by each queue's receive thread.
  *
  *  cookie	is a pointer to an opaque reference that, if not NULL, will be
  *		set to something that corresponds to the interface that is
@@ -250,6 +304,25 @@ int uinet_if_set_batch_event_handler(uinet_if_t uif,
 				     void (*handler)(void *arg, int event),
 				     void *arg);
 
+
+/*
+ *  Enable or disable software large receive offload on an interface.  When
+ *  enabled, in-order TCP segments of the same flow that arrive in the same
+ *  receive batch are merged before being passed to the stack, and any merged
+ *  segments are passed up before the batch finish event.  Disabled by
+ *  default.
+ *
+ *  Return values:
+ *
+ *  0			Setting changed
+ *
+ *  UINET_EINVAL	Invalid interface
+ *
+ *  UINET_EOPNOTSUPP	Interface driver does not support LRO (supported by
+ *			netmap, pcap, and pcapfile interfaces)
+ */
+int uinet_if_set_lro(uinet_if_t uif, int enable);
+
 #ifdef __cplusplus
 }
 #endif
@@ -512,7 +512,10 @@ typedef enum {
 	UINET_IFTYPE_NETMAP,
 	UINET_IFTYPE_PCAP,
 	UINET_IFTYPE_BRIDGE,
-	UINET_IFTYPE_SPAN
+	UINET_IFTYPE_SPAN,
+	UINET_IFTYPE_AFPACKET,
+	UINET_IFTYPE_PCAPFILE,
+	UINET_IFTYPE_MEMLINK
 } uinet_iftype_t;
 
 
@@ -520,6 +523,17 @@ struct uinet_if;
 typedef struct uinet_if * uinet_if_t;
 
 
+#define UINET_HZ_MIN	10
+#define UINET_HZ_MAX	10000
+
+struct uinet_global_cfg {
+	unsigned int ncpus;
+	unsigned int nmbclusters;
+	unsigned int hz;		/* clock ticks per second */
+	unsigned int hugepages;		/* 2MB pages reserved for mbuf, socket and pcb slabs, 0 to disable */
+};
+
+
 struct uinet_instance_cfg {
 	unsigned int loopback;
 	void *userdata;
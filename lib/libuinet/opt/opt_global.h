@@ -4,4 +4,5 @@
 #define RWLOCK_NOINLINE 1
 #define SX_NOINLINE 1
 //#define UINET_LOCK_DEBUG 1
+//#define LOCK_PROFILING 1
 //#define WITNESS 1
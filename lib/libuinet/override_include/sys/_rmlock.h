@@ -27,18 +27,31 @@
 #ifndef	_SYS__RMLOCK_H_
 #define _SYS__RMLOCK_H_
 
-#include "uinet_host_interface.h"
+#include <sys/_mutex.h>
 
 /*
- * Read mostly lock same as rwlock in this implementation
+ * Read-mostly lock.  Readers only touch the reader count of their own cpu
+ * slot, which lives on its own cache line.  Writers announce themselves
+ * with rm_writer, then wait for every slot's reader count to drain.
  */
+struct rm_pcpu {
+	volatile u_int		rp_readers;
+} __aligned(CACHE_LINE_SIZE);
+
 struct rmlock {
 	struct lock_object	lock_object;
-	uhi_rwlock_t		rm_lock;
+	volatile u_int		rm_writer;	/* write lock held */
+	u_int			rm_wrecurse;	/* (w) write recursion depth */
+	u_int			rm_ncpus;	/* number of rm_pcpu slots */
+	struct rm_pcpu		*rm_pcpu;
+	void			*rm_pcpu_mem;	/* allocation backing rm_pcpu */
+	struct mtx		rm_wlock;	/* serializes writers */
 };
 
 struct rm_priotracker {
-	char unused;
+	struct rmlock		*rmp_rmlock;
+	struct rm_priotracker	*rmp_next;	/* thread's held read locks */
+	u_int			rmp_slot;	/* cpu slot holding the count */
 };
 
 #endif	/* _SYS__RMLOCK_H_ */
@@ -170,6 +170,29 @@ struct pcpu *uinet_pcpu_get(void);
 	(__typeof(DPCPU_NAME(n))*)((b) + DPCPU_DEF_GET(n)->copyoffset + DPCPU_START)
 
 
+/*
+ * Per-cpu statistics blocks, in the spirit of counter(9).  A block holds
+ * one cache-line-aligned copy of a statistics structure per cpu slot, so
+ * that updates are plain increments of slot-local memory.  Readers sum the
+ * copies.  The structure must consist solely of u_long counters.
+ *
+ * More than one thread can map to a cpu slot, so updates are made in a
+ * critical section, which gives the thread exclusive use of its slot.
+ */
+#define	PCPUSTAT_STRIDE(size)		roundup2((size), CACHE_LINE_SIZE)
+#define	PCPUSTAT_PTR(type, base, cpu)					\
+	((type *)((char *)(base) + (cpu) * PCPUSTAT_STRIDE(sizeof(type))))
+#define	PCPUSTAT_ADD(type, base, name, val) do {			\
+	critical_enter();						\
+	PCPUSTAT_PTR(type, (base), curcpu)->name += (val);		\
+	critical_exit();						\
+} while (0)
+
+void	*pcpustat_alloc(size_t size, int flags);
+void	 pcpustat_free(void *base);
+void	 pcpustat_fetch(void *dst, const void *base, size_t size);
+void	 pcpustat_store(void *base, const void *src, size_t size);
+
 #include "uinet_host_interface.h"
 #include <sys/proc.h>
 
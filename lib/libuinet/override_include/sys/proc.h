@@ -42,4 +42,7 @@ extern uhi_tls_key_t kthread_tls_key;
 struct uinet_thread *uinet_thread_alloc(struct proc *p);
 void uinet_thread_free(struct uinet_thread *utd);
 
+u_char uinet_cpuslot_alloc(int cpu);
+void uinet_cpuslot_free(u_char slot);
+
 #endif	/* _UINET_SYS_PROC_H_ */
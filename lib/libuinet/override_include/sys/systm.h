@@ -31,6 +31,33 @@
 #define	log	syslog
 #include_next <sys/systm.h>
 
-void uinet_hardclock(void);
+void uinet_hardclock(int cnt);
+void uinet_hardclock_realtime(int cnt);
+void uinet_ticks_realtime(int cnt);
+void uinet_clock_sync(void);
+void uinet_vclock_enable(void);
+void uinet_vclock_disable(void);
+void uinet_vclock_advance(uint64_t timestamp_ns);
+void uinet_callout_claim(void);
+void uinet_callout_release(void);
+void uinet_callout_poll(void);
+
+u_int uinet_kthread_wait_started(uint64_t timeout_ns);
+
+struct uma_zone;
+int  uinet_hugepage_init(unsigned int npages);
+void uinet_hugepage_zone(struct uma_zone *zone);
+void uinet_zone_set_domain(struct uma_zone *zone, int domain);
+
+#define	MAXMEMDOM	8
+
+extern int vm_ndomains;
+extern int uinet_domain_node[MAXMEMDOM];
+
+void uinet_numa_init(unsigned int ncpus);
+int  uinet_curdomain(void);
+int  uinet_node_domain(int node);
+int  uinet_cpu_next(int cpu, unsigned int n);
+int  uinet_domain_cpu(int domain, unsigned int n);
 
 #endif	/* _UINET_SYS_SYSTM_H_ */
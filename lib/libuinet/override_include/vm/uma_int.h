@@ -35,80 +35,71 @@
 #undef	vsetslab
 #undef	vsetobj
 
-#define vsetobj(a, b)	panic("vsetobj() not implemented\n")
+#define vsetobj(a, b)	vclrslab(a)
+
+#include <machine/atomic.h>
 
 #undef UMA_MD_SMALL_ALLOC
 #define NO_OBJ_ALLOC
 
 
-void thread_bucket_lock(void);
-void thread_bucket_unlock(void);
-void uma_page_slab_hash_lock(void);
-void uma_page_slab_hash_unlock(void);
-
-#define critical_enter()        thread_bucket_lock()
-#define critical_exit()         thread_bucket_unlock()
+/*
+ * Page to slab lookup for UMA_ZONE_VTOSLAB kegs, in place of the vm_page
+ * based lookup.  This is a three level radix tree keyed by page number,
+ * which grows with the address space actually handed to UMA.  Lookups are
+ * lock free.  Updates happen only when a slab's pages enter or leave UMA,
+ * and are serialized in vsetslab() and vclrslab().  Tree nodes are never
+ * freed once published, so a reader can always follow a pointer it loaded.
+ */
+#ifdef __LP64__
+#define	UMA_PAGE_KEY_BITS	(48 - PAGE_SHIFT)
+#else
+#define	UMA_PAGE_KEY_BITS	(32 - PAGE_SHIFT)
+#endif
+#define	UMA_PAGE_LEVEL_BITS	(UMA_PAGE_KEY_BITS / 3)
+#define	UMA_PAGE_ROOT_BITS	(UMA_PAGE_KEY_BITS - 2 * UMA_PAGE_LEVEL_BITS)
+#define	UMA_PAGE_LEVEL_SIZE	(1UL << UMA_PAGE_LEVEL_BITS)
+#define	UMA_PAGE_ROOT_SIZE	(1UL << UMA_PAGE_ROOT_BITS)
 
-extern int uma_page_mask;
+#define	UMA_PAGE_ROOT_IDX(pgno)	((pgno) >> (2 * UMA_PAGE_LEVEL_BITS))
+#define	UMA_PAGE_NODE_IDX(pgno)	(((pgno) >> UMA_PAGE_LEVEL_BITS) & (UMA_PAGE_LEVEL_SIZE - 1))
+#define	UMA_PAGE_LEAF_IDX(pgno)	((pgno) & (UMA_PAGE_LEVEL_SIZE - 1))
 
+struct uma_page_leaf {
+	uma_slab_t		upl_slab[UMA_PAGE_LEVEL_SIZE];
+};
 
-#define UMA_PAGE_HASH(pgno) ((pgno) & uma_page_mask)
+struct uma_page_node {
+	struct uma_page_leaf	*upn_leaf[UMA_PAGE_LEVEL_SIZE];
+};
 
-typedef struct uma_page {
-        LIST_ENTRY(uma_page)    list_entry;
-	unsigned long		up_pageno;
-        uma_slab_t              up_slab;
-} *uma_page_t;
+extern struct uma_page_node *uma_page_root[UMA_PAGE_ROOT_SIZE];
 
-LIST_HEAD(uma_page_head, uma_page);
-extern struct uma_page_head *uma_page_slab_hash;
+void vsetslab(vm_offset_t va, uma_slab_t slab);
+void vclrslab(vm_offset_t va);
 
 static __inline uma_slab_t
 vtoslab(vm_offset_t va)
-{       
-        struct uma_page_head *hash_list;
-        uma_page_t up;
-	uma_slab_t slab = NULL;
+{
+	struct uma_page_node *node;
+	struct uma_page_leaf *leaf;
 	unsigned long pageno = atop(va);
 
-        hash_list = &uma_page_slab_hash[UMA_PAGE_HASH(pageno)];
-
- 	uma_page_slab_hash_lock();
-	LIST_FOREACH(up, hash_list, list_entry)
-	    if (up->up_pageno == pageno) {
-		    slab = up->up_slab;
-		    break;
-	    }
-	uma_page_slab_hash_unlock();
-	
-        return (slab);
-}
+	if (UMA_PAGE_ROOT_IDX(pageno) >= UMA_PAGE_ROOT_SIZE)
+		return (NULL);
 
-static __inline void
-vsetslab(vm_offset_t va, uma_slab_t slab)
-{
-        struct uma_page_head *hash_list;
-        uma_page_t up;
-	unsigned long pageno = atop(va);
-	
-        hash_list = &uma_page_slab_hash[UMA_PAGE_HASH(pageno)];
-
- 	uma_page_slab_hash_lock();
-	
-	LIST_FOREACH(up, hash_list, list_entry)
-                if (up->up_pageno == pageno)
-                        break;
-
-        if (up != NULL) {
-                up->up_slab = slab;
-        } else {
-		up = malloc(sizeof(*up), M_DEVBUF, M_WAITOK);
-		up->up_pageno = pageno;
-		up->up_slab = slab;
-		LIST_INSERT_HEAD(hash_list, up, list_entry);
-	}
-
-	uma_page_slab_hash_unlock();
+	node = (struct uma_page_node *)
+	    atomic_load_acq_ptr((volatile uintptr_t *)&uma_page_root[UMA_PAGE_ROOT_IDX(pageno)]);
+	if (node == NULL)
+		return (NULL);
+
+	leaf = (struct uma_page_leaf *)
+	    atomic_load_acq_ptr((volatile uintptr_t *)&node->upn_leaf[UMA_PAGE_NODE_IDX(pageno)]);
+	if (leaf == NULL)
+		return (NULL);
+
+	return ((uma_slab_t)
+	    atomic_load_acq_ptr((volatile uintptr_t *)&leaf->upl_slab[UMA_PAGE_LEAF_IDX(pageno)]));
 }
 
 #endif	/* _UINET_VM_UMA_INT_H_ */
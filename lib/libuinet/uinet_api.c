@@ -102,8 +102,15 @@ uinet_initialize_thread(void)
 		td = utd->td;
 	}
 
+	/*
+	 * A thread bound to a host cpu uses that cpu's slot.  Otherwise it
+	 * keeps the least-loaded slot it was given at allocation.
+	 */
 	cpuid = uhi_thread_bound_cpu();
-	td->td_oncpu = (cpuid == -1) ? 0 : cpuid % mp_ncpus;
+	if (cpuid != -1) {
+		uinet_cpuslot_free(td->td_oncpu);
+		td->td_oncpu = uinet_cpuslot_alloc(cpuid);
+	}
 
 	return (0);
 }
@@ -128,6 +135,7 @@ uinet_getifstat(uinet_instance_t uinst, const char *name, struct uinet_ifstat *s
 {
 	struct uinet_if *uif;
 	struct ifnet *ifp;
+	struct if_data ifd;
 	int error = 0;
 
 	CURVNET_SET(uinst->ui_vnet);
@@ -146,23 +154,25 @@ uinet_getifstat(uinet_instance_t uinst, const char *name, struct uinet_ifstat *s
 		goto out;
 	}
 	
-	stat->ifi_ipackets   = ifp->if_data.ifi_ipackets;
-	stat->ifi_ierrors    = ifp->if_data.ifi_ierrors;
-	stat->ifi_opackets   = ifp->if_data.ifi_opackets;
-	stat->ifi_oerrors    = ifp->if_data.ifi_oerrors;
-	stat->ifi_collisions = ifp->if_data.ifi_collisions;
-	stat->ifi_ibytes     = ifp->if_data.ifi_ibytes;
-	stat->ifi_obytes     = ifp->if_data.ifi_obytes;
-	stat->ifi_imcasts    = ifp->if_data.ifi_imcasts;
-	stat->ifi_omcasts    = ifp->if_data.ifi_omcasts;
-	stat->ifi_iqdrops    = ifp->if_data.ifi_iqdrops;
-	stat->ifi_noproto    = ifp->if_data.ifi_noproto;
-	stat->ifi_hwassist   = ifp->if_data.ifi_hwassist;
-	stat->ifi_epoch      = ifp->if_data.ifi_epoch;
-	stat->ifi_icopies    = ifp->if_data.ifi_icopies;
-	stat->ifi_izcopies   = ifp->if_data.ifi_izcopies;
-	stat->ifi_ocopies    = ifp->if_data.ifi_ocopies;
-	stat->ifi_ozcopies   = ifp->if_data.ifi_ozcopies;
+	if_data_fold(ifp, &ifd);
+
+	stat->ifi_ipackets   = ifd.ifi_ipackets;
+	stat->ifi_ierrors    = ifd.ifi_ierrors;
+	stat->ifi_opackets   = ifd.ifi_opackets;
+	stat->ifi_oerrors    = ifd.ifi_oerrors;
+	stat->ifi_collisions = ifd.ifi_collisions;
+	stat->ifi_ibytes     = ifd.ifi_ibytes;
+	stat->ifi_obytes     = ifd.ifi_obytes;
+	stat->ifi_imcasts    = ifd.ifi_imcasts;
+	stat->ifi_omcasts    = ifd.ifi_omcasts;
+	stat->ifi_iqdrops    = ifd.ifi_iqdrops;
+	stat->ifi_noproto    = ifd.ifi_noproto;
+	stat->ifi_hwassist   = ifd.ifi_hwassist;
+	stat->ifi_epoch      = ifd.ifi_epoch;
+	stat->ifi_icopies    = ifd.ifi_icopies;
+	stat->ifi_izcopies   = ifd.ifi_izcopies;
+	stat->ifi_ocopies    = ifd.ifi_ocopies;
+	stat->ifi_ozcopies   = ifd.ifi_ozcopies;
 
 	if_rele(ifp);
 
@@ -177,7 +187,7 @@ void
 uinet_gettcpstat(uinet_instance_t uinst, struct uinet_tcpstat *stat)
 {
 	CURVNET_SET(uinst->ui_vnet);
-	*((struct tcpstat *)stat) = V_tcpstat;
+	VNET_PCPUSTAT_FETCH(struct tcpstat, tcpstat, stat);
 	CURVNET_RESTORE();
 }
 
@@ -647,6 +657,7 @@ uinet_sobind(struct uinet_socket *so, struct uinet_sockaddr *nam)
 int
 uinet_soclose(struct uinet_socket *so)
 {
+	uinet_clock_sync();
 	return soclose((struct socket *)so);
 }
 
@@ -664,6 +675,8 @@ uinet_soconnect(struct uinet_socket *uso, struct uinet_sockaddr *nam)
 	int error;
 	int interrupted = 0;
 
+	uinet_clock_sync();
+
 	if (so->so_state & SS_ISCONNECTING) {
 		error = EALREADY;
 		goto done1;
@@ -896,6 +909,8 @@ uinet_soreceive(struct uinet_socket *so, struct uinet_sockaddr **psa, struct uin
 	int i;
 	int result;
 
+	uinet_clock_sync();
+
 	for (i = 0; i < uio->uio_iovcnt; i++) {
 		iov[i].iov_base = uio->uio_iov[i].iov_base;
 		iov[i].iov_len = uio->uio_iov[i].iov_len;
@@ -964,6 +979,8 @@ uinet_sosend(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_
 	int i;
 	int result;
 
+	uinet_clock_sync();
+
 	for (i = 0; i < uio->uio_iovcnt; i++) {
 		iov[i].iov_base = uio->uio_iov[i].iov_base;
 		iov[i].iov_len = uio->uio_iov[i].iov_len;
@@ -987,6 +1004,7 @@ uinet_sosend(struct uinet_socket *so, struct uinet_sockaddr *addr, struct uinet_
 int
 uinet_soshutdown(struct uinet_socket *so, int how)
 {
+	uinet_clock_sync();
 	return soshutdown((struct socket *)so, how);
 }
 
@@ -1469,31 +1487,44 @@ uinet_if_xmit(uinet_if_t uif, const char *buf, int len)
 	return (retval);
 }
 
+/*
+ * The lock log is now the in-memory lock profiler, which is only present
+ * when the library is built with LOCK_PROFILING.  Results are read from
+ * the debug.lock.prof.stats and debug.lock.prof.histograms sysctls, so no
+ * log file is used.
+ */
 int
 uinet_lock_log_set_file(const char *file)
 {
 
-	uhi_lock_log_set_file(file);
 	return (0);
 }
 
+static int
+uinet_lock_log_set(int enable)
+{
+#ifdef LOCK_PROFILING
+	return (kernel_sysctlbyname(curthread, "debug.lock.prof.enable", NULL,
+	    NULL, &enable, sizeof(enable), NULL, 0));
+#else
+	return (EOPNOTSUPP);
+#endif
+}
+
 int
 uinet_lock_log_enable(void)
 {
 
-	uhi_lock_log_enable();
-	return (0);
+	return (uinet_lock_log_set(1));
 }
 
 int
 uinet_lock_log_disable(void)
 {
 
-	uhi_lock_log_disable();
-	return (0);
+	return (uinet_lock_log_set(0));
 }
 
-
 void
 uinet_instance_default_cfg(struct uinet_instance_cfg *cfg)
 {
@@ -29,11 +29,20 @@
 #include <sys/libkern.h>
 #include <sys/malloc.h>
 #include <sys/systm.h>
+#include <sys/smp.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
 
 #include "uinet_internal.h"
+#include "uinet_host_interface.h"
+#include "uinet_if_afpacket.h"
 #include "uinet_if_netmap.h"
 #include "uinet_if_pcap.h"
+#include "uinet_if_pcapfile.h"
 #include "uinet_if_bridge.h"
+#include "uinet_if_memlink.h"
 #include "uinet_if_span.h"
 
 static VNET_DEFINE(TAILQ_HEAD(config_head, uinet_if), uinet_if_list);
@@ -81,6 +90,46 @@ uinet_iffind_bycdom(unsigned int cdom)
 }
 
 
+/*
+ * Pick a cpu in the memory domain local to the host NIC behind the given
+ * interface configuration, spreading successive interfaces across the
+ * domain's cpus.  Returns -1 if there is only one domain, the interface
+ * type has no host NIC, or the NIC's node is not one of the domains.
+ */
+static int
+uinet_if_local_cpu(uinet_iftype_t type, const char *configstr)
+{
+	static unsigned int next_cpu[MAXMEMDOM];
+	char ifname[IF_NAMESIZE];
+	size_t len;
+	int domain;
+
+	if ((vm_ndomains == 1) || (configstr == NULL))
+		return (-1);
+
+	switch (type) {
+	case UINET_IFTYPE_NETMAP:
+	case UINET_IFTYPE_PCAP:
+	case UINET_IFTYPE_AFPACKET:
+		break;
+	default:
+		return (-1);
+	}
+
+	len = strcspn(configstr, ":@");
+	if ((len == 0) || (len >= IF_NAMESIZE))
+		return (-1);
+	memcpy(ifname, configstr, len);
+	ifname[len] = '\0';
+
+	domain = uinet_node_domain(uhi_numa_ifnet_node(ifname));
+	if (domain < 0)
+		return (-1);
+
+	return (uinet_domain_cpu(domain, next_cpu[domain]++));
+}
+
+
 int
 uinet_ifcreate(uinet_instance_t uinst, uinet_iftype_t type, const char *configstr,
 	       const char *alias, unsigned int cdom, int cpu, uinet_if_t *uif)
@@ -104,6 +153,11 @@ uinet_ifcreate(uinet_instance_t uinst, uinet_iftype_t type, const char *configst
 		}
 	}
 
+	if (cpu >= mp_ncpus) {
+		error = EINVAL;
+		goto out;
+	}
+
 	/*
 	 * CDOM 0 is for non-promiscuous-inet interfaces and can contain
 	 * multiple interfaces.  All other CDOMs are for promiscuous-inet
@@ -136,6 +190,8 @@ uinet_ifcreate(uinet_instance_t uinst, uinet_iftype_t type, const char *configst
 	} else {
 		new_uif->alias[0] = '\0';
 	}
+	if (cpu < 0)
+		cpu = uinet_if_local_cpu(type, configstr);
 	new_uif->cpu = cpu;
 	new_uif->cdom = cdom;
 	new_uif->ifdata = NULL;
@@ -153,6 +209,15 @@ uinet_ifcreate(uinet_instance_t uinst, uinet_iftype_t type, const char *configst
 	case UINET_IFTYPE_SPAN:
 		error = if_span_attach(new_uif);
 		break;
+	case UINET_IFTYPE_AFPACKET:
+		error = if_afpacket_attach(new_uif);
+		break;
+	case UINET_IFTYPE_PCAPFILE:
+		error = if_pcapfile_attach(new_uif);
+		break;
+	case UINET_IFTYPE_MEMLINK:
+		error = if_memlink_attach(new_uif);
+		break;
 	default:
 		printf("Error attaching interface with config %s: unknown interface type %d\n", new_uif->configstr, new_uif->type);
 		error = ENXIO;
@@ -195,6 +260,15 @@ uinet_ifdestroy_internal(struct uinet_if *uif)
 	case UINET_IFTYPE_PCAP:
 		error = if_pcap_detach(uif);
 		break;
+	case UINET_IFTYPE_AFPACKET:
+		error = if_afpacket_detach(uif);
+		break;
+	case UINET_IFTYPE_PCAPFILE:
+		error = if_pcapfile_detach(uif);
+		break;
+	case UINET_IFTYPE_MEMLINK:
+		error = if_memlink_detach(uif);
+		break;
 	default:
 		printf("Error detaching interface %s: unknown interface type %d\n", uif->name, uif->type);
 		error = ENXIO;
@@ -286,3 +360,25 @@ uinet_if_set_batch_event_handler(uinet_if_t uif,
 
 	return (error);
 }
+
+
+int
+uinet_if_set_lro(uinet_if_t uif, int enable)
+{
+	struct ifnet *ifp;
+	int error = EINVAL;
+
+	if ((NULL != uif) && (NULL != uif->ifp)) {
+		ifp = uif->ifp;
+		if (ifp->if_capabilities & IFCAP_LRO) {
+			if (enable)
+				ifp->if_capenable |= IFCAP_LRO;
+			else
+				ifp->if_capenable &= ~IFCAP_LRO;
+			error = 0;
+		} else
+			error = EOPNOTSUPP;
+	}
+
+	return (error);
+}
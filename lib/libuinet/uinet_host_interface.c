@@ -37,6 +37,8 @@
 #endif /* __linux__ */
 
 #include <assert.h>
+#include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -69,6 +71,8 @@
 
 #if defined(__linux__)
 #include <netpacket/packet.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
 #endif /* __linux__ */
 
 #include <ifaddrs.h>
@@ -100,6 +104,7 @@ static struct itimerval prof_itimer;
 #endif /* UINET_STACK_UNWIND */
 
 static unsigned int uhi_num_cpus;
+static unsigned int uhi_host_cpus;	/* online in the host, not configured */
 
 static uhi_mutex_t uhi_thread_hook_lock;
 static uhi_tls_key_t uhi_thread_tls_key;
@@ -110,100 +115,8 @@ static struct {
 	void *arg;
 } uhi_thread_hook_table[UHI_THREAD_NUM_HOOK_TYPES][UHI_MAX_THREAD_HOOKS];
 
-static FILE *lock_log_fp = NULL;
-static pthread_mutex_t lock_log_mtx;
-static int lock_log_enabled = 0;
-static char *lock_log_filename = NULL;
-
 static void uhi_thread_tls_destructor(void *arg);
 
-void
-uhi_lock_log_init(void)
-{
-
-	pthread_mutex_init(&lock_log_mtx, NULL);
-}
-
-void
-uhi_lock_log_set_file(const char *file)
-{
-
-	pthread_mutex_lock(&lock_log_mtx);
-	if (lock_log_filename)
-		free(lock_log_filename);
-	lock_log_filename = strdup(file);
-	pthread_mutex_unlock(&lock_log_mtx);
-}
-
-void
-uhi_lock_log_enable(void)
-{
-
-	pthread_mutex_lock(&lock_log_mtx);
-	if (lock_log_enabled == 1) {
-		pthread_mutex_unlock(&lock_log_mtx);
-		return;
-	}
-
-	lock_log_fp = fopen(lock_log_filename, "w+");
-	lock_log_enabled = 1;
-	pthread_mutex_unlock(&lock_log_mtx);
-}
-
-void
-uhi_lock_log_disable(void)
-{
-	FILE *fp = NULL;
-
-	pthread_mutex_lock(&lock_log_mtx);
-	if (lock_log_enabled == 0) {
-		pthread_mutex_unlock(&lock_log_mtx);
-		return;
-	}
-	fp = lock_log_fp;
-	lock_log_fp = NULL;
-	lock_log_enabled = 0;
-	pthread_mutex_unlock(&lock_log_mtx);
-
-	/* This may take some time, so do it out of the lock */
-	fclose(fp);
-}
-
-static void
-uhi_lock_log(const char *type, const char *what, void *lp, void *ptr, const char *file, int line)
-{
-	uhi_thread_t curthr;
-	int64_t sec;
-	long nsec;
-
-	if (lock_log_enabled == 0)
-		return;
-
-	uhi_clock_gettime(UHI_CLOCK_MONOTONIC_FAST, &sec, &nsec);
-
-	curthr = uhi_thread_self();
-
-	/*
-	 * Use pthread_mutex_* calls instead of uhi_mutex_* calls here to
-	 * avoid recursive lock logging.
-	 */
-	pthread_mutex_lock(&lock_log_mtx);
-	if (lock_log_fp != NULL) {
-		fprintf(lock_log_fp,
-		    "%llu.%06llu: lp %p tid %x type %s what %s where %s:%d ptr %p\n",
-		    (unsigned long long) (sec),
-		    (unsigned long long) (nsec / 1000),
-		    lp,
-		    (int) curthr,
-		    type,
-		    what,
-		    file,
-		    line,
-		    ptr);
-	}
-	pthread_mutex_unlock(&lock_log_mtx);
-}
-
 
 void
 uhi_init(void)
@@ -227,14 +140,14 @@ uhi_init(void)
 	/* Ensure that a pthread_t can be stored in a uint64_t */
 	assert(sizeof(uint64_t) >= sizeof(pthread_t));
 
+	uhi_host_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
 	if (uhi_tls_key_create(&uhi_thread_tls_key, uhi_thread_tls_destructor))
 		printf("Could not create uhi thread subsystem tls key");
 
-	if (uhi_mutex_init(&uhi_thread_hook_lock, 0))
+	if (uhi_mutex_init(&uhi_thread_hook_lock, "uhi thread hooks", 0))
 		printf("Could not init uhi thread hook table lock");
 
-	uhi_lock_log_init();
-
 #if defined(UINET_PROFILE)
 	printf("getting prof timer\n");
 	getitimer(ITIMER_PROF, &prof_itimer);
@@ -367,6 +280,142 @@ uhi_nanosleep(uint64_t nsecs)
 	return (rv);
 }
 
+/*
+ * The uhi_timer_* functions implement a single-waiter timer that fires at
+ * an absolute UHI_CLOCK_MONOTONIC deadline.  The deadline may be moved by
+ * another thread while the waiter is blocked, and the waiter will wake at
+ * the new deadline.  Sleeping until an absolute deadline, rather than for
+ * a relative interval, keeps a periodic caller from accumulating the
+ * wakeup latency of each period.
+ *
+ * On Linux this is a timerfd.  Elsewhere it is a condition variable wait
+ * that is rechecked against the monotonic clock.
+ */
+
+int
+uhi_timer_init(struct uhi_timer *t)
+{
+	pthread_mutex_t *mtx;
+	pthread_cond_t *cv;
+
+	t->fd = -1;
+	t->deadline = 0;
+
+#if defined(__linux__)
+	t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#endif /* __linux__ */
+
+	mtx = malloc(sizeof(pthread_mutex_t));
+	cv = malloc(sizeof(pthread_cond_t));
+	if ((NULL == mtx) || (NULL == cv))
+		goto fail;
+
+	if (0 != pthread_mutex_init(mtx, NULL))
+		goto fail;
+
+	if (0 != pthread_cond_init(cv, NULL)) {
+		pthread_mutex_destroy(mtx);
+		goto fail;
+	}
+
+	t->mtx = mtx;
+	t->cv = cv;
+
+	return (0);
+
+fail:
+	free(mtx);
+	free(cv);
+	if (-1 != t->fd)
+		close(t->fd);
+
+	return (ENOMEM);
+}
+
+
+void
+uhi_timer_destroy(struct uhi_timer *t)
+{
+	if (-1 != t->fd)
+		close(t->fd);
+
+	pthread_cond_destroy((pthread_cond_t *)t->cv);
+	pthread_mutex_destroy((pthread_mutex_t *)t->mtx);
+	free(t->cv);
+	free(t->mtx);
+}
+
+
+void
+uhi_timer_set(struct uhi_timer *t, uint64_t deadline)
+{
+	pthread_mutex_lock((pthread_mutex_t *)t->mtx);
+	t->deadline = deadline;
+#if defined(__linux__)
+	if (-1 != t->fd) {
+		struct itimerspec its;
+
+		/* A zero it_value would disarm the timer */
+		if (0 == deadline)
+			deadline = 1;
+		its.it_interval.tv_sec = 0;
+		its.it_interval.tv_nsec = 0;
+		its.it_value.tv_sec = deadline / UHI_NSEC_PER_SEC;
+		its.it_value.tv_nsec = deadline % UHI_NSEC_PER_SEC;
+		timerfd_settime(t->fd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+#endif /* __linux__ */
+	pthread_cond_signal((pthread_cond_t *)t->cv);
+	pthread_mutex_unlock((pthread_mutex_t *)t->mtx);
+}
+
+
+/*
+ * Returns once the current deadline has passed.
+ */
+void
+uhi_timer_wait(struct uhi_timer *t)
+{
+	pthread_mutex_t *mtx = (pthread_mutex_t *)t->mtx;
+	pthread_cond_t *cv = (pthread_cond_t *)t->cv;
+	struct timespec abstime;
+	uint64_t now;
+	uint64_t when;
+	uint64_t deadline;
+
+#if defined(__linux__)
+	if (-1 != t->fd) {
+		uint64_t expirations;
+
+		/*
+		 * The read returns once the timer has expired, including
+		 * when it was rearmed while we were blocked.
+		 */
+		while ((-1 == read(t->fd, &expirations, sizeof(expirations))) &&
+		       (EINTR == errno))
+			;
+
+		return;
+	}
+#endif /* __linux__ */
+
+	pthread_mutex_lock(mtx);
+	for (;;) {
+		deadline = t->deadline;
+		now = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+		if (now >= deadline)
+			break;
+
+		/* The cond wait is against the realtime clock */
+		when = uhi_clock_gettime_ns(UHI_CLOCK_REALTIME) + (deadline - now);
+		abstime.tv_sec = when / UHI_NSEC_PER_SEC;
+		abstime.tv_nsec = when % UHI_NSEC_PER_SEC;
+		pthread_cond_timedwait(cv, mtx, &abstime);
+	}
+	pthread_mutex_unlock(mtx);
+}
+
+
 int
 uhi_open(const char *path, int flags)
 {
@@ -426,6 +475,151 @@ uhi_munmap(void *addr, uint64_t len)
 }
 
 
+/*
+ * Map len bytes of anonymous memory aligned to UHI_HUGEPAGE_SIZE.  len
+ * must be a multiple of UHI_HUGEPAGE_SIZE.  Explicit hugetlb pages are
+ * tried first, then an aligned mapping that the host is asked (or, on
+ * FreeBSD, expected) to back with superpages.  *backing reports which of
+ * the UHI_HUGEPAGE_* cases was obtained.
+ */
+void *
+uhi_hugepage_alloc(uint64_t len, int *backing)
+{
+	uintptr_t base, aligned;
+	void *p;
+	int host_flags;
+
+#if defined(__linux__) && defined(MAP_HUGETLB)
+	p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+		 MAP_PRIVATE|MAP_ANON|MAP_HUGETLB, -1, 0);
+	if (p != MAP_FAILED) {
+		*backing = UHI_HUGEPAGE_HUGETLB;
+		return (p);
+	}
+#endif /* __linux__ && MAP_HUGETLB */
+
+	host_flags = MAP_PRIVATE|MAP_ANON;
+#if defined(__FreeBSD__) && defined(MAP_ALIGNED_SUPER)
+	host_flags |= MAP_ALIGNED_SUPER;
+#endif
+
+	/*
+	 * Over-allocate by one hugepage and trim, as there is no portable
+	 * way to request the alignment directly.
+	 */
+	p = mmap(NULL, len + UHI_HUGEPAGE_SIZE, PROT_READ|PROT_WRITE,
+		 host_flags, -1, 0);
+	if (p == MAP_FAILED)
+		return (NULL);
+
+	base = (uintptr_t)p;
+	aligned = (base + UHI_HUGEPAGE_SIZE - 1) & ~((uintptr_t)UHI_HUGEPAGE_SIZE - 1);
+	if (aligned > base)
+		munmap(p, aligned - base);
+	if (base + UHI_HUGEPAGE_SIZE > aligned)
+		munmap((void *)(aligned + len), base + UHI_HUGEPAGE_SIZE - aligned);
+
+	*backing = UHI_HUGEPAGE_NONE;
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (madvise((void *)aligned, len, MADV_HUGEPAGE) == 0)
+		*backing = UHI_HUGEPAGE_TRANSPARENT;
+#elif defined(__FreeBSD__)
+	*backing = UHI_HUGEPAGE_TRANSPARENT;
+#endif
+
+	return ((void *)aligned);
+}
+
+
+/*
+ * Returns the host NUMA node of the given cpu, or -1 if it can't be
+ * determined.
+ */
+int
+uhi_numa_cpu_node(unsigned int cpu)
+{
+#if defined(__linux__)
+	char path[64];
+	DIR *dir;
+	struct dirent *de;
+	int node;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+	if ((dir = opendir(path)) == NULL)
+		return (-1);
+
+	node = -1;
+	while ((de = readdir(dir)) != NULL) {
+		if ((strncmp(de->d_name, "node", 4) == 0) &&
+		    isdigit((unsigned char)de->d_name[4])) {
+			node = atoi(&de->d_name[4]);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return (node);
+#else
+	return (-1);
+#endif /* __linux__ */
+}
+
+
+/*
+ * Returns the host NUMA node the device behind the given host interface
+ * is attached to, or -1 if it can't be determined (including for
+ * software interfaces).
+ */
+int
+uhi_numa_ifnet_node(const char *ifname)
+{
+#if defined(__linux__)
+	char path[96];
+	FILE *f;
+	int node;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+	if ((f = fopen(path, "r")) == NULL)
+		return (-1);
+
+	if (fscanf(f, "%d", &node) != 1)
+		node = -1;
+	fclose(f);
+
+	return (node);
+#else
+	return (-1);
+#endif /* __linux__ */
+}
+
+
+/*
+ * Set a preferred-node memory policy on the given page-aligned range.
+ * This has to be done before the range is first touched to have any
+ * effect.
+ */
+int
+uhi_numa_bind(void *addr, uint64_t len, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+#define UHI_MPOL_PREFERRED	1
+	unsigned long nodemask;
+
+	if ((node < 0) || (node >= (int)(sizeof(nodemask) * 8)))
+		return (-1);
+
+	nodemask = 1UL << node;
+	if (syscall(SYS_mbind, addr, len, UHI_MPOL_PREFERRED, &nodemask,
+		    sizeof(nodemask) * 8 + 1, 0) != 0)
+		return (-1);
+
+	return (0);
+#else
+	return (-1);
+#endif /* __linux__ && SYS_mbind */
+}
+
+
 /*
  *  In addition to normal poll() return values, this returns -2 to indicate
  *  poll() returned -1 and errno was EINTR.  This avoids having to do
@@ -838,18 +1032,103 @@ uhi_cond_broadcast(uhi_cond_t *c)
 }
 
 
+/*
+ * Mutexes are adaptive: a lock attempt that finds the mutex held spins,
+ * retrying with exponential backoff, for a bounded time before parking in
+ * pthread_mutex_lock().  Most stack locks are held for very short
+ * sections, so the holder usually releases the lock before the spin
+ * budget runs out, which avoids a futex sleep and wakeup.  There is no
+ * point spinning when the host has only one cpu online, whatever the
+ * number of cpus uinet was configured with.
+ *
+ * The pthread mutex is the first member so that the condition variable
+ * routines can continue to treat a uhi_mutex_t as a pthread_mutex_t.  The
+ * statistics are only updated by the lock holder, so they need no
+ * synchronization of their own.
+ *
+ * Every mutex is on one of UHI_MTX_SHARDS registry lists, chosen by its
+ * address, so the statistics can be walked with uhi_mutex_foreach_stats().
+ * When a mutex is destroyed its statistics are folded into its shard's
+ * retired table, keyed by name, so short-lived locks such as those of
+ * sockets still show up.
+ */
+#define UHI_CACHE_LINE_SIZE	64
+#define UHI_MTX_SPIN_ROUNDS	10
+#define UHI_MTX_SPIN_MAX_DELAY	64
+#define UHI_MTX_SHARDS		16
+#define UHI_MTX_RETIRED		64
+#define UHI_MTX_NAME_LEN	32
+
+struct uhi_mutex {
+	pthread_mutex_t pm;
+	struct uhi_lock_stats stats;
+	const char *name;
+	struct uhi_mutex *next;
+	struct uhi_mutex *prev;
+} __attribute__((aligned(UHI_CACHE_LINE_SIZE)));
+
+static struct uhi_mutex_shard {
+	pthread_mutex_t lock;
+	struct uhi_mutex *head;
+	struct {
+		char name[UHI_MTX_NAME_LEN];	/* copied, the lock's may be freed */
+		struct uhi_lock_stats stats;
+	} retired[UHI_MTX_RETIRED];
+} uhi_mutex_shards[UHI_MTX_SHARDS];
+
+static pthread_once_t uhi_mutex_shards_once = PTHREAD_ONCE_INIT;
+
+static void
+uhi_mutex_shards_init(void)
+{
+	int i;
+
+	for (i = 0; i < UHI_MTX_SHARDS; i++)
+		pthread_mutex_init(&uhi_mutex_shards[i].lock, NULL);
+}
+
+static inline struct uhi_mutex_shard *
+uhi_mutex_shard(struct uhi_mutex *um)
+{
+	return (&uhi_mutex_shards[((uintptr_t)um / UHI_CACHE_LINE_SIZE) %
+				  UHI_MTX_SHARDS]);
+}
+
+static void
+uhi_lock_stats_add(struct uhi_lock_stats *to, const struct uhi_lock_stats *from)
+{
+	to->acquisitions += from->acquisitions;
+	to->contended += from->contended;
+	to->parked += from->parked;
+	to->spin_ns += from->spin_ns;
+	to->park_ns += from->park_ns;
+}
+
+static inline void
+uhi_cpu_pause(void)
+{
+#if defined(__i386__) || defined(__amd64__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+
 int
-uhi_mutex_init(uhi_mutex_t *m, int opts)
+uhi_mutex_init(uhi_mutex_t *m, const char *name, int opts)
 {
 	pthread_mutexattr_t attr;
-	pthread_mutex_t *pm;
+	struct uhi_mutex *um;
+	struct uhi_mutex_shard *shard;
 	int error;
 
-	pm = malloc(sizeof(pthread_mutex_t));
-	if (NULL == pm)
+	if (0 != posix_memalign((void **)&um, UHI_CACHE_LINE_SIZE, sizeof(*um)))
 		return (ENOMEM);
+	memset(&um->stats, 0, sizeof(um->stats));
+	um->name = name;
 
-	*m = pm;
+	*m = um;
 
 	pthread_mutexattr_init(&attr);
 
@@ -857,36 +1136,110 @@ uhi_mutex_init(uhi_mutex_t *m, int opts)
 		if (0 != pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE)) 
 			printf("Warning: mtx will not be recursive\n");
 	} else {
-#if !defined(__APPLE__)
-		if (0 != pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP))
-#endif /* __APPLE__ */
-			pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
+		/* spinning is done here, not in the pthread library */
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
 	}
 	
-	error = pthread_mutex_init(pm, &attr);
+	error = pthread_mutex_init(&um->pm, &attr);
 	pthread_mutexattr_destroy(&attr);	    
+	if (error)
+		return (error);
+
+	pthread_once(&uhi_mutex_shards_once, uhi_mutex_shards_init);
+	shard = uhi_mutex_shard(um);
+	pthread_mutex_lock(&shard->lock);
+	um->prev = NULL;
+	um->next = shard->head;
+	if (shard->head)
+		shard->head->prev = um;
+	shard->head = um;
+	pthread_mutex_unlock(&shard->lock);
 
-	return (error);
+	return (0);
 }
 
 
 void
 uhi_mutex_destroy(uhi_mutex_t *m)
 {
-	pthread_mutex_t *pm;
+	struct uhi_mutex *um;
 	
-	pm = (pthread_mutex_t *)(*m);
+	struct uhi_mutex_shard *shard;
+	const char *name;
+	int i;
 
-	pthread_mutex_destroy(pm);
-	free(pm);
+	um = (struct uhi_mutex *)(*m);
+
+	shard = uhi_mutex_shard(um);
+	pthread_mutex_lock(&shard->lock);
+	if (um->prev)
+		um->prev->next = um->next;
+	else
+		shard->head = um->next;
+	if (um->next)
+		um->next->prev = um->prev;
+
+	if (um->stats.acquisitions) {
+		name = um->name ? um->name : "(unnamed)";
+		/* The last slot collects whatever doesn't fit */
+		for (i = 0; i < UHI_MTX_RETIRED - 1; i++)
+			if (shard->retired[i].name[0] == '\0' ||
+			    0 == strncmp(shard->retired[i].name, name,
+					 UHI_MTX_NAME_LEN - 1))
+				break;
+		if (i == UHI_MTX_RETIRED - 1)
+			name = "(other)";
+		snprintf(shard->retired[i].name, UHI_MTX_NAME_LEN, "%s", name);
+		uhi_lock_stats_add(&shard->retired[i].stats, &um->stats);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	pthread_mutex_destroy(&um->pm);
+	free(um);
 }
 
 
 void
 _uhi_mutex_lock(uhi_mutex_t *m, void *l, const char *file, int line)
 {
-	uhi_lock_log("mtx", "lock", l, m, file, line);
-	pthread_mutex_lock((pthread_mutex_t *)(*m));
+	struct uhi_mutex *um = (struct uhi_mutex *)(*m);
+	uint64_t start, spun;
+	unsigned int round;
+	unsigned int delay;
+	unsigned int i;
+
+	if (0 == pthread_mutex_trylock(&um->pm)) {
+		um->stats.acquisitions++;
+		return;
+	}
+
+	start = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+	if (uhi_host_cpus > 1) {
+		delay = 1;
+		for (round = 0; round < UHI_MTX_SPIN_ROUNDS; round++) {
+			for (i = 0; i < delay; i++)
+				uhi_cpu_pause();
+
+			if (0 == pthread_mutex_trylock(&um->pm)) {
+				um->stats.acquisitions++;
+				um->stats.contended++;
+				um->stats.spin_ns += uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) - start;
+				return;
+			}
+
+			if (delay < UHI_MTX_SPIN_MAX_DELAY)
+				delay <<= 1;
+		}
+	}
+	spun = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+
+	pthread_mutex_lock(&um->pm);
+
+	um->stats.acquisitions++;
+	um->stats.contended++;
+	um->stats.parked++;
+	um->stats.spin_ns += spun - start;
+	um->stats.park_ns += uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) - spun;
 }
 
 
@@ -896,19 +1249,88 @@ _uhi_mutex_lock(uhi_mutex_t *m, void *l, const char *file, int line)
 int
 _uhi_mutex_trylock(uhi_mutex_t *m, void *l, const char *file, int line)
 {
+	struct uhi_mutex *um = (struct uhi_mutex *)(*m);
 	int ret;
-	ret = (0 == pthread_mutex_trylock((pthread_mutex_t *)(*m)));
+
+	ret = (0 == pthread_mutex_trylock(&um->pm));
 	if (ret)
-		uhi_lock_log("mtx", "trylock", l, m, file, line);
+		um->stats.acquisitions++;
 	return (ret);
 }
 
 
+/*
+ * The counters are read without the lock, so a snapshot may be slightly
+ * inconsistent.
+ */
+void
+uhi_mutex_get_stats(uhi_mutex_t *m, struct uhi_lock_stats *stats)
+{
+	struct uhi_mutex *um = (struct uhi_mutex *)(*m);
+
+	*stats = um->stats;
+}
+
+
+/*
+ * Calls fn for every live mutex and for each retired-mutex total.  fn is
+ * called with a registry lock held, so it must not acquire mutexes, and
+ * the name is only valid for the duration of the call.
+ */
+void
+uhi_mutex_foreach_stats(uhi_lock_stats_fn_t fn, void *arg)
+{
+	struct uhi_mutex_shard *shard;
+	struct uhi_mutex *um;
+	struct uhi_lock_stats stats;
+	int i, j;
+
+	pthread_once(&uhi_mutex_shards_once, uhi_mutex_shards_init);
+	for (i = 0; i < UHI_MTX_SHARDS; i++) {
+		shard = &uhi_mutex_shards[i];
+		pthread_mutex_lock(&shard->lock);
+		for (um = shard->head; um != NULL; um = um->next) {
+			stats = um->stats;
+			fn(arg, um->name, &stats);
+		}
+		for (j = 0; j < UHI_MTX_RETIRED; j++)
+			if (shard->retired[j].name[0] != '\0')
+				fn(arg, shard->retired[j].name,
+				   &shard->retired[j].stats);
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+
+/*
+ * The live counters are cleared without taking each mutex, so an update
+ * racing with the reset may survive it.
+ */
+void
+uhi_mutex_reset_all_stats(void)
+{
+	struct uhi_mutex_shard *shard;
+	struct uhi_mutex *um;
+	int i;
+
+	pthread_once(&uhi_mutex_shards_once, uhi_mutex_shards_init);
+	for (i = 0; i < UHI_MTX_SHARDS; i++) {
+		shard = &uhi_mutex_shards[i];
+		pthread_mutex_lock(&shard->lock);
+		for (um = shard->head; um != NULL; um = um->next)
+			memset(&um->stats, 0, sizeof(um->stats));
+		memset(shard->retired, 0, sizeof(shard->retired));
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
+
+
 void
 _uhi_mutex_unlock(uhi_mutex_t *m, void *l, const char *file, int line)
 {
-	uhi_lock_log("mtx", "unlock", l, m, file, line);
-	pthread_mutex_unlock((pthread_mutex_t *)(*m));
+	struct uhi_mutex *um = (struct uhi_mutex *)(*m);
+
+	pthread_mutex_unlock(&um->pm);
 }
 
 
@@ -972,7 +1394,6 @@ uhi_rwlock_destroy(uhi_rwlock_t *rw)
 void
 _uhi_rwlock_wlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
-	uhi_lock_log("rw", "wlock", l, rw, file, line);
 	pthread_mutex_lock((pthread_mutex_t *)(*rw));
 }
 
@@ -983,8 +1404,6 @@ _uhi_rwlock_trywlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 	int ret;
 
 	ret = (0 == pthread_mutex_trylock((pthread_mutex_t *)(*rw)));
-	if (ret)
-		uhi_lock_log("rw", "trywlock", l, rw, file, line);
 	return (ret);
 }
 
@@ -992,7 +1411,6 @@ _uhi_rwlock_trywlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 void
 _uhi_rwlock_wunlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
-	uhi_lock_log("rw", "wunlock", l, rw, file, line);
 	pthread_mutex_unlock((pthread_mutex_t *)(*rw));
 }
 
@@ -1000,7 +1418,6 @@ _uhi_rwlock_wunlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 void
 _uhi_rwlock_rlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
-	uhi_lock_log("rw", "rlock", l, rw, file, line);
 	pthread_mutex_lock((pthread_mutex_t *)(*rw));
 }
 
@@ -1011,8 +1428,6 @@ _uhi_rwlock_tryrlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 	int ret;
 
 	ret = (0 == pthread_mutex_trylock((pthread_mutex_t *)(*rw)));
-	if (ret)
-		uhi_lock_log("rw", "tryrlock", l, rw, file, line);
 	return (ret);
 }
 
@@ -1020,7 +1435,6 @@ _uhi_rwlock_tryrlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 void
 _uhi_rwlock_runlock(uhi_rwlock_t *rw, void *l, const char *file, int line)
 {
-	uhi_lock_log("rw", "runlock", l, rw, file, line);
 	pthread_mutex_unlock((pthread_mutex_t *)(*rw));
 }
 
@@ -1032,7 +1446,6 @@ _uhi_rwlock_tryupgrade(uhi_rwlock_t *rw, void *l, const char *file, int line)
 	 * Always succeeds as this implementation is always an exclusive
 	 * lock
 	 */
-	uhi_lock_log("rw", "tryupgrade", l, rw, file, line);
 	return (1);
 }
 
@@ -1044,7 +1457,6 @@ _uhi_rwlock_downgrade(uhi_rwlock_t *rw, void *l, const char *file, int line)
 	 * Nothing to do here.  In this implementation, there is only one
 	 * grade of this lock.
 	 */
-	uhi_lock_log("rw", "downgrade", l, rw, file, line);
 }
 
 
@@ -74,6 +74,12 @@ struct uhi_pollfd {
 
 #define UHI_MAP_FAILED	((void *)-1)
 
+#define	UHI_HUGEPAGE_SIZE	(2 * 1024 * 1024)
+
+#define	UHI_HUGEPAGE_NONE	0	/* base pages only */
+#define	UHI_HUGEPAGE_HUGETLB	1	/* explicit hugetlb pages */
+#define	UHI_HUGEPAGE_TRANSPARENT 2	/* transparent/automatic superpages */
+
 
 typedef intptr_t uhi_thread_t;
 typedef intptr_t uhi_tls_key_t;
@@ -99,6 +105,24 @@ typedef void * uhi_mutex_t;
 
 #define UHI_MTX_RECURSE	0x1
 
+/*
+ * Per-mutex contention counters.  acquisitions counts all successful lock
+ * and trylock operations, contended counts lock operations that found the
+ * mutex held, and parked counts the subset of those that gave up spinning
+ * and slept.  spin_ns and park_ns are the time spent waiting in each
+ * phase.
+ */
+struct uhi_lock_stats {
+	uint64_t acquisitions;
+	uint64_t contended;
+	uint64_t parked;
+	uint64_t spin_ns;
+	uint64_t park_ns;
+};
+
+typedef void (*uhi_lock_stats_fn_t)(void *arg, const char *name,
+				    const struct uhi_lock_stats *stats);
+
 
 typedef void * uhi_cond_t;
 
@@ -117,6 +141,17 @@ struct uhi_msg {
 	unsigned int rsp_size;
 };
 
+/*
+ * This is opaque - don't reference the members anywhere.  The definition is
+ * public to allow static allocation.
+ */
+struct uhi_timer {
+	int fd;
+	void *mtx;
+	void *cv;
+	uint64_t deadline;
+};
+
 /*
  * Enable to compile in both the lock file/line into the source tree for
  * lock debugging.
@@ -129,11 +164,6 @@ struct uhi_msg {
 #define	UINET_LOCK_LINE		__LINE__
 #endif
 
-void uhi_lock_log_init(void);
-void uhi_lock_log_set_file(const char *file);
-void uhi_lock_log_enable(void);
-void uhi_lock_log_disable(void);
-
 void uhi_init(void) __attribute__((constructor));
 void uhi_set_num_cpus(unsigned int n);
 
@@ -146,10 +176,20 @@ void  uhi_clock_gettime(int id, int64_t *sec, long *nsec);
 uint64_t  uhi_clock_gettime_ns(int id);
 int   uhi_nanosleep(uint64_t nsecs);
 
+int   uhi_timer_init(struct uhi_timer *t);
+void  uhi_timer_destroy(struct uhi_timer *t);
+void  uhi_timer_set(struct uhi_timer *t, uint64_t deadline);
+void  uhi_timer_wait(struct uhi_timer *t);
+
 int   uhi_open(const char *path, int flags);
 int   uhi_close(int d);
 void *uhi_mmap(void *addr, uint64_t len, int prot, int flags, int fd, uint64_t offset);
 int   uhi_munmap(void *addr, uint64_t len);
+void *uhi_hugepage_alloc(uint64_t len, int *backing);
+
+int   uhi_numa_cpu_node(unsigned int cpu);
+int   uhi_numa_ifnet_node(const char *ifname);
+int   uhi_numa_bind(void *addr, uint64_t len, int node);
 int   uhi_poll(struct uhi_pollfd *fds, unsigned int nfds, int timeout);
 
 void  uhi_thread_bind(unsigned int cpu);
@@ -176,11 +216,14 @@ int  uhi_cond_timedwait(uhi_cond_t *c, uhi_mutex_t *m, uint64_t nsecs);
 void uhi_cond_signal(uhi_cond_t *c);
 void uhi_cond_broadcast(uhi_cond_t *c);
 
-int   uhi_mutex_init(uhi_mutex_t *m, int opts);
+int   uhi_mutex_init(uhi_mutex_t *m, const char *name, int opts);
 void  uhi_mutex_destroy(uhi_mutex_t *m);
 void  _uhi_mutex_lock(uhi_mutex_t *m, void *l, const char *file, int line);
 int   _uhi_mutex_trylock(uhi_mutex_t *m, void *l, const char *file, int line);
 void  _uhi_mutex_unlock(uhi_mutex_t *m, void *l, const char *file, int line);
+void  uhi_mutex_get_stats(uhi_mutex_t *m, struct uhi_lock_stats *stats);
+void  uhi_mutex_foreach_stats(uhi_lock_stats_fn_t fn, void *arg);
+void  uhi_mutex_reset_all_stats(void);
 
 #if 0
 #define	uhi_mutex_lock(m)	_uhi_mutex_lock((m),	\
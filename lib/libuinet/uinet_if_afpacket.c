@@ -0,0 +1,516 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/proc.h>
+#include <sys/kthread.h>
+#include <sys/sched.h>
+#include <sys/sockio.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/if_types.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <net/if_tap.h>
+#include <net/if_dl.h>
+
+#include <machine/atomic.h>
+
+#include "uinet_internal.h"
+#include "uinet_host_interface.h"
+#include "uinet_if_afpacket.h"
+#include "uinet_if_afpacket_host.h"
+#include "uinet_rxbatch.h"
+#include "uinet_tso.h"
+
+
+/*
+ * Receive copies each frame out of the rx ring rather than attaching it to
+ * an mbuf in place.  The kernel fills TPACKET_V3 blocks strictly in ring
+ * order, so a block kept by a zero-copy mbuf - one segment sitting in an
+ * idle connection's socket buffer is enough - would stop the ring for the
+ * whole interface once it wrapped around to that block.  Unlike netmap,
+ * there is no way to swap a replacement buffer into the ring, and the
+ * stack's references to a block can't be found to copy them out later.
+ */
+
+
+struct if_afpacket_softc {
+	struct ifnet *ifp;
+	const struct uinet_if *uif;
+	uint8_t addr[ETHER_ADDR_LEN];
+	char host_ifname[IF_NAMESIZE];
+
+	struct if_afpacket_host_context *host_ctx;
+
+	uint32_t rx_blocks;
+	uint32_t rx_cur_block;
+	struct uinet_rxbatch rx_batch;
+
+	struct thread *tx_thread;
+	struct thread *rx_thread;
+
+	struct mtx tx_lock;
+	struct cv tx_cv;
+	int tx_pkts_to_send;
+};
+
+
+static int if_afpacket_setup_interface(struct if_afpacket_softc *sc);
+
+
+static unsigned int interface_count;
+
+
+int
+if_afpacket_attach(struct uinet_if *uif)
+{
+	struct if_afpacket_softc *sc = NULL;
+	int error = 0;
+
+	if (NULL == uif->configstr) {
+		error = EINVAL;
+		goto fail;
+	}
+
+	printf("configstr is %s\n", uif->configstr);
+
+	snprintf(uif->name, sizeof(uif->name), "afpacket%u", interface_count);
+	interface_count++;
+
+	sc = malloc(sizeof(struct if_afpacket_softc), M_DEVBUF, M_WAITOK);
+	if (NULL == sc) {
+		printf("if_afpacket_softc allocation failed\n");
+		error = ENOMEM;
+		goto fail;
+	}
+	memset(sc, 0, sizeof(struct if_afpacket_softc));
+
+	sc->uif = uif;
+
+	if (strlen(uif->configstr) > (sizeof(sc->host_ifname) - 1)) {
+		error = ENAMETOOLONG;
+		goto fail;
+	}
+	strcpy(sc->host_ifname, uif->configstr);
+
+	sc->host_ctx = if_afpacket_create_handle(sc->host_ifname);
+	if (NULL == sc->host_ctx) {
+		printf("Failed to create AF_PACKET handle for %s\n", sc->host_ifname);
+		error = ENXIO;
+		goto fail;
+	}
+
+	sc->rx_blocks = if_afpacket_rxblocks(sc->host_ctx);
+
+	if (0 != uhi_get_ifaddr(sc->host_ifname, sc->addr)) {
+		printf("failed to find interface address\n");
+		error = ENXIO;
+		goto fail;
+	}
+
+	if (0 != if_afpacket_setup_interface(sc)) {
+		error = ENXIO;
+		goto fail;
+	}
+
+	uif->ifindex = sc->ifp->if_index;
+	uif->ifdata = sc;
+	uif->ifp = sc->ifp;
+
+	return (0);
+
+fail:
+	if (sc) {
+		if (sc->host_ctx)
+			if_afpacket_destroy_handle(sc->host_ctx);
+
+		free(sc, M_DEVBUF);
+	}
+
+	return (error);
+}
+
+
+static void
+if_afpacket_init(void *arg)
+{
+	struct if_afpacket_softc *sc = arg;
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags |= IFF_DRV_RUNNING;
+	ifp->if_drv_flags &= ~IFF_DRV_OACTIVE;
+}
+
+
+static void
+if_afpacket_start(struct ifnet *ifp)
+{
+	struct if_afpacket_softc *sc = ifp->if_softc;
+
+	mtx_lock(&sc->tx_lock);
+	sc->tx_pkts_to_send++;
+	if (sc->tx_pkts_to_send == 1) {
+		cv_signal(&sc->tx_cv);
+	}
+	mtx_unlock(&sc->tx_lock);
+}
+
+
+static void
+if_afpacket_send(void *arg)
+{
+	struct mbuf *m;
+	struct if_afpacket_softc *sc = (struct if_afpacket_softc *)arg;
+	struct ifnet *ifp = sc->ifp;
+	struct uhi_pollfd pfd;
+	void *frame;
+	u_int pktlen;
+	struct uinet_tso tso;
+	int in_tso;
+	int rv;
+	int done;
+	int pkts_sent;
+	int poll_wait_ms;
+
+	if (sc->uif->cpu >= 0)
+		sched_bind(sc->tx_thread, sc->uif->cpu);
+
+	done = 0;
+	pkts_sent = 0;
+	poll_wait_ms = (sc->tx_thread->td_stop_check_ticks * 1000) / hz;
+	do {
+		mtx_lock(&sc->tx_lock);
+		sc->tx_pkts_to_send -= pkts_sent;
+		while ((sc->tx_pkts_to_send == 0) && !done)
+			if (EWOULDBLOCK == cv_timedwait(&sc->tx_cv, &sc->tx_lock, sc->tx_thread->td_stop_check_ticks))
+				done = kthread_stop_check();
+		mtx_unlock(&sc->tx_lock);
+
+		if (done)
+			break;
+
+		pkts_sent = 0;
+
+		IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+		in_tso = 0;
+		while (m) {
+			if (!in_tso && (m->m_pkthdr.csum_flags & CSUM_TSO)) {
+				if (0 != uinet_tso_start(&tso, m)) {
+					IF_STAT_INC(ifp, oerrors);
+					m_freem(m);
+					pkts_sent++;
+					IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+					continue;
+				}
+				in_tso = 1;
+			}
+
+			if (in_tso)
+				pktlen = uinet_tso_seglen(&tso);
+			else {
+				uinet_tso_txcsum(m);
+				pktlen = m_length(m, NULL);
+			}
+
+			frame = if_afpacket_txframe_get(sc->host_ctx, pktlen);
+			if (NULL == frame) {
+				if (pktlen > ETHER_MAX_FRAME(ifp, ETHERTYPE_VLAN, 1)) {
+					IF_STAT_INC(ifp, oerrors);
+					m_freem(m);
+					pkts_sent++;
+					IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+					continue;
+				}
+
+				/*
+				 * Ring is full.  Push out what has been
+				 * queued and wait for frames to free up.
+				 */
+				if (0 != if_afpacket_txflush(sc->host_ctx))
+					printf("%s: tx ring flush failed\n", ifp->if_xname);
+
+				memset(&pfd, 0, sizeof(pfd));
+				pfd.fd = if_afpacket_txfd(sc->host_ctx);
+				pfd.events = UHI_POLLOUT;
+
+				rv = uhi_poll(&pfd, 1, poll_wait_ms);
+				if (rv == 0)
+					done = kthread_stop_check();
+				else if (rv == -1)
+					printf("error from poll for transmit\n");
+
+				if (done || (done = kthread_stop_check())) {
+					m_freem(m);
+					break;
+				}
+
+				continue;
+			}
+
+			if (in_tso) {
+				uinet_tso_build(&tso, frame);
+				if_afpacket_txframe_put(sc->host_ctx, pktlen);
+
+				IF_STAT_INC(ifp, opackets);
+				IF_STAT_INC(ifp, ocopies);
+
+				/* More segments to go for this mbuf. */
+				if (0 != uinet_tso_seglen(&tso))
+					continue;
+				in_tso = 0;
+			} else {
+				m_copydata(m, 0, pktlen, frame);
+				if_afpacket_txframe_put(sc->host_ctx, pktlen);
+
+				IF_STAT_INC(ifp, opackets);
+				IF_STAT_INC(ifp, ocopies);
+			}
+			pkts_sent++;
+
+			m_freem(m);
+			IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+		}
+
+		if (0 != if_afpacket_txflush(sc->host_ctx))
+			printf("%s: tx ring flush failed\n", ifp->if_xname);
+	} while (!done);
+
+	kthread_stop_ack();
+}
+
+
+static void
+if_afpacket_stop(struct if_afpacket_softc *sc)
+{
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags &= ~(IFF_DRV_RUNNING|IFF_DRV_OACTIVE);
+}
+
+
+static int
+if_afpacket_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
+{
+	int error = 0;
+	struct if_afpacket_softc *sc = ifp->if_softc;
+
+	switch (cmd) {
+	case SIOCSIFFLAGS:
+		if (ifp->if_flags & IFF_UP)
+			if_afpacket_init(sc);
+		else if (ifp->if_drv_flags & IFF_DRV_RUNNING)
+			if_afpacket_stop(sc);
+		break;
+	default:
+		error = ether_ioctl(ifp, cmd, data);
+		break;
+	}
+
+	return (error);
+}
+
+
+static void
+if_afpacket_receive(void *arg)
+{
+	struct if_afpacket_softc *sc;
+	struct ifnet *ifp;
+	struct uhi_pollfd pfd;
+	struct mbuf *m;
+	void *cursor;
+	void *pkt;
+	uint32_t pktlen;
+	uint32_t npkts;
+	uint32_t n;
+	int rv;
+	int done;
+	int poll_wait_ms;
+
+	sc = (struct if_afpacket_softc *)arg;
+	ifp = sc->ifp;
+
+	if (sc->uif->cpu >= 0)
+		sched_bind(sc->rx_thread, sc->uif->cpu);
+
+	/* Run the timers of the connections we receive between batches */
+	uinet_callout_claim();
+
+	uinet_rxbatch_init(&sc->rx_batch, ifp, NULL);
+
+	done = 0;
+	poll_wait_ms = (sc->rx_thread->td_stop_check_ticks * 1000) / hz;
+	for (;;) {
+		npkts = 0;
+		while (!done) {
+			memset(&pfd, 0, sizeof pfd);
+			pfd.fd = if_afpacket_rxfd(sc->host_ctx);
+			pfd.events = UHI_POLLIN;
+
+			if (0 != (npkts = if_afpacket_rxblock_ready(sc->host_ctx, sc->rx_cur_block))) {
+				break;
+			} else {
+				rv = uhi_poll(&pfd, 1, poll_wait_ms);
+				if (rv == -1)
+					printf("error from poll for receive\n");
+			}
+
+			done = kthread_stop_check();
+		}
+
+		if (done || kthread_stop_check())
+			break;
+
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_START);
+
+		cursor = NULL;
+		for (n = 0; n < npkts; n++) {
+			pkt = if_afpacket_rxblock_packet(sc->host_ctx, sc->rx_cur_block, &cursor, &pktlen, NULL);
+			if (0 == pktlen) {
+				/* our own transmit */
+				continue;
+			}
+
+			IF_STAT_INC(ifp, ipackets);
+			IF_STAT_ADD(ifp, ibytes, pktlen);
+
+			/*
+			 * Frames can be larger than a cluster, and
+			 * m_devget() returns a chain with the lengths and
+			 * rcvif already set.
+			 */
+			IF_STAT_INC(ifp, icopies);
+			m = m_devget(pkt, pktlen, ETHER_ALIGN, sc->ifp, NULL);
+			if (m) {
+				uinet_rxbatch_input(&sc->rx_batch, m);
+			} else {
+				IF_STAT_INC(ifp, iqdrops);
+			}
+		}
+
+		/* Everything has been copied out, so the kernel can refill it */
+		if_afpacket_rxblock_release(sc->host_ctx, sc->rx_cur_block);
+
+		uinet_rxbatch_flush(&sc->rx_batch);
+
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_FINISH);
+
+		uinet_callout_poll();
+
+		sc->rx_cur_block++;
+		if (sc->rx_cur_block == sc->rx_blocks)
+			sc->rx_cur_block = 0;
+	}
+
+	uinet_callout_release();
+
+	kthread_stop_ack();
+}
+
+
+static int
+if_afpacket_setup_interface(struct if_afpacket_softc *sc)
+{
+	struct ifnet *ifp;
+
+	ifp = sc->ifp = if_alloc(IFT_ETHER);
+
+	ifp->if_init =  if_afpacket_init;
+	ifp->if_softc = sc;
+
+	if_initname(ifp, sc->uif->name, IF_DUNIT_NONE);
+	ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST;
+	ifp->if_ioctl = if_afpacket_ioctl;
+	ifp->if_start = if_afpacket_start;
+
+	IFQ_SET_MAXLEN(&ifp->if_snd, if_afpacket_txframes(sc->host_ctx));
+	ifp->if_snd.ifq_drv_maxlen = if_afpacket_txframes(sc->host_ctx);
+
+	IFQ_SET_READY(&ifp->if_snd);
+
+	ifp->if_fib = sc->uif->cdom;
+
+	ether_ifattach(ifp, sc->addr);
+	ifp->if_capabilities = ifp->if_capenable = IFCAP_HWSTATS;
+	uinet_tso_attach(ifp);
+
+
+	mtx_init(&sc->tx_lock, "txlk", NULL, MTX_DEF);
+	cv_init(&sc->tx_cv, "txcv");
+
+	if (kthread_add(if_afpacket_send, sc, NULL, &sc->tx_thread, 0, 0, "afpacket_tx: %s", ifp->if_xname)) {
+		printf("Could not start transmit thread for %s (%s)\n", ifp->if_xname, sc->host_ifname);
+		ether_ifdetach(ifp);
+		if_free(ifp);
+		return (1);
+	}
+
+
+	if (kthread_add(if_afpacket_receive, sc, NULL, &sc->rx_thread, 0, 0, "afpacket_rx: %s", ifp->if_xname)) {
+		printf("Could not start receive thread for %s (%s)\n", ifp->if_xname, sc->host_ifname);
+		ether_ifdetach(ifp);
+		if_free(ifp);
+		return (1);
+	}
+
+	return (0);
+}
+
+
+int
+if_afpacket_detach(struct uinet_if *uif)
+{
+	struct if_afpacket_softc *sc = uif->ifdata;
+	struct thread_stop_req rx_tsr;
+	struct thread_stop_req tx_tsr;
+
+	if (sc) {
+		printf("%s (%s): Stopping rx thread\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+		kthread_stop(sc->rx_thread, &rx_tsr);
+		printf("%s (%s): Stopping tx thread\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+		kthread_stop(sc->tx_thread, &tx_tsr);
+
+		kthread_stop_wait(&rx_tsr);
+		kthread_stop_wait(&tx_tsr);
+		printf("%s (%s): Interface threads stopped\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+
+#if notyet
+		/* XXX ether_ifdetach */
+
+		if_afpacket_destroy_handle(sc->host_ctx);
+
+		free(sc, M_DEVBUF);
+#endif
+	}
+
+	return (0);
+}
@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#if defined(__linux__)
+/*
+ * To expose required facilities in net/if.h.
+ */
+#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#if defined(__linux__)
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#endif /* __linux__ */
+
+#include "uinet_host_interface.h"
+#include "uinet_if_afpacket_host.h"
+
+
+#if defined(__linux__)
+
+/*
+ * Receive uses a TPACKET_V3 ring, where the kernel fills variable-length
+ * packet records into fixed-size blocks and hands whole blocks to user
+ * space.  Transmit uses a TPACKET_V2 ring on a second socket, as a single
+ * socket can only have one TPACKET version and TPACKET_V3 tx rings are not
+ * available on older kernels.
+ */
+#define IF_AFPACKET_RX_BLOCK_SIZE	(1 << 18)
+#define IF_AFPACKET_RX_BLOCK_NUM	64
+#define IF_AFPACKET_RX_FRAME_SIZE	2048
+#define IF_AFPACKET_RX_BLOCK_TMO_MS	1
+
+#define IF_AFPACKET_TX_FRAME_SIZE	2048
+#define IF_AFPACKET_TX_FRAME_NUM	1024
+
+
+struct if_afpacket_host_context {
+	int rxfd;
+	int txfd;
+	const char *ifname;
+	int ifindex;
+
+	struct tpacket_req3 rx_req;
+	uint8_t *rx_ring;
+	size_t rx_ring_size;
+
+	struct tpacket_req tx_req;
+	uint8_t *tx_ring;
+	size_t tx_ring_size;
+	uint32_t tx_cur;
+	uint32_t tx_pending;
+};
+
+
+/*
+ * Binding with a protocol of 0 attaches no receive hook, so frames are
+ * queued to the socket only if protocol is ETH_P_ALL.
+ */
+static int
+if_afpacket_bind(int fd, int ifindex, int protocol)
+{
+	struct sockaddr_ll sll;
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(protocol);
+	sll.sll_ifindex = ifindex;
+
+	return (bind(fd, (struct sockaddr *)&sll, sizeof(sll)));
+}
+
+
+static int
+if_afpacket_setup_rx(struct if_afpacket_host_context *ctx)
+{
+	struct packet_mreq mreq;
+	int version = TPACKET_V3;
+
+	/*
+	 * Created with protocol 0 so nothing is queued to the socket until
+	 * the ring is in place and it is bound below.
+	 */
+	ctx->rxfd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (-1 == ctx->rxfd) {
+		printf("Could not create rx packet socket (%d)\n", errno);
+		return (-1);
+	}
+
+	if (-1 == setsockopt(ctx->rxfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+		printf("Could not set TPACKET_V3 on rx socket (%d)\n", errno);
+		return (-1);
+	}
+
+	ctx->rx_req.tp_block_size = IF_AFPACKET_RX_BLOCK_SIZE;
+	ctx->rx_req.tp_block_nr = IF_AFPACKET_RX_BLOCK_NUM;
+	ctx->rx_req.tp_frame_size = IF_AFPACKET_RX_FRAME_SIZE;
+	ctx->rx_req.tp_frame_nr = (IF_AFPACKET_RX_BLOCK_SIZE / IF_AFPACKET_RX_FRAME_SIZE) * IF_AFPACKET_RX_BLOCK_NUM;
+	ctx->rx_req.tp_retire_blk_tov = IF_AFPACKET_RX_BLOCK_TMO_MS;
+	ctx->rx_req.tp_feature_req_word = 0;
+
+	if (-1 == setsockopt(ctx->rxfd, SOL_PACKET, PACKET_RX_RING, &ctx->rx_req, sizeof(ctx->rx_req))) {
+		printf("Could not create rx ring (%d)\n", errno);
+		return (-1);
+	}
+
+	ctx->rx_ring_size = (size_t)ctx->rx_req.tp_block_size * ctx->rx_req.tp_block_nr;
+	ctx->rx_ring = uhi_mmap(NULL, ctx->rx_ring_size, UHI_PROT_READ | UHI_PROT_WRITE, UHI_MAP_SHARED, ctx->rxfd, 0);
+	if (UHI_MAP_FAILED == ctx->rx_ring) {
+		ctx->rx_ring = NULL;
+		printf("Could not map rx ring (%d)\n", errno);
+		return (-1);
+	}
+
+	if (0 != if_afpacket_bind(ctx->rxfd, ctx->ifindex, ETH_P_ALL)) {
+		printf("Could not bind rx socket to %s (%d)\n", ctx->ifname, errno);
+		return (-1);
+	}
+
+	memset(&mreq, 0, sizeof(mreq));
+	mreq.mr_ifindex = ctx->ifindex;
+	mreq.mr_type = PACKET_MR_PROMISC;
+	if (-1 == setsockopt(ctx->rxfd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq))) {
+		printf("Could not enable promiscuous mode on %s (%d)\n", ctx->ifname, errno);
+		return (-1);
+	}
+
+	return (0);
+}
+
+
+static int
+if_afpacket_setup_tx(struct if_afpacket_host_context *ctx)
+{
+	int version = TPACKET_V2;
+#ifdef PACKET_QDISC_BYPASS
+	int one = 1;
+#endif
+
+	ctx->txfd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (-1 == ctx->txfd) {
+		printf("Could not create tx packet socket (%d)\n", errno);
+		return (-1);
+	}
+
+	if (-1 == setsockopt(ctx->txfd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version))) {
+		printf("Could not set TPACKET_V2 on tx socket (%d)\n", errno);
+		return (-1);
+	}
+
+#ifdef PACKET_QDISC_BYPASS
+	/* Best effort - not available on older kernels */
+	setsockopt(ctx->txfd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+#endif
+
+	ctx->tx_req.tp_frame_size = IF_AFPACKET_TX_FRAME_SIZE;
+	ctx->tx_req.tp_frame_nr = IF_AFPACKET_TX_FRAME_NUM;
+	ctx->tx_req.tp_block_size = IF_AFPACKET_TX_FRAME_SIZE * 16;
+	ctx->tx_req.tp_block_nr = IF_AFPACKET_TX_FRAME_NUM / 16;
+
+	if (-1 == setsockopt(ctx->txfd, SOL_PACKET, PACKET_TX_RING, &ctx->tx_req, sizeof(ctx->tx_req))) {
+		printf("Could not create tx ring (%d)\n", errno);
+		return (-1);
+	}
+
+	ctx->tx_ring_size = (size_t)ctx->tx_req.tp_block_size * ctx->tx_req.tp_block_nr;
+	ctx->tx_ring = uhi_mmap(NULL, ctx->tx_ring_size, UHI_PROT_READ | UHI_PROT_WRITE, UHI_MAP_SHARED, ctx->txfd, 0);
+	if (UHI_MAP_FAILED == ctx->tx_ring) {
+		ctx->tx_ring = NULL;
+		printf("Could not map tx ring (%d)\n", errno);
+		return (-1);
+	}
+
+	/* Transmit only - the tx socket must not receive copies of every frame */
+	if (0 != if_afpacket_bind(ctx->txfd, ctx->ifindex, 0)) {
+		printf("Could not bind tx socket to %s (%d)\n", ctx->ifname, errno);
+		return (-1);
+	}
+
+	return (0);
+}
+
+
+struct if_afpacket_host_context *
+if_afpacket_create_handle(const char *ifname)
+{
+	struct if_afpacket_host_context *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (NULL == ctx)
+		return (NULL);
+
+	ctx->rxfd = -1;
+	ctx->txfd = -1;
+	ctx->ifname = ifname;
+
+	ctx->ifindex = if_nametoindex(ifname);
+	if (0 == ctx->ifindex) {
+		printf("No such interface %s\n", ifname);
+		goto fail;
+	}
+
+	if (0 != if_afpacket_setup_rx(ctx))
+		goto fail;
+
+	if (0 != if_afpacket_setup_tx(ctx))
+		goto fail;
+
+	return (ctx);
+
+fail:
+	if_afpacket_destroy_handle(ctx);
+	return (NULL);
+}
+
+
+void
+if_afpacket_destroy_handle(struct if_afpacket_host_context *ctx)
+{
+	if (ctx->rx_ring)
+		uhi_munmap(ctx->rx_ring, ctx->rx_ring_size);
+	if (ctx->tx_ring)
+		uhi_munmap(ctx->tx_ring, ctx->tx_ring_size);
+	if (ctx->rxfd != -1)
+		close(ctx->rxfd);
+	if (ctx->txfd != -1)
+		close(ctx->txfd);
+	free(ctx);
+}
+
+
+int
+if_afpacket_rxfd(struct if_afpacket_host_context *ctx)
+{
+	return (ctx->rxfd);
+}
+
+
+int
+if_afpacket_txfd(struct if_afpacket_host_context *ctx)
+{
+	return (ctx->txfd);
+}
+
+
+uint32_t
+if_afpacket_rxblocks(struct if_afpacket_host_context *ctx)
+{
+	return (ctx->rx_req.tp_block_nr);
+}
+
+
+static inline struct tpacket_block_desc *
+if_afpacket_rxblock(struct if_afpacket_host_context *ctx, uint32_t blockno)
+{
+	return ((struct tpacket_block_desc *)(ctx->rx_ring + (size_t)blockno * ctx->rx_req.tp_block_size));
+}
+
+
+/*
+ * If the given block has been handed to user space, return the number of
+ * packet records in it, otherwise return 0.
+ */
+uint32_t
+if_afpacket_rxblock_ready(struct if_afpacket_host_context *ctx, uint32_t blockno)
+{
+	struct tpacket_block_desc *bd = if_afpacket_rxblock(ctx, blockno);
+
+	if (0 == (bd->hdr.bh1.block_status & TP_STATUS_USER))
+		return (0);
+
+	__sync_synchronize();
+	return (bd->hdr.bh1.num_pkts);
+}
+
+
+/*
+ * Return the next packet in the given block, advancing *cursor.  *cursor
+ * must be NULL on the first call for a block.  Packets that were
+ * transmitted by this host are reported with *len set to 0.
+ */
+void *
+if_afpacket_rxblock_packet(struct if_afpacket_host_context *ctx, uint32_t blockno, void **cursor,
+			   uint32_t *len, uint64_t *timestamp)
+{
+	struct tpacket_block_desc *bd = if_afpacket_rxblock(ctx, blockno);
+	struct tpacket3_hdr *hdr;
+	struct sockaddr_ll *sll;
+
+	if (NULL == *cursor)
+		hdr = (struct tpacket3_hdr *)((uint8_t *)bd + bd->hdr.bh1.offset_to_first_pkt);
+	else
+		hdr = *cursor;
+
+	*cursor = (uint8_t *)hdr + hdr->tp_next_offset;
+
+	sll = (struct sockaddr_ll *)((uint8_t *)hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+	*len = (PACKET_OUTGOING == sll->sll_pkttype) ? 0 : hdr->tp_snaplen;
+	if (timestamp)
+		*timestamp = (uint64_t)hdr->tp_sec * UHI_NSEC_PER_SEC + hdr->tp_nsec;
+
+	return ((uint8_t *)hdr + hdr->tp_mac);
+}
+
+
+/*
+ * Return the given block to the kernel.  This may be called from any
+ * thread.
+ */
+void
+if_afpacket_rxblock_release(struct if_afpacket_host_context *ctx, uint32_t blockno)
+{
+	struct tpacket_block_desc *bd = if_afpacket_rxblock(ctx, blockno);
+
+	__sync_synchronize();
+	bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	__sync_synchronize();
+}
+
+
+uint32_t
+if_afpacket_txframes(struct if_afpacket_host_context *ctx)
+{
+	return (ctx->tx_req.tp_frame_nr);
+}
+
+
+static inline struct tpacket2_hdr *
+if_afpacket_txframe(struct if_afpacket_host_context *ctx, uint32_t frameno)
+{
+	return ((struct tpacket2_hdr *)(ctx->tx_ring + (size_t)frameno * ctx->tx_req.tp_frame_size));
+}
+
+
+/*
+ * Return a pointer to the packet data area of the next free tx frame, or
+ * NULL if the ring is full or the packet will not fit in a frame.
+ */
+void *
+if_afpacket_txframe_get(struct if_afpacket_host_context *ctx, uint32_t len)
+{
+	struct tpacket2_hdr *hdr = if_afpacket_txframe(ctx, ctx->tx_cur);
+	uint32_t offset = TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+
+	if (len > ctx->tx_req.tp_frame_size - offset)
+		return (NULL);
+
+	if (hdr->tp_status & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING))
+		return (NULL);
+
+	return ((uint8_t *)hdr + offset);
+}
+
+
+/*
+ * Queue the frame most recently returned by if_afpacket_txframe_get() for
+ * transmission.  Nothing is sent until if_afpacket_txflush() is called.
+ */
+void
+if_afpacket_txframe_put(struct if_afpacket_host_context *ctx, uint32_t len)
+{
+	struct tpacket2_hdr *hdr = if_afpacket_txframe(ctx, ctx->tx_cur);
+
+	hdr->tp_len = len;
+	__sync_synchronize();
+	hdr->tp_status = TP_STATUS_SEND_REQUEST;
+
+	ctx->tx_cur++;
+	if (ctx->tx_cur == ctx->tx_req.tp_frame_nr)
+		ctx->tx_cur = 0;
+	ctx->tx_pending++;
+}
+
+
+/*
+ * Kick the kernel to transmit all queued frames with a single syscall.
+ */
+int
+if_afpacket_txflush(struct if_afpacket_host_context *ctx)
+{
+	if (0 == ctx->tx_pending)
+		return (0);
+
+	ctx->tx_pending = 0;
+	if (-1 == sendto(ctx->txfd, NULL, 0, MSG_DONTWAIT, NULL, 0)) {
+		if ((EAGAIN != errno) && (ENOBUFS != errno))
+			return (errno);
+	}
+
+	return (0);
+}
+
+#else /* !__linux__ */
+
+struct if_afpacket_host_context *
+if_afpacket_create_handle(const char *ifname)
+{
+	printf("AF_PACKET interfaces are only supported on Linux\n");
+	return (NULL);
+}
+
+
+void
+if_afpacket_destroy_handle(struct if_afpacket_host_context *ctx)
+{
+}
+
+
+int
+if_afpacket_rxfd(struct if_afpacket_host_context *ctx)
+{
+	return (-1);
+}
+
+
+int
+if_afpacket_txfd(struct if_afpacket_host_context *ctx)
+{
+	return (-1);
+}
+
+
+uint32_t
+if_afpacket_rxblocks(struct if_afpacket_host_context *ctx)
+{
+	return (0);
+}
+
+
+uint32_t
+if_afpacket_rxblock_ready(struct if_afpacket_host_context *ctx, uint32_t blockno)
+{
+	return (0);
+}
+
+
+void *
+if_afpacket_rxblock_packet(struct if_afpacket_host_context *ctx, uint32_t blockno, void **cursor,
+			   uint32_t *len, uint64_t *timestamp)
+{
+	return (NULL);
+}
+
+
+void
+if_afpacket_rxblock_release(struct if_afpacket_host_context *ctx, uint32_t blockno)
+{
+}
+
+
+uint32_t
+if_afpacket_txframes(struct if_afpacket_host_context *ctx)
+{
+	return (0);
+}
+
+
+void *
+if_afpacket_txframe_get(struct if_afpacket_host_context *ctx, uint32_t len)
+{
+	return (NULL);
+}
+
+
+void
+if_afpacket_txframe_put(struct if_afpacket_host_context *ctx, uint32_t len)
+{
+}
+
+
+int
+if_afpacket_txflush(struct if_afpacket_host_context *ctx)
+{
+	return (ENXIO);
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _UINET_IF_AFPACKET_HOST_H_
+#define _UINET_IF_AFPACKET_HOST_H_
+
+struct if_afpacket_host_context;
+
+struct if_afpacket_host_context *if_afpacket_create_handle(const char *ifname);
+void if_afpacket_destroy_handle(struct if_afpacket_host_context *ctx);
+int if_afpacket_rxfd(struct if_afpacket_host_context *ctx);
+int if_afpacket_txfd(struct if_afpacket_host_context *ctx);
+uint32_t if_afpacket_rxblocks(struct if_afpacket_host_context *ctx);
+uint32_t if_afpacket_rxblock_ready(struct if_afpacket_host_context *ctx, uint32_t blockno);
+void *if_afpacket_rxblock_packet(struct if_afpacket_host_context *ctx, uint32_t blockno, void **cursor,
+				 uint32_t *len, uint64_t *timestamp);
+void if_afpacket_rxblock_release(struct if_afpacket_host_context *ctx, uint32_t blockno);
+uint32_t if_afpacket_txframes(struct if_afpacket_host_context *ctx);
+void *if_afpacket_txframe_get(struct if_afpacket_host_context *ctx, uint32_t len);
+void if_afpacket_txframe_put(struct if_afpacket_host_context *ctx, uint32_t len);
+int if_afpacket_txflush(struct if_afpacket_host_context *ctx);
+
+#endif /* _UINET_IF_AFPACKET_HOST_H_ */
@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/ctype.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/proc.h>
+#include <sys/kthread.h>
+#include <sys/sched.h>
+#include <sys/sockio.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/if_types.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <net/if_tap.h>
+#include <net/if_dl.h>
+
+#include <machine/atomic.h>
+
+#include "uinet_internal.h"
+#include "uinet_host_interface.h"
+#include "uinet_if_memlink.h"
+#include "uinet_rxbatch.h"
+
+/*
+ * This implements an in-process point-to-point ethernet link.
+ *
+ * The first two interfaces created with the same link name are the two
+ * ends of the link.  They can be in the same or different instances.  Each
+ * direction of the link is a single-producer, single-consumer ring of mbuf
+ * pointers, so frames are handed from one stack to the other without being
+ * copied.  Transmitting threads are serialized by a per-end lock, and each
+ * end's receive thread drains the peer's ring without taking any locks.
+ */
+
+#define IF_MEMLINK_RING_SIZE	1024	/* must be a power of 2 */
+#define IF_MEMLINK_RX_BATCH	256
+
+
+struct if_memlink_ring {
+	volatile u_int head;		/* written by producer */
+	u_int pad0[CACHE_LINE_SIZE / sizeof(u_int) - 1];
+	volatile u_int tail;		/* written by consumer */
+	u_int pad1[CACHE_LINE_SIZE / sizeof(u_int) - 1];
+	struct mbuf *slots[IF_MEMLINK_RING_SIZE];
+};
+
+
+struct if_memlink_softc;
+
+struct if_memlink {
+	LIST_ENTRY(if_memlink) link;
+	char name[IF_NAMESIZE];
+
+	/* ends[i] transmits on rings[i] and receives on rings[1 - i] */
+	struct if_memlink_softc * volatile ends[2];
+	struct if_memlink_ring rings[2];
+};
+
+
+struct if_memlink_softc {
+	struct ifnet *ifp;
+	const struct uinet_if *uif;
+	uint8_t addr[ETHER_ADDR_LEN];
+
+	struct if_memlink *link;
+	unsigned int end;
+
+	struct mtx tx_lock;
+
+	struct thread *rx_thread;
+	struct mtx rx_lock;
+	struct cv rx_cv;
+	volatile int rx_sleeping;
+	struct uinet_rxbatch rx_batch;
+};
+
+
+static LIST_HEAD(, if_memlink) if_memlink_list = LIST_HEAD_INITIALIZER(if_memlink_list);
+static struct mtx if_memlink_list_lock;
+MTX_SYSINIT(if_memlink_list, &if_memlink_list_lock, "memlinks", MTX_DEF);
+
+static unsigned int interface_count;
+
+
+static int if_memlink_setup_interface(struct if_memlink_softc *sc);
+
+
+static inline int
+if_memlink_ring_put(struct if_memlink_ring *r, struct mbuf *m)
+{
+	u_int head = r->head;
+
+	if (head - atomic_load_acq_int(&r->tail) == IF_MEMLINK_RING_SIZE)
+		return (ENOBUFS);
+
+	r->slots[head & (IF_MEMLINK_RING_SIZE - 1)] = m;
+	atomic_store_rel_int(&r->head, head + 1);
+
+	return (0);
+}
+
+
+static inline struct mbuf *
+if_memlink_ring_get(struct if_memlink_ring *r)
+{
+	struct mbuf *m;
+	u_int tail = r->tail;
+
+	if (tail == atomic_load_acq_int(&r->head))
+		return (NULL);
+
+	m = r->slots[tail & (IF_MEMLINK_RING_SIZE - 1)];
+	atomic_store_rel_int(&r->tail, tail + 1);
+
+	return (m);
+}
+
+
+static inline int
+if_memlink_ring_empty(struct if_memlink_ring *r)
+{
+	return (r->tail == atomic_load_acq_int(&r->head));
+}
+
+
+static int
+if_memlink_join(struct if_memlink_softc *sc, const char *name)
+{
+	struct if_memlink *link;
+	int error = 0;
+
+	mtx_lock(&if_memlink_list_lock);
+	LIST_FOREACH(link, &if_memlink_list, link) {
+		if (0 == strcmp(link->name, name))
+			break;
+	}
+
+	if (NULL == link) {
+		link = malloc(sizeof(*link), M_DEVBUF, M_NOWAIT | M_ZERO);
+		if (NULL == link) {
+			error = ENOMEM;
+			goto out;
+		}
+		strcpy(link->name, name);
+		LIST_INSERT_HEAD(&if_memlink_list, link, link);
+	}
+
+	if (NULL == link->ends[0])
+		sc->end = 0;
+	else if (NULL == link->ends[1])
+		sc->end = 1;
+	else {
+		error = EEXIST;
+		goto out;
+	}
+
+	sc->link = link;
+	atomic_store_rel_ptr((volatile uintptr_t *)&link->ends[sc->end], (uintptr_t)sc);
+
+out:
+	mtx_unlock(&if_memlink_list_lock);
+
+	return (error);
+}
+
+
+static void
+if_memlink_leave(struct if_memlink_softc *sc)
+{
+	mtx_lock(&if_memlink_list_lock);
+	atomic_store_rel_ptr((volatile uintptr_t *)&sc->link->ends[sc->end], (uintptr_t)NULL);
+	mtx_unlock(&if_memlink_list_lock);
+}
+
+
+int
+if_memlink_attach(struct uinet_if *uif)
+{
+	struct if_memlink_softc *sc = NULL;
+	unsigned int unit;
+	int error = 0;
+
+	if (NULL == uif->configstr) {
+		error = EINVAL;
+		goto fail;
+	}
+
+	printf("configstr is %s\n", uif->configstr);
+
+	if (('\0' == uif->configstr[0]) || (strlen(uif->configstr) > (IF_NAMESIZE - 1))) {
+		error = EINVAL;
+		goto fail;
+	}
+
+	unit = interface_count;
+	snprintf(uif->name, sizeof(uif->name), "memlink%u", unit);
+	interface_count++;
+
+	sc = malloc(sizeof(struct if_memlink_softc), M_DEVBUF, M_WAITOK);
+	if (NULL == sc) {
+		printf("if_memlink_softc allocation failed\n");
+		error = ENOMEM;
+		goto fail;
+	}
+	memset(sc, 0, sizeof(struct if_memlink_softc));
+
+	sc->uif = uif;
+
+	/* locally administered, unique within the process */
+	sc->addr[0] = 0x02;
+	sc->addr[3] = (unit >> 16) & 0xff;
+	sc->addr[4] = (unit >> 8) & 0xff;
+	sc->addr[5] = unit & 0xff;
+
+	error = if_memlink_join(sc, uif->configstr);
+	if (0 != error) {
+		printf("Failed to join link %s (%d)\n", uif->configstr, error);
+		sc->link = NULL;
+		goto fail;
+	}
+
+	if (0 != if_memlink_setup_interface(sc)) {
+		error = ENXIO;
+		goto fail;
+	}
+
+	uif->ifindex = sc->ifp->if_index;
+	uif->ifdata = sc;
+	uif->ifp = sc->ifp;
+
+	return (0);
+
+fail:
+	if (sc) {
+		if (sc->link)
+			if_memlink_leave(sc);
+
+		free(sc, M_DEVBUF);
+	}
+
+	return (error);
+}
+
+
+static void
+if_memlink_init(void *arg)
+{
+	struct if_memlink_softc *sc = arg;
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags |= IFF_DRV_RUNNING;
+	ifp->if_drv_flags &= ~IFF_DRV_OACTIVE;
+}
+
+
+static void
+if_memlink_stop(struct if_memlink_softc *sc)
+{
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags &= ~(IFF_DRV_RUNNING|IFF_DRV_OACTIVE);
+}
+
+
+static int
+if_memlink_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
+{
+	int error = 0;
+	struct if_memlink_softc *sc = ifp->if_softc;
+
+	switch (cmd) {
+	case SIOCSIFFLAGS:
+		if (ifp->if_flags & IFF_UP)
+			if_memlink_init(sc);
+		else if (ifp->if_drv_flags & IFF_DRV_RUNNING)
+			if_memlink_stop(sc);
+		break;
+	default:
+		error = ether_ioctl(ifp, cmd, data);
+		break;
+	}
+
+	return (error);
+}
+
+
+static int
+if_memlink_transmit(struct ifnet *ifp, struct mbuf *m)
+{
+	struct if_memlink_softc *sc = ifp->if_softc;
+	struct if_memlink_softc *peer;
+	int pktlen;
+	int error;
+
+	peer = (struct if_memlink_softc *)atomic_load_acq_ptr((volatile uintptr_t *)&sc->link->ends[1 - sc->end]);
+	if ((NULL == peer) || (NULL == peer->ifp) ||
+	    !(peer->ifp->if_drv_flags & IFF_DRV_RUNNING)) {
+		IF_STAT_INC(ifp, oerrors);
+		m_freem(m);
+		return (ENETDOWN);
+	}
+
+	pktlen = m->m_pkthdr.len;
+
+	mtx_lock(&sc->tx_lock);
+	error = if_memlink_ring_put(&sc->link->rings[sc->end], m);
+	if (0 == error) {
+		IF_STAT_INC(ifp, opackets);
+		IF_STAT_ADD(ifp, obytes, pktlen);
+		IF_STAT_INC(ifp, ozcopies);
+	} else
+		ifp->if_snd.ifq_drops++;
+	mtx_unlock(&sc->tx_lock);
+
+	if (0 != error) {
+		m_freem(m);
+		return (error);
+	}
+
+	/*
+	 * The full barrier orders the ring update above before the load of
+	 * rx_sleeping below, pairing with the one in the receive loop, so
+	 * that either the receiver sees the new frame or we see that it is
+	 * going to sleep.
+	 */
+	mb();
+	if (peer->rx_sleeping) {
+		mtx_lock(&peer->rx_lock);
+		cv_signal(&peer->rx_cv);
+		mtx_unlock(&peer->rx_lock);
+	}
+
+	return (0);
+}
+
+
+static void
+if_memlink_qflush(struct ifnet *ifp)
+{
+
+}
+
+
+static void
+if_memlink_receive(void *arg)
+{
+	struct if_memlink_softc *sc = (struct if_memlink_softc *)arg;
+	struct ifnet *ifp = sc->ifp;
+	struct if_memlink_ring *ring;
+	struct mbuf *m;
+	unsigned int n;
+	int done;
+
+	if (sc->uif->cpu >= 0)
+		sched_bind(sc->rx_thread, sc->uif->cpu);
+
+	/* Run the timers of the connections we receive between batches */
+	uinet_callout_claim();
+
+	uinet_rxbatch_init(&sc->rx_batch, ifp, NULL);
+
+	ring = &sc->link->rings[1 - sc->end];
+
+	done = 0;
+	while (!done) {
+		if (if_memlink_ring_empty(ring)) {
+			mtx_lock(&sc->rx_lock);
+			sc->rx_sleeping = 1;
+			mb();
+			if (if_memlink_ring_empty(ring))
+				if (EWOULDBLOCK == cv_timedwait(&sc->rx_cv, &sc->rx_lock, sc->rx_thread->td_stop_check_ticks))
+					done = kthread_stop_check();
+			sc->rx_sleeping = 0;
+			mtx_unlock(&sc->rx_lock);
+
+			continue;
+		}
+
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_START);
+
+		for (n = 0; n < IF_MEMLINK_RX_BATCH; n++) {
+			m = if_memlink_ring_get(ring);
+			if (NULL == m)
+				break;
+
+			IF_STAT_INC(ifp, ipackets);
+			IF_STAT_ADD(ifp, ibytes, m->m_pkthdr.len);
+			IF_STAT_INC(ifp, izcopies);
+
+			/* the frame is leaving the sending stack */
+			m_tag_delete_chain(m, NULL);
+			m->m_flags &= ~(M_BCAST | M_MCAST | M_PROMISC);
+			m->m_pkthdr.rcvif = ifp;
+
+			uinet_rxbatch_input(&sc->rx_batch, m);
+		}
+
+		uinet_rxbatch_flush(&sc->rx_batch);
+
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_FINISH);
+
+		uinet_callout_poll();
+
+		done = kthread_stop_check();
+	}
+
+	uinet_callout_release();
+
+	kthread_stop_ack();
+}
+
+
+static int
+if_memlink_setup_interface(struct if_memlink_softc *sc)
+{
+	struct ifnet *ifp;
+
+	ifp = sc->ifp = if_alloc(IFT_ETHER);
+
+	ifp->if_init =  if_memlink_init;
+	ifp->if_softc = sc;
+
+	if_initname(ifp, sc->uif->name, IF_DUNIT_NONE);
+	ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST;
+	ifp->if_ioctl = if_memlink_ioctl;
+	ifp->if_transmit = if_memlink_transmit;
+	ifp->if_qflush = if_memlink_qflush;
+
+	ifp->if_fib = sc->uif->cdom;
+
+	ether_ifattach(ifp, sc->addr);
+	ifp->if_capabilities = ifp->if_capenable = IFCAP_HWSTATS;
+
+	mtx_init(&sc->tx_lock, "txlk", NULL, MTX_DEF);
+	mtx_init(&sc->rx_lock, "rxlk", NULL, MTX_DEF);
+	cv_init(&sc->rx_cv, "rxcv");
+
+	if (kthread_add(if_memlink_receive, sc, NULL, &sc->rx_thread, 0, 0, "memlink_rx: %s", ifp->if_xname)) {
+		printf("Could not start receive thread for %s (%s)\n", ifp->if_xname, sc->link->name);
+		ether_ifdetach(ifp);
+		if_free(ifp);
+		return (1);
+	}
+
+	return (0);
+}
+
+
+int
+if_memlink_detach(struct uinet_if *uif)
+{
+	struct if_memlink_softc *sc = uif->ifdata;
+	struct thread_stop_req tsr;
+
+	if (sc) {
+		if_memlink_leave(sc);
+
+		printf("%s (%s): Stopping rx thread\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+		kthread_stop(sc->rx_thread, &tsr);
+		kthread_stop_wait(&tsr);
+
+#if notyet
+		/* XXX ether_ifdetach, drain rings, free link when unused */
+
+		free(sc, M_DEVBUF);
+#endif
+	}
+
+	return (0);
+}
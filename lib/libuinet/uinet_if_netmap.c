@@ -32,6 +32,7 @@
 #include <sys/proc.h>
 #include <sys/kthread.h>
 #include <sys/sched.h>
+#include <sys/smp.h>
 #include <sys/sockio.h>
 
 #include <net/if.h>
@@ -42,12 +43,18 @@
 #include <net/if_tap.h>
 #include <net/if_dl.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp_lro.h>
+
 #include <machine/atomic.h>
 
 #include "uinet_internal.h"
 #include "uinet_host_interface.h"
 #include "uinet_if_netmap.h"
 #include "uinet_if_netmap_host.h"
+#include "uinet_lro.h"
+#include "uinet_rxbatch.h"
+#include "uinet_tso.h"
 
 
 /*
@@ -77,44 +84,82 @@
 #define IF_NETMAP_RXRING_ZCOPY_FRAC_NUM 1
 #define IF_NETMAP_RXRING_ZCOPY_FRAC_DEN 2
 
+/*
+ *  When IF_NETMAP_TX_ZCOPY is non-zero, the transmit path avoids copying
+ *  packets into tx ring buffers where it can.  A single-buffer packet that
+ *  was zero-copy received from a netmap interface sharing the same netmap
+ *  memory is posted by exchanging its buffer index with that of the tx
+ *  slot.  On VALE ports, any other single-buffer packet is posted via an
+ *  indirect slot that refers to the mbuf data in place.  Everything else,
+ *  including fragmented chains, is copied.
+ */
+#define IF_NETMAP_TX_ZCOPY 1
+
 #define IF_NETMAP_THREAD_STOP_CHECK_MS 200
 
+/*
+ *  Upper bound on the number of hardware rings used by a single multi-queue
+ *  interface, and on the length of its cpu list.
+ */
+#define IF_NETMAP_MAX_QUEUES 64
+
 struct if_netmap_bufinfo {
 	unsigned int refcnt;
 	uint32_t nm_index;  /* netmap buffer index */
 	uint32_t bi_index;  /* bufinfo index */
 };
 
+/*
+ * The free list is a ring of bufinfo indices addressed by free-running
+ * counters.  Entries in [head, trail) are available for allocation by the
+ * receive thread, and entries from trail onward have been returned by
+ * if_netmap_bufinfo_free() and are waiting for their netmap buffers to be
+ * put back in the hardware ring by if_netmap_sweep_trail().
+ *
+ * Frees may come from any thread, so a returned entry is claimed with an
+ * atomic increment of tail and then published by writing its ticket to
+ * seq, which is what the receive thread checks before consuming it.  The
+ * ring is at least as large as the pool, so producers can never overrun
+ * the receive thread.
+ */
 struct if_netmap_bufinfo_pool {
 	unsigned int initialized;
-	struct mtx tail_lock;
 	struct if_netmap_bufinfo *pool;
 	uint32_t *free_list;
+	volatile u_int *seq;
 	uint32_t max;
+	uint32_t mask;
 	uint32_t avail;
-	volatile u_int returnable;
 	uint32_t head;
-	uint32_t tail;
 	uint32_t trail;
+	volatile u_int tail __aligned(CACHE_LINE_SIZE);
 };
 
 
-struct if_netmap_softc {
-	struct ifnet *ifp;
-	const struct uinet_if *uif;
-	uint8_t addr[ETHER_ADDR_LEN];
-	int isvale;
+/*
+ * Per-hardware-ring state.  In single-queue mode there is exactly one of
+ * these, and in multi-queue mode there is one for each hardware rx/tx ring
+ * pair, each with its own netmap fd and its own rx/tx thread pair.
+ */
+struct if_netmap_queue {
+	struct if_netmap_softc *sc;
+	unsigned int index;		/* index in sc->queues[] */
+	uint16_t qno;			/* hardware ring number */
+	int cpu;
 	int fd;
-	char host_ifname[IF_NAMESIZE];
-	uint16_t queue;
 
 	uint32_t hw_rx_rsvd_begin;
 	uint32_t *nm_buffer_indices;
+	uint32_t *nm_tx_buffer_indices;
 	struct if_netmap_host_context *nm_host_ctx;
+	int tx_indirect;
 
-	struct if_netmap_bufinfo_pool rx_bufinfo;
+	struct mbuf **tx_held;		/* referenced by indirect tx slots */
+	uint32_t tx_held_count;
 
-	int stop_check_ticks;
+	struct if_netmap_bufinfo_pool rx_bufinfo;
+	struct lro_ctrl rx_lro;
+	struct uinet_rxbatch rx_batch;
 
 	struct thread *tx_thread;
 	struct thread *rx_thread;
@@ -122,10 +167,33 @@ struct if_netmap_softc {
 	struct mtx tx_lock;
 	struct cv tx_cv;
 	int tx_pkts_to_send;
+	struct ifqueue tx_ifq;		/* multi-queue mode only */
+};
+
+
+struct if_netmap_softc {
+	struct ifnet *ifp;
+	const struct uinet_if *uif;
+	uint8_t addr[ETHER_ADDR_LEN];
+	int isvale;
+	char host_ifname[IF_NAMESIZE];
+	uint16_t queue;
+	int allqueues;
+
+	int ncpus;
+	int cpus[IF_NETMAP_MAX_QUEUES];
+
+	int stop_check_ticks;
+
+	unsigned int nqueues;
+	struct if_netmap_queue *queues;
 };
 
 
 static int if_netmap_setup_interface(struct if_netmap_softc *sc);
+static int if_netmap_queue_init(struct if_netmap_softc *sc, struct if_netmap_queue *q);
+static void if_netmap_queue_destroy(struct if_netmap_queue *q);
+static void if_netmap_free(void *arg1, void *arg2);
 
 
 
@@ -136,36 +204,44 @@ static int
 if_netmap_bufinfo_pool_init(struct if_netmap_bufinfo_pool *p, uint32_t max)
 {
 	uint32_t i;
+	uint32_t ring_size;
 
 	p->max = max;
 
+	ring_size = 1;
+	while (ring_size < p->max)
+		ring_size <<= 1;
+	p->mask = ring_size - 1;
+
+	p->free_list = NULL;
+	p->seq = NULL;
 	if (p->max > 0) {
 		p->pool = malloc(sizeof(struct if_netmap_bufinfo) * p->max, M_DEVBUF, M_WAITOK);
 		if (NULL == p->pool) {
-			p->free_list = NULL;
 			return (-1);
 		}
-		p->free_list = malloc(sizeof(uint32_t) * p->max, M_DEVBUF, M_WAITOK);
+		p->free_list = malloc(sizeof(uint32_t) * ring_size, M_DEVBUF, M_WAITOK);
 		if (NULL == p->free_list) {
 			return (-1);
 		}
+		p->seq = malloc(sizeof(u_int) * ring_size, M_DEVBUF, M_WAITOK | M_ZERO);
+		if (NULL == p->seq) {
+			return (-1);
+		}
 	} else {
 		p->pool = NULL;
-		p->free_list = NULL;
 	}
 	p->avail = p->max;
-	p->returnable = 0;
 	p->head = 0;
-	p->tail = 0;
-	p->trail = 0;
+	p->trail = p->max;
+	p->tail = p->max;
 
 	for (i = 0; i < p->max; i++) {
 		p->pool[i].bi_index = i;
 		p->free_list[i] = i;
+		p->seq[i] = i + 1;
 	}
 
-	mtx_init(&p->tail_lock, "bitllk", NULL, MTX_DEF);
-
 	p->initialized = 1;
 
 	return (0);
@@ -175,7 +251,9 @@ if_netmap_bufinfo_pool_init(struct if_netmap_bufinfo_pool *p, uint32_t max)
 static int
 if_netmap_bufinfo_pool_destroy(struct if_netmap_bufinfo_pool *p)
 {
-	mtx_destroy(&p->tail_lock);
+	if (p->seq) {
+		free(__DEVOLATILE(u_int *, p->seq), M_DEVBUF);
+	}
 
 	if (p->free_list) {
 		free(p->free_list, M_DEVBUF);
@@ -197,13 +275,10 @@ if_netmap_bufinfo_alloc(struct if_netmap_bufinfo_pool *p, uint32_t slotindex)
 
 	if (p->avail) {
 		p->avail--;
-		bi = &p->pool[p->free_list[p->head]];
+		bi = &p->pool[p->free_list[p->head & p->mask]];
 		bi->nm_index = slotindex;
 
 		p->head++;
-		if (p->head == p->max) {
-			p->head = 0;
-		}
 
 		return (bi);
 	}
@@ -220,32 +295,53 @@ static void
 if_netmap_bufinfo_unalloc(struct if_netmap_bufinfo_pool *p)
 {
 	p->avail++;
-	if (p->head > 0) {
-		p->head--;
-	} else {
-		p->head = p->max - 1;
-	}
+	p->head--;
 }
 
 /* This may be called from arbitrary threads */
 static void
 if_netmap_bufinfo_free(struct if_netmap_bufinfo_pool *p, struct if_netmap_bufinfo *bi)
 {
-	mtx_lock(&p->tail_lock);
-	p->free_list[p->tail] = bi->bi_index;
+	u_int ticket;
+
+	ticket = atomic_fetchadd_int(&p->tail, 1);
+	p->free_list[ticket & p->mask] = bi->bi_index;
+	atomic_store_rel_int(&p->seq[ticket & p->mask], ticket + 1);
+}
 
-	/*
-	 * p->returnable is the only state shared with
-	 * if_netmap_sweep_trail, and using atomic add here saves us from
-	 * locking there.
-	 */
-	atomic_add_int(&p->returnable, 1);
 
-	p->tail++;
-	if (p->tail == p->max) {
-		p->tail = 0;
+
+
+static int
+if_netmap_parse_cpulist(struct if_netmap_softc *sc, const char *list)
+{
+	const char *p = list;
+	char *end;
+	unsigned long cpu;
+
+	sc->ncpus = 0;
+	while ('\0' != *p) {
+		if (!isdigit(*p))
+			return (EINVAL);
+
+		cpu = strtoul(p, &end, 10);
+		if ((cpu >= mp_ncpus) || (sc->ncpus == IF_NETMAP_MAX_QUEUES))
+			return (EINVAL);
+		sc->cpus[sc->ncpus++] = cpu;
+
+		p = end;
+		if (',' == *p) {
+			p++;
+			if ('\0' == *p) {
+				/* comma at the end */
+				return (EINVAL);
+			}
+		} else if ('\0' != *p) {
+			return (EINVAL);
+		}
 	}
-	mtx_unlock(&p->tail_lock);
+
+	return (sc->ncpus > 0 ? 0 : EINVAL);
 }
 
 
@@ -285,23 +381,39 @@ if_netmap_process_configstr(struct if_netmap_softc *sc)
 				goto out;
 			}
 
-			while (isdigit(*p) && ('\0' != *p))
+			if ('*' == *p) {
+				/* all hardware rings, with optional cpu list */
+				sc->allqueues = 1;
+				sc->queue = 0;
+
 				p++;
-			
-			if ('\0' != *p) {
-				/* non-numeric chars after colon */
-				error = EINVAL;
-				goto out;
+				if ('@' == *p) {
+					error = if_netmap_parse_cpulist(sc, p + 1);
+					if (0 != error)
+						goto out;
+				} else if ('\0' != *p) {
+					error = EINVAL;
+					goto out;
+				}
+			} else {
+				while (isdigit(*p) && ('\0' != *p))
+					p++;
+
+				if ('\0' != *p) {
+					/* non-numeric chars after colon */
+					error = EINVAL;
+					goto out;
+				}
+
+				sc->queue = strtoul(last_colon + 1, NULL, 10);
 			}
 
-			sc->queue = strtoul(last_colon + 1, NULL, 10);
-			
 			namelen = last_colon - configstr;
 			if (namelen > (sizeof(sc->host_ifname) - 1)) {
 				error = ENAMETOOLONG;
 				goto out;
 			}
-			
+
 			memcpy(sc->host_ifname, configstr, namelen);
 			sc->host_ifname[namelen] = '\0';
 		} else {
@@ -315,16 +427,122 @@ out:
 }
 
 
+static int
+if_netmap_queue_init(struct if_netmap_softc *sc, struct if_netmap_queue *q)
+{
+	uint32_t pool_size;
+	uint32_t slotindex, curslotindex;
+	uint32_t bufindex, unused;
+	int error;
+
+	q->fd = uhi_open("/dev/netmap", UHI_O_RDWR);
+	if (q->fd < 0) {
+		printf("/dev/netmap open failed\n");
+		return (ENXIO);
+	}
+
+	q->nm_host_ctx = if_netmap_register_if(q->fd, sc->host_ifname, sc->isvale, q->qno);
+	if (NULL == q->nm_host_ctx) {
+		printf("Failed to register netmap interface (ring %u)\n", q->qno);
+		return (ENXIO);
+	}
+
+	/*
+	 * Limiting the size of the rxring zero-copy context pool to the
+	 * given fraction of the rxring size limits the amount of rxring
+	 * buffers that can be outstanding to the stack via zero-copy at any
+	 * given time as a failure to allocate a zero-copy context in the
+	 * receive loop causes the buffer to be copied to the stack.
+	 */
+	pool_size = (if_netmap_rxslots(q->nm_host_ctx) * IF_NETMAP_RXRING_ZCOPY_FRAC_NUM) / IF_NETMAP_RXRING_ZCOPY_FRAC_DEN;
+	error = if_netmap_bufinfo_pool_init(&q->rx_bufinfo, pool_size);
+	if (error != 0) {
+		printf("bufinfo pool init failed\n");
+		return (ENOMEM);
+	}
+
+	q->nm_buffer_indices = malloc(if_netmap_rxslots(q->nm_host_ctx) *
+				      sizeof(q->nm_buffer_indices[0]),
+				      M_DEVBUF, M_WAITOK);
+	if (NULL == q->nm_buffer_indices) {
+		printf("Failed to alloc buffer index array\n");
+		return (ENOMEM);
+	}
+
+	q->nm_tx_buffer_indices = malloc(if_netmap_txslots(q->nm_host_ctx) *
+					 sizeof(q->nm_tx_buffer_indices[0]),
+					 M_DEVBUF, M_WAITOK);
+	if (NULL == q->nm_tx_buffer_indices) {
+		printf("Failed to alloc tx buffer index array\n");
+		return (ENOMEM);
+	}
+
+	q->tx_indirect = IF_NETMAP_TX_ZCOPY && if_netmap_txindirect(q->nm_host_ctx);
+	if (q->tx_indirect) {
+		q->tx_held = malloc(if_netmap_txslots(q->nm_host_ctx) *
+				    sizeof(q->tx_held[0]), M_DEVBUF, M_WAITOK);
+		if (NULL == q->tx_held) {
+			printf("Failed to alloc tx held mbuf array\n");
+			return (ENOMEM);
+		}
+	}
+
+	/*
+	 * XXX This goes away when netmap implements buffer ownership tracking
+	 * Record the set of netmap buffer indices in the rx ring so they
+	 * can be restored on exit.
+	 */
+	slotindex = 0;
+	do {
+		curslotindex = slotindex;
+		if_netmap_rxslot(q->nm_host_ctx, &slotindex, &unused, &bufindex);
+		q->nm_buffer_indices[curslotindex] = bufindex;
+	} while (slotindex);
+
+	/*
+	 * Zero-copy transmit exchanges buffers between the rx and tx
+	 * rings, so the tx ring has to be restored on exit as well.
+	 */
+	for (slotindex = 0; slotindex < if_netmap_txslots(q->nm_host_ctx); slotindex++)
+		q->nm_tx_buffer_indices[slotindex] = if_netmap_txslotindex(q->nm_host_ctx, slotindex);
+
+	return (0);
+}
+
+
+static void
+if_netmap_queue_destroy(struct if_netmap_queue *q)
+{
+	if (q->nm_buffer_indices)
+		free(q->nm_buffer_indices, M_DEVBUF);
+
+	if (q->nm_tx_buffer_indices)
+		free(q->nm_tx_buffer_indices, M_DEVBUF);
+
+	if (q->tx_held)
+		free(q->tx_held, M_DEVBUF);
+
+	if (q->rx_bufinfo.initialized)
+		if_netmap_bufinfo_pool_destroy(&q->rx_bufinfo);
+
+	if (q->nm_host_ctx)
+		if_netmap_deregister_if(q->nm_host_ctx);
+
+	if (q->fd >= 0)
+		uhi_close(q->fd);
+}
+
+
 int
 if_netmap_attach(struct uinet_if *uif)
 {
 	struct if_netmap_softc *sc = NULL;
-	int fd = -1;
+	struct if_netmap_queue *q;
+	int fd;
 	int error = 0;
-	uint32_t pool_size;
-	uint32_t slotindex, curslotindex;
-	uint32_t bufindex, unused;
-	
+	uint32_t nrings;
+	unsigned int i;
+
 	if (NULL == uif->configstr) {
 		error = EINVAL;
 		goto fail;
@@ -350,39 +568,69 @@ if_netmap_attach(struct uinet_if *uif)
 		goto fail;
 	}
 
-	fd = uhi_open("/dev/netmap", UHI_O_RDWR);
-	if (fd < 0) {
-		printf("/dev/netmap open failed\n");
-		error = ENXIO;
-		goto fail;
-	}
-
-	sc->fd = fd;
 	sc->stop_check_ticks = (IF_NETMAP_THREAD_STOP_CHECK_MS * hz) / 1000;
 	if (sc->stop_check_ticks == 0)
 		sc->stop_check_ticks = 1;
 
-	sc->nm_host_ctx = if_netmap_register_if(sc->fd, sc->host_ifname, sc->isvale, sc->queue);
-	if (NULL == sc->nm_host_ctx) {
-		printf("Failed to register netmap interface\n");
-		error = ENXIO;
-		goto fail;
+	if (sc->allqueues) {
+		fd = uhi_open("/dev/netmap", UHI_O_RDWR);
+		if (fd < 0) {
+			printf("/dev/netmap open failed\n");
+			error = ENXIO;
+			goto fail;
+		}
+
+		error = if_netmap_num_rings(fd, sc->host_ifname, &nrings);
+		uhi_close(fd);
+		if ((0 != error) || (0 == nrings)) {
+			printf("Failed to retrieve ring count for %s\n", sc->host_ifname);
+			error = ENXIO;
+			goto fail;
+		}
+
+		if (nrings > IF_NETMAP_MAX_QUEUES) {
+			printf("Using %u of %u rings on %s\n", IF_NETMAP_MAX_QUEUES, nrings, sc->host_ifname);
+			nrings = IF_NETMAP_MAX_QUEUES;
+		}
+		sc->nqueues = nrings;
+	} else {
+		sc->nqueues = 1;
 	}
 
-	/*
-	 * Limiting the size of the rxring zero-copy context pool to the
-	 * given fraction of the rxring size limits the amount of rxring
-	 * buffers that can be outstanding to the stack via zero-copy at any
-	 * given time as a failure to allocate a zero-copy context in the
-	 * receive loop causes the buffer to be copied to the stack.
-	 */
-	pool_size = (if_netmap_rxslots(sc->nm_host_ctx) * IF_NETMAP_RXRING_ZCOPY_FRAC_NUM) / IF_NETMAP_RXRING_ZCOPY_FRAC_DEN;
-	error = if_netmap_bufinfo_pool_init(&sc->rx_bufinfo, pool_size);
-	if (error != 0) {
-		printf("bufinfo pool init failed\n");
+	sc->queues = malloc(sc->nqueues * sizeof(struct if_netmap_queue), M_DEVBUF, M_WAITOK | M_ZERO);
+	if (NULL == sc->queues) {
+		printf("if_netmap_queue allocation failed\n");
+		error = ENOMEM;
 		goto fail;
 	}
 
+	for (i = 0; i < sc->nqueues; i++) {
+		q = &sc->queues[i];
+
+		q->sc = sc;
+		q->index = i;
+		q->fd = -1;
+		q->qno = sc->allqueues ? i : sc->queue;
+
+		/*
+		 * An explicit cpu list is applied round-robin across the
+		 * rings.  Otherwise, ring threads are placed on consecutive
+		 * cpus in the memory domain of the one the interface was
+		 * created with, starting with that cpu, or left to the
+		 * scheduler.
+		 */
+		if (sc->ncpus > 0)
+			q->cpu = sc->cpus[i % sc->ncpus];
+		else if (uif->cpu >= 0)
+			q->cpu = uinet_cpu_next(uif->cpu, i);
+		else
+			q->cpu = -1;
+
+		error = if_netmap_queue_init(sc, q);
+		if (0 != error)
+			goto fail;
+	}
+
 	if (!sc->isvale) {
 		if (0 != uhi_get_ifaddr(sc->host_ifname, sc->addr)) {
 			printf("failed to find interface address\n");
@@ -391,26 +639,6 @@ if_netmap_attach(struct uinet_if *uif)
 		}
 	}
 
-	sc->nm_buffer_indices = malloc(if_netmap_rxslots(sc->nm_host_ctx) *
-				       sizeof(sc->nm_buffer_indices[0]),
-				       M_DEVBUF, M_WAITOK);
-	if (NULL == sc->nm_buffer_indices) {
-		printf("Failed to alloc buffer index array\n");
-		goto fail;
-	}
-
-	/*
-	 * XXX This goes away when netmap implements buffer ownership tracking
-	 * Record the set of netmap buffer indices in the rx ring so they
-	 * can be restored on exit.
-	 */
-	slotindex = 0;
-	do {
-		curslotindex = slotindex;
-		if_netmap_rxslot(sc->nm_host_ctx, &slotindex, &unused, &bufindex);		
-		sc->nm_buffer_indices[curslotindex] = bufindex;
-	} while (slotindex);
-
 	if (0 != if_netmap_setup_interface(sc)) {
 		error = ENXIO;
 		goto fail;
@@ -424,17 +652,12 @@ if_netmap_attach(struct uinet_if *uif)
 
 fail:
 	if (sc) {
-		if (sc->nm_buffer_indices)
-			free(sc->nm_buffer_indices, M_DEVBUF);
-
-		if (sc->rx_bufinfo.initialized)
-			if_netmap_bufinfo_pool_destroy(&sc->rx_bufinfo);
+		if (sc->queues) {
+			for (i = 0; i < sc->nqueues; i++)
+				if_netmap_queue_destroy(&sc->queues[i]);
 
-		if (sc->nm_host_ctx)
-			if_netmap_deregister_if(sc->nm_host_ctx);
-
-		if (sc->fd >= 0)
-			uhi_close(sc->fd);
+			free(sc->queues, M_DEVBUF);
+		}
 
 		free(sc, M_DEVBUF);
 	}
@@ -458,13 +681,158 @@ static void
 if_netmap_start(struct ifnet *ifp)
 {
 	struct if_netmap_softc *sc = ifp->if_softc;
+	struct if_netmap_queue *q = &sc->queues[0];
+
+	mtx_lock(&q->tx_lock);
+	q->tx_pkts_to_send++;
+	if (q->tx_pkts_to_send == 1) {
+		cv_signal(&q->tx_cv);
+	}
+	mtx_unlock(&q->tx_lock);
+}
+
+
+/*
+ * Multi-queue transmit entry point.  Packets are steered to the ring whose
+ * index matches their flowid, which for TCP is the flowid assigned by the
+ * receive thread of the ring the connection's packets arrive on.
+ */
+static int
+if_netmap_transmit(struct ifnet *ifp, struct mbuf *m)
+{
+	struct if_netmap_softc *sc = ifp->if_softc;
+	struct if_netmap_queue *q;
+
+	if (m->m_flags & M_FLOWID)
+		q = &sc->queues[m->m_pkthdr.flowid % sc->nqueues];
+	else
+		q = &sc->queues[0];
+
+	mtx_lock(&q->tx_lock);
+	if (_IF_QFULL(&q->tx_ifq)) {
+		_IF_DROP(&q->tx_ifq);
+		mtx_unlock(&q->tx_lock);
+		m_freem(m);
+		return (ENOBUFS);
+	}
 
-	mtx_lock(&sc->tx_lock);
-	sc->tx_pkts_to_send++;
-	if (sc->tx_pkts_to_send == 1) {
-		cv_signal(&sc->tx_cv);
+	IF_STAT_ADD(ifp, obytes, m->m_pkthdr.len);
+	if (m->m_flags & (M_BCAST|M_MCAST))
+		IF_STAT_INC(ifp, omcasts);
+
+	_IF_ENQUEUE(&q->tx_ifq, m);
+	q->tx_pkts_to_send++;
+	if (q->tx_pkts_to_send == 1) {
+		cv_signal(&q->tx_cv);
 	}
-	mtx_unlock(&sc->tx_lock);
+	mtx_unlock(&q->tx_lock);
+
+	return (0);
+}
+
+
+static void
+if_netmap_qflush(struct ifnet *ifp)
+{
+	struct if_netmap_softc *sc = ifp->if_softc;
+	struct if_netmap_queue *q;
+	unsigned int i;
+
+	for (i = 0; i < sc->nqueues; i++) {
+		q = &sc->queues[i];
+
+		mtx_lock(&q->tx_lock);
+		_IF_DRAIN(&q->tx_ifq);
+		mtx_unlock(&q->tx_lock);
+	}
+
+	if_qflush(ifp);
+}
+
+
+static struct mbuf *
+if_netmap_txdequeue(struct if_netmap_queue *q)
+{
+	struct mbuf *m;
+
+	if (q->sc->nqueues > 1) {
+		mtx_lock(&q->tx_lock);
+		_IF_DEQUEUE(&q->tx_ifq, m);
+		mtx_unlock(&q->tx_lock);
+	} else {
+		IFQ_DRV_DEQUEUE(&q->sc->ifp->if_snd, m);
+	}
+
+	return (m);
+}
+
+
+/*
+ * Post the given packet to the tx ring without copying it, if possible.
+ * Returns non-zero if the packet was posted, in which case the driver has
+ * assumed ownership of the mbuf.
+ */
+static int
+if_netmap_txzcopy(struct if_netmap_queue *q, struct mbuf *m, uint32_t *cur, u_int pktlen)
+{
+	struct if_netmap_queue *rxq;
+	struct if_netmap_bufinfo *bi;
+
+	if (!IF_NETMAP_TX_ZCOPY || (NULL != m->m_next))
+		return (0);
+
+	if ((m->m_flags & M_EXT) && (if_netmap_free == m->m_ext.ext_free)) {
+		rxq = m->m_ext.ext_arg1;
+		bi = m->m_ext.ext_arg2;
+
+		/*
+		 * The buffer can only be handed to the tx ring if no other
+		 * mbuf refers to it and the packet starts at the beginning
+		 * of the buffer (netmap slots have no data offset).
+		 *
+		 * The buffer that was in the tx slot takes the place of the
+		 * received buffer in the bufinfo, and will be returned to
+		 * the originating rx ring when the mbuf is freed below.
+		 *
+		 * Swaps are confined to the receiving interface.  Physical
+		 * interfaces share netmap's global memory region, but each
+		 * interface only restores its own rings when it is
+		 * detached, so a buffer moved to another interface's rings
+		 * would be left there, or handed out twice.  Packets
+		 * forwarded between interfaces go out via an indirect slot
+		 * or a copy instead.
+		 */
+		if ((rxq->sc == q->sc) &&
+		    (m->m_data == m->m_ext.ext_buf) &&
+		    (1 == *(m->m_ext.ref_cnt))) {
+			bi->nm_index = if_netmap_txswapslot(q->nm_host_ctx, cur, bi->nm_index, pktlen);
+			m_freem(m);
+			return (1);
+		}
+	}
+
+	if (q->tx_indirect) {
+		if_netmap_txsetslotptr(q->nm_host_ctx, cur, mtod(m, void *), pktlen);
+		q->tx_held[q->tx_held_count++] = m;
+		return (1);
+	}
+
+	return (0);
+}
+
+
+/*
+ * Free the mbufs referenced by indirect tx slots.  Only valid after a
+ * txsync has completed.
+ */
+static void
+if_netmap_txrelease(struct if_netmap_queue *q)
+{
+	uint32_t i;
+
+	for (i = 0; i < q->tx_held_count; i++)
+		m_freem(q->tx_held[i]);
+	q->tx_held_count = 0;
 }
 
 
@@ -472,9 +840,10 @@ static void
 if_netmap_send(void *arg)
 {
 	struct mbuf *m;
-	struct if_netmap_softc *sc = (struct if_netmap_softc *)arg;
-	struct ifnet *ifp = sc->ifp;
+	struct if_netmap_queue *q = (struct if_netmap_queue *)arg;
+	struct ifnet *ifp = q->sc->ifp;
 	struct uhi_pollfd pfd;
+	struct uinet_tso tso;
 	uint32_t avail;
 	uint32_t cur;
 	u_int pktlen;
@@ -482,76 +851,131 @@ if_netmap_send(void *arg)
 	int done;
 	int pkts_sent;
 	int poll_wait_ms;
+	int in_tso;
 
-	if (sc->uif->cpu >= 0)
-		sched_bind(sc->tx_thread, sc->uif->cpu);
+	if (q->cpu >= 0)
+		sched_bind(q->tx_thread, q->cpu);
 
 	done = 0;
 	pkts_sent = 0;
 	avail = 0;
-	poll_wait_ms = (sc->tx_thread->td_stop_check_ticks * 1000) / hz;
+	in_tso = 0;
+	poll_wait_ms = (q->tx_thread->td_stop_check_ticks * 1000) / hz;
 	do {
-		mtx_lock(&sc->tx_lock);
-		sc->tx_pkts_to_send -= pkts_sent;
-		while ((sc->tx_pkts_to_send == 0) && !done)
-			if (EWOULDBLOCK == cv_timedwait(&sc->tx_cv, &sc->tx_lock, sc->tx_thread->td_stop_check_ticks))
+		mtx_lock(&q->tx_lock);
+		q->tx_pkts_to_send -= pkts_sent;
+		while ((q->tx_pkts_to_send == 0) && !done)
+			if (EWOULDBLOCK == cv_timedwait(&q->tx_cv, &q->tx_lock, q->tx_thread->td_stop_check_ticks))
 				done = kthread_stop_check();
-		mtx_unlock(&sc->tx_lock);
-	
+		mtx_unlock(&q->tx_lock);
+
 		if (done)
 			break;
 
 		pkts_sent = 0;
 
-		IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+		m = if_netmap_txdequeue(q);
 		while (m) {
+			if (0 == avail && q->tx_held_count) {
+				/*
+				 * Indirect slots must be synced before
+				 * their mbufs can be released and the
+				 * slots reused.
+				 */
+				while (EBUSY == (rv = if_netmap_txsync(q->nm_host_ctx, &avail, &cur)));
+				if_netmap_txrelease(q);
+				avail = if_netmap_txavail(q->nm_host_ctx);
+			}
+
 			while (0 == avail && !done) {
 				memset(&pfd, 0, sizeof(pfd));
 
-				pfd.fd = sc->fd;
+				pfd.fd = q->fd;
 				pfd.events = UHI_POLLOUT;
-				
+
 				rv = uhi_poll(&pfd, 1, poll_wait_ms);
 				if (rv == 0)
-					done = kthread_stop_check();	
+					done = kthread_stop_check();
 				else if (rv == -1)
 					printf("error from poll for transmit\n");
-					
-				avail = if_netmap_txavail(sc->nm_host_ctx);
+
+				avail = if_netmap_txavail(q->nm_host_ctx);
 			}
 
 			if (done || (done = kthread_stop_check()))
 				break;
 
-			cur = if_netmap_txcur(sc->nm_host_ctx);
+			cur = if_netmap_txcur(q->nm_host_ctx);
 
 			while (m && avail) {
-				ifp->if_ocopies++;
-				ifp->if_opackets++;
+				if (m->m_pkthdr.csum_flags & CSUM_TSO) {
+					/*
+					 * Large segment from the stack,
+					 * sliced into frames one slot at a
+					 * time.  It may take more than one
+					 * pass if the ring fills up.
+					 */
+					if (!in_tso) {
+						if (0 != uinet_tso_start(&tso, m)) {
+							IF_STAT_INC(ifp, oerrors);
+							pkts_sent++;
+							m_freem(m);
+							m = if_netmap_txdequeue(q);
+							continue;
+						}
+						in_tso = 1;
+					}
+
+					IF_STAT_INC(ifp, opackets);
+					IF_STAT_INC(ifp, ocopies);
+					avail--;
+
+					pktlen = uinet_tso_seglen(&tso);
+					uinet_tso_build(&tso, if_netmap_txslot(q->nm_host_ctx, &cur, pktlen));
+
+					if (0 == uinet_tso_seglen(&tso)) {
+						in_tso = 0;
+						pkts_sent++;
+						m_freem(m);
+						m = if_netmap_txdequeue(q);
+					}
+					continue;
+				}
+
+				IF_STAT_INC(ifp, opackets);
 
 				avail--;
 				pkts_sent++;
 
+				uinet_tso_txcsum(m);
 				pktlen = m_length(m, NULL);
 
-				m_copydata(m, 0, pktlen,
-					   if_netmap_txslot(sc->nm_host_ctx, &cur, pktlen)); 
-				m_freem(m);
+				if (if_netmap_txzcopy(q, m, &cur, pktlen)) {
+					IF_STAT_INC(ifp, ozcopies);
+				} else {
+					IF_STAT_INC(ifp, ocopies);
+					m_copydata(m, 0, pktlen,
+						   if_netmap_txslot(q->nm_host_ctx, &cur, pktlen));
+					m_freem(m);
+				}
 
-				IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+				m = if_netmap_txdequeue(q);
 			}
 
 		}
 
 		if (pkts_sent) {
-			while (EBUSY == (rv = if_netmap_txsync(sc->nm_host_ctx, &avail, &cur)));
+			while (EBUSY == (rv = if_netmap_txsync(q->nm_host_ctx, &avail, &cur)));
 			if (rv != 0) {
 				printf("could not sync tx descriptors after transmit\n");
 			}
-			avail = if_netmap_txavail(sc->nm_host_ctx);
+			if_netmap_txrelease(q);
+			avail = if_netmap_txavail(q->nm_host_ctx);
 		}
 	} while (!done);
 
+	if_netmap_txrelease(q);
+
 	kthread_stop_ack();
 }
 
@@ -590,43 +1014,43 @@ if_netmap_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
 static void
 if_netmap_free(void *arg1, void *arg2)
 {
-	struct if_netmap_softc *sc;
+	struct if_netmap_queue *q;
 	struct if_netmap_bufinfo *bi;
 
-	sc = (struct if_netmap_softc *)arg1;
+	q = (struct if_netmap_queue *)arg1;
 	bi = (struct if_netmap_bufinfo *)arg2;
 
-	if_netmap_bufinfo_free(&sc->rx_bufinfo, bi);
+	if_netmap_bufinfo_free(&q->rx_bufinfo, bi);
 }
 
 /* Only called from the receive thread */
 static uint32_t
-if_netmap_sweep_trail(struct if_netmap_softc *sc)
+if_netmap_sweep_trail(struct if_netmap_queue *q)
 {
 	struct if_netmap_bufinfo_pool *p;
 	struct if_netmap_bufinfo *bi;
 	uint32_t i;
 	uint32_t returned;
-	unsigned int n;
 
-	i = sc->hw_rx_rsvd_begin;
-	
-	p = &sc->rx_bufinfo;
+	i = q->hw_rx_rsvd_begin;
+
+	p = &q->rx_bufinfo;
 
-	returned = p->returnable;
-	for (n = 0; n < returned; n++) {
-		bi = &p->pool[p->free_list[p->trail]];
-		if_netmap_rxsetslot(sc->nm_host_ctx, &i, bi->nm_index);
+	/*
+	 * Stop at the first entry that has been claimed but not yet
+	 * published, as later entries can't be consumed out of order.
+	 */
+	returned = 0;
+	while (atomic_load_acq_int(&p->seq[p->trail & p->mask]) == p->trail + 1) {
+		bi = &p->pool[p->free_list[p->trail & p->mask]];
+		if_netmap_rxsetslot(q->nm_host_ctx, &i, bi->nm_index);
 		bi->refcnt = 0;
 
 		p->trail++;
-		if (p->trail == p->max) {
-			p->trail = 0;
-		}
+		returned++;
 	}
-	sc->hw_rx_rsvd_begin = i;
+	q->hw_rx_rsvd_begin = i;
 
-	atomic_subtract_int(&p->returnable, returned);
 	p->avail += returned;
 
 	return (returned);
@@ -636,6 +1060,7 @@ if_netmap_sweep_trail(struct if_netmap_softc *sc)
 static void
 if_netmap_receive(void *arg)
 {
+	struct if_netmap_queue *q;
 	struct if_netmap_softc *sc;
 	struct ifnet *ifp;
 	struct uhi_pollfd pfd;
@@ -653,6 +1078,7 @@ if_netmap_receive(void *arg)
 	int rv;
 	int done;
 	int poll_wait_ms;
+	int lro_ok;
 
 
 	/* Zero-copy receive
@@ -678,22 +1104,29 @@ if_netmap_receive(void *arg)
 	 * from the stack but not yet returned to the netmap ring.
 	 */
 
-	sc = (struct if_netmap_softc *)arg;
+	q = (struct if_netmap_queue *)arg;
+	sc = q->sc;
 	ifp = sc->ifp;
 
-	if (sc->uif->cpu >= 0)
-		sched_bind(sc->rx_thread, sc->uif->cpu);
+	if (q->cpu >= 0)
+		sched_bind(q->rx_thread, q->cpu);
+
+	/* Run the timers of the connections we receive between batches */
+	uinet_callout_claim();
 
 	reserved = 0;
-	sc->hw_rx_rsvd_begin = 0;
+	q->hw_rx_rsvd_begin = 0;
+
+	lro_ok = (0 == uinet_lro_init(&q->rx_lro, ifp));
+	uinet_rxbatch_init(&q->rx_batch, ifp, lro_ok ? &q->rx_lro : NULL);
 
 	done = 0;
-	poll_wait_ms = (sc->tx_thread->td_stop_check_ticks * 1000) / hz;
+	poll_wait_ms = (q->rx_thread->td_stop_check_ticks * 1000) / hz;
 	for (;;) {
-		while (!done && (0 == (avail = if_netmap_rxavail(sc->nm_host_ctx)))) {
+		while (!done && (0 == (avail = if_netmap_rxavail(q->nm_host_ctx)))) {
 			memset(&pfd, 0, sizeof pfd);
 
-			pfd.fd = sc->fd;
+			pfd.fd = q->fd;
 			pfd.events = UHI_POLLIN;
 
 			rv = uhi_poll(&pfd, 1, poll_wait_ms);
@@ -706,20 +1139,20 @@ if_netmap_receive(void *arg)
 		if (done || kthread_stop_check())
 			break;
 
-		cur = if_netmap_rxcur(sc->nm_host_ctx);
+		cur = if_netmap_rxcur(q->nm_host_ctx);
 		new_reserved = 0;
 		if (sc->uif->batch_event_handler)
 			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_START);
 		for (n = 0; n < avail; n++) {
-			slotbuf = if_netmap_rxslot(sc->nm_host_ctx, &cur, &pktlen, &slotindex);
+			slotbuf = if_netmap_rxslot(q->nm_host_ctx, &cur, &pktlen, &slotindex);
 
-			ifp->if_ipackets++;
-			ifp->if_ibytes += pktlen;
+			IF_STAT_INC(ifp, ipackets);
+			IF_STAT_ADD(ifp, ibytes, pktlen);
 
-			bi = if_netmap_bufinfo_alloc(&sc->rx_bufinfo, slotindex);
+			bi = if_netmap_bufinfo_alloc(&q->rx_bufinfo, slotindex);
 			if (NULL == bi) {
 				/* copy receive */
-				ifp->if_icopies++;
+				IF_STAT_INC(ifp, icopies);
 
 				/* could streamline this a little since we
 				 * know the data is going to fit in a
@@ -731,15 +1164,15 @@ if_netmap_receive(void *arg)
 				 * reserved trail from prior zero-copy
 				 * activity.
 				 */
-				if_netmap_rxsetslot(sc->nm_host_ctx, &sc->hw_rx_rsvd_begin, slotindex);
+				if_netmap_rxsetslot(q->nm_host_ctx, &q->hw_rx_rsvd_begin, slotindex);
 			} else {
 				/* zero-copy receive */
-				ifp->if_izcopies++;
+				IF_STAT_INC(ifp, izcopies);
 
 				m = m_gethdr(M_DONTWAIT, MT_DATA);
 				if (NULL == m) {
-					if_netmap_bufinfo_unalloc(&sc->rx_bufinfo);
-					if_netmap_rxsetslot(sc->nm_host_ctx, &sc->hw_rx_rsvd_begin, slotindex);
+					if_netmap_bufinfo_unalloc(&q->rx_bufinfo);
+					if_netmap_rxsetslot(q->nm_host_ctx, &q->hw_rx_rsvd_begin, slotindex);
 				} else {
 					/* XXX presumably in this path the
 					 * IP header isn't aligned on a
@@ -751,12 +1184,12 @@ if_netmap_receive(void *arg)
 					 * support 16-bit aligned access to
 					 * 32-bit values.
 					 */
-					
+
 					m->m_pkthdr.len = m->m_len = pktlen;
 					m->m_pkthdr.rcvif = sc->ifp;
 					m->m_ext.ref_cnt = &bi->refcnt;
-					m_extadd(m, slotbuf, if_netmap_rxbufsize(sc->nm_host_ctx),
-						 if_netmap_free, sc, bi, 0, EXT_EXTREF);
+					m_extadd(m, slotbuf, if_netmap_rxbufsize(q->nm_host_ctx),
+						 if_netmap_free, q, bi, 0, EXT_EXTREF);
 
 					new_reserved++;
 				}
@@ -764,33 +1197,86 @@ if_netmap_receive(void *arg)
 			}
 
 			if (m) {
-				sc->ifp->if_input(sc->ifp, m);
+				if (sc->nqueues > 1) {
+					/*
+					 * Tag the packet with the ring it
+					 * arrived on so that transmits for
+					 * the same flow use the same ring.
+					 */
+					m->m_pkthdr.flowid = q->index;
+					m->m_flags |= M_FLOWID;
+				}
+				uinet_rxbatch_input(&q->rx_batch, m);
 			} else {
-				ifp->if_iqdrops++;				
+				IF_STAT_INC(ifp, iqdrops);
 			}
 		}
 
+		uinet_rxbatch_flush(&q->rx_batch);
+
 		if (sc->uif->batch_event_handler)
 			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_FINISH);
 
+		uinet_callout_poll();
+
 		avail = 0;
 		reserved += new_reserved;
 
 		/* Return any netmap buffers freed by the stack to the ring */
-		returned = if_netmap_sweep_trail(sc);
+		returned = if_netmap_sweep_trail(q);
 		reserved -= returned;
 
-		if_netmap_rxupdate(sc->nm_host_ctx, &avail, &cur, &reserved);
+		if_netmap_rxupdate(q->nm_host_ctx, &avail, &cur, &reserved);
 	}
 
+	if (lro_ok)
+		uinet_lro_free(&q->rx_lro);
+
+	uinet_callout_release();
+
 	kthread_stop_ack();
 }
 
 
+static void
+if_netmap_stop_threads(struct if_netmap_softc *sc, unsigned int nqueues)
+{
+	struct if_netmap_queue *q;
+	struct thread_stop_req *tsr;
+	unsigned int i;
+
+	tsr = malloc(2 * nqueues * sizeof(struct thread_stop_req), M_DEVBUF, M_WAITOK);
+
+	for (i = 0; i < nqueues; i++) {
+		q = &sc->queues[i];
+		if (q->rx_thread)
+			kthread_stop(q->rx_thread, &tsr[2 * i]);
+		if (q->tx_thread)
+			kthread_stop(q->tx_thread, &tsr[2 * i + 1]);
+	}
+
+	for (i = 0; i < nqueues; i++) {
+		q = &sc->queues[i];
+		if (q->rx_thread) {
+			kthread_stop_wait(&tsr[2 * i]);
+			q->rx_thread = NULL;
+		}
+		if (q->tx_thread) {
+			kthread_stop_wait(&tsr[2 * i + 1]);
+			q->tx_thread = NULL;
+		}
+	}
+
+	free(tsr, M_DEVBUF);
+}
+
+
 static int
 if_netmap_setup_interface(struct if_netmap_softc *sc)
 {
 	struct ifnet *ifp;
+	struct if_netmap_queue *q;
+	unsigned int i;
 
 	ifp = sc->ifp = if_alloc(IFT_ETHER);
 
@@ -800,109 +1286,125 @@ if_netmap_setup_interface(struct if_netmap_softc *sc)
 	if_initname(ifp, sc->uif->name, IF_DUNIT_NONE);
 	ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST;
 	ifp->if_ioctl = if_netmap_ioctl;
-	ifp->if_start = if_netmap_start;
+	if (sc->nqueues > 1) {
+		ifp->if_transmit = if_netmap_transmit;
+		ifp->if_qflush = if_netmap_qflush;
+	} else {
+		ifp->if_start = if_netmap_start;
+	}
 
 	/* XXX what values? */
-	IFQ_SET_MAXLEN(&ifp->if_snd, if_netmap_txslots(sc->nm_host_ctx));
-	ifp->if_snd.ifq_drv_maxlen = if_netmap_txslots(sc->nm_host_ctx);
+	IFQ_SET_MAXLEN(&ifp->if_snd, if_netmap_txslots(sc->queues[0].nm_host_ctx));
+	ifp->if_snd.ifq_drv_maxlen = if_netmap_txslots(sc->queues[0].nm_host_ctx);
 
 	IFQ_SET_READY(&ifp->if_snd);
 
 	ifp->if_fib = sc->uif->cdom;
 
 	ether_ifattach(ifp, sc->addr);
-	ifp->if_capabilities = ifp->if_capenable = IFCAP_HWSTATS;
+	ifp->if_capabilities = IFCAP_HWSTATS | IFCAP_LRO;
+	ifp->if_capenable = IFCAP_HWSTATS;
+	uinet_tso_attach(ifp);
 
 
-	mtx_init(&sc->tx_lock, "txlk", NULL, MTX_DEF);
-	cv_init(&sc->tx_cv, "txcv");
+	for (i = 0; i < sc->nqueues; i++) {
+		q = &sc->queues[i];
 
-	if (kthread_add(if_netmap_send, sc, NULL, &sc->tx_thread, 0, 0, "nm_tx: %s", ifp->if_xname)) {
-		printf("Could not start transmit thread for %s (%s)\n", ifp->if_xname, sc->host_ifname);
-		ether_ifdetach(ifp);
-		if_free(ifp);
-		return (1);
-	}
+		mtx_init(&q->tx_lock, "txlk", NULL, MTX_DEF);
+		cv_init(&q->tx_cv, "txcv");
+		q->tx_ifq.ifq_maxlen = if_netmap_txslots(q->nm_host_ctx);
 
+		if (kthread_add(if_netmap_send, q, NULL, &q->tx_thread, 0, 0, "nm_tx: %s/%u", ifp->if_xname, q->qno)) {
+			printf("Could not start transmit thread for %s (%s ring %u)\n", ifp->if_xname, sc->host_ifname, q->qno);
+			goto fail;
+		}
 
-	if (kthread_add(if_netmap_receive, sc, NULL, &sc->rx_thread, 0, 0, "nm_rx: %s", ifp->if_xname)) {
-		printf("Could not start receive thread for %s (%s)\n", ifp->if_xname, sc->host_ifname);
-		ether_ifdetach(ifp);
-		if_free(ifp);
-		return (1);
+
+		if (kthread_add(if_netmap_receive, q, NULL, &q->rx_thread, 0, 0, "nm_rx: %s/%u", ifp->if_xname, q->qno)) {
+			printf("Could not start receive thread for %s (%s ring %u)\n", ifp->if_xname, sc->host_ifname, q->qno);
+			goto fail;
+		}
 	}
 
 	return (0);
+
+fail:
+	if_netmap_stop_threads(sc, i + 1);
+	ether_ifdetach(ifp);
+	if_free(ifp);
+	return (1);
 }
 
 
-int
-if_netmap_detach(struct uinet_if *uif)
+/*
+ * XXX This goes away when netmap implements buffer ownership tracking
+ *
+ * Zero-copy receive can result in missing/duplicate buffer indicies in the
+ * receive ring, due to out-of-order return.  During normal operation, this
+ * is fine, as any missing/duplicate buffer indices occur in the
+ * libuinet-reserved range within the ring.  When the netmap fd is closed,
+ * netmap currently blindly frees the buffer in each ring slot, so given
+ * the foregoing, there can be double frees and leaks.
+ *
+ * The following code restores the rings to their post-initialization
+ * state, thereby avoiding the double-free/leak issue.
+ */
+static void
+if_netmap_queue_restore_rings(struct if_netmap_queue *q)
 {
-	struct if_netmap_softc *sc = uif->ifdata;
 	int i, j;
 	uint32_t slotindex;
 	uint32_t unused;
 	uint32_t bufindex, bufindex2;
 	uint32_t ring_size;
-	struct thread_stop_req rx_tsr;
-	struct thread_stop_req tx_tsr;
 
-	if (sc) {
-		printf("%s (%s): Stopping rx thread\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
-		kthread_stop(sc->rx_thread, &rx_tsr);
-		printf("%s (%s): Stopping tx thread\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
-		kthread_stop(sc->tx_thread, &tx_tsr);
+	slotindex = 0;
+	do {
+		if_netmap_rxsetslot(q->nm_host_ctx, &slotindex, q->nm_buffer_indices[slotindex]);
+	} while (slotindex);
 
-		kthread_stop_wait(&rx_tsr);
-		kthread_stop_wait(&tx_tsr);
-		printf("%s (%s): Interface threads stopped\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+	slotindex = 0;
+	do {
+		if_netmap_txswapslot(q->nm_host_ctx, &slotindex,
+				     q->nm_tx_buffer_indices[slotindex], 0);
+	} while (slotindex);
 
-		if (sc->nm_buffer_indices) {
-			/*
-			 * XXX This goes away when netmap implements buffer
-			 * ownership tracking
-			 *
-			 * Zero-copy receive can result in missing/duplicate
-			 * buffer indicies in the receive ring, due to
-			 * out-of-order return.  During normal operation,
-			 * this is fine, as any missing/duplicate buffer
-			 * indices occur in the libuinet-reserved range
-			 * within the ring.  When the netmap fd is closed,
-			 * netmap currently blindly frees the buffer in each
-			 * ring slot, so given the foregoing, there can be
-			 * double frees and leaks.
-			 *
-			 * The following code restores the ring to its
-			 * post-initialization state, thereby avoiding the
-			 * double-free/leak issue.
-			 */
-			slotindex = 0;
-			do {
-				if_netmap_rxsetslot(sc->nm_host_ctx, &slotindex, sc->nm_buffer_indices[slotindex]);
-			} while (slotindex);
-			
-			/* Report any duplicates (there should be none at this point) */
-			ring_size = if_netmap_rxslots(sc->nm_host_ctx);
-			for (i = 0; i < ring_size - 1;) {
-				if_netmap_rxslot(sc->nm_host_ctx, &i, &unused, &bufindex);
-				for (j = i + 1; j < ring_size;) {
-					if_netmap_rxslot(sc->nm_host_ctx, &j, &unused, &bufindex2);
-					if (j ==0) j = ring_size;
-					if (bufindex == bufindex2)
-						printf("Duplicate buffer index %u in slots %u and %u\n", bufindex, i - 1, j - 1);
-				}
-			}
+	/* Report any duplicates (there should be none at this point) */
+	ring_size = if_netmap_rxslots(q->nm_host_ctx);
+	for (i = 0; i < ring_size - 1;) {
+		if_netmap_rxslot(q->nm_host_ctx, &i, &unused, &bufindex);
+		for (j = i + 1; j < ring_size;) {
+			if_netmap_rxslot(q->nm_host_ctx, &j, &unused, &bufindex2);
+			if (j ==0) j = ring_size;
+			if (bufindex == bufindex2)
+				printf("Duplicate buffer index %u in slots %u and %u\n", bufindex, i - 1, j - 1);
 		}
+	}
+}
+
+
+int
+if_netmap_detach(struct uinet_if *uif)
+{
+	struct if_netmap_softc *sc = uif->ifdata;
+	unsigned int i;
+
+	if (sc) {
+		printf("%s (%s): Stopping interface threads\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+		if_netmap_stop_threads(sc, sc->nqueues);
+		printf("%s (%s): Interface threads stopped\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+
+		for (i = 0; i < sc->nqueues; i++)
+			if (sc->queues[i].nm_buffer_indices)
+				if_netmap_queue_restore_rings(&sc->queues[i]);
 
 #if notyet
 		/* XXX ether_ifdetach, stop threads */
 
-		if_netmap_deregister_if(sc->nm_host_ctx);
-		
-		if_netmap_bufinfo_pool_destroy(&sc->rx_bufinfo);
+		for (i = 0; i < sc->nqueues; i++)
+			if_netmap_queue_destroy(&sc->queues[i]);
 
-		uhi_close(sc->fd);
+		free(sc->queues, M_DEVBUF);
 
 		free(sc, M_DEVBUF);
 #endif
@@ -910,5 +1412,3 @@ if_netmap_detach(struct uinet_if *uif)
 
 	return (0);
 }
-
-
@@ -82,6 +82,10 @@
 #define NETMAP_RING_NEXT(r, i) nm_ring_next((r), (i))
 #endif
 
+#if NETMAP_API >= 10 && defined(NS_INDIRECT)
+#define IF_NETMAP_HAVE_INDIRECT
+#endif
+
 struct if_netmap_host_context {
 	int fd;
 	int cfgfd;
@@ -167,6 +171,27 @@ fail:
 }
 
 
+/*
+ * Retrieve the number of hardware rx/tx ring pairs on the given interface.
+ */
+int
+if_netmap_num_rings(int nmfd, const char *ifname, uint32_t *nrings)
+{
+	struct nmreq req;
+
+	memset(&req, 0, sizeof(req));
+	req.nr_version = NETMAP_API;
+	snprintf(req.nr_name, sizeof(req.nr_name), "%s", ifname);
+
+	if (-1 == ioctl(nmfd, NIOCGINFO, &req))
+		return (errno);
+
+	*nrings = (req.nr_rx_rings < req.nr_tx_rings) ? req.nr_rx_rings : req.nr_tx_rings;
+
+	return (0);
+}
+
+
 void
 if_netmap_deregister_if(struct if_netmap_host_context *ctx)
 {
@@ -321,11 +346,84 @@ if_netmap_txslot(struct if_netmap_host_context *ctx, uint32_t *slotno, uint32_t
 	assert(len <= txr->nr_buf_size);
 
 	txr->slot[cur].len = len;
+#ifdef IF_NETMAP_HAVE_INDIRECT
+	txr->slot[cur].flags &= ~NS_INDIRECT;
+#endif
 	*slotno = NETMAP_RING_NEXT(txr, cur); 
 	return (NETMAP_BUF(txr, txr->slot[cur].buf_idx));
 }
 
 
+uint32_t
+if_netmap_txslotindex(struct if_netmap_host_context *ctx, uint32_t slotno)
+{
+	return (ctx->hw_tx_ring->slot[slotno].buf_idx);
+}
+
+
+/*
+ * Place the given netmap buffer in the tx slot, returning the index of the
+ * buffer that was previously there.
+ */
+uint32_t
+if_netmap_txswapslot(struct if_netmap_host_context *ctx, uint32_t *slotno, uint32_t index, uint32_t len)
+{
+	struct netmap_ring *txr = ctx->hw_tx_ring;
+	uint32_t cur = *slotno;
+	uint32_t previndex;
+
+	assert(len <= txr->nr_buf_size);
+
+	previndex = txr->slot[cur].buf_idx;
+	txr->slot[cur].buf_idx = index;
+	txr->slot[cur].len = len;
+#ifdef IF_NETMAP_HAVE_INDIRECT
+	txr->slot[cur].flags &= ~NS_INDIRECT;
+#endif
+	txr->slot[cur].flags |= NS_BUF_CHANGED;
+	*slotno = NETMAP_RING_NEXT(txr, cur);
+
+	return (previndex);
+}
+
+
+/*
+ * Point the tx slot at a buffer outside of netmap memory.  The buffer must
+ * remain valid until the next txsync completes.  Only meaningful when
+ * if_netmap_txindirect() returns non-zero.
+ */
+void
+if_netmap_txsetslotptr(struct if_netmap_host_context *ctx, uint32_t *slotno, const void *buf, uint32_t len)
+{
+	struct netmap_ring *txr = ctx->hw_tx_ring;
+	uint32_t cur = *slotno;
+
+#ifdef IF_NETMAP_HAVE_INDIRECT
+	txr->slot[cur].ptr = (uint64_t)(uintptr_t)buf;
+	txr->slot[cur].len = len;
+	txr->slot[cur].flags |= NS_INDIRECT;
+#else
+	assert(0);
+#endif
+	*slotno = NETMAP_RING_NEXT(txr, cur);
+}
+
+
+/*
+ * Indirect tx slots are only honored by VALE ports, which copy the
+ * referenced data during txsync.
+ */
+int
+if_netmap_txindirect(struct if_netmap_host_context *ctx)
+{
+#ifdef IF_NETMAP_HAVE_INDIRECT
+	return (ctx->isvale);
+#else
+	return (0);
+#endif
+}
+
+
 #if defined(__linux__)
 static int
 if_netmap_ethtool_set_flag(struct if_netmap_host_context *ctx, struct ifreq *ifr, uint32_t flag, int on)
@@ -30,6 +30,7 @@ struct if_netmap_host_context;
 
 struct if_netmap_host_context *if_netmap_register_if(int nmfd, const char *ifname, unsigned int isvale, unsigned int qno);
 void if_netmap_deregister_if(struct if_netmap_host_context *ctx);
+int if_netmap_num_rings(int nmfd, const char *ifname, uint32_t *nrings);
 void if_netmap_rxupdate(struct if_netmap_host_context *ctx, const uint32_t *avail, const uint32_t *cur, const uint32_t *reserved);
 uint32_t if_netmap_rxavail(struct if_netmap_host_context *ctx);
 uint32_t if_netmap_rxcur(struct if_netmap_host_context *ctx);
@@ -43,6 +44,10 @@ uint32_t if_netmap_txavail(struct if_netmap_host_context *ctx);
 uint32_t if_netmap_txcur(struct if_netmap_host_context *ctx);
 uint32_t if_netmap_txslots(struct if_netmap_host_context *ctx);
 void *if_netmap_txslot(struct if_netmap_host_context *ctx, uint32_t *slotno, uint32_t len);
+uint32_t if_netmap_txslotindex(struct if_netmap_host_context *ctx, uint32_t slotno);
+uint32_t if_netmap_txswapslot(struct if_netmap_host_context *ctx, uint32_t *slotno, uint32_t index, uint32_t len);
+void if_netmap_txsetslotptr(struct if_netmap_host_context *ctx, uint32_t *slotno, const void *buf, uint32_t len);
+int if_netmap_txindirect(struct if_netmap_host_context *ctx);
 int if_netmap_set_offload(struct if_netmap_host_context *ctx, int on);
 int if_netmap_set_promisc(struct if_netmap_host_context *ctx, int on);
 
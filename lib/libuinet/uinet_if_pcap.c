@@ -43,12 +43,21 @@
 #include <net/if_tap.h>
 #include <net/if_dl.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp_lro.h>
+
 #include <machine/atomic.h>
 
 #include "uinet_internal.h"
 #include "uinet_host_interface.h"
 #include "uinet_if_pcap.h"
 #include "uinet_if_pcap_host.h"
+#include "uinet_lro.h"
+#include "uinet_rxbatch.h"
+#include "uinet_tso.h"
+
+
+#define IF_PCAP_RX_BATCH	64
 
 
 struct if_pcap_softc {
@@ -63,6 +72,9 @@ struct if_pcap_softc {
 	struct thread *tx_thread;
 	struct thread *rx_thread;
 	struct mtx tx_lock;
+
+	struct lro_ctrl rx_lro;
+	struct uinet_rxbatch rx_batch;
 };
 
 
@@ -208,6 +220,7 @@ if_pcap_send(void *arg)
 	uint8_t copybuf[2048];
 	uint8_t *pkt;
 	unsigned int pktlen;
+	struct uinet_tso tso;
 
 	if (sc->uif->cpu >= 0)
 		sched_bind(sc->tx_thread, sc->uif->cpu);
@@ -222,27 +235,46 @@ if_pcap_send(void *arg)
 	
 		while (!IFQ_DRV_IS_EMPTY(&ifp->if_snd)) {
 			IFQ_DRV_DEQUEUE(&ifp->if_snd, m);
+
+			if (!sc->isfile && (m->m_pkthdr.csum_flags & CSUM_TSO)) {
+				if (0 != uinet_tso_start(&tso, m)) {
+					IF_STAT_INC(ifp, oerrors);
+				} else {
+					while (0 != (pktlen = uinet_tso_seglen(&tso))) {
+						uinet_tso_build(&tso, copybuf);
+						IF_STAT_INC(ifp, opackets);
+						IF_STAT_INC(ifp, ocopies);
+						if (0 != if_pcap_sendpacket(sc->pcap_host_ctx, copybuf, pktlen))
+							IF_STAT_INC(ifp, oerrors);
+					}
+				}
+
+				m_freem(m);
+				continue;
+			}
+
+			uinet_tso_txcsum(m);
 			pktlen = m_length(m, NULL);
 
-			ifp->if_opackets++;
+			IF_STAT_INC(ifp, opackets);
 
 			if (!sc->isfile && (pktlen <= sizeof(copybuf))) {			
 				if (NULL == m->m_next) {
 					/* all in one piece - avoid copy */
 					pkt = mtod(m, uint8_t *);
-					ifp->if_ozcopies++;
+					IF_STAT_INC(ifp, ozcopies);
 				} else {
 					pkt = copybuf;
 					m_copydata(m, 0, pktlen, pkt);
-					ifp->if_ocopies++;
+					IF_STAT_INC(ifp, ocopies);
 				}
 
 				if (0 != if_pcap_sendpacket(sc->pcap_host_ctx, pkt, pktlen))
-					ifp->if_oerrors++;
+					IF_STAT_INC(ifp, oerrors);
 			} else {
 				if (sc->isfile)
 					printf("if_pcap_send: Packet send attempt in file mode\n");
-				ifp->if_oerrors++;
+				IF_STAT_INC(ifp, oerrors);
 			}
 
 			m_freem(m);
@@ -292,7 +324,7 @@ if_pcap_receive_handler(void *ctx, const uint8_t *buf, unsigned int size)
 	m = m_getcl(M_DONTWAIT, MT_DATA, M_PKTHDR);
 
 	if (m == NULL) {
-		ifp->if_iqdrops++;
+		IF_STAT_INC(ifp, iqdrops);
 		return;
 	}
 
@@ -311,9 +343,9 @@ if_pcap_receive_handler(void *ctx, const uint8_t *buf, unsigned int size)
 #pragma GCC diagnostic error "-Wformat-extra-args"
 #endif
 
-	ifp->if_ipackets++;
-	ifp->if_icopies++;
-	sc->ifp->if_input(sc->ifp, m);
+	IF_STAT_INC(ifp, ipackets);
+	IF_STAT_INC(ifp, icopies);
+	uinet_rxbatch_input(&sc->rx_batch, m);
 }
 
 
@@ -321,17 +353,69 @@ static void
 if_pcap_receive(void *arg)
 {
 	struct if_pcap_softc *sc = (struct if_pcap_softc *)arg;
+	struct ifnet *ifp = sc->ifp;
 	int result;
+	int lro_ok;
+	int done;
 
 	if (sc->uif->cpu >= 0)
 		sched_bind(sc->rx_thread, sc->uif->cpu);
 
+	/* Run the timers of the connections we receive between batches */
+	uinet_callout_claim();
+
+	lro_ok = (0 == uinet_lro_init(&sc->rx_lro, ifp));
+	uinet_rxbatch_init(&sc->rx_batch, ifp, lro_ok ? &sc->rx_lro : NULL);
+
+	/*
+	 * In file mode, don't start replaying until the interface has been
+	 * brought up, which gives the application a chance to finish
+	 * configuring the stack.
+	 */
+	done = 0;
 	if (sc->isfile)
-		pause("pcaprx", hz);
+		while (!(sc->ifp->if_drv_flags & IFF_DRV_RUNNING) && !done) {
+			pause("pcaprx", sc->rx_thread->td_stop_check_ticks);
+			done = kthread_stop_check();
+		}
+
+	result = 0;
+	while (!done) {
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_START);
+
+		result = if_pcap_dispatch(sc->pcap_host_ctx, IF_PCAP_RX_BATCH);
+
+		uinet_rxbatch_flush(&sc->rx_batch);
+
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_FINISH);
+
+		uinet_callout_poll();
+
+		/* in file mode, nothing read means end of file */
+		if ((result < 0) || ((0 == result) && sc->isfile))
+			break;
+
+		if (sc->isfile)
+			done = kthread_stop_check();
+	}
+
+	if (lro_ok)
+		uinet_lro_free(&sc->rx_lro);
+
+	uinet_callout_release();
 
-	result = if_pcap_loop(sc->pcap_host_ctx);
-	
 	printf("%s exiting receive thread (%d)\n", sc->uif->name, result);
+
+	/* if_pcap_detach() stops and waits for the thread in file mode */
+	if (sc->isfile) {
+		while (!done) {
+			pause("pcapeof", sc->rx_thread->td_stop_check_ticks);
+			done = kthread_stop_check();
+		}
+		kthread_stop_ack();
+	}
 }
 
 
@@ -359,7 +443,10 @@ if_pcap_setup_interface(struct if_pcap_softc *sc)
 	ifp->if_fib = sc->uif->cdom;
 
 	ether_ifattach(ifp, sc->addr);
-	ifp->if_capabilities = ifp->if_capenable = IFCAP_HWSTATS;
+	ifp->if_capabilities = IFCAP_HWSTATS | IFCAP_LRO;
+	ifp->if_capenable = IFCAP_HWSTATS;
+	if (!sc->isfile)
+		uinet_tso_attach(ifp);
 
 
 	mtx_init(&sc->tx_lock, "txlk", NULL, MTX_DEF);
@@ -387,9 +474,19 @@ int
 if_pcap_detach(struct uinet_if *uif)
 {
 	struct if_pcap_softc *sc = uif->ifdata;
+	struct thread_stop_req tsr;
 
 	if (sc) {
-		/* XXX ether_ifdetach, stop threads */
+		/*
+		 * Only a file-mode receive thread can be stopped; a live one
+		 * may be blocked in the host capture indefinitely.
+		 */
+		if (sc->isfile) {
+			kthread_stop(sc->rx_thread, &tsr);
+			kthread_stop_wait(&tsr);
+		}
+
+		/* XXX ether_ifdetach, stop the other threads */
 
 #if notyet
 		if_pcap_destroy_handle(sc->pcap_host_ctx);
@@ -164,9 +164,9 @@ if_pcap_packet_handler(struct if_pcap_host_context *ctx, const struct pcap_pkthd
 
 
 int
-if_pcap_loop(struct if_pcap_host_context *ctx)
+if_pcap_dispatch(struct if_pcap_host_context *ctx, int cnt)
 {
-	return pcap_loop(ctx->p, -1, (pcap_handler)if_pcap_packet_handler, (unsigned char *)ctx);
+	return pcap_dispatch(ctx->p, cnt, (pcap_handler)if_pcap_packet_handler, (unsigned char *)ctx);
 }
 
 
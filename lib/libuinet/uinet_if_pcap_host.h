@@ -33,6 +33,6 @@ typedef void (*if_pcap_handler)(void *ctx, const uint8_t *buf, unsigned int size
 struct if_pcap_host_context *if_pcap_create_handle(const char *ifname, unsigned int isfile, if_pcap_handler handler, void *handlerarg);
 void if_pcap_destroy_handle(struct if_pcap_host_context *ctx);
 int if_pcap_sendpacket(struct if_pcap_host_context *ctx, const uint8_t *buf, unsigned int size);
-int if_pcap_loop(struct if_pcap_host_context *ctx);
+int if_pcap_dispatch(struct if_pcap_host_context *ctx, int cnt);
 
 #endif /* _UINET_IF_PCAP_HOST_H_ */
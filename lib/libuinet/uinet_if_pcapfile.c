@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <sys/ctype.h>
+#include <sys/dirent.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/module.h>
+#include <sys/kernel.h>
+#include <sys/proc.h>
+#include <sys/kthread.h>
+#include <sys/sched.h>
+#include <sys/sockio.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/if_types.h>
+#include <net/ethernet.h>
+#include <net/if_arp.h>
+#include <net/if_tap.h>
+#include <net/if_dl.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp_lro.h>
+
+#include <machine/atomic.h>
+
+#include "uinet_internal.h"
+#include "uinet_host_interface.h"
+#include "uinet_if_pcapfile.h"
+#include "uinet_if_pcapfile_host.h"
+#include "uinet_lro.h"
+#include "uinet_rxbatch.h"
+
+
+#define IF_PCAPFILE_DEFAULT_BATCH	64
+#define IF_PCAPFILE_MAX_BATCH		65536
+
+
+struct if_pcapfile_softc {
+	struct ifnet *ifp;
+	const struct uinet_if *uif;
+	uint8_t addr[ETHER_ADDR_LEN];
+	char filename[MAXNAMLEN];
+	unsigned int batch_size;
+	int realtime;
+	int vclock;
+
+	struct if_pcapfile_host_context *host_ctx;
+
+	/*
+	 * Reference count shared by every mbuf that has file data attached
+	 * to it, plus one held by the driver.  The file is unmapped when it
+	 * drops to zero.
+	 */
+	volatile u_int ext_refcnt;
+
+	struct thread *rx_thread;
+	struct lro_ctrl rx_lro;
+	struct uinet_rxbatch rx_batch;
+};
+
+
+static int if_pcapfile_setup_interface(struct if_pcapfile_softc *sc);
+
+
+static unsigned int interface_count;
+
+
+/*
+ *  The configstr is <filename>[:batch=<n>][:realtime][:vclock].  Options
+ *  are only recognized at the end of the string, so filenames containing
+ *  ':' work as long as they don't end in something that looks like an
+ *  option.
+ */
+static int
+if_pcapfile_process_configstr(struct if_pcapfile_softc *sc)
+{
+	char *configstr;
+	char *p;
+	char *endp;
+	unsigned long val;
+	int error = 0;
+
+	configstr = strdup(sc->uif->configstr, M_DEVBUF);
+
+	sc->batch_size = IF_PCAPFILE_DEFAULT_BATCH;
+	sc->realtime = 0;
+	sc->vclock = 0;
+
+	while (NULL != (p = strrchr(configstr, ':'))) {
+		if (0 == strcmp(p + 1, "realtime")) {
+			sc->realtime = 1;
+		} else if (0 == strcmp(p + 1, "vclock")) {
+			sc->vclock = 1;
+		} else if (0 == strncmp(p + 1, "batch=", 6)) {
+			val = strtoul(p + 7, &endp, 10);
+			if ((p[7] == '\0') || (*endp != '\0') ||
+			    (val == 0) || (val > IF_PCAPFILE_MAX_BATCH)) {
+				error = EINVAL;
+				goto out;
+			}
+			sc->batch_size = val;
+		} else
+			break;
+
+		*p = '\0';
+	}
+
+	if ('\0' == configstr[0]) {
+		error = EINVAL;
+		goto out;
+	}
+
+	if (strlen(configstr) > (sizeof(sc->filename) - 1)) {
+		error = ENAMETOOLONG;
+		goto out;
+	}
+
+	strcpy(sc->filename, configstr);
+
+out:
+	free(configstr, M_DEVBUF);
+
+	return (error);
+}
+
+
+int
+if_pcapfile_attach(struct uinet_if *uif)
+{
+	struct if_pcapfile_softc *sc = NULL;
+	int error = 0;
+
+	if (NULL == uif->configstr) {
+		error = EINVAL;
+		goto fail;
+	}
+
+	printf("configstr is %s\n", uif->configstr);
+
+	snprintf(uif->name, sizeof(uif->name), "pcapfile%u", interface_count);
+	interface_count++;
+
+	sc = malloc(sizeof(struct if_pcapfile_softc), M_DEVBUF, M_WAITOK);
+	if (NULL == sc) {
+		printf("if_pcapfile_softc allocation failed\n");
+		error = ENOMEM;
+		goto fail;
+	}
+	memset(sc, 0, sizeof(struct if_pcapfile_softc));
+
+	sc->uif = uif;
+
+	error = if_pcapfile_process_configstr(sc);
+	if (0 != error) {
+		goto fail;
+	}
+
+	sc->host_ctx = if_pcapfile_create_handle(sc->filename);
+	if (NULL == sc->host_ctx) {
+		printf("Failed to open capture file %s\n", sc->filename);
+		error = ENXIO;
+		goto fail;
+	}
+	sc->ext_refcnt = 1;
+
+	if (0 != if_pcapfile_setup_interface(sc)) {
+		error = ENXIO;
+		goto fail;
+	}
+
+	uif->ifindex = sc->ifp->if_index;
+	uif->ifdata = sc;
+	uif->ifp = sc->ifp;
+
+	return (0);
+
+fail:
+	if (sc) {
+		if (sc->host_ctx)
+			if_pcapfile_destroy_handle(sc->host_ctx);
+
+		free(sc, M_DEVBUF);
+	}
+
+	return (error);
+}
+
+
+static void
+if_pcapfile_init(void *arg)
+{
+	struct if_pcapfile_softc *sc = arg;
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags |= IFF_DRV_RUNNING;
+	ifp->if_drv_flags &= ~IFF_DRV_OACTIVE;
+}
+
+
+/*
+ * There is nowhere to send packets to, so anything the stack transmits is
+ * dropped.
+ */
+static void
+if_pcapfile_start(struct ifnet *ifp)
+{
+	struct mbuf *m;
+
+	for (;;) {
+		IFQ_DEQUEUE(&ifp->if_snd, m);
+		if (NULL == m)
+			break;
+
+		IF_STAT_INC(ifp, oerrors);
+		m_freem(m);
+	}
+}
+
+
+static void
+if_pcapfile_stop(struct if_pcapfile_softc *sc)
+{
+	struct ifnet *ifp = sc->ifp;
+
+	ifp->if_drv_flags &= ~(IFF_DRV_RUNNING|IFF_DRV_OACTIVE);
+}
+
+
+static int
+if_pcapfile_ioctl(struct ifnet *ifp, u_long cmd, caddr_t data)
+{
+	int error = 0;
+	struct if_pcapfile_softc *sc = ifp->if_softc;
+
+	switch (cmd) {
+	case SIOCSIFFLAGS:
+		if (ifp->if_flags & IFF_UP)
+			if_pcapfile_init(sc);
+		else if (ifp->if_drv_flags & IFF_DRV_RUNNING)
+			if_pcapfile_stop(sc);
+		break;
+	default:
+		error = ether_ioctl(ifp, cmd, data);
+		break;
+	}
+
+	return (error);
+}
+
+
+/* This may be called from arbitrary threads */
+static void
+if_pcapfile_free(void *arg1, void *arg2)
+{
+	struct if_pcapfile_softc *sc = (struct if_pcapfile_softc *)arg1;
+
+	if_pcapfile_destroy_handle(sc->host_ctx);
+	sc->host_ctx = NULL;
+}
+
+
+static void
+if_pcapfile_report(struct if_pcapfile_softc *sc, uint64_t packets, uint64_t bytes, uint64_t elapsed_ns)
+{
+	uint64_t pps;
+	uint64_t mbps;
+
+	if (0 == elapsed_ns)
+		elapsed_ns = 1;
+
+	pps = (packets * 1000000000ULL) / elapsed_ns;
+	mbps = (bytes * 8000ULL) / elapsed_ns;
+
+	printf("%s (%s): replayed %llu packets, %llu bytes in %llu.%03llu s (%llu pps, %llu Mbps)\n",
+	       sc->uif->name, sc->uif->alias[0] != '\0' ? sc->uif->alias : "",
+	       (unsigned long long)packets, (unsigned long long)bytes,
+	       (unsigned long long)(elapsed_ns / 1000000000ULL),
+	       (unsigned long long)((elapsed_ns % 1000000000ULL) / 1000000ULL),
+	       (unsigned long long)pps, (unsigned long long)mbps);
+}
+
+
+static void
+if_pcapfile_receive(void *arg)
+{
+	struct if_pcapfile_softc *sc = (struct if_pcapfile_softc *)arg;
+	struct ifnet *ifp = sc->ifp;
+	struct mbuf *m;
+	const uint8_t *pkt;
+	uint32_t pktlen;
+	uint64_t timestamp;
+	uint64_t now;
+	uint64_t start;
+	uint64_t last_delivery;
+	uint64_t last_timestamp;
+	uint64_t packets;
+	uint64_t bytes;
+	unsigned int n;
+	int result;
+	int done;
+	int vclock;
+	int lro_ok;
+
+	if (sc->uif->cpu >= 0)
+		sched_bind(sc->rx_thread, sc->uif->cpu);
+
+	lro_ok = (0 == uinet_lro_init(&sc->rx_lro, ifp));
+	uinet_rxbatch_init(&sc->rx_batch, ifp, lro_ok ? &sc->rx_lro : NULL);
+
+	/*
+	 * Don't start replaying until the interface has been brought up,
+	 * which gives the application a chance to finish configuring the
+	 * stack.
+	 */
+	done = 0;
+	while (!(ifp->if_drv_flags & IFF_DRV_RUNNING) && !done) {
+		pause("pcapwt", sc->rx_thread->td_stop_check_ticks);
+		done = kthread_stop_check();
+	}
+
+	vclock = sc->vclock && !done;
+	if (vclock)
+		uinet_vclock_enable();
+
+	packets = 0;
+	bytes = 0;
+	last_delivery = 0;
+	last_timestamp = 0;
+	result = 1;
+	start = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+	while (!done && (1 == result)) {
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_START);
+
+		for (n = 0; n < sc->batch_size; n++) {
+			result = if_pcapfile_next(sc->host_ctx, &pkt, &pktlen, &timestamp);
+			if (1 != result)
+				break;
+
+			if (sc->realtime) {
+				now = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+				if ((0 != last_delivery) &&
+				    (now - last_delivery < timestamp - last_timestamp))
+					uhi_nanosleep((timestamp - last_timestamp) - (now - last_delivery));
+
+				last_delivery = now;
+				last_timestamp = timestamp;
+			}
+
+			/*
+			 * Run any timers that expire before this packet,
+			 * after delivering the packets that precede it.
+			 */
+			if (vclock) {
+				uinet_rxbatch_flush(&sc->rx_batch);
+				uinet_vclock_advance(timestamp);
+			}
+
+			packets++;
+			bytes += pktlen;
+			IF_STAT_INC(ifp, ipackets);
+			IF_STAT_ADD(ifp, ibytes, pktlen);
+
+			m = m_gethdr(M_DONTWAIT, MT_DATA);
+			if (NULL == m) {
+				IF_STAT_INC(ifp, iqdrops);
+				continue;
+			}
+
+			/*
+			 * The packet data is attached in place.  m_extadd()
+			 * would reset the shared reference count, so the
+			 * external storage is set up by hand.
+			 */
+			atomic_add_int(&sc->ext_refcnt, 1);
+			m->m_flags |= M_EXT | M_RDONLY;
+			m->m_ext.ext_buf = __DECONST(caddr_t, pkt);
+			m->m_ext.ext_size = pktlen;
+			m->m_ext.ext_free = if_pcapfile_free;
+			m->m_ext.ext_arg1 = sc;
+			m->m_ext.ext_arg2 = NULL;
+			m->m_ext.ref_cnt = __DEVOLATILE(u_int *, &sc->ext_refcnt);
+			m->m_ext.ext_type = EXT_EXTREF;
+			m->m_data = m->m_ext.ext_buf;
+			m->m_len = m->m_pkthdr.len = pktlen;
+			m->m_pkthdr.rcvif = ifp;
+
+			IF_STAT_INC(ifp, izcopies);
+			uinet_rxbatch_input(&sc->rx_batch, m);
+		}
+
+		uinet_rxbatch_flush(&sc->rx_batch);
+
+		if (sc->uif->batch_event_handler)
+			sc->uif->batch_event_handler(sc->uif->batch_event_handler_arg, UINET_BATCH_EVENT_FINISH);
+
+		done = kthread_stop_check();
+	}
+
+	if (-1 == result)
+		printf("%s: %s is malformed, stopping replay\n", sc->uif->name, sc->filename);
+
+	if_pcapfile_report(sc, packets, bytes, uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) - start);
+
+	if (vclock)
+		uinet_vclock_disable();
+
+	if (lro_ok)
+		uinet_lro_free(&sc->rx_lro);
+
+	while (!done) {
+		pause("pcapeof", sc->rx_thread->td_stop_check_ticks);
+		done = kthread_stop_check();
+	}
+
+	kthread_stop_ack();
+}
+
+
+static int
+if_pcapfile_setup_interface(struct if_pcapfile_softc *sc)
+{
+	struct ifnet *ifp;
+
+	ifp = sc->ifp = if_alloc(IFT_ETHER);
+
+	ifp->if_init =  if_pcapfile_init;
+	ifp->if_softc = sc;
+
+	if_initname(ifp, sc->uif->name, IF_DUNIT_NONE);
+	ifp->if_flags = IFF_BROADCAST | IFF_SIMPLEX | IFF_MULTICAST;
+	ifp->if_ioctl = if_pcapfile_ioctl;
+	ifp->if_start = if_pcapfile_start;
+
+	IFQ_SET_MAXLEN(&ifp->if_snd, 128);
+	ifp->if_snd.ifq_drv_maxlen = 128;
+
+	IFQ_SET_READY(&ifp->if_snd);
+
+	ifp->if_fib = sc->uif->cdom;
+
+	ether_ifattach(ifp, sc->addr);
+	ifp->if_capabilities = IFCAP_HWSTATS | IFCAP_LRO;
+	ifp->if_capenable = IFCAP_HWSTATS;
+
+	if (kthread_add(if_pcapfile_receive, sc, NULL, &sc->rx_thread, 0, 0, "pcapfile_rx: %s", ifp->if_xname)) {
+		printf("Could not start receive thread for %s (%s)\n", ifp->if_xname, sc->filename);
+		ether_ifdetach(ifp);
+		if_free(ifp);
+		return (1);
+	}
+
+	return (0);
+}
+
+
+int
+if_pcapfile_detach(struct uinet_if *uif)
+{
+	struct if_pcapfile_softc *sc = uif->ifdata;
+	struct thread_stop_req tsr;
+
+	if (sc) {
+		printf("%s (%s): Stopping rx thread\n", uif->name, uif->alias[0] != '\0' ? uif->alias : "");
+		kthread_stop(sc->rx_thread, &tsr);
+		kthread_stop_wait(&tsr);
+
+#if notyet
+		/* XXX ether_ifdetach */
+
+		/*
+		 * Drop the driver's reference to the file mapping.  XXX
+		 * mbufs still in the stack reference the softc.
+		 */
+		if (1 == atomic_fetchadd_int(&sc->ext_refcnt, -1)) {
+			if_pcapfile_free(sc, NULL);
+			free(sc, M_DEVBUF);
+		}
+#endif
+	}
+
+	return (0);
+}
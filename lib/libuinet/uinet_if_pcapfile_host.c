@@ -0,0 +1,457 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+#if defined(__linux__)
+/*
+ * To expose madvise() in sys/mman.h.
+ */
+#define _GNU_SOURCE
+#endif /* __linux__ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uinet_if_pcapfile_host.h"
+
+
+#define PCAP_MAGIC_US		0xa1b2c3d4
+#define PCAP_MAGIC_NS		0xa1b23c4d
+#define PCAP_HDR_LEN		24
+#define PCAP_REC_HDR_LEN	16
+
+#define PCAPNG_BT_SHB		0x0a0d0d0a
+#define PCAPNG_BT_IDB		0x00000001
+#define PCAPNG_BT_PB		0x00000002
+#define PCAPNG_BT_SPB		0x00000003
+#define PCAPNG_BT_EPB		0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC	0x1a2b3c4d
+#define PCAPNG_OPT_ENDOFOPT	0
+#define PCAPNG_OPT_IF_TSRESOL	9
+
+#define LINKTYPE_ETHERNET	1
+
+#define IF_PCAPFILE_MAX_INTERFACES	256
+
+
+struct if_pcapfile_interface {
+	uint16_t linktype;
+	uint32_t snaplen;
+	uint8_t tsresol;	/* as encoded in the if_tsresol option */
+};
+
+
+struct if_pcapfile_host_context {
+	uint8_t *map;
+	size_t size;
+	size_t offset;
+
+	int isng;
+	int swapped;
+
+	/* pcap */
+	uint32_t pcap_linktype;
+	uint64_t pcap_tsfrac_mult;
+
+	/* pcapng */
+	unsigned int num_interfaces;
+	struct if_pcapfile_interface interfaces[IF_PCAPFILE_MAX_INTERFACES];
+
+	uint64_t last_timestamp;
+};
+
+
+static inline uint16_t
+rd16(const struct if_pcapfile_host_context *ctx, const uint8_t *p)
+{
+	uint16_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (ctx->swapped ? __builtin_bswap16(v) : v);
+}
+
+
+static inline uint32_t
+rd32(const struct if_pcapfile_host_context *ctx, const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return (ctx->swapped ? __builtin_bswap32(v) : v);
+}
+
+
+static int
+if_pcapfile_open_pcap(struct if_pcapfile_host_context *ctx, uint32_t magic)
+{
+	if (ctx->size < PCAP_HDR_LEN)
+		return (-1);
+
+	switch (magic) {
+	case PCAP_MAGIC_US:
+		ctx->pcap_tsfrac_mult = 1000;
+		break;
+	case PCAP_MAGIC_NS:
+		ctx->pcap_tsfrac_mult = 1;
+		break;
+	default:
+		return (-1);
+	}
+
+	ctx->pcap_linktype = rd32(ctx, &ctx->map[20]) & 0x0fffffff;
+	if (LINKTYPE_ETHERNET != ctx->pcap_linktype) {
+		printf("Link type of pcap file is %u, only %u supported\n", ctx->pcap_linktype, LINKTYPE_ETHERNET);
+		return (-1);
+	}
+
+	ctx->offset = PCAP_HDR_LEN;
+
+	return (0);
+}
+
+
+static int
+if_pcapfile_next_pcap(struct if_pcapfile_host_context *ctx, const uint8_t **buf, uint32_t *caplen, uint64_t *timestamp)
+{
+	const uint8_t *rec;
+	uint32_t len;
+
+	if (ctx->size - ctx->offset < PCAP_REC_HDR_LEN)
+		return (0);
+
+	rec = &ctx->map[ctx->offset];
+	len = rd32(ctx, &rec[8]);
+	if (ctx->size - ctx->offset - PCAP_REC_HDR_LEN < len) {
+		/* truncated final record */
+		return (0);
+	}
+
+	*buf = rec + PCAP_REC_HDR_LEN;
+	*caplen = len;
+	*timestamp = (uint64_t)rd32(ctx, &rec[0]) * 1000000000ULL + (uint64_t)rd32(ctx, &rec[4]) * ctx->pcap_tsfrac_mult;
+
+	ctx->offset += PCAP_REC_HDR_LEN + len;
+
+	return (1);
+}
+
+
+static uint64_t
+if_pcapfile_ng_timestamp(const struct if_pcapfile_interface *ifc, uint64_t ts)
+{
+	uint64_t div;
+	unsigned int exp;
+
+	exp = ifc->tsresol & 0x7f;
+	if (ifc->tsresol & 0x80) {
+		/* units of 2^-exp seconds */
+		if (exp > 32) {
+			ts >>= (exp - 32);
+			exp = 32;
+		}
+		return ((ts >> exp) * 1000000000ULL + (((ts & ((1ULL << exp) - 1)) * 1000000000ULL) >> exp));
+	}
+
+	/* units of 10^-exp seconds */
+	div = 1;
+	if (exp <= 9) {
+		while (exp++ < 9)
+			div *= 10;
+		return (ts * div);
+	}
+
+	while (exp-- > 9)
+		div *= 10;
+	return (ts / div);
+}
+
+
+static void
+if_pcapfile_ng_add_interface(struct if_pcapfile_host_context *ctx, const uint8_t *body, uint32_t bodylen)
+{
+	struct if_pcapfile_interface *ifc;
+	uint32_t optoff;
+	uint16_t optcode;
+	uint16_t optlen;
+
+	if ((ctx->num_interfaces == IF_PCAPFILE_MAX_INTERFACES) || (bodylen < 8))
+		return;
+
+	ifc = &ctx->interfaces[ctx->num_interfaces++];
+	ifc->linktype = rd16(ctx, &body[0]);
+	ifc->snaplen = rd32(ctx, &body[4]);
+	ifc->tsresol = 6;
+
+	optoff = 8;
+	while (bodylen - optoff >= 4) {
+		optcode = rd16(ctx, &body[optoff]);
+		optlen = rd16(ctx, &body[optoff + 2]);
+		optoff += 4;
+
+		if ((PCAPNG_OPT_ENDOFOPT == optcode) || (bodylen - optoff < optlen))
+			break;
+
+		if ((PCAPNG_OPT_IF_TSRESOL == optcode) && (optlen >= 1))
+			ifc->tsresol = body[optoff];
+
+		optoff += (optlen + 3) & ~3;
+		if (optoff > bodylen)
+			break;
+	}
+}
+
+
+static int
+if_pcapfile_ng_section(struct if_pcapfile_host_context *ctx)
+{
+	const uint8_t *blk = &ctx->map[ctx->offset];
+	uint32_t bom;
+
+	if (ctx->size - ctx->offset < 28)
+		return (-1);
+
+	memcpy(&bom, &blk[8], sizeof(bom));
+	if (PCAPNG_BYTE_ORDER_MAGIC == bom)
+		ctx->swapped = 0;
+	else if (PCAPNG_BYTE_ORDER_MAGIC == __builtin_bswap32(bom))
+		ctx->swapped = 1;
+	else
+		return (-1);
+
+	/* interface ids are scoped to the section */
+	ctx->num_interfaces = 0;
+
+	return (0);
+}
+
+
+static int
+if_pcapfile_next_pcapng(struct if_pcapfile_host_context *ctx, const uint8_t **buf, uint32_t *caplen, uint64_t *timestamp)
+{
+	const struct if_pcapfile_interface *ifc;
+	const uint8_t *blk;
+	const uint8_t *body;
+	uint32_t type;
+	uint32_t blklen;
+	uint32_t bodylen;
+	uint32_t ifid;
+	uint32_t len;
+	uint64_t ts;
+
+	for (;;) {
+		if (ctx->size - ctx->offset < 12)
+			return (0);
+
+		blk = &ctx->map[ctx->offset];
+
+		type = rd32(ctx, &blk[0]);
+		if (PCAPNG_BT_SHB == type) {
+			if (0 != if_pcapfile_ng_section(ctx))
+				return (-1);
+		}
+
+		blklen = rd32(ctx, &blk[4]);
+		if ((blklen < 12) || (blklen & 3))
+			return (-1);
+		if (ctx->size - ctx->offset < blklen) {
+			/* truncated final block */
+			return (0);
+		}
+
+		ctx->offset += blklen;
+
+		body = &blk[8];
+		bodylen = blklen - 12;
+
+		switch (type) {
+		case PCAPNG_BT_IDB:
+			if_pcapfile_ng_add_interface(ctx, body, bodylen);
+			continue;
+		case PCAPNG_BT_EPB:
+			if (bodylen < 20)
+				continue;
+			ifid = rd32(ctx, &body[0]);
+			ts = ((uint64_t)rd32(ctx, &body[4]) << 32) | rd32(ctx, &body[8]);
+			len = rd32(ctx, &body[12]);
+			body += 20;
+			bodylen -= 20;
+			break;
+		case PCAPNG_BT_PB:
+			if (bodylen < 20)
+				continue;
+			ifid = rd16(ctx, &body[0]);
+			ts = ((uint64_t)rd32(ctx, &body[4]) << 32) | rd32(ctx, &body[8]);
+			len = rd32(ctx, &body[12]);
+			body += 20;
+			bodylen -= 20;
+			break;
+		case PCAPNG_BT_SPB:
+			if (bodylen < 4)
+				continue;
+			ifid = 0;
+			ts = 0;
+			len = rd32(ctx, &body[0]);
+			body += 4;
+			bodylen -= 4;
+			break;
+		default:
+			continue;
+		}
+
+		if (ifid >= ctx->num_interfaces)
+			continue;
+
+		ifc = &ctx->interfaces[ifid];
+		if (len > bodylen) {
+			if (PCAPNG_BT_SPB != type)
+				continue;
+
+			/*
+			 * The SPB length is the original packet length, the
+			 * captured length is implied by the snap length.
+			 */
+			len = bodylen;
+			if ((0 != ifc->snaplen) && (ifc->snaplen < len))
+				len = ifc->snaplen;
+		}
+
+		if (LINKTYPE_ETHERNET != ifc->linktype)
+			continue;
+
+		*buf = body;
+		*caplen = len;
+		if (PCAPNG_BT_SPB == type)
+			*timestamp = ctx->last_timestamp;
+		else
+			*timestamp = ctx->last_timestamp = if_pcapfile_ng_timestamp(ifc, ts);
+
+		return (1);
+	}
+}
+
+
+struct if_pcapfile_host_context *
+if_pcapfile_create_handle(const char *filename)
+{
+	struct if_pcapfile_host_context *ctx;
+	struct stat st;
+	uint32_t magic;
+	void *map;
+	int fd = -1;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (NULL == ctx)
+		goto fail;
+
+	fd = open(filename, O_RDONLY);
+	if (-1 == fd) {
+		printf("Could not open %s (%d)\n", filename, errno);
+		goto fail;
+	}
+
+	if (-1 == fstat(fd, &st))
+		goto fail;
+
+	if (st.st_size < 4) {
+		printf("%s is too short to be a capture file\n", filename);
+		goto fail;
+	}
+
+	/*
+	 * The mapping is private and writable because the stack rewrites
+	 * some header fields in place during input processing.  Pages that
+	 * are never written are never copied.
+	 */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == map) {
+		printf("Could not map %s (%d)\n", filename, errno);
+		goto fail;
+	}
+	close(fd);
+	fd = -1;
+
+	ctx->map = map;
+	ctx->size = st.st_size;
+
+	madvise(map, ctx->size, MADV_SEQUENTIAL);
+	madvise(map, ctx->size, MADV_WILLNEED);
+
+	memcpy(&magic, ctx->map, sizeof(magic));
+	if (PCAPNG_BT_SHB == magic) {
+		ctx->isng = 1;
+		if (0 != if_pcapfile_ng_section(ctx))
+			goto bad_format;
+	} else if ((PCAP_MAGIC_US == magic) || (PCAP_MAGIC_NS == magic)) {
+		if (0 != if_pcapfile_open_pcap(ctx, magic))
+			goto bad_format;
+	} else if ((PCAP_MAGIC_US == __builtin_bswap32(magic)) || (PCAP_MAGIC_NS == __builtin_bswap32(magic))) {
+		ctx->swapped = 1;
+		if (0 != if_pcapfile_open_pcap(ctx, __builtin_bswap32(magic)))
+			goto bad_format;
+	} else
+		goto bad_format;
+
+	return (ctx);
+
+bad_format:
+	printf("%s is not a supported pcap or pcapng file\n", filename);
+fail:
+	if (-1 != fd)
+		close(fd);
+
+	if (ctx) {
+		if (ctx->map)
+			munmap(ctx->map, ctx->size);
+		free(ctx);
+	}
+
+	return (NULL);
+}
+
+
+void
+if_pcapfile_destroy_handle(struct if_pcapfile_host_context *ctx)
+{
+	munmap(ctx->map, ctx->size);
+	free(ctx);
+}
+
+
+int
+if_pcapfile_next(struct if_pcapfile_host_context *ctx, const uint8_t **buf, uint32_t *caplen, uint64_t *timestamp)
+{
+	if (ctx->isng)
+		return (if_pcapfile_next_pcapng(ctx, buf, caplen, timestamp));
+	else
+		return (if_pcapfile_next_pcap(ctx, buf, caplen, timestamp));
+}
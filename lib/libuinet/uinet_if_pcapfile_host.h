@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _UINET_IF_PCAPFILE_HOST_H_
+#define _UINET_IF_PCAPFILE_HOST_H_
+
+struct if_pcapfile_host_context;
+
+struct if_pcapfile_host_context *if_pcapfile_create_handle(const char *filename);
+void if_pcapfile_destroy_handle(struct if_pcapfile_host_context *ctx);
+
+/*
+ * Returns 1 and the next packet's data, captured length, and timestamp in
+ * nanoseconds, 0 at end of file, or -1 if the file is malformed.  The
+ * packet data remains valid until the handle is destroyed.
+ */
+int if_pcapfile_next(struct if_pcapfile_host_context *ctx, const uint8_t **buf, uint32_t *caplen, uint64_t *timestamp);
+
+#endif /* _UINET_IF_PCAPFILE_HOST_H_ */
@@ -43,7 +43,6 @@
 #include <vm/vm.h>
 #include <vm/vm_page.h>
 #include <vm/uma.h>
-#include <vm/uma_int.h>
 
 #include "uinet_internal.h"
 #include "uinet_host_interface.h"
@@ -72,14 +71,39 @@ static struct thread *at_least_one_sighandling_thread;
 static struct uhi_msg shutdown_helper_msg;
 struct uinet_instance uinst0;
 
+void
+uinet_default_cfg(struct uinet_global_cfg *cfg)
+{
+	cfg->ncpus = 1;
+	cfg->nmbclusters = 128*1024;
+	cfg->hz = HZ;
+	cfg->hugepages = 0;
+}
+
+
 int
-uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_cfg *inst_cfg)
+uinet_init(struct uinet_global_cfg *cfg, struct uinet_instance_cfg *inst_cfg)
 {
+	struct uinet_global_cfg default_cfg;
 	struct thread *td;
 	char tmpbuf[32];
+	unsigned int ncpus, nmbclusters, clock_hz;
 	int boot_pages;
 	int num_hash_buckets;
 	caddr_t v;
+	uint64_t boot_start;
+	u_int pending;
+
+	boot_start = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+
+	if (cfg == NULL) {
+		uinet_default_cfg(&default_cfg);
+		cfg = &default_cfg;
+	}
+
+	ncpus = cfg->ncpus;
+	nmbclusters = cfg->nmbclusters;
+	clock_hz = cfg->hz;
 
 	if (ncpus > MAXCPU) {
 		printf("Limiting number of CPUs to %u\n", MAXCPU);
@@ -89,15 +113,28 @@ uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_c
 		ncpus = 1;
 	}
 
-	printf("uinet starting: cpus=%u, nmbclusters=%u\n", ncpus, nmbclusters);
+	if (clock_hz > UINET_HZ_MAX) {
+		printf("Limiting hz to %u\n", UINET_HZ_MAX);
+		clock_hz = UINET_HZ_MAX;
+	} else if (clock_hz < UINET_HZ_MIN) {
+		printf("Setting hz to %u\n", UINET_HZ_MIN);
+		clock_hz = UINET_HZ_MIN;
+	}
+
+	printf("uinet starting: cpus=%u, nmbclusters=%u, hz=%u\n", ncpus, nmbclusters, clock_hz);
 
 	snprintf(tmpbuf, sizeof(tmpbuf), "%u", nmbclusters);
 	setenv("kern.ipc.nmbclusters", tmpbuf);
 
+	/* Read by init_param1() during mi_startup() */
+	snprintf(tmpbuf, sizeof(tmpbuf), "%u", clock_hz);
+	setenv("kern.hz", tmpbuf);
+
 	/* The env var kern.ncallout will get read in proc0_init(), but
 	 * that's after we init the callwheel below.  So we set it here for
 	 * consistency, but the operative setting is the direct assignment
-	 * below.
+	 * below.  This is based on the default HZ rather than the
+	 * configured rate so the table and wheel don't grow with hz.
 	 */
         ncallout = HZ * 3600;
 	snprintf(tmpbuf, sizeof(tmpbuf), "%u", ncallout);
@@ -123,12 +160,25 @@ uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_c
 
 	uhi_set_num_cpus(mp_ncpus);
 
+	/* Must be in place before mi_startup() creates the zones that use them */
+	uinet_numa_init(mp_ncpus);
+	uinet_hugepage_init(cfg->hugepages);
+
         /* vm_init bits */
 	
 	/* first get size required, then alloc memory, then give that memory to the second call */
+	/*
+	 * The callout table and wheel are large and are set up on first
+	 * use, so take them straight from anonymous memory, which is
+	 * zero-filled without being touched here.
+	 */
 	v = 0;
         v = kern_timeout_callwheel_alloc(v);
-	kern_timeout_callwheel_alloc(malloc(round_page((vm_offset_t)v), M_DEVBUF, M_ZERO));
+	v = uhi_mmap(NULL, round_page((vm_offset_t)v), UHI_PROT_READ|UHI_PROT_WRITE,
+	    UHI_MAP_ANON|UHI_MAP_PRIVATE, -1, 0);
+	if (v == UHI_MAP_FAILED)
+		panic("Could not allocate callwheel");
+	kern_timeout_callwheel_alloc(v);
         kern_timeout_callwheel_init();
 
 	uinet_init_thread0();
@@ -136,11 +186,6 @@ uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_c
         uma_startup(malloc(boot_pages*PAGE_SIZE, M_DEVBUF, M_ZERO), boot_pages);
 	uma_startup2();
 
-	/* XXX any need to tune this? */
-	num_hash_buckets = 8192;  /* power of 2.  32 bytes per bucket on a 64-bit system, so no need to skimp */
-	uma_page_slab_hash = malloc(sizeof(struct uma_page)*num_hash_buckets, M_DEVBUF, M_ZERO);
-	uma_page_mask = num_hash_buckets - 1;
-
 #if 0
 	pthread_mutex_init(&init_lock, NULL);
 	pthread_cond_init(&init_cond, NULL);
@@ -150,11 +195,13 @@ uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_c
 	sx_init(&proctree_lock, "proctree");
 	td = curthread;
 
-	/* XXX - would very much like to do better than this */
-	/* give all configuration threads time to complete initialization
-	 * before continuing
+	/*
+	 * Give the threads started by the SYSINITs a chance to get going
+	 * before continuing.
 	 */
-	sleep(1);
+	pending = uinet_kthread_wait_started(UHI_NSEC_PER_SEC);
+	if (pending)
+		printf("%u kernel threads did not start\n", pending);
 
 	uinet_instance_init(&uinst0, vnet0, inst_cfg);
 
@@ -171,6 +218,10 @@ uinet_init(unsigned int ncpus, unsigned int nmbclusters, struct uinet_instance_c
 		printf("Failed to create at least one signal handling thread\n");
 	uhi_mask_all_signals();
 
+	printf("uinet ready in %ju ms\n",
+	    (uintmax_t)((uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) - boot_start) /
+		1000000));
+
 #if 0
 	printf("maxusers=%d\n", maxusers);
 	printf("maxfiles=%d\n", maxfiles);
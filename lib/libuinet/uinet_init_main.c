@@ -100,6 +100,12 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/kern/init_main.c 237725 2012-06-28 19:34:2
 #include <ddb/db_sym.h>
 #endif
 
+#ifdef UINET
+#include <sys/sbuf.h>
+
+#include "uinet_host_interface.h"
+#endif
+
 void mi_startup(void);				/* Should be elsewhere */
 
 /* Components of the first process -- never freed. */
@@ -119,6 +125,104 @@ int	bootverbose;
 SYSCTL_INT(_debug, OID_AUTO, bootverbose, CTLFLAG_RW, &bootverbose, 0,
 	"Control the output of verbose kernel messages");
 
+#ifdef UINET
+/*
+ * mi_startup() times each SYSINIT it runs and keeps the slowest ones,
+ * slowest first, so the cost of bringing up an instance can be
+ * attributed.  A summary is printed at startup, with the slowest entries
+ * when booting verbose, and the full table is in debug.sysinit_profile.
+ * Functions are reported by address.
+ */
+#define	SYSINIT_PROF_SLOTS	16
+#define	SYSINIT_PROF_SHOWN	5
+
+struct sysinit_prof {
+	sysinit_cfunc_t	sp_func;
+	const void	*sp_udata;
+	u_int		sp_subsystem;
+	u_int		sp_order;
+	uint64_t	sp_ns;
+};
+
+static struct sysinit_prof sysinit_prof[SYSINIT_PROF_SLOTS];
+static u_int sysinit_prof_count;
+static uint64_t sysinit_prof_total;
+
+static void
+sysinit_prof_record(struct sysinit *sip, uint64_t ns)
+{
+	int i;
+
+	sysinit_prof_count++;
+	sysinit_prof_total += ns;
+
+	for (i = SYSINIT_PROF_SLOTS; i > 0 && ns > sysinit_prof[i - 1].sp_ns; i--)
+		continue;
+	if (i == SYSINIT_PROF_SLOTS)
+		return;
+	memmove(&sysinit_prof[i + 1], &sysinit_prof[i],
+	    (SYSINIT_PROF_SLOTS - i - 1) * sizeof(sysinit_prof[0]));
+	sysinit_prof[i].sp_func = sip->func;
+	sysinit_prof[i].sp_udata = sip->udata;
+	sysinit_prof[i].sp_subsystem = sip->subsystem;
+	sysinit_prof[i].sp_order = sip->order;
+	sysinit_prof[i].sp_ns = ns;
+}
+
+static void
+sysinit_prof_format(struct sbuf *sb, int n)
+{
+	struct sysinit_prof *sp;
+	int i;
+
+	sbuf_printf(sb, "%u SYSINITs in %ju.%03ju ms\n", sysinit_prof_count,
+	    (uintmax_t)(sysinit_prof_total / 1000000),
+	    (uintmax_t)(sysinit_prof_total % 1000000) / 1000);
+	for (i = 0; i < n && i < SYSINIT_PROF_SLOTS; i++) {
+		sp = &sysinit_prof[i];
+		if (sp->sp_ns == 0)
+			break;
+		sbuf_printf(sb, "  %6ju.%03ju ms  %08x:%08x  %p(%p)\n",
+		    (uintmax_t)(sp->sp_ns / 1000000),
+		    (uintmax_t)(sp->sp_ns % 1000000) / 1000,
+		    sp->sp_subsystem, sp->sp_order, sp->sp_func, sp->sp_udata);
+	}
+}
+
+static void
+sysinit_prof_report(void)
+{
+	struct sbuf *sb;
+
+	sb = sbuf_new_auto();
+	sysinit_prof_format(sb, bootverbose ? SYSINIT_PROF_SLOTS :
+	    SYSINIT_PROF_SHOWN);
+	sbuf_finish(sb);
+	printf("%s", sbuf_data(sb));
+	sbuf_delete(sb);
+}
+
+static int
+sysctl_debug_sysinit_profile(SYSCTL_HANDLER_ARGS)
+{
+	struct sbuf sb;
+	int error;
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		return (error);
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	sbuf_printf(&sb, "\n");
+	sysinit_prof_format(&sb, SYSINIT_PROF_SLOTS);
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+	return (error);
+}
+SYSCTL_PROC(_debug, OID_AUTO, sysinit_profile, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, sysctl_debug_sysinit_profile, "A",
+    "Slowest SYSINITs run at startup");
+#endif
+
 /*
  * This ensures that there is at least one entry so that the sysinit_set
  * symbol is not undefined.  A sybsystem ID of SI_SUB_DUMMY is never
@@ -209,6 +313,7 @@ mi_startup(void)
 #ifdef UINET
 	struct sysinit **temp;
 	int size;
+	uint64_t start;
 #endif 
 
 #if defined(VERBOSE_SYSINIT)
@@ -297,8 +402,15 @@ restart:
 #endif
 
 		mtx_lock(&Giant);
+#ifdef UINET
+		start = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+#endif
 		/* Call function */
 		(*((*sipp)->func))((*sipp)->udata);
+#ifdef UINET
+		sysinit_prof_record(*sipp,
+		    uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) - start);
+#endif
 		mtx_unlock(&Giant);
 
 #if defined(VERBOSE_SYSINIT)
@@ -321,6 +433,10 @@ restart:
 		}
 	}
 
+#ifdef UINET
+	sysinit_prof_report();
+#endif
+
 #ifndef UINET  /* UINET exists in a user process, which will pass through here on a normal exit */
 	panic("Shouldn't get here!");
 	/* NOTREACHED*/
@@ -526,7 +642,10 @@ proc0_init(void *dummy __unused)
 	td->td_lend_user_pri = PRI_MAX;
 	td->td_priority = PVM;
 	td->td_base_pri = PVM;
+#ifndef UINET
+	/* uinet_init_thread0() has already assigned thread0's cpu slot */
 	td->td_oncpu = 0;
+#endif
 	td->td_flags = TDF_INMEM|TDP_KTHREAD;
 
 #ifndef UINET
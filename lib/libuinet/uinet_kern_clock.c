@@ -30,6 +30,8 @@
 #include <sys/systm.h>
 #include <sys/kernel.h>
 #include <sys/limits.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
 #include <sys/timetc.h>
 
 
@@ -38,13 +40,65 @@ int	ticks;
 
 
 /*
- * The real-time timer, interrupting hz times per second.
+ * Virtual clock.  While enabled, the real-time timer thread stops
+ * generating hardclocks and time is instead advanced by packet timestamps
+ * supplied via uinet_vclock_advance(), typically by a capture file replay.
+ * Callouts that come due run synchronously in the thread advancing the
+ * clock, so the timer behavior seen by the stack depends only on the
+ * timestamps and not on the replay speed.
+ *
+ * There is one tick counter and callout wheel for the whole process, so
+ * the virtual clock is shared by all instances.
+ */
+static struct mtx vclock_lock;
+MTX_SYSINIT(vclock, &vclock_lock, "vclock", MTX_DEF);
+
+/*
+ * Callouts run from uinet_hardclock(), so it is called without
+ * vclock_lock held.  hardclock_lock only serializes the timecounter
+ * update between the clock thread and threads advancing the virtual
+ * clock.
+ */
+static struct mtx hardclock_lock;
+MTX_SYSINIT(hardclock, &hardclock_lock, "hardclock", MTX_DEF);
+
+/*
+ * Most ticks issued per uinet_hardclock() call when the virtual clock
+ * crosses a gap, so callouts rearmed while catching up are scheduled no
+ * more than this far from where they would have been.
+ */
+#define	VCLOCK_STEP_MAX	((hz + 99) / 100)
+
+static int vclock_enabled;		/* number of users */
+static int vclock_started;
+static uint64_t vclock_base;		/* timestamp of first advance */
+static uint64_t vclock_hardclocks;	/* issued since vclock_base */
+
+
+/*
+ * Advance ticks and the timecounter without running callouts.
+ */
+static void
+uinet_ticks_advance(int cnt)
+{
+
+	mtx_lock(&hardclock_lock);
+	atomic_add_int((volatile int *)&ticks, cnt);
+	tc_ticktock(cnt);
+	mtx_unlock(&hardclock_lock);
+}
+
+
+/*
+ * The real-time timer, interrupting hz times per second.  cnt is the
+ * number of ticks to advance, which is more than one when the timer thread
+ * has skipped idle ticks or woken late.
  */
 void
-uinet_hardclock(void)
+uinet_hardclock(int cnt)
 {
 
-	atomic_add_int((volatile int *)&ticks, 1);
+	uinet_ticks_advance(cnt);
 
 	/* hardclock_cpu(usermode);
 	 *
@@ -54,7 +108,6 @@ uinet_hardclock(void)
 	 */
 
 	callout_tick();
-	tc_ticktock(1);
 
 	/* cpu_tick_calibration();
 	 *
@@ -87,6 +140,111 @@ uinet_hardclock(void)
 }
 
 
+/*
+ * Called by the real-time timer thread.  Suppressed while the virtual
+ * clock is in use.
+ */
+void
+uinet_hardclock_realtime(int cnt)
+{
+
+	int enabled;
+
+	mtx_lock(&vclock_lock);
+	enabled = vclock_enabled;
+	mtx_unlock(&vclock_lock);
+
+	if (!enabled)
+		uinet_hardclock(cnt);
+}
+
+
+/*
+ * Called by uinet_clock_sync() to catch ticks up outside the clock
+ * thread.  Callouts that come due are left to the clock thread.  The
+ * unlocked check is enough, as the clock thread drops real-time ticks
+ * while the virtual clock is in use as well.
+ */
+void
+uinet_ticks_realtime(int cnt)
+{
+
+	if (!vclock_enabled)
+		uinet_ticks_advance(cnt);
+}
+
+
+void
+uinet_vclock_enable(void)
+{
+
+	mtx_lock(&vclock_lock);
+	vclock_enabled++;
+	mtx_unlock(&vclock_lock);
+}
+
+
+/*
+ * Return control of the clock to the real-time timer thread once the last
+ * user is done.  Ticks continue on from wherever the virtual clock left
+ * them.
+ */
+void
+uinet_vclock_disable(void)
+{
+
+	mtx_lock(&vclock_lock);
+	KASSERT(vclock_enabled > 0, ("uinet_vclock_disable: not enabled"));
+	vclock_enabled--;
+	if (0 == vclock_enabled)
+		vclock_started = 0;
+	mtx_unlock(&vclock_lock);
+}
+
+
+/*
+ * Advance the virtual clock to the given timestamp in nanoseconds, running
+ * any callouts that come due.  The first timestamp seen establishes the
+ * starting point, and timestamps that are behind the clock (such as those
+ * from a second, slightly skewed capture) do not move it backwards.  Ticks
+ * are claimed under vclock_lock and issued after dropping it, at most
+ * VCLOCK_STEP_MAX at a time, so callouts never run with it held and the
+ * real-time path is not held up behind a long gap.
+ */
+void
+uinet_vclock_advance(uint64_t timestamp_ns)
+{
+	uint64_t target;
+	int cnt;
+
+	for (;;) {
+		cnt = 0;
+		mtx_lock(&vclock_lock);
+		if (vclock_enabled) {
+			if (!vclock_started) {
+				vclock_base = timestamp_ns;
+				vclock_hardclocks = 0;
+				vclock_started = 1;
+			} else if (timestamp_ns > vclock_base) {
+				target = (timestamp_ns - vclock_base) /
+				    (1000000000ULL / hz);
+				if (vclock_hardclocks < target) {
+					cnt = VCLOCK_STEP_MAX;
+					if (target - vclock_hardclocks < cnt)
+						cnt = target - vclock_hardclocks;
+					vclock_hardclocks += cnt;
+				}
+			}
+		}
+		mtx_unlock(&vclock_lock);
+
+		if (cnt == 0)
+			break;
+		uinet_hardclock(cnt);
+	}
+}
+
+
 /*
  * Compute number of ticks in the specified amount of time.
  */
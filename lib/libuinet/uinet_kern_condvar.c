@@ -77,7 +77,9 @@ _cv_wait(struct cv *cvp, struct lock_object *lock)
 	 */
 	KASSERT(LOCK_CLASS(lock) == lock_class_mtx_sleep, ("non-sleep mutex used with condition variable"));
 
+	lock_profile_release_lock(lock);
 	uhi_cond_wait(&cvp->cv_cond, &m->mtx_lock);
+	lock_profile_obtain_lock_success(lock, 0, 0, LOCK_FILE, LOCK_LINE);
 }
 
 /*
@@ -97,7 +99,9 @@ _cv_wait_sig(struct cv *cvp, struct lock_object *lock)
 	 */
 	KASSERT(LOCK_CLASS(lock) == lock_class_mtx_sleep, ("non-sleep mutex used with condition variable"));
 
+	lock_profile_release_lock(lock);
 	uhi_cond_wait(&cvp->cv_cond, &m->mtx_lock);
+	lock_profile_obtain_lock_success(lock, 0, 0, LOCK_FILE, LOCK_LINE);
 
 	return (0);
 }
@@ -112,6 +116,7 @@ _cv_timedwait(struct cv *cvp, struct lock_object *lock, int timo)
 {
 	uint64_t nsecs = ((uint64_t)timo * (1000UL*1000UL*1000UL)) / hz;
 	struct mtx *m = (struct mtx *)lock;
+	int error;
 
 	/*
 	 * We only support sleep mutexes since that's what the underlying
@@ -119,7 +124,11 @@ _cv_timedwait(struct cv *cvp, struct lock_object *lock, int timo)
 	 */
 	KASSERT(LOCK_CLASS(lock) == lock_class_mtx_sleep, ("non-sleep mutex used with condition variable"));
 
-	return (uhi_cond_timedwait(&cvp->cv_cond, &m->mtx_lock, nsecs) ? EWOULDBLOCK : 0);
+	lock_profile_release_lock(lock);
+	error = uhi_cond_timedwait(&cvp->cv_cond, &m->mtx_lock, nsecs);
+	lock_profile_obtain_lock_success(lock, 0, 0, LOCK_FILE, LOCK_LINE);
+
+	return (error ? EWOULDBLOCK : 0);
 }
 
 /*
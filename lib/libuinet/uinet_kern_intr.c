@@ -66,6 +66,8 @@ __FBSDID("$FreeBSD$");
 #include <ddb/db_sym.h>
 #endif
 
+#include "uinet_host_interface.h"
+
 
 
 /*
@@ -87,25 +89,61 @@ struct	intr_entropy {
 };
 
 
-extern struct mtx uinet_pcpu_locks[MAXCPU];
+/*
+ * A critical section gives the current thread exclusive use of its cpu's
+ * per-cpu data.  uinet threads aren't pinned to host cpus and more than
+ * one thread can map to the same td_oncpu, so the outermost
+ * critical_enter() claims the cpu by installing the thread as the owner of
+ * that cpu's slot with a single compare-and-set.  Nested entries only
+ * adjust td_critnest.  A thread that finds the slot owned by another
+ * spins briefly, then yields the host cpu until the owner leaves, which
+ * covers the owner having been descheduled by the host.
+ */
+struct critical_slot {
+	volatile uintptr_t owner;
+} __aligned(CACHE_LINE_SIZE);
+
+static struct critical_slot critical_slots[MAXCPU];
+
+#define	CRITICAL_SPINS	100
 
 void
 critical_enter(void)
 {
-	/* XXX grab per-cpu mutex 
-	   The best performing reimplementation is TBD.  For now, a per-cpu
-	   mutex is used to prevent another thread from entering the same
-	   critical section on the current cpu.
-	 */
-	KASSERT(curthread->td_oncpu < mp_ncpus, ("curthread->td_oncpu >= mp_ncpus"));
-	mtx_lock(&uinet_pcpu_locks[curthread->td_oncpu]);
+	struct thread *td = curthread;
+	struct critical_slot *slot;
+	int spins;
+
+	if (td->td_critnest++ != 0)
+		return;
+
+	KASSERT(td->td_oncpu < mp_ncpus, ("curthread->td_oncpu >= mp_ncpus"));
+	slot = &critical_slots[td->td_oncpu];
+	spins = 0;
+	while (!atomic_cmpset_acq_ptr(&slot->owner, 0, (uintptr_t)td)) {
+		if (spins < CRITICAL_SPINS) {
+			spins++;
+			cpu_spinwait();
+		} else
+			uhi_thread_yield();
+	}
 }
 
 void
 critical_exit(void)
 {
-	KASSERT(curthread->td_oncpu < mp_ncpus, ("curthread->td_oncpu >= mp_ncpus"));
-	mtx_unlock(&uinet_pcpu_locks[curthread->td_oncpu]);
+	struct thread *td = curthread;
+	struct critical_slot *slot;
+
+	KASSERT(td->td_critnest != 0, ("critical_exit: td_critnest == 0"));
+
+	if (--td->td_critnest != 0)
+		return;
+
+	KASSERT(td->td_oncpu < mp_ncpus, ("curthread->td_oncpu >= mp_ncpus"));
+	slot = &critical_slots[td->td_oncpu];
+	KASSERT(slot->owner == (uintptr_t)td, ("critical_exit: not slot owner"));
+	atomic_store_rel_ptr(&slot->owner, 0);
 }
 
 #undef thread_lock
@@ -43,6 +43,8 @@
 #include <sys/smp.h>
 #include <sys/ucred.h>
 
+#include <machine/atomic.h>
+
 /* XXX - should we really be picking up the host stdarg? */ 
 #include <machine/stdarg.h>
 
@@ -84,13 +86,14 @@ uinet_thread_alloc(struct proc *p)
 		goto error;
 
 	cv_init(cond, "thread_sleepq");
+	cv_init(&td->td_sleep.ts_cv, "thread_sleep");
 	mtx_init(lock, "thread_lock", NULL, MTX_DEF);
 	td->td_lock = lock;
 	td->td_sleepqueue = (struct sleepqueue *)cond;
 	td->td_ucred = crhold(p->p_ucred);
 	td->td_proc = p;
 	td->td_pflags |= TDP_KTHREAD;
-	td->td_oncpu = 0;
+	td->td_oncpu = uinet_cpuslot_alloc(-1);
 	td->td_stop_req = NULL;
 	td->td_last_stop_check = ticks;
 	td->td_stop_check_ticks = hz / 2;
@@ -114,11 +117,14 @@ uinet_thread_free(struct uinet_thread *utd)
 {
 	struct thread *td = utd->td;
 
+	lock_profile_thread_exit(td);
+	uinet_cpuslot_free(td->td_oncpu);
 	crfree(td->td_proc->p_ucred);
 	mtx_destroy(td->td_lock);
 	free(td->td_lock, M_DEVBUF);
 	cv_destroy((struct cv *)td->td_sleepqueue);
 	free(td->td_sleepqueue, M_DEVBUF);
+	cv_destroy(&td->td_sleep.ts_cv);
 	free(td, M_DEVBUF);
 	free(utd, M_DEVBUF);
 }
@@ -134,6 +140,53 @@ tls_destructor(void *tls_data)
 }
 
 
+/*
+ * Threads created with kthread_add() and kproc_kthread_add() are counted
+ * when created and again once they are running, so uinet_init() can wait
+ * for the threads the SYSINITs started instead of sleeping for a fixed
+ * time.
+ */
+struct kthread_start_args {
+	void (*start_routine)(void *);
+	void *start_routine_arg;
+};
+
+static volatile u_int kthreads_created;
+static volatile u_int kthreads_started;
+
+static void
+kthread_start_routine(void *arg)
+{
+	struct kthread_start_args ksa;
+
+	ksa = *(struct kthread_start_args *)arg;
+	free(arg, M_DEVBUF);
+
+	atomic_add_int(&kthreads_started, 1);
+	ksa.start_routine(ksa.start_routine_arg);
+}
+
+
+/*
+ * Wait until every kernel thread created so far has started, or until
+ * timeout_ns has passed.  Returns the number of threads that have not
+ * started.
+ */
+u_int
+uinet_kthread_wait_started(uint64_t timeout_ns)
+{
+	uint64_t deadline;
+	u_int pending;
+
+	deadline = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) + timeout_ns;
+	while ((pending = kthreads_created - kthreads_started) != 0 &&
+	       uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC) < deadline)
+		uhi_nanosleep(100000);
+
+	return (pending);
+}
+
+
 /*
  * N.B. The flags are ignored.  Namely RFSTOPPED is not honored and threads
  * are started right away.
@@ -146,6 +199,7 @@ kthread_add(void (*start_routine)(void *), void *arg, struct proc *p,
 	int error;
 	uhi_thread_t host_thread;
 	struct uhi_thread_start_args *tsa;
+	struct kthread_start_args *ksa;
 	struct uinet_thread *utd;
 	struct thread *td;
 	va_list ap;
@@ -159,9 +213,13 @@ kthread_add(void (*start_routine)(void *), void *arg, struct proc *p,
 	if (tdp)
 		*tdp = td;
 
+	ksa = malloc(sizeof(struct kthread_start_args), M_DEVBUF, M_WAITOK);
+	ksa->start_routine = start_routine;
+	ksa->start_routine_arg = arg;
+
 	tsa = malloc(sizeof(struct uhi_thread_start_args), M_DEVBUF, M_WAITOK);
-	tsa->start_routine = start_routine;
-	tsa->start_routine_arg = arg;
+	tsa->start_routine = kthread_start_routine;
+	tsa->start_routine_arg = ksa;
 	tsa->end_routine = NULL;
 	tsa->tls_key = kthread_tls_key;
 	tsa->tls_data = utd;
@@ -169,13 +227,18 @@ kthread_add(void (*start_routine)(void *), void *arg, struct proc *p,
 	/* Have uhi_thread_create() store the host thread ID in td_wchan */
 	KASSERT(sizeof(td->td_wchan) >= sizeof(uhi_thread_t), ("kthread_add: can't safely store host thread id"));
 	tsa->host_thread_id = (uhi_thread_t *)&td->td_wchan;
-	tsa->oncpu = &td->td_oncpu;
+	tsa->oncpu = NULL;	/* slot assigned by uinet_thread_alloc() */
 
 	va_start(ap, str);
 	vsnprintf(tsa->name, sizeof(tsa->name), str, ap);
 	va_end(ap);
 
+	atomic_add_int(&kthreads_created, 1);
 	error = uhi_thread_create(&host_thread, tsa, pages * PAGE_SIZE); 
+	if (error) {
+		atomic_subtract_int(&kthreads_created, 1);
+		free(ksa, M_DEVBUF);
+	}
 
 	/*
 	 * Ensure tc_wchan is valid before kthread_add returns, in case the
@@ -204,6 +267,7 @@ kproc_kthread_add(void (*start_routine)(void *), void *arg,
 	int error;
 	uhi_thread_t host_thread;
 	struct uhi_thread_start_args *tsa;
+	struct kthread_start_args *ksa;
 	struct uinet_thread *utd;
 	struct thread *td;
 	va_list ap;
@@ -217,9 +281,13 @@ kproc_kthread_add(void (*start_routine)(void *), void *arg,
 	if (tdp)
 		*tdp = td;
 
+	ksa = malloc(sizeof(struct kthread_start_args), M_DEVBUF, M_WAITOK);
+	ksa->start_routine = start_routine;
+	ksa->start_routine_arg = arg;
+
 	tsa = malloc(sizeof(struct uhi_thread_start_args), M_DEVBUF, M_WAITOK);
-	tsa->start_routine = start_routine;
-	tsa->start_routine_arg = arg;
+	tsa->start_routine = kthread_start_routine;
+	tsa->start_routine_arg = ksa;
 	tsa->end_routine = NULL;
 	tsa->tls_key = kthread_tls_key;
 	tsa->tls_data = utd;
@@ -227,13 +295,18 @@ kproc_kthread_add(void (*start_routine)(void *), void *arg,
 	/* Have uhi_thread_create() store the host thread ID in td_wchan */
 	KASSERT(sizeof(td->td_wchan) >= sizeof(uhi_thread_t), ("kproc_kthread_add: can't safely store host thread id"));
 	tsa->host_thread_id = (uhi_thread_t *)&td->td_wchan;
-	tsa->oncpu = &td->td_oncpu;
+	tsa->oncpu = NULL;	/* slot assigned by uinet_thread_alloc() */
 
 	va_start(ap, str);
 	vsnprintf(tsa->name, sizeof(tsa->name), str, ap);
 	va_end(ap);
 
+	atomic_add_int(&kthreads_created, 1);
 	error = uhi_thread_create(&host_thread, tsa, pages * PAGE_SIZE); 
+	if (error) {
+		atomic_subtract_int(&kthreads_created, 1);
+		free(ksa, M_DEVBUF);
+	}
 
 	/*
 	 * Ensure tc_wchan is valid before kthread_add returns, in case the
@@ -256,12 +329,13 @@ uinet_init_thread0(void)
 
 	td = &thread0;
 	td->td_proc = &proc0;
+	cv_init(&td->td_sleep.ts_cv, "thread_sleep");
 
 	KASSERT(sizeof(td->td_wchan) >= sizeof(uhi_thread_t), ("uinet_init_thread0: can't safely store host thread id"));
 	td->td_wchan = (void *)uhi_thread_self();
 
 	cpuid = uhi_thread_bound_cpu();
-	td->td_oncpu = (cpuid == -1) ? 0 : cpuid % mp_ncpus;
+	td->td_oncpu = uinet_cpuslot_alloc(cpuid);
 	
 	uinet_thread0.td = td;
 
@@ -31,7 +31,12 @@
 
 #include <sys/param.h>
 #include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/mutex.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
 #include <sys/systm.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 /*
@@ -43,47 +48,237 @@
  */
 #include <sys/malloc.h>
 
+#include <vm/vm.h>
+#include <vm/vm_page.h>
+#include <vm/uma.h>
+#include <vm/uma_int.h>
 
 #include "uinet_host_interface.h"
 
 
+/*
+ * Small allocations are carved from a set of power-of-two UMA zones, so
+ * they are served from the calling thread's UMA cache for the size class
+ * without taking any lock in the common case.  Larger allocations get
+ * their own pages via uma_large_malloc().  free() finds the owning zone
+ * through the page-to-slab lookup, as in the stock kernel allocator.
+ *
+ * Allocations made before kmeminit() has run (e.g. during uinet_init(),
+ * or from constructors) come from the host allocator.  free() recognizes
+ * these by the absence of a slab and hands them back to the host.
+ *
+ * Per-type statistics are kept per cpu slot and exported through the
+ * kern.malloc_stats sysctl in the format libmemstat expects.  The number
+ * of failed allocations is reported in the first reserved field.
+ */
+
 MALLOC_DEFINE(M_DEVBUF, "devbuf", "device driver memory");
 MALLOC_DEFINE(M_TEMP, "temp", "misc temporary data buffers");
 
 MALLOC_DEFINE(M_IP6OPT, "ip6opt", "IPv6 options");
 MALLOC_DEFINE(M_IP6NDP, "ip6ndp", "IPv6 Neighbor Discovery");
 
+static void kmeminit(void *);
+SYSINIT(kmem, SI_SUB_KMEM, SI_ORDER_FIRST, kmeminit, NULL);
+
+static struct malloc_type *kmemstatistics;
+static int kmemcount;
+static int kmem_ready;
+
+#define	mts_failures	_mts_reserved1
+
+#define	KMEM_ZSHIFT	4
+#define	KMEM_ZBASE	16
+#define	KMEM_ZMASK	(KMEM_ZBASE - 1)
+
+#define	KMEM_ZMAX	65536
+#define	KMEM_ZSIZE	(KMEM_ZMAX >> KMEM_ZSHIFT)
+static uint8_t kmemsize[KMEM_ZSIZE + 1];
+
+static struct {
+	int kz_size;
+	char *kz_name;
+	uma_zone_t kz_zone;
+} kmemzones[] = {
+	{16, "16", },
+	{32, "32", },
+	{64, "64", },
+	{128, "128", },
+	{256, "256", },
+	{512, "512", },
+	{1024, "1024", },
+	{2048, "2048", },
+	{4096, "4096", },
+	{8192, "8192", },
+	{16384, "16384", },
+	{32768, "32768", },
+	{65536, "65536", },
+	{0, NULL},
+};
+
+/*
+ * Zone to allocate the per-type statistics from.
+ */
+static uma_zone_t mt_zone;
+
+/*
+ * The malloc_mtx protects the kmemstatistics linked list.
+ */
+struct mtx malloc_mtx;
+
+/*
+ * time_uptime of the last malloc(9) failure.
+ */
+static time_t t_malloc_fail;
+
+
+int
+malloc_last_fail(void)
+{
+
+	return (time_uptime - t_malloc_fail);
+}
+
+
+static void
+kmeminit(void *dummy)
+{
+	uint8_t indx;
+	int i, size;
+
+	mtx_init(&malloc_mtx, "malloc", NULL, MTX_DEF);
+
+	mt_zone = uma_zcreate("mt_zone", sizeof(struct malloc_type_internal),
+	    NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, UMA_ZONE_MALLOC);
+	for (i = 0, indx = 0; kmemzones[indx].kz_size != 0; indx++) {
+		size = kmemzones[indx].kz_size;
+		kmemzones[indx].kz_zone = uma_zcreate(kmemzones[indx].kz_name,
+		    size, NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, UMA_ZONE_MALLOC);
+		for (; i <= size; i += KMEM_ZBASE)
+			kmemsize[i >> KMEM_ZSHIFT] = indx;
+	}
+
+	kmem_ready = 1;
+}
+
 
 void
 malloc_init(void *data)
 {
-	/* Nothing to do here */
+	struct malloc_type_internal *mtip;
+	struct malloc_type *mtp;
+
+	mtp = data;
+	if (mtp->ks_magic != M_MAGIC)
+		panic("malloc_init: bad malloc type magic");
+
+	mtip = uma_zalloc(mt_zone, M_WAITOK | M_ZERO);
+	mtp->ks_handle = mtip;
+
+	mtx_lock(&malloc_mtx);
+	mtp->ks_next = kmemstatistics;
+	kmemstatistics = mtp;
+	kmemcount++;
+	mtx_unlock(&malloc_mtx);
 }
 
 
 void
 malloc_uninit(void *data)
 {
-	/* Nothing to do here */
+	struct malloc_type_internal *mtip;
+	struct malloc_type *mtp, *temp;
+
+	mtp = data;
+	KASSERT(mtp->ks_magic == M_MAGIC,
+	    ("malloc_uninit: bad malloc type magic"));
+	KASSERT(mtp->ks_handle != NULL, ("malloc_deregister: cookie NULL"));
+
+	mtx_lock(&malloc_mtx);
+	mtip = mtp->ks_handle;
+	mtp->ks_handle = NULL;
+	if (mtp != kmemstatistics) {
+		for (temp = kmemstatistics; temp != NULL;
+		    temp = temp->ks_next) {
+			if (temp->ks_next == mtp) {
+				temp->ks_next = mtp->ks_next;
+				break;
+			}
+		}
+		KASSERT(temp,
+		    ("malloc_uninit: type '%s' not found", mtp->ks_shortdesc));
+	} else
+		kmemstatistics = mtp->ks_next;
+	kmemcount--;
+	mtx_unlock(&malloc_mtx);
+
+	uma_zfree(mt_zone, mtip);
 }
 
 
 /*
- * libuinet/include/sys/malloc.h redirects all malloc() and free() calls to
- * these routines for users of sys/malloc.h.
+ * Statistics are updated on the current cpu slot's copy, in a critical
+ * section as more than one thread can share a slot.  Types that have not
+ * been registered yet are not accounted.
  */
-void *
-malloc(unsigned long size, struct malloc_type *type, int flags)
+static void
+malloc_type_zone_allocated(struct malloc_type *mtp, unsigned long size,
+    int zindx)
 {
-	void *alloc;
+	struct malloc_type_internal *mtip;
+	struct malloc_type_stats *mtsp;
+
+	mtip = mtp->ks_handle;
+	if (mtip == NULL)
+		return;
+
+	critical_enter();
+	mtsp = &mtip->mti_stats[curcpu];
+	if (size > 0) {
+		mtsp->mts_memalloced += size;
+		mtsp->mts_numallocs++;
+	} else
+		mtsp->mts_failures++;
+	if (zindx != -1)
+		mtsp->mts_size |= 1 << zindx;
+	critical_exit();
+}
+
+
+void
+malloc_type_allocated(struct malloc_type *mtp, unsigned long size)
+{
+
+	if (size > 0)
+		malloc_type_zone_allocated(mtp, size, -1);
+}
+
+
+void
+malloc_type_freed(struct malloc_type *mtp, unsigned long size)
+{
+	struct malloc_type_internal *mtip;
+	struct malloc_type_stats *mtsp;
+
+	mtip = mtp->ks_handle;
+	if (mtip == NULL)
+		return;
+
+	critical_enter();
+	mtsp = &mtip->mti_stats[curcpu];
+	mtsp->mts_memfreed += size;
+	mtsp->mts_numfrees++;
+	critical_exit();
+}
 
-	do {
-		alloc = uhi_malloc(size);
-		if (alloc || !(flags & M_WAITOK))
-			break;
 
+static void *
+malloc_host(unsigned long size, int flags)
+{
+	void *alloc;
+
+	while ((alloc = uhi_malloc(size)) == NULL && (flags & M_WAITOK))
 		pause("malloc", hz/100);
-	} while (alloc == NULL);
 
 	if ((flags & M_ZERO) && alloc != NULL)
 		bzero(alloc, size);
@@ -91,30 +286,233 @@ malloc(unsigned long size, struct malloc_type *type, int flags)
 }
 
 
+/*
+ * libuinet/include/sys/malloc.h redirects all malloc() and free() calls to
+ * these routines for users of sys/malloc.h.
+ */
+void *
+malloc(unsigned long size, struct malloc_type *mtp, int flags)
+{
+	uma_zone_t zone;
+	void *va;
+	int indx;
+
+	KASSERT(mtp->ks_magic == M_MAGIC, ("malloc: bad malloc type magic"));
+
+	if (!kmem_ready)
+		return (malloc_host(size, flags));
+
+	if (size <= KMEM_ZMAX) {
+		if (size & KMEM_ZMASK)
+			size = (size & ~KMEM_ZMASK) + KMEM_ZBASE;
+		indx = kmemsize[size >> KMEM_ZSHIFT];
+		zone = kmemzones[indx].kz_zone;
+		while ((va = uma_zalloc(zone, flags)) == NULL &&
+		    (flags & M_WAITOK))
+			pause("malloc", hz/100);
+		if (va != NULL)
+			size = zone->uz_size;
+		malloc_type_zone_allocated(mtp, va == NULL ? 0 : size, indx);
+	} else {
+		size = roundup(size, PAGE_SIZE);
+		while ((va = uma_large_malloc(size, flags)) == NULL &&
+		    (flags & M_WAITOK))
+			pause("malloc", hz/100);
+		malloc_type_zone_allocated(mtp, va == NULL ? 0 : size, -1);
+	}
+	if (va == NULL)
+		t_malloc_fail = time_uptime;
+
+	return (va);
+}
+
+
 void
-free(void *addr, struct malloc_type *type)
+free(void *addr, struct malloc_type *mtp)
 {
+	uma_slab_t slab;
+	u_long size;
+
+	KASSERT(mtp->ks_magic == M_MAGIC, ("free: bad malloc type magic"));
 
-	uhi_free(addr);
+	/* free(NULL, ...) does nothing */
+	if (addr == NULL)
+		return;
+
+	slab = vtoslab((vm_offset_t)addr & (~UMA_SLAB_MASK));
+	if (slab == NULL) {
+		uhi_free(addr);
+		return;
+	}
+
+	if (!(slab->us_flags & UMA_SLAB_MALLOC)) {
+		size = slab->us_keg->uk_size;
+		uma_zfree_arg(LIST_FIRST(&slab->us_keg->uk_zones), addr, slab);
+	} else {
+		size = slab->us_size;
+		uma_large_free(slab);
+	}
+	malloc_type_freed(mtp, size);
 }
 
 
 void *
-realloc(void *addr, unsigned long size, struct malloc_type *type,
-	int flags)
+realloc(void *addr, unsigned long size, struct malloc_type *mtp, int flags)
 {
-	return (uhi_realloc(addr, size));
+	uma_slab_t slab;
+	unsigned long alloc;
+	void *newaddr;
+
+	KASSERT(mtp->ks_magic == M_MAGIC,
+	    ("realloc: bad malloc type magic"));
+
+	/* realloc(NULL, ...) is equivalent to malloc(...) */
+	if (addr == NULL)
+		return (malloc(size, mtp, flags));
+
+	slab = vtoslab((vm_offset_t)addr & ~(UMA_SLAB_MASK));
+
+	/* Memory from before kmeminit() stays with the host allocator */
+	if (slab == NULL)
+		return (uhi_realloc(addr, size));
+
+	/* Get the size of the original block */
+	if (!(slab->us_flags & UMA_SLAB_MALLOC))
+		alloc = slab->us_keg->uk_size;
+	else
+		alloc = slab->us_size;
+
+	/* Reuse the original block if appropriate */
+	if (size <= alloc && (size > (alloc >> 1) || alloc == KMEM_ZBASE))
+		return (addr);
+
+	/* Allocate a new, bigger (or smaller) block */
+	if ((newaddr = malloc(size, mtp, flags)) == NULL)
+		return (NULL);
+
+	/* Copy over original contents */
+	bcopy(addr, newaddr, min(size, alloc));
+	free(addr, mtp);
+	return (newaddr);
 }
 
 
 void *
-reallocf(void *addr, unsigned long size, struct malloc_type *type,
-	 int flags)
+reallocf(void *addr, unsigned long size, struct malloc_type *mtp, int flags)
 {
 	void *mem;
 
-	if ((mem = uhi_realloc(addr, size)) == NULL)
-		uhi_free(addr);
+	if ((mem = realloc(addr, size, mtp, flags)) == NULL)
+		free(addr, mtp);
 
 	return (mem);
 }
+
+
+struct malloc_type *
+malloc_desc2type(const char *desc)
+{
+	struct malloc_type *mtp;
+
+	mtx_assert(&malloc_mtx, MA_OWNED);
+	for (mtp = kmemstatistics; mtp != NULL; mtp = mtp->ks_next) {
+		if (strcmp(mtp->ks_shortdesc, desc) == 0)
+			return (mtp);
+	}
+	return (NULL);
+}
+
+
+void
+malloc_type_list(malloc_type_list_func_t *func, void *arg)
+{
+	struct malloc_type *mtp, **bufmtp;
+	int count, i;
+	size_t buflen;
+
+	mtx_lock(&malloc_mtx);
+restart:
+	mtx_assert(&malloc_mtx, MA_OWNED);
+	count = kmemcount;
+	mtx_unlock(&malloc_mtx);
+
+	buflen = sizeof(struct malloc_type *) * count;
+	bufmtp = malloc(buflen, M_TEMP, M_WAITOK);
+
+	mtx_lock(&malloc_mtx);
+
+	if (count < kmemcount) {
+		free(bufmtp, M_TEMP);
+		goto restart;
+	}
+
+	for (mtp = kmemstatistics, i = 0; mtp != NULL; mtp = mtp->ks_next, i++)
+		bufmtp[i] = mtp;
+
+	mtx_unlock(&malloc_mtx);
+
+	for (i = 0; i < count; i++)
+		(func)(bufmtp[i], arg);
+
+	free(bufmtp, M_TEMP);
+}
+
+
+static int
+sysctl_kern_malloc_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct malloc_type_stream_header mtsh;
+	struct malloc_type_internal *mtip;
+	struct malloc_type_header mth;
+	struct malloc_type *mtp;
+	int error, i;
+	struct sbuf sbuf;
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		return (error);
+	sbuf_new_for_sysctl(&sbuf, NULL, 128, req);
+	mtx_lock(&malloc_mtx);
+
+	/*
+	 * Insert stream header.
+	 */
+	bzero(&mtsh, sizeof(mtsh));
+	mtsh.mtsh_version = MALLOC_TYPE_STREAM_VERSION;
+	mtsh.mtsh_maxcpus = MAXCPU;
+	mtsh.mtsh_count = kmemcount;
+	(void)sbuf_bcat(&sbuf, &mtsh, sizeof(mtsh));
+
+	/*
+	 * Insert alternating sequence of type headers and type statistics.
+	 */
+	for (mtp = kmemstatistics; mtp != NULL; mtp = mtp->ks_next) {
+		mtip = (struct malloc_type_internal *)mtp->ks_handle;
+
+		/*
+		 * Insert type header.
+		 */
+		bzero(&mth, sizeof(mth));
+		strlcpy(mth.mth_name, mtp->ks_shortdesc, MALLOC_MAX_NAME);
+		(void)sbuf_bcat(&sbuf, &mth, sizeof(mth));
+
+		/*
+		 * Insert type statistics for each CPU.
+		 */
+		for (i = 0; i < MAXCPU; i++) {
+			(void)sbuf_bcat(&sbuf, &mtip->mti_stats[i],
+			    sizeof(mtip->mti_stats[i]));
+		}
+	}
+	mtx_unlock(&malloc_mtx);
+	error = sbuf_finish(&sbuf);
+	sbuf_delete(&sbuf);
+	return (error);
+}
+
+SYSCTL_PROC(_kern, OID_AUTO, malloc_stats, CTLFLAG_RD|CTLTYPE_STRUCT,
+    0, 0, sysctl_kern_malloc_stats, "s,malloc_type_ustats",
+    "Return malloc types");
+
+SYSCTL_INT(_kern, OID_AUTO, malloc_count, CTLFLAG_RD, &kmemcount, 0,
+    "Count of kernel malloc types");
@@ -30,10 +30,13 @@
 
 #include <sys/param.h>
 #include <sys/conf.h>
+#include <sys/malloc.h>
 #include <sys/mutex.h>
 #include <sys/proc.h>
+#include <sys/sbuf.h>
 #include <sys/systm.h>
 #include <sys/sx.h>
+#include <sys/sysctl.h>
 
 #include "uinet_host_interface.h"
 
@@ -140,9 +143,14 @@ mutex_init(void)
 void
 mtx_init(struct mtx *m, const char *name, const char *type, int opts)
 {
-	lock_init(&m->lock_object, &lock_class_mtx_sleep, name, type, opts);
+	int flags;
 
-	if (0 != uhi_mutex_init(&m->mtx_lock, opts & MTX_RECURSE ? UHI_MTX_RECURSE : 0))
+	flags = opts;
+	if (opts & MTX_NOPROFILE)
+		flags |= LO_NOPROFILE;
+	lock_init(&m->lock_object, &lock_class_mtx_sleep, name, type, flags);
+
+	if (0 != uhi_mutex_init(&m->mtx_lock, name, opts & MTX_RECURSE ? UHI_MTX_RECURSE : 0))
 		panic("Could not initialize mutex");
 }
 
@@ -160,13 +168,36 @@ mtx_sysinit(void *arg)
 	mtx_init(margs->ma_mtx, margs->ma_desc, NULL, margs->ma_opts);
 }
 
+/*
+ * With lock profiling, a trylock is made first so that contested
+ * acquisitions, and the time spent waiting in them, can be told apart.
+ */
+static inline void
+mtx_lock_profiled(struct mtx *m, const char *file, int line)
+{
+#ifdef LOCK_PROFILING
+	uint64_t waittime = 0;
+	int contested = 0;
+
+	if (!_uhi_mutex_trylock(&m->mtx_lock, m, file, line)) {
+		lock_profile_obtain_lock_failed(&m->lock_object, &contested,
+		    &waittime);
+		_uhi_mutex_lock(&m->mtx_lock, m, file, line);
+	}
+	lock_profile_obtain_lock_success(&m->lock_object, contested, waittime,
+	    file, line);
+#else
+	_uhi_mutex_lock(&m->mtx_lock, m, file, line);
+#endif
+}
+
 void
 _mtx_lock_flags(struct mtx *m, int opts, const char *file, int line)
 {
 
 	WITNESS_CHECKORDER(&m->lock_object, opts | LOP_NEWORDER | LOP_EXCLUSIVE,
 	    file, line, NULL);
-	_uhi_mutex_lock(&m->mtx_lock, m, file, line);
+	mtx_lock_profiled(m, file, line);
 	WITNESS_LOCK(&m->lock_object, opts | LOP_EXCLUSIVE, file, line);
 }
 
@@ -175,6 +206,7 @@ _mtx_unlock_flags(struct mtx *m, int opts, const char *file, int line)
 {
 
 	WITNESS_UNLOCK(&m->lock_object, opts | LOP_EXCLUSIVE, file, line);
+	lock_profile_release_lock(&m->lock_object);
 	_uhi_mutex_unlock(&m->mtx_lock, m, file, line);
 }
 
@@ -185,6 +217,8 @@ _mtx_trylock(struct mtx *m, int opts, const char *file, int line)
 
 	rval = _uhi_mutex_trylock(&m->mtx_lock, m, file, line);
 	if (rval) {
+		lock_profile_obtain_lock_success(&m->lock_object, 0, 0, file,
+		    line);
 		WITNESS_LOCK(&m->lock_object, opts | LOP_EXCLUSIVE | LOP_TRYLOCK,
 		    file, line);
 	}
@@ -198,7 +232,7 @@ _mtx_lock_spin_flags(struct mtx *m, int opts, const char *file, int line)
 
 	WITNESS_CHECKORDER(&m->lock_object, opts | LOP_NEWORDER | LOP_EXCLUSIVE,
 	    file, line, NULL);
-	_uhi_mutex_lock(&m->mtx_lock, m, file, line);
+	mtx_lock_profiled(m, file, line);
 	WITNESS_LOCK(&m->lock_object, opts | LOP_EXCLUSIVE, file, line);
 }
 
@@ -207,5 +241,115 @@ _mtx_unlock_spin_flags(struct mtx *m, int opts, const char *file, int line)
 {
 
 	WITNESS_UNLOCK(&m->lock_object, opts | LOP_EXCLUSIVE, file, line);
+	lock_profile_release_lock(&m->lock_object);
 	_uhi_mutex_unlock(&m->mtx_lock, m, file, line);
 }
+
+
+/*
+ * Contention counters kept by the host mutexes, summed by lock name.
+ * debug.mtx_stats lists the names with any acquisitions, and writing a
+ * non-zero value to debug.mtx_stats_reset clears the counters.
+ */
+#define	MTX_STATS_SLOTS	1024
+#define	MTX_STATS_NAMELEN	32
+
+struct mtx_stats_entry {
+	char			name[MTX_STATS_NAMELEN];
+	struct uhi_lock_stats	stats;
+};
+
+/*
+ * Called with a host registry lock held, so this only touches the table.
+ * Names are copied since the lock, and its name, may go away afterwards.
+ */
+static void
+mtx_stats_add(void *arg, const char *name, const struct uhi_lock_stats *stats)
+{
+	struct mtx_stats_entry *table = arg;
+	struct mtx_stats_entry *e;
+	const char *p;
+	u_int i, n;
+
+	if (stats->acquisitions == 0)
+		return;
+	if (name == NULL)
+		name = "(unnamed)";
+
+	/* Open addressing on the name; the last slot is overflow */
+	i = 0;
+	for (p = name; *p != '\0' && p - name < MTX_STATS_NAMELEN - 1; p++)
+		i = i * 31 + (u_char)*p;
+	i %= MTX_STATS_SLOTS - 1;
+	for (n = 0; n < MTX_STATS_SLOTS - 1; n++) {
+		e = &table[i];
+		if (e->name[0] == '\0' ||
+		    strncmp(e->name, name, MTX_STATS_NAMELEN - 1) == 0)
+			break;
+		i = (i + 1) % (MTX_STATS_SLOTS - 1);
+	}
+	if (n == MTX_STATS_SLOTS - 1) {
+		e = &table[MTX_STATS_SLOTS - 1];
+		name = "(other)";
+	}
+	if (e->name[0] == '\0')
+		strlcpy(e->name, name, sizeof(e->name));
+	e->stats.acquisitions += stats->acquisitions;
+	e->stats.contended += stats->contended;
+	e->stats.parked += stats->parked;
+	e->stats.spin_ns += stats->spin_ns;
+	e->stats.park_ns += stats->park_ns;
+}
+
+static int
+sysctl_debug_mtx_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct mtx_stats_entry *table, *e;
+	struct sbuf sb;
+	int error, i;
+
+	table = malloc(sizeof(*table) * MTX_STATS_SLOTS, M_TEMP,
+	    M_WAITOK | M_ZERO);
+	uhi_mutex_foreach_stats(mtx_stats_add, table);
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		goto out;
+	sbuf_new_for_sysctl(&sb, NULL, 128, req);
+	sbuf_printf(&sb, "\n%12s %12s %12s %12s %12s name\n",
+	    "acquisitions", "contended", "parked", "spin_us", "park_us");
+	for (i = 0; i < MTX_STATS_SLOTS; i++) {
+		e = &table[i];
+		if (e->name[0] == '\0')
+			continue;
+		sbuf_printf(&sb, "%12ju %12ju %12ju %12ju %12ju %s\n",
+		    (uintmax_t)e->stats.acquisitions,
+		    (uintmax_t)e->stats.contended,
+		    (uintmax_t)e->stats.parked,
+		    (uintmax_t)e->stats.spin_ns / 1000,
+		    (uintmax_t)e->stats.park_ns / 1000, e->name);
+	}
+	error = sbuf_finish(&sb);
+	sbuf_delete(&sb);
+out:
+	free(table, M_TEMP);
+	return (error);
+}
+SYSCTL_PROC(_debug, OID_AUTO, mtx_stats, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, sysctl_debug_mtx_stats, "A",
+    "Mutex contention counters by lock name");
+
+static int
+sysctl_debug_mtx_stats_reset(SYSCTL_HANDLER_ARGS)
+{
+	int error, v;
+
+	v = 0;
+	error = sysctl_handle_int(oidp, &v, 0, req);
+	if (error == 0 && req->newptr != NULL && v != 0)
+		uhi_mutex_reset_all_stats();
+	return (error);
+}
+SYSCTL_PROC(_debug, OID_AUTO, mtx_stats_reset, CTLTYPE_INT | CTLFLAG_RW,
+    NULL, 0, sysctl_debug_mtx_stats_reset, "I",
+    "Reset the mutex contention counters");
@@ -31,11 +31,35 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/conf.h>
+#include <sys/kernel.h>
+#include <sys/malloc.h>
 #include <sys/rmlock.h>
 #include <sys/proc.h>
+#include <sys/smp.h>
+
+#include <machine/atomic.h>
+#include <machine/cpu.h>
 
 #include "uinet_host_interface.h"
 
+/*
+ * A read lock increments the reader count of the calling thread's cpu
+ * slot and then checks for a writer.  A write lock sets rm_writer and
+ * then waits for all of the slot reader counts to drop to zero.  Each
+ * side makes its store visible before it loads the other side's state,
+ * so either the reader sees the writer and backs out, or the writer sees
+ * the reader and waits for it.
+ *
+ * A reader that backs out waits for the writer by acquiring and releasing
+ * rm_wlock, which the writer holds until it is done.  A thread that
+ * already holds a read lock on the rmlock does not back out, as the
+ * writer would otherwise wait forever for its count to drain.
+ */
+
+#define	RM_WRITER_SPINS	100
+
+static MALLOC_DEFINE(M_RMLOCK, "rmlock", "rmlock per-cpu reader counts");
+
 static void
 assert_rm(struct lock_object *lock, int what)
 {
@@ -73,48 +97,121 @@ rm_init_flags(struct rmlock *rm, const char *name, int opts)
 		liflags |= LO_WITNESS;
 	if (opts & RM_RECURSE)
 		liflags |= LO_RECURSABLE;
-	/* XXX validate - do we need more? */
-#if 0
-        if (opts & RM_SLEEPABLE) {
-                liflags |= RM_SLEEPABLE;
-                sx_init_flags(&rm->rm_lock_sx, "rmlock_sx", SX_RECURSE);
-        } else
-                mtx_init(&rm->rm_lock_mtx, name, "rmlock_mtx", MTX_NOWITNESS);
-#endif
 
 	lock_init(&rm->lock_object, &lock_class_rm, name, NULL, liflags);
-	if (0 != uhi_rwlock_init(&rm->rm_lock, opts & RM_RECURSE ? UHI_RW_WRECURSE : 0))
-		panic("Could not initialize rmlock");
+
+	rm->rm_writer = 0;
+	rm->rm_wrecurse = 0;
+	rm->rm_ncpus = mp_ncpus;
+	rm->rm_pcpu_mem = malloc(sizeof(struct rm_pcpu) * rm->rm_ncpus +
+	    CACHE_LINE_SIZE, M_RMLOCK, M_WAITOK | M_ZERO);
+	rm->rm_pcpu = (struct rm_pcpu *)roundup2((uintptr_t)rm->rm_pcpu_mem,
+	    CACHE_LINE_SIZE);
+	mtx_init(&rm->rm_wlock, name, "rmlock writer",
+	    MTX_NOWITNESS | (opts & RM_RECURSE ? MTX_RECURSE : 0));
 }
 
 void
 rm_destroy(struct rmlock *rm)
 {
 
-	uhi_rwlock_destroy(&rm->rm_lock);
+	mtx_destroy(&rm->rm_wlock);
+	free(rm->rm_pcpu_mem, M_RMLOCK);
+}
+
+void
+rm_sysinit(void *arg)
+{
+	struct rm_args *args = arg;
+
+	rm_init(args->ra_rm, args->ra_desc);
+}
+
+void
+rm_sysinit_flags(void *arg)
+{
+	struct rm_args_flags *args = arg;
+
+	rm_init_flags(args->ra_rm, args->ra_desc, args->ra_opts);
 }
 
 void
 _rm_wlock(struct rmlock *rm)
 {
-	_uhi_rwlock_wlock(&rm->rm_lock, rm, NULL, 0);
+	struct rm_pcpu *pc;
+	u_int cpu;
+	int spins;
+
+	mtx_lock(&rm->rm_wlock);
+	if (rm->rm_wrecurse++ > 0)
+		return;
+
+	rm->rm_writer = 1;
+	mb();
+
+	for (cpu = 0; cpu < rm->rm_ncpus; cpu++) {
+		pc = &rm->rm_pcpu[cpu];
+		spins = 0;
+		while (pc->rp_readers != 0) {
+			if (spins < RM_WRITER_SPINS) {
+				spins++;
+				cpu_spinwait();
+			} else
+				uhi_thread_yield();
+		}
+	}
 }
 
 void
 _rm_wunlock(struct rmlock *rm)
 {
 
-	_uhi_rwlock_wunlock(&rm->rm_lock, rm, NULL, 0);
+	if (--rm->rm_wrecurse == 0)
+		atomic_store_rel_int(&rm->rm_writer, 0);
+	mtx_unlock(&rm->rm_wlock);
+}
+
+static int
+rm_reader_owned(struct thread *td, struct rmlock *rm)
+{
+	struct rm_priotracker *tracker;
+
+	for (tracker = td->td_rmtrackers; tracker != NULL;
+	     tracker = tracker->rmp_next)
+		if (tracker->rmp_rmlock == rm)
+			return (1);
+	return (0);
 }
 
 int
 _rm_rlock(struct rmlock *rm, struct rm_priotracker *tracker, int trylock)
 {
+	struct thread *td = curthread;
+	struct rm_pcpu *pc;
+
+	KASSERT(td->td_oncpu < rm->rm_ncpus,
+	    ("_rm_rlock: cpu slot %d out of range", td->td_oncpu));
+
+	tracker->rmp_rmlock = rm;
+	tracker->rmp_slot = td->td_oncpu;
+	pc = &rm->rm_pcpu[tracker->rmp_slot];
 
-	if (trylock)
-		return _uhi_rwlock_tryrlock(&rm->rm_lock, rm, NULL, 0);
+	for (;;) {
+		atomic_add_int(&pc->rp_readers, 1);
+		mb();
+		if (rm->rm_writer == 0 || rm_reader_owned(td, rm))
+			break;
+
+		atomic_subtract_rel_int(&pc->rp_readers, 1);
+		if (trylock)
+			return (0);
+		mtx_lock(&rm->rm_wlock);
+		mtx_unlock(&rm->rm_wlock);
+	}
+
+	tracker->rmp_next = td->td_rmtrackers;
+	td->td_rmtrackers = tracker;
 
-	_uhi_rwlock_rlock(&rm->rm_lock, rm, NULL, 0);
 	return (1);
 }
 
@@ -122,8 +219,15 @@ _rm_rlock(struct rmlock *rm, struct rm_priotracker *tracker, int trylock)
 void
 _rm_runlock(struct rmlock *rm,  struct rm_priotracker *tracker)
 {
+	struct thread *td = curthread;
+	struct rm_priotracker **trp;
+
+	for (trp = &td->td_rmtrackers; *trp != tracker;
+	     trp = &(*trp)->rmp_next)
+		KASSERT(*trp != NULL, ("_rm_runlock: tracker not found"));
+	*trp = tracker->rmp_next;
 
-	_uhi_rwlock_runlock(&rm->rm_lock, rm, NULL, 0);
+	atomic_subtract_rel_int(&rm->rm_pcpu[tracker->rmp_slot].rp_readers, 1);
 }
 
 #if LOCK_DEBUG > 0
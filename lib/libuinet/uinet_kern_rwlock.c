@@ -43,10 +43,38 @@ assert_rw(struct lock_object *lock, int what)
 	rw_assert((struct rwlock *)lock, what);
 }
 
+/*
+ * The host rwlock is a single exclusive lock, so a held rwlock is
+ * released and reacquired as a write lock whichever way it was taken.
+ */
+static void
+lock_rw(struct lock_object *lock, int how)
+{
+	struct rwlock *rw;
+
+	rw = (struct rwlock *)lock;
+	if (how)
+		rw_wlock(rw);
+	else
+		rw_rlock(rw);
+}
+
+static int
+unlock_rw(struct lock_object *lock)
+{
+	struct rwlock *rw;
+
+	rw = (struct rwlock *)lock;
+	rw_wunlock(rw);
+	return (1);
+}
+
 struct lock_class lock_class_rw = {
 	.lc_name = "rw",
 	.lc_flags = LC_SLEEPLOCK | LC_RECURSABLE | LC_UPGRADABLE,
 	.lc_assert = assert_rw,
+	.lc_lock = lock_rw,
+	.lc_unlock = unlock_rw,
 #ifdef DDB
 	.lc_ddb_show = db_show_rwlock,
 #endif
@@ -98,13 +126,36 @@ rw_destroy(struct rwlock *rw)
 	uhi_rwlock_destroy(&rw->rw_lock);
 }
 
+/*
+ * With lock profiling, a trylock is made first so that contested
+ * acquisitions, and the time spent waiting in them, can be told apart.
+ */
+#ifdef LOCK_PROFILING
+#define	RW_LOCK_PROFILED(rw, try, lock, file, line) do {			\
+	uint64_t waittime = 0;							\
+	int contested = 0;							\
+										\
+	if (!try(&(rw)->rw_lock, (rw), (file), (line))) {			\
+		lock_profile_obtain_lock_failed(&(rw)->lock_object,		\
+		    &contested, &waittime);					\
+		lock(&(rw)->rw_lock, (rw), (file), (line));			\
+	}									\
+	lock_profile_obtain_lock_success(&(rw)->lock_object, contested,	\
+	    waittime, (file), (line));						\
+} while (0)
+#else
+#define	RW_LOCK_PROFILED(rw, try, lock, file, line)				\
+	lock(&(rw)->rw_lock, (rw), (file), (line))
+#endif
+
 void
 _rw_wlock(struct rwlock *rw, const char *file, int line)
 {
 
 	WITNESS_CHECKORDER(&rw->lock_object, LOP_NEWORDER | LOP_EXCLUSIVE, file,
 	    line, NULL);
-	_uhi_rwlock_wlock(&rw->rw_lock, rw, file, line);
+	RW_LOCK_PROFILED(rw, _uhi_rwlock_trywlock, _uhi_rwlock_wlock, file,
+	    line);
 	WITNESS_LOCK(&rw->lock_object, LOP_EXCLUSIVE, file, line);
 }
 
@@ -115,6 +166,8 @@ _rw_try_wlock(struct rwlock *rw, const char *file, int line)
 
 	rval = _uhi_rwlock_trywlock(&rw->rw_lock, rw, file, line);
 	if (rval) {
+		lock_profile_obtain_lock_success(&rw->lock_object, 0, 0, file,
+		    line);
 		WITNESS_LOCK(&rw->lock_object, LOP_EXCLUSIVE | LOP_TRYLOCK,
 		    file, line);
 	}
@@ -126,6 +179,7 @@ _rw_wunlock(struct rwlock *rw, const char *file, int line)
 {
 
 	WITNESS_UNLOCK(&rw->lock_object, LOP_EXCLUSIVE, file, line);
+	lock_profile_release_lock(&rw->lock_object);
 	_uhi_rwlock_wunlock(&rw->rw_lock, rw, file, line);
 }
 
@@ -133,7 +187,8 @@ void
 _rw_rlock(struct rwlock *rw, const char *file, int line)
 {
 	WITNESS_CHECKORDER(&rw->lock_object, LOP_NEWORDER, file, line, NULL);
-	_uhi_rwlock_rlock(&rw->rw_lock, rw, file, line);
+	RW_LOCK_PROFILED(rw, _uhi_rwlock_tryrlock, _uhi_rwlock_rlock, file,
+	    line);
 	WITNESS_LOCK(&rw->lock_object, 0, file, line);
 }
 
@@ -143,6 +198,8 @@ _rw_try_rlock(struct rwlock *rw, const char *file, int line)
 	int rval;
 	rval = _uhi_rwlock_tryrlock(&rw->rw_lock, rw, file, line);
 	if (rval) {
+		lock_profile_obtain_lock_success(&rw->lock_object, 0, 0, file,
+		    line);
 		WITNESS_LOCK(&rw->lock_object, LOP_TRYLOCK, file, line);
 	}
 	return (rval);
@@ -153,6 +210,7 @@ _rw_runlock(struct rwlock *rw, const char *file, int line)
 {
 
 	WITNESS_UNLOCK(&rw->lock_object, 0, file, line);
+	lock_profile_release_lock(&rw->lock_object);
 	_uhi_rwlock_runlock(&rw->rw_lock, rw, file, line);
 }
 
@@ -36,9 +36,37 @@
 
 #include "uinet_host_interface.h"
 
+/*
+ * The host rwlock is a single exclusive lock, so a held sx lock is
+ * released and reacquired as an exclusive lock whichever way it was taken.
+ */
+static void
+lock_sx(struct lock_object *lock, int how)
+{
+	struct sx *sx;
+
+	sx = (struct sx *)lock;
+	if (how)
+		sx_xlock(sx);
+	else
+		sx_slock(sx);
+}
+
+static int
+unlock_sx(struct lock_object *lock)
+{
+	struct sx *sx;
+
+	sx = (struct sx *)lock;
+	sx_xunlock(sx);
+	return (1);
+}
+
 struct lock_class lock_class_sx = {
 	.lc_name = "sx",
 	.lc_flags = LC_SLEEPLOCK | LC_SLEEPABLE | LC_RECURSABLE | LC_UPGRADABLE,
+	.lc_lock = lock_sx,
+	.lc_unlock = unlock_sx,
 #ifdef DDB
 	.lc_ddb_show = db_show_sx,
 #endif
@@ -62,74 +62,79 @@ __FBSDID("$FreeBSD$");
 int	hogticks;
 static int pause_wchan;
 
-typedef struct sleep_entry {
-	LIST_ENTRY(sleep_entry) list_entry;
-	void 		*chan;
-	const char 	*wmesg;
-	struct cv	cond;
-	int		waiters;
-} *sleep_entry_t;
+/*
+ * Sleeping threads are kept on hashed sleep queue chains, each with its own
+ * lock, so unrelated sleeps and wakeups don't contend.  Each thread has its
+ * own preallocated linkage and condition variable in td_sleep, and waits on
+ * that condition variable using the chain lock, which is held from the
+ * point the thread is queued until it is asleep so that no wakeup can be
+ * lost, whether or not the waker holds the caller's lock.  wakeup()
+ * removes threads from the chain as it wakes them.
+ */
+struct synch_chain {
+	struct mtx	sc_lock;
+	TAILQ_HEAD(, thread_sleep) sc_sleepers;
+} __aligned(CACHE_LINE_SIZE);
+
+#define	SYNCH_CHAINS_PER_CPU	64
+#define	SYNCH_HASH(wc)	((((uintptr_t)(wc) >> 10) ^ (uintptr_t)(wc)) & synch_mask)
+
+static struct synch_chain *synch_chains;
+static u_long synch_mask;
 
 static void synch_setup(void *dummy);
 SYSINIT(synch_setup, SI_SUB_INTR, SI_ORDER_FIRST, synch_setup,
     NULL);
 
-static struct se_head *se_active;
-static u_long se_hashmask;
-static struct mtx synch_lock;
-#define SE_HASH(chan)	(((uintptr_t)chan) & se_hashmask)
-LIST_HEAD(se_head, sleep_entry);
-
 static void
 synch_setup(void *arg)
 {
-	mtx_init(&synch_lock, "synch_lock", NULL, MTX_DEF);
+	u_long nchains;
+	u_long i;
 
-	se_active = hashinit(64, M_TEMP, &se_hashmask);
-}
+	nchains = 1;
+	while (nchains < SYNCH_CHAINS_PER_CPU * mp_ncpus)
+		nchains <<= 1;
 
-static sleep_entry_t
-se_alloc(void *chan, const char *wmesg)
-{
-	sleep_entry_t se;
-	struct se_head *hash_list;
-
-	se = malloc(sizeof(*se), M_DEVBUF, 0);
-	se->chan = chan;
-	se->wmesg = wmesg;
-	se->waiters = 1;
-	cv_init(&se->cond, "sleep entry cv");
-
-	/* insert in hash table */
-	hash_list = &se_active[SE_HASH(chan)];
-	LIST_INSERT_HEAD(hash_list, se, list_entry);
-	
-	return (se);
+	synch_chains = malloc(nchains * sizeof(struct synch_chain), M_DEVBUF, M_WAITOK | M_ZERO);
+	synch_mask = nchains - 1;
+
+	for (i = 0; i < nchains; i++) {
+		mtx_init(&synch_chains[i].sc_lock, "synch chain", NULL, MTX_DEF);
+		TAILQ_INIT(&synch_chains[i].sc_sleepers);
+	}
 }
 
-static sleep_entry_t
-se_lookup(void *chan)
+/*
+ * Queue the current thread on ident's chain and wait until it is woken or
+ * the timeout expires.  The chain lock must be held on entry, and is
+ * released on return.
+ */
+static int
+synch_wait(struct synch_chain *sc, void *ident, const char *wmesg, int timo)
 {
-	struct se_head *hash_list;
-	sleep_entry_t se;
+	struct thread_sleep *ts = &curthread->td_sleep;
+	int rv = 0;
 
-	hash_list = &se_active[SE_HASH(chan)];
-	LIST_FOREACH(se, hash_list, list_entry) 
-		if (se->chan == chan)
-			return (se);
+	ts->ts_chan = ident;
+	ts->ts_wmesg = wmesg;
+	ts->ts_woken = 0;
+	TAILQ_INSERT_TAIL(&sc->sc_sleepers, ts, ts_link);
 
-	return (NULL);
-}
+	if (timo)
+		rv = cv_timedwait(&ts->ts_cv, &sc->sc_lock, timo);
+	else
+		while (!ts->ts_woken)
+			cv_wait(&ts->ts_cv, &sc->sc_lock);
 
-static void
-se_free(sleep_entry_t se)
-{
+	if (ts->ts_woken)
+		rv = 0;
+	else
+		TAILQ_REMOVE(&sc->sc_sleepers, ts, ts_link);
+	ts->ts_chan = NULL;
+	mtx_unlock(&sc->sc_lock);
 
-	if (--se->waiters == 0) {
-		LIST_REMOVE(se, list_entry);
-		cv_destroy(&se->cond);
-		free(se, M_DEVBUF);
-	}
+	return (rv);
 }
 
 /*
@@ -151,37 +156,25 @@ int
 _sleep(void *ident, struct lock_object *lock, int priority,
     const char *wmesg, int timo)
 {
-	sleep_entry_t se = NULL;
-	int rv = 0;
-	struct mtx *m = (struct mtx *)lock;
+	struct synch_chain *sc;
+	struct lock_class *class = NULL;
+	int lock_state = 0;
+	int rv;
+
+	sc = &synch_chains[SYNCH_HASH(ident)];
+	mtx_lock(&sc->sc_lock);
 
 	if (lock) {
-		mtx_lock(&synch_lock);
-		if ((se = se_lookup(ident)) != NULL)
-			se->waiters++;
-		else
-			se = se_alloc(ident, wmesg);
-		mtx_unlock(&synch_lock);
+		class = LOCK_CLASS(lock);
+		KASSERT(class->lc_unlock != NULL,
+		    ("_sleep: unsupported lock class %s", class->lc_name));
+		lock_state = class->lc_unlock(lock);
 	}
 
-	if (timo) {
-		if (lock) {
-			rv = cv_timedwait(&se->cond, m, timo);
-		} else {
-			uint64_t nsecs = ((uint64_t)timo * (1000UL*1000UL*1000UL)) / hz;
-			uhi_nanosleep(nsecs);
-			rv = EWOULDBLOCK;
-		}
+	rv = synch_wait(sc, ident, wmesg, timo);
 
-	} else if (lock) {
-		cv_wait(&se->cond, m);
-	}
-
-	if (lock) {
-		mtx_lock(&synch_lock);
-		se_free(se);
-		mtx_unlock(&synch_lock);
-	}
+	if (lock && !(priority & PDROP))
+		class->lc_lock(lock, lock_state);
 
 	return (rv);
 }
@@ -189,24 +182,16 @@ _sleep(void *ident, struct lock_object *lock, int priority,
 int
 msleep_spin(void *ident, struct mtx *mtx, const char *wmesg, int timo)
 {
-	sleep_entry_t se;
-	int rv = 0;
+	struct synch_chain *sc;
+	int rv;
 
-	mtx_lock(&synch_lock);
-	if ((se = se_lookup(ident)) != NULL)
-		se->waiters++;
-	else
-		se = se_alloc(ident, wmesg);
-	mtx_unlock(&synch_lock);
+	sc = &synch_chains[SYNCH_HASH(ident)];
+	mtx_lock(&sc->sc_lock);
+	mtx_unlock_spin(mtx);
 
-	if (timo)
-		rv = cv_timedwait(&se->cond, mtx, timo);
-	else
-		cv_wait(&se->cond, mtx);
+	rv = synch_wait(sc, ident, wmesg, timo);
 
-	mtx_lock(&synch_lock);
-	se_free(se);
-	mtx_unlock(&synch_lock);
+	mtx_lock_spin(mtx);
 
 	return (rv);
 }
@@ -228,27 +213,40 @@ pause(const char *wmesg, int timo)
 	return (tsleep(&pause_wchan, 0, wmesg, timo));
 }
 
+/*
+ * Wake up the first (wakeup_one) or all threads sleeping on chan.
+ */
+static void
+synch_wakeup(void *chan, int all)
+{
+	struct synch_chain *sc;
+	struct thread_sleep *ts, *tmp;
+
+	sc = &synch_chains[SYNCH_HASH(chan)];
+	mtx_lock(&sc->sc_lock);
+	TAILQ_FOREACH_SAFE(ts, &sc->sc_sleepers, ts_link, tmp) {
+		if (ts->ts_chan == chan) {
+			TAILQ_REMOVE(&sc->sc_sleepers, ts, ts_link);
+			ts->ts_woken = 1;
+			cv_signal(&ts->ts_cv);
+			if (!all)
+				break;
+		}
+	}
+	mtx_unlock(&sc->sc_lock);
+}
+
 void
 wakeup(void *chan)
 {
-	sleep_entry_t se;
-
-	mtx_lock(&synch_lock);
-	if ((se = se_lookup(chan)) != NULL)
-		cv_broadcast(&se->cond);
-	mtx_unlock(&synch_lock);
+	synch_wakeup(chan, 1);
 }
 
 
 void
 wakeup_one(void *chan)
 {
-	sleep_entry_t se;
-
-	mtx_lock(&synch_lock);
-	if ((se = se_lookup(chan)) != NULL)
-		cv_signal(&se->cond);
-	mtx_unlock(&synch_lock);
+	synch_wakeup(chan, 0);
 }
 
 void
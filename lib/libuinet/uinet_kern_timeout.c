@@ -67,6 +67,7 @@ extern int errno;
 
 int min_to_ticks = 1000000;
 
+static void clock_wakeup(int tick);
 static void timer_intr(void *arg);
 
 static int avg_depth;
@@ -82,9 +83,19 @@ static int avg_mpcalls;
 SYSCTL_INT(_debug, OID_AUTO, to_avg_mpcalls, CTLFLAG_RD, &avg_mpcalls, 0,
     "Average number of MP callouts made per softclock call. Units = 1/1000");
 /*
- * TODO:
- *	allocate more timeout table slots when table overflows.
+ * The wheel and the timeout(9) table are sized for the busiest instance
+ * (see uinet_init()), but both live in untouched zero-filled memory and
+ * are set up as they are used, so an idle instance neither pays for
+ * initializing them at boot nor keeps them resident.  A wheel bucket with
+ * a NULL tqh_last has never been used and is empty; it is initialized on
+ * its first insertion.  Entries of cc_callout beyond cc_callout_used have
+ * never been handed out by timeout() and are not on cc_callfree.
  */
+#define	CALLWHEEL_BUCKET_INIT(b) do {					\
+	if ((b)->tqh_last == NULL)					\
+		TAILQ_INIT(b);						\
+} while (0)
+
 int callwheelsize, callwheelbits, callwheelmask;
 
 struct cv callout_cv;
@@ -94,12 +105,15 @@ struct callout_cpu {
 	struct callout		*cc_callout;
 	struct callout_tailq	*cc_callwheel;
 	struct callout_list	cc_callfree;
+	int			cc_callout_used;
 	struct callout		*cc_next;
 	struct callout		*cc_curr;
 	void			*cc_cookie;
 	int 			cc_softticks;
 	int			cc_cancel;
 	int			cc_waiting;
+	int			cc_running;
+	int			cc_owners;
 };
 
 #ifdef SMP
@@ -116,10 +130,46 @@ struct callout_cpu cc_cpu;
 
 static int timeout_cpu;
 
+/*
+ * The clock thread sleeps until an absolute deadline on the monotonic
+ * clock.  When the callout wheels are empty for the next several ticks it
+ * skips them, sleeping until the first tick that has work (but no more
+ * than 1/clock_idle_hz seconds), and issues the skipped ticks as a batch
+ * when it wakes.
+ *
+ * clock_next_tick is the value ticks will have after the next wakeup.  It
+ * is only written under clock_lock.  Before scanning the wheels, the clock
+ * thread raises it to the furthest it could sleep, then lowers it to the
+ * first tick it found work for.  callout_reset_on() compares a newly
+ * scheduled callout against it under that wheel's cc_lock, so either the
+ * scan sees the callout or the comparison sees the raised value and pulls
+ * the wakeup in with clock_wakeup().  clock_lock and cc_lock are never
+ * held together.
+ */
+static struct uhi_timer clock_timer;
+static struct mtx clock_lock;
+static uint64_t clock_base;		/* monotonic ns at tick 0 */
+static uint64_t clock_issued;		/* ticks issued since clock_base */
+static volatile int clock_next_tick;
+static int clock_idle_max;		/* most ticks skipped per sleep */
+static int clock_owner_lag;		/* ticks before taking over a wheel */
+
+static int clock_idle_hz = 100;
+TUNABLE_INT("kern.clock_idle_hz", &clock_idle_hz);
+SYSCTL_INT(_kern, OID_AUTO, clock_idle_hz, CTLFLAG_RDTUN, &clock_idle_hz, 0,
+    "Minimum clock thread wakeup rate while idle, 0 to wake every tick");
+
 MALLOC_DEFINE(M_CALLOUT, "callout", "Callout datastructures");
 
 /**
  * Locked by cc_lock:
+ *   cc_running      - softclock() is processing this wheel.  Only one
+ *                     thread at a time may do so.
+ *   cc_owners       - Number of threads that have claimed this wheel
+ *                     with uinet_callout_claim() and run it via
+ *                     uinet_callout_poll().  The clock thread leaves a
+ *                     claimed wheel to its owners unless they fall more
+ *                     than clock_owner_lag ticks behind.
  *   cc_curr         - If a callout is in progress, it is curr_callout.
  *                     If curr_callout is non-NULL, threads waiting in
  *                     callout_drain() will be woken up as soon as the
@@ -171,22 +221,10 @@ kern_timeout_callwheel_alloc(caddr_t v)
 static void
 callout_cpu_init(struct callout_cpu *cc)
 {
-	struct callout *c;
-	int i;
 
 	mtx_init(&cc->cc_lock, "callout mtx", NULL, MTX_DEF);
 	SLIST_INIT(&cc->cc_callfree);
-	for (i = 0; i < callwheelsize; i++)
-		TAILQ_INIT(&cc->cc_callwheel[i]);
-
-	if (cc->cc_callout == NULL)
-		return;
-	for (i = 0; i < ncallout; i++) {
-		c = &cc->cc_callout[i];
-		callout_init(c, 0);
-		c->c_flags = CALLOUT_LOCAL_ALLOC;
-		SLIST_INSERT_HEAD(&cc->cc_callfree, c, c_links.sle);
-	}
+	cc->cc_callout_used = 0;
 }
 
 /*
@@ -216,65 +254,159 @@ start_softclock(void *dummy)
 	int cpu;
 #endif
 	cc = CC_CPU(timeout_cpu);
-#if 0
-	if (swi_add(&clk_intr_event, "clock", softclock, cc, SWI_CLOCK,
-	    INTR_MPSAFE, &softclock_ih))
-		panic("died while creating standard software ithreads");
-#endif
-	if (kthread_add(timer_intr, cc, NULL, (void *)&softclock_ih, 0, 0, "clock"))
-		panic("died while creating standard software ithreads");
 
-	cc->cc_cookie = softclock_ih;
+	mtx_init(&clock_lock, "clock", NULL, MTX_DEF);
+	if (0 != uhi_timer_init(&clock_timer))
+		panic("could not create clock timer");
+	clock_idle_max = 1;
+	if ((clock_idle_hz > 0) && (hz > clock_idle_hz))
+		clock_idle_max = hz / clock_idle_hz;
+	clock_owner_lag = hz / 1000;
+	if (clock_owner_lag < 1)
+		clock_owner_lag = 1;
 
 #ifdef SMP
+	/*
+	 * The other cpus' wheels are run by the clock thread or by the
+	 * threads that claim them, so there are no per-cpu softclock swis.
+	 * They must exist before the clock thread starts.
+	 */
 	for (cpu = 0; cpu <= mp_maxid; cpu++) {
 		if (cpu == timeout_cpu)
 			continue;
 		if (CPU_ABSENT(cpu))
 			continue;
 		cc = CC_CPU(cpu);
-		if (swi_add(NULL, "clock", softclock, cc, SWI_CLOCK,
-		    INTR_MPSAFE, &cc->cc_cookie))
-			panic("died while creating standard software ithreads");
 		cc->cc_callout = NULL;	/* Only cpu0 handles timeout(). */
 		cc->cc_callwheel = malloc(
 		    sizeof(struct callout_tailq) * callwheelsize, M_CALLOUT,
-		    M_WAITOK);
+		    M_WAITOK | M_ZERO);
 		callout_cpu_init(cc);
 	}
 #endif
+
+	cc = CC_CPU(timeout_cpu);
+#if 0
+	if (swi_add(&clk_intr_event, "clock", softclock, cc, SWI_CLOCK,
+	    INTR_MPSAFE, &softclock_ih))
+		panic("died while creating standard software ithreads");
+#endif
+	if (kthread_add(timer_intr, cc, NULL, (void *)&softclock_ih, 0, 0, "clock"))
+		panic("died while creating standard software ithreads");
+
+	cc->cc_cookie = softclock_ih;
 }
 
 SYSINIT(start_softclock, SI_SUB_SOFTINTR, SI_ORDER_FIRST, start_softclock, NULL);
 
-void
-callout_tick(void)
+/*
+ * Advance the wheel past empty buckets and run softclock() if callouts are
+ * due, unless another thread is already running the wheel.  If lag is
+ * non-negative, the callouts are only run if they have been due for more
+ * than lag ticks.
+ */
+static void
+callout_cpu_tick(struct callout_cpu *cc, int lag)
 {
-	struct callout_cpu *cc;
 	int need_softclock;
 	int bucket;
 
-	/*
-	 * Process callouts at a very low cpu priority, so we don't keep the
-	 * relatively high clock interrupt priority any longer than necessary.
-	 */
 	need_softclock = 0;
-	cc = CC_SELF();
 	mtx_lock(&cc->cc_lock);
-	for (; (cc->cc_softticks - ticks) < 0; cc->cc_softticks++) {
-		bucket = cc->cc_softticks & callwheelmask;
-		if (!TAILQ_EMPTY(&cc->cc_callwheel[bucket])) {
-			need_softclock = 1;
-			break;
+	if (!cc->cc_running) {
+		for (; (cc->cc_softticks - ticks) < 0; cc->cc_softticks++) {
+			bucket = cc->cc_softticks & callwheelmask;
+			if (!TAILQ_EMPTY(&cc->cc_callwheel[bucket])) {
+				need_softclock = 1;
+				break;
+			}
 		}
+		if (need_softclock && (lag >= 0) &&
+		    (ticks - cc->cc_softticks <= lag))
+			need_softclock = 0;
+		if (need_softclock)
+			cc->cc_running = 1;
 	}
 	mtx_unlock(&cc->cc_lock);
+
+	if (need_softclock) {
+		softclock(cc);
+		mtx_lock(&cc->cc_lock);
+		cc->cc_running = 0;
+		mtx_unlock(&cc->cc_lock);
+	}
+}
+
+
+void
+callout_tick(void)
+{
+#ifdef SMP
+	struct callout_cpu *cc;
+	int cpu;
+#endif
+
 	/*
-	 * swi_sched acquires the thread lock, so we don't want to call it
-	 * with cc_lock held; incorrect locking order.
+	 * The clock thread is not necessarily in timeout_cpu's slot, so
+	 * name the wheel it drives explicitly rather than using CC_SELF().
 	 */
-	if (need_softclock)
-		softclock(cc);
+	callout_cpu_tick(CC_CPU(timeout_cpu), -1);
+
+#ifdef SMP
+	for (cpu = 0; cpu <= mp_maxid; cpu++) {
+		if (cpu == timeout_cpu)
+			continue;
+		if (CPU_ABSENT(cpu))
+			continue;
+		cc = CC_CPU(cpu);
+		callout_cpu_tick(cc, cc->cc_owners ? clock_owner_lag : -1);
+	}
+#endif
+}
+
+
+/*
+ * Make the calling thread responsible for running its cpu's callout wheel
+ * via uinet_callout_poll(), typically a receive thread bound to that cpu
+ * so that the timers of the connections it receives run there too.  The
+ * thread must not change cpus until it calls uinet_callout_release().
+ */
+void
+uinet_callout_claim(void)
+{
+	struct callout_cpu *cc;
+
+	cc = CC_SELF();
+	CC_LOCK(cc);
+	cc->cc_owners++;
+	CC_UNLOCK(cc);
+}
+
+
+void
+uinet_callout_release(void)
+{
+	struct callout_cpu *cc;
+
+	cc = CC_SELF();
+	CC_LOCK(cc);
+	KASSERT(cc->cc_owners > 0, ("uinet_callout_release: not claimed"));
+	cc->cc_owners--;
+	CC_UNLOCK(cc);
+}
+
+
+/*
+ * Run any callouts that are due on the calling thread's cpu.
+ */
+void
+uinet_callout_poll(void)
+{
+	struct callout_cpu *cc;
+
+	cc = CC_SELF();
+	if (cc->cc_softticks != ticks)
+		callout_cpu_tick(cc, -1);
 }
 
 static struct callout_cpu *
@@ -523,10 +655,14 @@ timeout(ftn, arg, to_ticks)
 	CC_LOCK(cc);
 	/* Fill in the next free callout structure. */
 	new = SLIST_FIRST(&cc->cc_callfree);
-	if (new == NULL)
-		/* XXX Attempt to malloc first */
+	if (new != NULL)
+		SLIST_REMOVE_HEAD(&cc->cc_callfree, c_links.sle);
+	else if (cc->cc_callout_used < ncallout) {
+		new = &cc->cc_callout[cc->cc_callout_used++];
+		callout_init(new, 0);
+		new->c_flags = CALLOUT_LOCAL_ALLOC;
+	} else
 		panic("timeout table full");
-	SLIST_REMOVE_HEAD(&cc->cc_callfree, c_links.sle);
 	callout_reset(new, to_ticks, ftn, arg);
 	handle.callout = new;
 	CC_UNLOCK(cc);
@@ -584,6 +720,7 @@ callout_reset_on(struct callout *c, int to_ticks, void (*ftn)(void *),
 {
 	struct callout_cpu *cc;
 	int cancelled = 0;
+	int wakeup_tick;
 
 	/*
 	 * Don't allow migration of pre-allocated callouts lest they
@@ -626,7 +763,15 @@ retry:
 	/*
 	 * If the lock must migrate we have to check the state again as
 	 * we can't hold both the new and old locks simultaneously.
+	 *
+	 * There is no deferred migration here, so a callout that is
+	 * running is rescheduled on the wheel it is running from and only
+	 * moves when it is next reset while idle.  Otherwise it could run
+	 * on two wheels at once, and callout_stop() and callout_drain()
+	 * would wait on the wrong wheel's cc_curr.
 	 */
+	if (c->c_cpu != cpu && cc->cc_curr == c)
+		cpu = c->c_cpu;
 	if (c->c_cpu != cpu) {
 		c->c_cpu = cpu;
 		CC_UNLOCK(cc);
@@ -642,12 +787,24 @@ retry:
 	c->c_flags |= (CALLOUT_ACTIVE | CALLOUT_PENDING);
 	c->c_func = ftn;
 	c->c_time = ticks + to_ticks;
+	CALLWHEEL_BUCKET_INIT(&cc->cc_callwheel[c->c_time & callwheelmask]);
 	TAILQ_INSERT_TAIL(&cc->cc_callwheel[c->c_time & callwheelmask], 
 			  c, c_links.tqe);
 	CTR5(KTR_CALLOUT, "%sscheduled %p func %p arg %p in %d",
 	    cancelled ? "re" : "", c, c->c_func, c->c_arg, to_ticks);
+
+	/*
+	 * The callout runs on the tick after c_time.  If the clock thread
+	 * is sleeping past that, wake it sooner.
+	 */
+	wakeup_tick = c->c_time + 1;
+	if (wakeup_tick - clock_next_tick >= 0)
+		wakeup_tick = 0;
 	CC_UNLOCK(cc);
 
+	if (wakeup_tick)
+		clock_wakeup(wakeup_tick);
+
 	return (cancelled);
 }
 
@@ -792,123 +949,204 @@ _callout_init_lock(c, lock, flags)
 }
 
 
-extern int     sched_get_priority_max(int);
-extern int     sched_get_priority_min(int);
+/*
+ * Monotonic time at which the given number of ticks since clock_base will
+ * have elapsed.  Computed from the tick count each time rather than by
+ * adding up tick periods so that rounding of the period doesn't drift.
+ */
+static uint64_t
+clock_deadline(uint64_t n)
+{
+
+	return (clock_base + (n / hz) * UHI_NSEC_PER_SEC +
+	    ((n % hz) * UHI_NSEC_PER_SEC) / hz);
+}
 
 
-static void
-timer_intr(void *arg)
+/*
+ * Ticks elapsed since clock_base at monotonic time now.
+ */
+static uint64_t
+clock_elapsed(uint64_t now)
 {
-	struct timespec base_tick_period, tick_period;
-	struct timespec start, target_period, delta;
-	int64_t sec;
-	long nsec;
-	int hardclocks;
-	const int calibration_period = 5;
-	int i;
+	uint64_t ns;
 
-	/* XXX arbitrary prioritization: If able to schedule as a real-time
-	 * thread, set to ~80% max real-time priority, otherwise set to max
-	 * time-sharing priority.
-	 */
+	ns = (now > clock_base) ? now - clock_base : 0;
 
-	if (0 != uhi_thread_setprio_rt(80)) {
-		printf("Warning: Timer interrupt thread will not run at real-time priority.\n");
-		if (0 != uhi_thread_setprio(80))
-			printf("Warning: Timer interrupt thread priority could not be adjusted.\n");
+	return ((ns / UHI_NSEC_PER_SEC) * hz +
+	    ((ns % UHI_NSEC_PER_SEC) * hz) / UHI_NSEC_PER_SEC);
+}
+
+
+/*
+ * Move the clock thread's next wakeup earlier so that ticks reaches the
+ * given value on time.
+ */
+static void
+clock_wakeup(int tick)
+{
+	int delta;
+
+	mtx_lock(&clock_lock);
+	if (tick - clock_next_tick < 0) {
+		clock_next_tick = tick;
+		delta = tick - ticks;
+		if (delta < 1)
+			delta = 1;
+		uhi_timer_set(&clock_timer, clock_deadline(clock_issued + delta));
 	}
+	mtx_unlock(&clock_lock);
+}
 
-	nsec = 1000000000UL / hz;
-	
-	delta.tv_sec = 0;
-	delta.tv_nsec = 0;
 
-	base_tick_period.tv_sec = 0;
-	base_tick_period.tv_nsec = nsec;
+/*
+ * Return the number of ticks, at most skip, until the wheel next needs to
+ * be run.  Callouts that are due when ticks becomes T are in the bucket
+ * for T - 1.
+ */
+static int
+clock_wheel_skip(struct callout_cpu *cc, int now, int skip)
+{
+	int t;
 
-	target_period.tv_sec = 0;
-	target_period.tv_nsec = 0;
-	for (i = 0; i < calibration_period; i++) {
-		timespecadd(&target_period, &base_tick_period);
+	CC_LOCK(cc);
+	if (cc->cc_softticks != now) {
+		/*
+		 * Work is already due.  A wheel with owners is only taken
+		 * over once they have fallen clock_owner_lag ticks behind.
+		 */
+		t = 1;
+		if (cc->cc_owners)
+			t = cc->cc_softticks + clock_owner_lag + 1 - now;
+		if (t < 1)
+			t = 1;
+		if (t < skip)
+			skip = t;
+	} else {
+		for (t = 1; t < skip; t++) {
+			if (!TAILQ_EMPTY(&cc->cc_callwheel[(now + t - 1) & callwheelmask])) {
+				skip = t;
+				break;
+			}
+		}
 	}
+	CC_UNLOCK(cc);
+
+	return (skip);
+}
 
-	hardclocks = 0;
-	tick_period = base_tick_period;
 
-	uhi_clock_gettime(UHI_CLOCK_MONOTONIC, &sec, &nsec);
-	start.tv_sec = sec;
-	start.tv_nsec = nsec;
-	while (1) {
-		uhi_nanosleep(UHI_TS_TO_NSEC(tick_period));
+/*
+ * Arm the clock timer for the next tick that has callouts to run, looking
+ * no further ahead than clock_idle_max ticks.
+ */
+static void
+clock_schedule(void)
+{
+	int now;
+	int skip;
+#ifdef SMP
+	int cpu;
+#endif
 
-		uinet_hardclock();
+	mtx_lock(&clock_lock);
+	now = ticks;
+	clock_next_tick = now + clock_idle_max;
+	mtx_unlock(&clock_lock);
 
-		hardclocks++;
-		if (hardclocks == calibration_period) {
-			struct timespec now, elapsed, correction;
+	skip = clock_wheel_skip(CC_CPU(timeout_cpu), now, clock_idle_max);
+#ifdef SMP
+	for (cpu = 0; cpu <= mp_maxid; cpu++) {
+		if ((cpu == timeout_cpu) || CPU_ABSENT(cpu))
+			continue;
+		skip = clock_wheel_skip(CC_CPU(cpu), now, skip);
+	}
+#endif
 
-			hardclocks = 0;
+	/*
+	 * clock_wakeup() may have pulled clock_next_tick in further while
+	 * the wheels were being scanned.
+	 */
+	mtx_lock(&clock_lock);
+	if (now + skip - clock_next_tick < 0)
+		clock_next_tick = now + skip;
+	skip = clock_next_tick - now;
+	if (skip < 1)
+		skip = 1;
+	uhi_timer_set(&clock_timer, clock_deadline(clock_issued + skip));
+	mtx_unlock(&clock_lock);
+}
 
-			uhi_clock_gettime(CLOCK_MONOTONIC, &sec, &nsec);
-			now.tv_sec = sec;
-			now.tv_nsec = nsec;
 
-			elapsed = now;
-			timespecsub(&elapsed, &start);
-			start = now;
+/*
+ * Bring ticks up to date with the monotonic clock.  While the wheels are
+ * idle the clock thread sleeps through ticks, leaving ticks behind until
+ * it wakes, so this is called where the stack is entered to receive or
+ * send and reads ticks for RTT samples and timestamps.  The claimed ticks
+ * are not issued again by the clock thread, and the callouts they make
+ * due are left to it.
+ */
+void
+uinet_clock_sync(void)
+{
+	uint64_t due;
+	int n;
 
-			/* 
-			 * This will accumulate the residuals over a series
-			 * of too-long periods.
-			 */
-			timespecadd(&elapsed, &delta);
+	if (0 == clock_base)
+		return;
 
-			if (timespeccmp(&elapsed, &target_period, >=)) {
-				/* 
-				 * Period was too long.  Revise sleep time
-				 * downward and issue any missed ticks.
-				 */
+	due = clock_elapsed(uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC));
+	if (due <= clock_issued)
+		return;
 
-				delta = elapsed;
-				timespecsub(&delta, &target_period);
-				
-				correction = delta;
-				correction.tv_nsec /= calibration_period * 2;
+	mtx_lock(&clock_lock);
+	n = (due > clock_issued) ? due - clock_issued : 0;
+	clock_issued += n;
+	mtx_unlock(&clock_lock);
 
-				if (timespeccmp(&tick_period, &correction, >=)) {
-						timespecsub(&tick_period, &correction);
-				}
+	if (n > 0)
+		uinet_ticks_realtime(n);
+}
 
-				while (timespeccmp(&delta, &base_tick_period, >=)) {
-					timespecsub(&delta, &base_tick_period);
-					uinet_hardclock();
-				}
-			} else {
-				/*
-				 * Period was too short.  Revise sleep time
-				 * upward and sleep now for the remainder of
-				 * the period.
-				 */
 
-				delta = target_period;
-				timespecsub(&delta, &elapsed);
+static void
+timer_intr(void *arg)
+{
+	uint64_t due;
+	int n;
 
-				/*
-				 * Don't include this catch-up sleep in the
-				 * measurement of the next period.
-				 */
-				timespecadd(&start, &delta);
+	/* XXX arbitrary prioritization: If able to schedule as a real-time
+	 * thread, set to ~80% max real-time priority, otherwise set to max
+	 * time-sharing priority.
+	 */
+
+	if (0 != uhi_thread_setprio_rt(80)) {
+		printf("Warning: Timer interrupt thread will not run at real-time priority.\n");
+		if (0 != uhi_thread_setprio(80))
+			printf("Warning: Timer interrupt thread priority could not be adjusted.\n");
+	}
 
-				correction = delta;
-				correction.tv_nsec /= calibration_period * 2;
-				timespecadd(&tick_period, &correction);
+	mtx_lock(&clock_lock);
+	clock_base = uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC);
+	clock_issued = 0;
+	mtx_unlock(&clock_lock);
 
-				uhi_nanosleep(UHI_TS_TO_NSEC(delta));
+	while (1) {
+		clock_schedule();
+		uhi_timer_wait(&clock_timer);
 
-				delta.tv_sec = 0;
-				delta.tv_nsec = 0;
-			}
+		/*
+		 * Issue every tick that has come due, which after an idle
+		 * sleep or a late wakeup is more than one.  n is zero when
+		 * uinet_clock_sync() has already issued them, but the
+		 * callouts they made due still have to be run.
+		 */
+		due = clock_elapsed(uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC));
+		mtx_lock(&clock_lock);
+		n = (due > clock_issued) ? due - clock_issued : 0;
+		clock_issued += n;
+		mtx_unlock(&clock_lock);
 
-		}
+		uinet_hardclock_realtime(n);
 	}
 }
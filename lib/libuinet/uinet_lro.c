@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "opt_inet.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/tcp_lro.h>
+
+#include <machine/in_cksum.h>
+
+#include "uinet_lro.h"
+
+
+#define UINET_LRO_CSUM_OK	(CSUM_IP_CHECKED | CSUM_IP_VALID | \
+				 CSUM_DATA_VALID | CSUM_PSEUDO_HDR)
+
+
+int
+uinet_lro_init(struct lro_ctrl *lc, struct ifnet *ifp)
+{
+	int error;
+
+	error = tcp_lro_init(lc);
+	if (0 == error)
+		lc->ifp = ifp;
+
+	return (error);
+}
+
+
+void
+uinet_lro_free(struct lro_ctrl *lc)
+{
+	tcp_lro_free(lc);
+}
+
+
+/*
+ * tcp_lro assumes the NIC has already verified the checksums, and marks
+ * merged segments as having valid checksums, so they must be verified here
+ * before a segment is offered for merging.  The stack would have done the
+ * same work during input, and the result is recorded in the mbuf so it
+ * isn't repeated there.
+ *
+ * Returns non-zero if m is an IPv4 TCP segment, in a single mbuf, with
+ * valid checksums.
+ */
+static int
+uinet_lro_csum_ok(struct mbuf *m)
+{
+	struct ether_header *eh;
+	struct ip *ip;
+	int hlen;
+	int ip_len;
+	u_int sum;
+
+	if ((NULL != m->m_next) ||
+	    (m->m_len < ETHER_HDR_LEN + sizeof(struct ip) + sizeof(struct tcphdr)))
+		return (0);
+
+	eh = mtod(m, struct ether_header *);
+	if (htons(ETHERTYPE_IP) != eh->ether_type)
+		return (0);
+
+	ip = (struct ip *)(eh + 1);
+	hlen = ip->ip_hl << 2;
+	ip_len = ntohs(ip->ip_len);
+	if ((IPPROTO_TCP != ip->ip_p) ||
+	    (sizeof(struct ip) != hlen) ||
+	    (ip_len < hlen + sizeof(struct tcphdr)) ||
+	    (ip_len > m->m_len - ETHER_HDR_LEN) ||
+	    (ip->ip_off & htons(IP_MF | IP_OFFMASK)))
+		return (0);
+
+	if (0 != in_cksum_hdr(ip))
+		return (0);
+
+	sum = in_pseudo(ip->ip_src.s_addr, ip->ip_dst.s_addr,
+	    htonl(ip_len - hlen + IPPROTO_TCP));
+	sum += (~in_cksum_skip(m, ETHER_HDR_LEN + ip_len, ETHER_HDR_LEN + hlen)) & 0xffff;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += sum >> 16;
+	if (0xffff != (sum & 0xffff))
+		return (0);
+
+	m->m_pkthdr.csum_flags |= UINET_LRO_CSUM_OK;
+	m->m_pkthdr.csum_data = 0xffff;
+
+	return (1);
+}
+
+
+/*
+ * Offer a received frame for merging, passing it to the stack immediately
+ * if it can't be merged.  Merged frames are held until uinet_lro_flush().
+ */
+void
+uinet_lro_input(struct lro_ctrl *lc, struct mbuf *m)
+{
+	struct ifnet *ifp = lc->ifp;
+
+	if (!uinet_lro_csum_ok(m) || (0 != tcp_lro_rx(lc, m, 0)))
+		ifp->if_input(ifp, m);
+}
+
+
+/*
+ * Pass all merged frames to the stack.  Drivers call this at the end of
+ * each receive batch, before the batch finish event.
+ */
+void
+uinet_lro_flush(struct lro_ctrl *lc)
+{
+	struct lro_entry *le;
+
+	while (NULL != (le = SLIST_FIRST(&lc->lro_active))) {
+		SLIST_REMOVE_HEAD(&lc->lro_active, next);
+		tcp_lro_flush(lc, le);
+	}
+}
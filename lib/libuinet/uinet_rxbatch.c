@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "opt_inet.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+#include <net/vnet.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/in_pcb.h>
+#include <netinet/ip.h>
+#include <netinet/tcp_lro.h>
+
+#include "uinet_lro.h"
+#include "uinet_rxbatch.h"
+
+
+/*
+ * Receive bursts are collected here and handed to the stack in flow
+ * order rather than arrival order.  Frames of the same IPv4 TCP or UDP
+ * flow are delivered back to back, in the order they arrived, and frames
+ * that aren't part of such a flow (ARP, fragments, etc.) are delivered in
+ * arrival order relative to the first frame of each flow.  While a burst
+ * is being delivered, the inpcb last-flow cache is active on the
+ * delivering thread, so each run of a flow costs one inpcb hash lookup.
+ */
+
+
+void
+uinet_rxbatch_init(struct uinet_rxbatch *rb, struct ifnet *ifp, struct lro_ctrl *lc)
+{
+	rb->ifp = ifp;
+	rb->lro = lc;
+	rb->count = 0;
+	rb->ngroups = 0;
+}
+
+
+/*
+ * Returns a non-zero hash of the 4-tuple for IPv4 TCP and UDP frames, and
+ * zero for everything else.
+ */
+static uint32_t
+uinet_rxbatch_flowhash(struct mbuf *m)
+{
+	struct ether_header *eh;
+	struct ip *ip;
+	uint16_t *ports;
+	uint32_t h;
+	int off;
+	int hlen;
+
+	off = ETHER_HDR_LEN;
+	if (m->m_len < off + sizeof(struct ip))
+		return (0);
+
+	eh = mtod(m, struct ether_header *);
+	if (htons(ETHERTYPE_VLAN) == eh->ether_type) {
+		off += ETHER_VLAN_ENCAP_LEN;
+		if ((m->m_len < off + sizeof(struct ip)) ||
+		    (htons(ETHERTYPE_IP) != *(uint16_t *)(mtod(m, uint8_t *) + off - 2)))
+			return (0);
+	} else if (htons(ETHERTYPE_IP) != eh->ether_type)
+		return (0);
+
+	ip = (struct ip *)(mtod(m, uint8_t *) + off);
+	hlen = ip->ip_hl << 2;
+	if (((IPPROTO_TCP != ip->ip_p) && (IPPROTO_UDP != ip->ip_p)) ||
+	    (ip->ip_off & htons(IP_MF | IP_OFFMASK)) ||
+	    (m->m_len < off + hlen + 4))
+		return (0);
+
+	ports = (uint16_t *)((uint8_t *)ip + hlen);
+
+	h = ip->ip_src.s_addr * 0x9e3779b1;
+	h ^= ip->ip_dst.s_addr;
+	h *= 0x85ebca6b;
+	h ^= ((uint32_t)ports[0] << 16) | ports[1];
+	h ^= ip->ip_p;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return (h ? h : 1);
+}
+
+
+/*
+ * Add m to its flow's group, starting a new group if it is the first
+ * frame of the flow in this batch.  Frames of distinct flows that collide
+ * in the hash share a group, which is harmless as ordering within the
+ * group is still arrival order.
+ */
+static void
+uinet_rxbatch_group(struct uinet_rxbatch *rb, unsigned int i)
+{
+	uint32_t h;
+	unsigned int s;
+	unsigned int g;
+
+	h = rb->hash[i];
+	rb->next[i] = UINET_RXBATCH_MAX;
+
+	if (h) {
+		s = h & (UINET_RXBATCH_HASHSIZE - 1);
+		while (rb->slot[s]) {
+			g = rb->slot[s] - 1;
+			if (rb->hash[rb->group_head[g]] == h) {
+				rb->next[rb->group_tail[g]] = i;
+				rb->group_tail[g] = i;
+				return;
+			}
+			s = (s + 1) & (UINET_RXBATCH_HASHSIZE - 1);
+		}
+		rb->slot[s] = rb->ngroups + 1;
+	}
+
+	g = rb->ngroups++;
+	rb->group_head[g] = i;
+	rb->group_tail[g] = i;
+}
+
+
+void
+uinet_rxbatch_input(struct uinet_rxbatch *rb, struct mbuf *m)
+{
+	unsigned int i;
+
+	if (0 == rb->count)
+		memset(rb->slot, 0, sizeof(rb->slot));
+
+	i = rb->count++;
+	rb->m[i] = m;
+	rb->hash[i] = uinet_rxbatch_flowhash(m);
+	uinet_rxbatch_group(rb, i);
+
+	if (UINET_RXBATCH_MAX == rb->count)
+		uinet_rxbatch_flush(rb);
+}
+
+
+/*
+ * Deliver all accumulated frames to the stack, via LRO if it is
+ * available and enabled on the interface.
+ */
+void
+uinet_rxbatch_flush(struct uinet_rxbatch *rb)
+{
+	struct ifnet *ifp = rb->ifp;
+	struct inpcb_lastflow ilf;
+	struct mbuf *m;
+	unsigned int g;
+	unsigned int i;
+	int lro;
+
+	if (0 == rb->count)
+		return;
+
+	uinet_clock_sync();
+
+	lro = (NULL != rb->lro) && (ifp->if_capenable & IFCAP_LRO);
+
+	CURVNET_SET(ifp->if_vnet);
+	in_pcblastflow_begin(&ilf);
+
+	for (g = 0; g < rb->ngroups; g++) {
+		for (i = rb->group_head[g]; i < UINET_RXBATCH_MAX; i = rb->next[i]) {
+			m = rb->m[i];
+			if (lro)
+				uinet_lro_input(rb->lro, m);
+			else
+				ifp->if_input(ifp, m);
+		}
+	}
+
+	if (lro)
+		uinet_lro_flush(rb->lro);
+
+	in_pcblastflow_end(&ilf);
+	CURVNET_RESTORE();
+
+	rb->count = 0;
+	rb->ngroups = 0;
+}
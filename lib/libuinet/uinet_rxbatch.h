@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _UINET_RXBATCH_H_
+#define _UINET_RXBATCH_H_
+
+#define UINET_RXBATCH_MAX	256
+#define UINET_RXBATCH_HASHSIZE	(2 * UINET_RXBATCH_MAX)
+
+struct ifnet;
+struct lro_ctrl;
+struct mbuf;
+
+/*
+ * Accumulates received frames so they can be delivered to the stack as a
+ * burst, grouped by flow.
+ */
+struct uinet_rxbatch {
+	struct ifnet *ifp;
+	struct lro_ctrl *lro;
+	unsigned int count;
+	unsigned int ngroups;
+	struct mbuf *m[UINET_RXBATCH_MAX];
+	uint32_t hash[UINET_RXBATCH_MAX];
+	uint16_t next[UINET_RXBATCH_MAX];
+	uint16_t group_head[UINET_RXBATCH_MAX];
+	uint16_t group_tail[UINET_RXBATCH_MAX];
+	uint16_t slot[UINET_RXBATCH_HASHSIZE];
+};
+
+void uinet_rxbatch_init(struct uinet_rxbatch *rb, struct ifnet *ifp, struct lro_ctrl *lc);
+void uinet_rxbatch_input(struct uinet_rxbatch *rb, struct mbuf *m);
+void uinet_rxbatch_flush(struct uinet_rxbatch *rb);
+
+#endif /* _UINET_RXBATCH_H_ */
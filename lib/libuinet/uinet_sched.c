@@ -27,12 +27,70 @@
 #include <sys/param.h>
 #include <sys/systm.h>
 #include <sys/proc.h>
+#include <machine/atomic.h>
 #include <sys/sched.h>
 #include <sys/smp.h>
 
 #include "uinet_host_interface.h"
 
 
+/*
+ * Every uinet thread occupies one of the mp_ncpus cpu slots, recorded in
+ * td_oncpu, which selects the per-cpu data (UMA caches, DPCPU, critical
+ * section slot) the thread uses.  Threads bound to a host cpu take the
+ * slot for that cpu.  All other threads are spread across the slots,
+ * each taking the slot with the fewest occupants when it is created, so
+ * that per-cpu state scales with the number of application threads
+ * rather than everything landing on slot 0.
+ */
+static volatile u_int cpuslot_threads[MAXCPU];
+
+
+u_char
+uinet_cpuslot_alloc(int cpu)
+{
+	u_int min;
+	int slot;
+	int i;
+
+	if (cpu >= 0) {
+		/* Limit td_oncpu to the set of cpus that uinet_init() was
+		 * told we have, as that number of cpus is used to
+		 * initialize per-cpu state and td_oncpu is used to index
+		 * into that state.
+		 */
+		slot = cpu % mp_ncpus;
+	} else {
+		/*
+		 * Racing allocations may pick the same slot, which only
+		 * costs some balance.
+		 */
+		slot = 0;
+		min = cpuslot_threads[0];
+		for (i = 1; i < mp_ncpus; i++) {
+			if (cpuslot_threads[i] < min) {
+				min = cpuslot_threads[i];
+				slot = i;
+			}
+		}
+	}
+
+	atomic_add_int(&cpuslot_threads[slot], 1);
+
+	return (slot);
+}
+
+
+void
+uinet_cpuslot_free(u_char slot)
+{
+	KASSERT(slot < mp_ncpus, ("uinet_cpuslot_free: slot >= mp_ncpus"));
+	KASSERT(cpuslot_threads[slot] > 0, ("uinet_cpuslot_free: slot not in use"));
+
+	atomic_subtract_int(&cpuslot_threads[slot], 1);
+}
+
+
 /*
  * Bind a thread to a target cpu.
  *
@@ -48,11 +106,7 @@ sched_bind(struct thread *td, int cpu)
 	if (cpu >= 0) {
 		uhi_thread_bind(cpu);
 
-		/* Limit td_oncpu to the set of cpus that uinet_init() was
-		 * told we have, as that number of cpus is used to
-		 * initialize per-cpu state and td_oncpu is used to index
-		 * into that state.
-		 */
-		td->td_oncpu = cpu % mp_ncpus;
+		uinet_cpuslot_free(td->td_oncpu);
+		td->td_oncpu = uinet_cpuslot_alloc(cpu);
 	}
 }
@@ -0,0 +1,594 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+
+/*
+ * Lock profiling for uinet.  This provides the LOCK_PROFILING interface
+ * found in FreeBSD's subr_lock.c, but the bookkeeping is per-thread rather
+ * than per-cpu, as uinet threads are not pinned and there is no way to
+ * idle a cpu in order to reset or read per-cpu state.
+ *
+ * Each thread that acquires a profiled lock while profiling is enabled
+ * gets a private buffer holding the locks it currently holds and a table
+ * of statistics for each (lock name, file, line) acquisition site.  The
+ * owning thread is the only writer of its buffer, so recording takes no
+ * locks.  The buffers are merged when the statistics are read, and the
+ * statistics of exited threads are folded into a retired table.
+ *
+ * In addition to the FreeBSD counters, a log2 histogram of hold times and
+ * of contested wait times is kept for each site.
+ */
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/proc.h>
+#include <sys/sbuf.h>
+#include <sys/sysctl.h>
+
+#include <machine/atomic.h>
+
+#include "uinet_host_interface.h"
+
+#ifdef LOCK_PROFILING
+
+#define	LPROF_SITES		512	/* per thread, power of 2 */
+#define	LPROF_MERGE_SITES	4096	/* merged and retired tables, power of 2 */
+#define	LPROF_HELD		32	/* max profiled locks held by a thread */
+#define	LPROF_NBUCKETS		16
+#define	LPROF_BUCKET_SHIFT	8	/* first bucket is < 256ns */
+
+#define	LPROF_SBUF_SIZE		256
+
+/*
+ * One lock_prof for each (file, line, lock name) triple.
+ */
+struct lock_prof {
+	const char	*name;		/* NULL if the slot is free */
+	const char	*file;
+	struct lock_class *class;
+	int		line;
+	uint64_t	cnt_max;
+	uint64_t	cnt_wait_max;
+	uint64_t	cnt_tot;
+	uint64_t	cnt_wait;
+	uint64_t	cnt_cur;
+	uint64_t	cnt_contest_locking;
+	uint64_t	hold_hist[LPROF_NBUCKETS];
+	uint64_t	wait_hist[LPROF_NBUCKETS];
+};
+
+/*
+ * One lock_prof_held for each profiled lock a thread holds.
+ */
+struct lock_prof_held {
+	struct lock_object *lph_obj;
+	const char	*lph_file;
+	int		lph_line;
+	int		lph_ref;
+	int		lph_cnt;
+	int		lph_contested;
+	uint64_t	lph_acqtime;
+	uint64_t	lph_waittime;
+};
+
+struct lock_prof_thread {
+	LIST_ENTRY(lock_prof_thread) lpt_link;
+	u_int		lpt_gen;	/* lock_prof_gen the sites belong to */
+	u_int		lpt_count;	/* for lock_prof_skipcount */
+	int		lpt_nheld;
+	struct lock_prof_held lpt_held[LPROF_HELD];
+	struct lock_prof lpt_sites[LPROF_SITES];
+};
+
+volatile int lock_prof_enable = 0;
+
+/*
+ * Incremented on each reset.  A thread whose buffer belongs to an older
+ * generation discards its statistics the next time it records any, and
+ * the buffer is skipped when merging until then.
+ */
+static volatile u_int lock_prof_gen;
+
+static int lock_prof_rejected;
+static int lock_prof_skipcount;
+
+static struct mtx lock_prof_lock;
+static LIST_HEAD(, lock_prof_thread) lock_prof_threads =
+    LIST_HEAD_INITIALIZER(lock_prof_threads);
+static struct lock_prof *lock_prof_retired;
+
+static MALLOC_DEFINE(M_LOCKPROF, "lockprof", "lock profiling");
+
+
+uint64_t
+nanoseconds(void)
+{
+
+	return (uhi_clock_gettime_ns(UHI_CLOCK_MONOTONIC));
+}
+
+static void
+lock_prof_init(void *arg)
+{
+
+	mtx_init(&lock_prof_lock, "lock profiling", NULL,
+	    MTX_DEF | MTX_NOPROFILE);
+	lock_prof_retired = malloc(sizeof(struct lock_prof) * LPROF_MERGE_SITES,
+	    M_LOCKPROF, M_WAITOK | M_ZERO);
+}
+SYSINIT(lockprof, SI_SUB_LOCK, SI_ORDER_ANY, lock_prof_init, NULL);
+
+static inline int
+lock_prof_bucket(uint64_t ns)
+{
+
+	ns >>= LPROF_BUCKET_SHIFT;
+	if (ns >= (1ULL << (LPROF_NBUCKETS - 1)))
+		return (LPROF_NBUCKETS - 1);
+	return (fls((int)ns));
+}
+
+static struct lock_prof *
+lock_prof_lookup(struct lock_prof *table, u_int size, const char *name,
+    const char *file, int line, struct lock_class *class)
+{
+	struct lock_prof *lp;
+	const char *lpname;
+	u_int hash, i;
+
+	hash = (uintptr_t)name * 31 + (uintptr_t)file * 31 + line;
+	for (i = 0; i < size; i++) {
+		lp = &table[(hash + i) & (size - 1)];
+		lpname = (const char *)atomic_load_acq_ptr((volatile uintptr_t *)&lp->name);
+		if (lpname == NULL) {
+			/*
+			 * Publish the name last so that a concurrent merge
+			 * never sees a partially filled in slot.
+			 */
+			lp->file = file;
+			lp->line = line;
+			lp->class = class;
+			atomic_store_rel_ptr((volatile uintptr_t *)&lp->name,
+			    (uintptr_t)name);
+			return (lp);
+		}
+		if (lpname == name && lp->file == file && lp->line == line)
+			return (lp);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Add the statistics in src to table.  The caller holds lock_prof_lock.
+ * When src is a live thread buffer, its owner may be updating it
+ * concurrently, so the result is a close approximation.
+ */
+static void
+lock_prof_merge(struct lock_prof *table, u_int size, struct lock_prof *src,
+    u_int nsrc)
+{
+	struct lock_prof *s, *d;
+	const char *name;
+	u_int i;
+	int b;
+
+	for (i = 0; i < nsrc; i++) {
+		s = &src[i];
+		name = (const char *)atomic_load_acq_ptr((volatile uintptr_t *)&s->name);
+		if (name == NULL)
+			continue;
+		d = lock_prof_lookup(table, size, name, s->file, s->line,
+		    s->class);
+		if (d == NULL) {
+			atomic_add_int(&lock_prof_rejected, 1);
+			continue;
+		}
+		if (s->cnt_max > d->cnt_max)
+			d->cnt_max = s->cnt_max;
+		if (s->cnt_wait_max > d->cnt_wait_max)
+			d->cnt_wait_max = s->cnt_wait_max;
+		d->cnt_tot += s->cnt_tot;
+		d->cnt_wait += s->cnt_wait;
+		d->cnt_cur += s->cnt_cur;
+		d->cnt_contest_locking += s->cnt_contest_locking;
+		for (b = 0; b < LPROF_NBUCKETS; b++) {
+			d->hold_hist[b] += s->hold_hist[b];
+			d->wait_hist[b] += s->wait_hist[b];
+		}
+	}
+}
+
+static struct lock_prof_thread *
+lock_prof_thread_get(void)
+{
+	struct uinet_thread *utd;
+	struct lock_prof_thread *lpt;
+	struct thread *td;
+
+	/*
+	 * Host threads that have not been set up as uinet threads may
+	 * still acquire stack locks.  They are not profiled.
+	 */
+	utd = uhi_tls_get(kthread_tls_key);
+	if (utd == NULL)
+		return (NULL);
+	td = utd->td;
+
+	lpt = td->td_lprof_thread;
+	if (lpt != NULL)
+		return (lpt);
+
+	/*
+	 * Allocate from the host so that taking the buffer doesn't itself
+	 * acquire profiled locks.
+	 */
+	lpt = uhi_calloc(1, sizeof(*lpt));
+	if (lpt == NULL) {
+		atomic_add_int(&lock_prof_rejected, 1);
+		return (NULL);
+	}
+	lpt->lpt_gen = lock_prof_gen;
+
+	mtx_lock(&lock_prof_lock);
+	LIST_INSERT_HEAD(&lock_prof_threads, lpt, lpt_link);
+	mtx_unlock(&lock_prof_lock);
+
+	td->td_lprof_thread = lpt;
+
+	return (lpt);
+}
+
+void
+lock_profile_obtain_lock_success(struct lock_object *lo, int contested,
+    uint64_t waittime, const char *file, int line)
+{
+	struct lock_prof_thread *lpt;
+	struct lock_prof_held *h;
+	int i;
+
+	if (!lock_prof_enable || (lo->lo_flags & LO_NOPROFILE))
+		return;
+
+	lpt = lock_prof_thread_get();
+	if (lpt == NULL)
+		return;
+
+	/* don't reset the timer when/if recursing */
+	for (i = lpt->lpt_nheld - 1; i >= 0; i--) {
+		h = &lpt->lpt_held[i];
+		if (h->lph_obj == lo) {
+			h->lph_ref++;
+			h->lph_cnt++;
+			return;
+		}
+	}
+
+	if (lock_prof_skipcount &&
+	    (++lpt->lpt_count % lock_prof_skipcount) != 0)
+		return;
+
+	if (lpt->lpt_nheld == LPROF_HELD) {
+		atomic_add_int(&lock_prof_rejected, 1);
+		return;
+	}
+
+	h = &lpt->lpt_held[lpt->lpt_nheld++];
+	h->lph_obj = lo;
+	h->lph_file = (file == NULL || *file == '\0') ? "(unknown)" : file;
+	h->lph_line = line;
+	h->lph_ref = 1;
+	h->lph_cnt = 1;
+	h->lph_contested = contested;
+	h->lph_acqtime = nanoseconds();
+	if (waittime && (h->lph_acqtime > waittime))
+		h->lph_waittime = h->lph_acqtime - waittime;
+	else
+		h->lph_waittime = 0;
+}
+
+void
+lock_profile_release_lock(struct lock_object *lo)
+{
+	struct uinet_thread *utd;
+	struct lock_prof_thread *lpt;
+	struct lock_prof_held held;
+	struct lock_prof *lp;
+	uint64_t curtime, holdtime;
+	u_int gen;
+	int i;
+
+	if (lo->lo_flags & LO_NOPROFILE)
+		return;
+
+	utd = uhi_tls_get(kthread_tls_key);
+	if (utd == NULL)
+		return;
+	lpt = utd->td->td_lprof_thread;
+	if (lpt == NULL || lpt->lpt_nheld == 0)
+		return;
+
+	/*
+	 * If lock profiling is not enabled we still want to remove the
+	 * held entry.
+	 */
+	for (i = lpt->lpt_nheld - 1; i >= 0; i--)
+		if (lpt->lpt_held[i].lph_obj == lo)
+			break;
+	if (i < 0)
+		return;
+	if (--lpt->lpt_held[i].lph_ref > 0)
+		return;
+	held = lpt->lpt_held[i];
+	lpt->lpt_nheld--;
+	for (; i < lpt->lpt_nheld; i++)
+		lpt->lpt_held[i] = lpt->lpt_held[i + 1];
+
+	if (!lock_prof_enable)
+		return;
+
+	curtime = nanoseconds();
+	if (curtime < held.lph_acqtime)
+		return;
+	holdtime = curtime - held.lph_acqtime;
+
+	gen = atomic_load_acq_int(&lock_prof_gen);
+	if (lpt->lpt_gen != gen) {
+		bzero(lpt->lpt_sites, sizeof(lpt->lpt_sites));
+		atomic_store_rel_int(&lpt->lpt_gen, gen);
+	}
+
+	lp = lock_prof_lookup(lpt->lpt_sites, LPROF_SITES, lo->lo_name,
+	    held.lph_file, held.lph_line, LOCK_CLASS(lo));
+	if (lp == NULL) {
+		atomic_add_int(&lock_prof_rejected, 1);
+		return;
+	}
+
+	/*
+	 * Record if the lock has been held longer now than ever
+	 * before.
+	 */
+	if (holdtime > lp->cnt_max)
+		lp->cnt_max = holdtime;
+	if (held.lph_waittime > lp->cnt_wait_max)
+		lp->cnt_wait_max = held.lph_waittime;
+	lp->cnt_tot += holdtime;
+	lp->cnt_wait += held.lph_waittime;
+	lp->cnt_contest_locking += held.lph_contested;
+	lp->cnt_cur += held.lph_cnt;
+	lp->hold_hist[lock_prof_bucket(holdtime)]++;
+	if (held.lph_contested)
+		lp->wait_hist[lock_prof_bucket(held.lph_waittime)]++;
+}
+
+void
+lock_profile_thread_exit(struct thread *td)
+{
+	struct lock_prof_thread *lpt;
+
+	lpt = td->td_lprof_thread;
+	if (lpt == NULL)
+		return;
+	td->td_lprof_thread = NULL;
+
+	mtx_lock(&lock_prof_lock);
+	LIST_REMOVE(lpt, lpt_link);
+	if (lpt->lpt_gen == lock_prof_gen)
+		lock_prof_merge(lock_prof_retired, LPROF_MERGE_SITES,
+		    lpt->lpt_sites, LPROF_SITES);
+	mtx_unlock(&lock_prof_lock);
+
+	uhi_free(lpt);
+}
+
+static void
+lock_prof_reset(void)
+{
+
+	mtx_lock(&lock_prof_lock);
+	atomic_add_rel_int(&lock_prof_gen, 1);
+	bzero(lock_prof_retired, sizeof(struct lock_prof) * LPROF_MERGE_SITES);
+	mtx_unlock(&lock_prof_lock);
+}
+
+/*
+ * Returns a table of the statistics of all threads, to be freed by the
+ * caller.
+ */
+static struct lock_prof *
+lock_prof_collect(void)
+{
+	struct lock_prof_thread *lpt;
+	struct lock_prof *table;
+	u_int gen;
+
+	table = malloc(sizeof(struct lock_prof) * LPROF_MERGE_SITES,
+	    M_LOCKPROF, M_WAITOK | M_ZERO);
+
+	mtx_lock(&lock_prof_lock);
+	gen = lock_prof_gen;
+	lock_prof_merge(table, LPROF_MERGE_SITES, lock_prof_retired,
+	    LPROF_MERGE_SITES);
+	LIST_FOREACH(lpt, &lock_prof_threads, lpt_link) {
+		if (atomic_load_acq_int(&lpt->lpt_gen) != gen)
+			continue;
+		lock_prof_merge(table, LPROF_MERGE_SITES, lpt->lpt_sites,
+		    LPROF_SITES);
+	}
+	mtx_unlock(&lock_prof_lock);
+
+	return (table);
+}
+
+static const char *
+lock_prof_file(const struct lock_prof *lp)
+{
+	const char *p;
+
+	for (p = lp->file; p != NULL && strncmp(p, "../", 3) == 0; p += 3);
+	return (p);
+}
+
+static void
+lock_prof_output(struct lock_prof *lp, struct sbuf *sb)
+{
+
+	sbuf_printf(sb,
+	    "%8ju %9ju %11ju %11ju %11ju %6ju %6ju %2ju %6ju %s:%d (%s:%s)\n",
+	    (uintmax_t)lp->cnt_max / 1000, (uintmax_t)lp->cnt_wait_max / 1000,
+	    (uintmax_t)lp->cnt_tot / 1000, (uintmax_t)lp->cnt_wait / 1000,
+	    (uintmax_t)lp->cnt_cur,
+	    lp->cnt_cur == 0 ? (uintmax_t)0 :
+	    (uintmax_t)(lp->cnt_tot / (lp->cnt_cur * 1000)),
+	    lp->cnt_cur == 0 ? (uintmax_t)0 :
+	    (uintmax_t)(lp->cnt_wait / (lp->cnt_cur * 1000)),
+	    (uintmax_t)0, (uintmax_t)lp->cnt_contest_locking,
+	    lock_prof_file(lp), lp->line, lp->class->lc_name, lp->name);
+}
+
+static void
+lock_prof_output_hist(struct lock_prof *lp, struct sbuf *sb)
+{
+	int b;
+
+	sbuf_printf(sb, "%s:%d (%s:%s)\n", lock_prof_file(lp), lp->line,
+	    lp->class->lc_name, lp->name);
+	sbuf_printf(sb, "  hold");
+	for (b = 0; b < LPROF_NBUCKETS; b++)
+		sbuf_printf(sb, " %ju", (uintmax_t)lp->hold_hist[b]);
+	sbuf_printf(sb, "\n  wait");
+	for (b = 0; b < LPROF_NBUCKETS; b++)
+		sbuf_printf(sb, " %ju", (uintmax_t)lp->wait_hist[b]);
+	sbuf_printf(sb, "\n");
+}
+
+static int
+dump_lock_prof_stats(SYSCTL_HANDLER_ARGS)
+{
+	struct lock_prof *table;
+	struct sbuf *sb;
+	int error, hist, i;
+
+	hist = arg2;
+
+	error = sysctl_wire_old_buffer(req, 0);
+	if (error != 0)
+		return (error);
+	sb = sbuf_new_for_sysctl(NULL, NULL, LPROF_SBUF_SIZE, req);
+	if (hist) {
+		/*
+		 * Bucket 0 counts times below 2^8 ns, bucket n counts times
+		 * in [2^(n+7), 2^(n+8)) ns, and the last bucket counts
+		 * everything from 2^22 ns up.  Wait times are only counted
+		 * for contested acquisitions.
+		 */
+		sbuf_printf(sb, "\nbuckets (ns): <2^8");
+		for (i = 1; i < LPROF_NBUCKETS - 1; i++)
+			sbuf_printf(sb, " <2^%d", i + LPROF_BUCKET_SHIFT);
+		sbuf_printf(sb, " >=2^%d\n",
+		    LPROF_NBUCKETS - 2 + LPROF_BUCKET_SHIFT);
+	} else
+		sbuf_printf(sb, "\n%8s %9s %11s %11s %11s %6s %6s %2s %6s %s\n",
+		    "max", "wait_max", "total", "wait_total", "count", "avg",
+		    "wait_avg", "cnt_hold", "cnt_lock", "name");
+
+	table = lock_prof_collect();
+	for (i = 0; i < LPROF_MERGE_SITES; i++) {
+		if (table[i].name == NULL)
+			continue;
+		if (hist)
+			lock_prof_output_hist(&table[i], sb);
+		else
+			lock_prof_output(&table[i], sb);
+	}
+	free(table, M_LOCKPROF);
+
+	error = sbuf_finish(sb);
+	/* Output a trailing NUL. */
+	if (error == 0)
+		error = SYSCTL_OUT(req, "", 1);
+	sbuf_delete(sb);
+	return (error);
+}
+
+static int
+enable_lock_prof(SYSCTL_HANDLER_ARGS)
+{
+	int error, v;
+
+	v = lock_prof_enable;
+	error = sysctl_handle_int(oidp, &v, v, req);
+	if (error)
+		return (error);
+	if (req->newptr == NULL)
+		return (error);
+	if (v == lock_prof_enable)
+		return (0);
+	if (v == 1)
+		lock_prof_reset();
+	lock_prof_enable = !!v;
+
+	return (0);
+}
+
+static int
+reset_lock_prof_stats(SYSCTL_HANDLER_ARGS)
+{
+	int error, v;
+
+	v = 0;
+	error = sysctl_handle_int(oidp, &v, 0, req);
+	if (error)
+		return (error);
+	if (req->newptr == NULL)
+		return (error);
+	if (v == 0)
+		return (0);
+	lock_prof_reset();
+
+	return (0);
+}
+
+SYSCTL_NODE(_debug, OID_AUTO, lock, CTLFLAG_RD, NULL, "lock debugging");
+SYSCTL_NODE(_debug_lock, OID_AUTO, prof, CTLFLAG_RD, NULL, "lock profiling");
+SYSCTL_INT(_debug_lock_prof, OID_AUTO, skipcount, CTLFLAG_RW,
+    &lock_prof_skipcount, 0, "Sample approximately every N lock acquisitions.");
+SYSCTL_INT(_debug_lock_prof, OID_AUTO, rejected, CTLFLAG_RD,
+    &lock_prof_rejected, 0, "Number of rejected profiling records");
+SYSCTL_PROC(_debug_lock_prof, OID_AUTO, stats, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 0, dump_lock_prof_stats, "A", "Lock profiling statistics");
+SYSCTL_PROC(_debug_lock_prof, OID_AUTO, histograms, CTLTYPE_STRING | CTLFLAG_RD,
+    NULL, 1, dump_lock_prof_stats, "A", "Lock hold and wait time histograms");
+SYSCTL_PROC(_debug_lock_prof, OID_AUTO, reset, CTLTYPE_INT | CTLFLAG_RW,
+    NULL, 0, reset_lock_prof_stats, "I", "Reset lock profiling statistics");
+SYSCTL_PROC(_debug_lock_prof, OID_AUTO, enable, CTLTYPE_INT | CTLFLAG_RW,
+    NULL, 0, enable_lock_prof, "I", "Enable lock profiling");
+
+#endif /* LOCK_PROFILING */
@@ -25,6 +25,7 @@
 
 
 #include <sys/param.h>
+#include <sys/kernel.h>
 #include <sys/malloc.h>
 #include <sys/pcpu.h>
 #include <sys/smp.h>
@@ -64,3 +65,71 @@ uinet_pcpu_get(void)
 	KASSERT(curthread->td_oncpu < mp_ncpus, ("curthread->td_oncpu >= mp_ncpus"));
 	return (&pcpup[curthread->td_oncpu]);
 }
+
+
+static MALLOC_DEFINE(M_PCPUSTAT, "pcpustat", "per-cpu statistics");
+
+/*
+ * The block is over-allocated by a cache line so the copies can be aligned,
+ * with the original allocation address stashed just below the first copy.
+ */
+void *
+pcpustat_alloc(size_t size, int flags)
+{
+	size_t stride = PCPUSTAT_STRIDE(size);
+	char *mem, *base;
+
+	KASSERT(size % sizeof(u_long) == 0, ("pcpustat_alloc: bad size %zu", size));
+
+	mem = malloc(stride * mp_ncpus + CACHE_LINE_SIZE, M_PCPUSTAT, flags | M_ZERO);
+	if (NULL == mem)
+		return (NULL);
+
+	base = (char *)roundup2((uintptr_t)mem + sizeof(void *), CACHE_LINE_SIZE);
+	((void **)base)[-1] = mem;
+
+	return (base);
+}
+
+
+void
+pcpustat_free(void *base)
+{
+	if (NULL != base)
+		free(((void **)base)[-1], M_PCPUSTAT);
+}
+
+
+void
+pcpustat_fetch(void *dst, const void *base, size_t size)
+{
+	size_t stride = PCPUSTAT_STRIDE(size);
+	size_t nwords = size / sizeof(u_long);
+	const u_long *src;
+	u_long *sum = dst;
+	size_t i;
+	int cpu;
+
+	memset(sum, 0, size);
+	for (cpu = 0; cpu < mp_ncpus; cpu++) {
+		src = (const u_long *)((const char *)base + cpu * stride);
+		for (i = 0; i < nwords; i++)
+			sum[i] += src[i];
+	}
+}
+
+
+/*
+ * Replace the summed value of a block with the given one, e.g. to zero the
+ * statistics.  Updates that race with this may be lost.
+ */
+void
+pcpustat_store(void *base, const void *src, size_t size)
+{
+	size_t stride = PCPUSTAT_STRIDE(size);
+	int cpu;
+
+	memcpy(base, src, size);
+	for (cpu = 1; cpu < mp_ncpus; cpu++)
+		memset((char *)base + cpu * stride, 0, size);
+}
@@ -39,6 +39,8 @@
 #include <sys/systm.h>
 #include <sys/sysctl.h>
 
+#include "uinet_host_interface.h"
+
 
 /* This is used in modules that need to work in both SMP and UP. */
 cpuset_t all_cpus;
@@ -56,8 +58,19 @@ SYSCTL_INT(_kern_smp, OID_AUTO, maxid, CTLFLAG_RD|CTLFLAG_CAPRD, &mp_maxid, 0,
 SYSCTL_INT(_kern_smp, OID_AUTO, maxcpus, CTLFLAG_RD|CTLFLAG_CAPRD, &mp_maxcpus,
     0, "Max number of CPUs that the system was compiled for.");
 
-/* XXX temporary until final pcpu approach is determined */
-struct mtx uinet_pcpu_locks[MAXCPU];
+
+/*
+ * Memory domains are the host NUMA nodes that the configured cpus belong
+ * to, numbered densely in order of first appearance.  uinet cpu n is
+ * host cpu n, as that is what uhi_thread_bind() binds to.
+ */
+int vm_ndomains = 1;
+int uinet_domain_node[MAXMEMDOM];
+static int uinet_cpu_domain[MAXCPU];
+
+SYSCTL_INT(_vm, OID_AUTO, ndomains, CTLFLAG_RD, &vm_ndomains, 0,
+    "Number of memory domains");
+
 
 static void
 mp_start(void *dummy)
@@ -75,17 +88,113 @@ mp_start(void *dummy)
 		CPU_SET(i, &all_cpus);
 
 		pcpu_init(&pcpup[i], i, sizeof(struct pcpu));
+		pcpup[i].pc_domain = uinet_cpu_domain[i];
 
 		dpcpu = malloc(DPCPU_SIZE, M_DEVBUF, M_WAITOK);
 		if (NULL == dpcpu)
 			panic("Failed to allocate DPCPU area for cpu %d\n", i);
 
 		dpcpu_init(dpcpu, i);
-
-		mtx_init(&uinet_pcpu_locks[i], "uipcpu", NULL, MTX_DEF | MTX_RECURSE);
 	}
 
 	printf("UINET multiprocessor subsystem configured with %d CPUs\n", mp_ncpus);
 }
 SYSINIT(cpu_mp, SI_SUB_CPU, SI_ORDER_THIRD, mp_start, NULL);
 
+
+
+void
+uinet_numa_init(unsigned int ncpus)
+{
+	unsigned int i;
+	int domain, node;
+
+	vm_ndomains = 0;
+	for (i = 0; i < ncpus; i++) {
+		node = uhi_numa_cpu_node(i);
+		for (domain = 0; domain < vm_ndomains; domain++)
+			if (uinet_domain_node[domain] == node)
+				break;
+		if (domain == vm_ndomains) {
+			if (vm_ndomains < MAXMEMDOM)
+				uinet_domain_node[vm_ndomains++] = node;
+			else
+				domain = 0;
+		}
+		uinet_cpu_domain[i] = domain;
+	}
+
+	if (vm_ndomains == 0) {
+		vm_ndomains = 1;
+		uinet_domain_node[0] = -1;
+	}
+
+	if (vm_ndomains > 1)
+		printf("UINET using %d memory domains\n", vm_ndomains);
+}
+
+
+int
+uinet_curdomain(void)
+{
+
+	return (PCPU_GET(domain));
+}
+
+
+/*
+ * Returns the memory domain for the given host NUMA node, or -1 if none of
+ * the configured cpus are on it.
+ */
+int
+uinet_node_domain(int node)
+{
+	int domain;
+
+	if (node < 0)
+		return (-1);
+
+	for (domain = 0; domain < vm_ndomains; domain++)
+		if (uinet_domain_node[domain] == node)
+			return (domain);
+
+	return (-1);
+}
+
+
+/*
+ * Returns the n'th cpu after the given one that is in the same memory
+ * domain, wrapping around within the domain.  cpu must not be negative.
+ */
+int
+uinet_cpu_next(int cpu, unsigned int n)
+{
+	int domain;
+
+	cpu %= mp_ncpus;
+	domain = uinet_cpu_domain[cpu];
+	while (n > 0) {
+		cpu = (cpu + 1) % mp_ncpus;
+		if (uinet_cpu_domain[cpu] == domain)
+			n--;
+	}
+
+	return (cpu);
+}
+
+
+/*
+ * Returns the n'th cpu in the given memory domain, wrapping around within
+ * the domain.
+ */
+int
+uinet_domain_cpu(int domain, unsigned int n)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < mp_ncpus; cpu++)
+		if (uinet_cpu_domain[cpu] == domain)
+			return (uinet_cpu_next(cpu, n));
+
+	return (-1);
+}
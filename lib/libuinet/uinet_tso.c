@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "opt_inet.h"
+
+#include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/mbuf.h>
+#include <sys/socket.h>
+
+#include <net/if.h>
+#include <net/if_var.h>
+#include <net/ethernet.h>
+
+#include <netinet/in.h>
+#include <netinet/in_systm.h>
+#include <netinet/ip.h>
+#include <netinet/tcp.h>
+
+#include <machine/in_cksum.h>
+
+#include "uinet_tso.h"
+
+/*
+ * Software TCP segmentation offload.
+ *
+ * Interfaces that use this advertise IFCAP_TSO4 and IFCAP_TXCSUM, so
+ * tcp_output() hands them segments of up to 64KB with the TCP checksum
+ * left undone, and the driver's transmit loop slices each one into MSS
+ * sized frames as it copies them to the device.  The ethernet, IP and TCP
+ * headers of the large segment are captured once as a template, and each
+ * frame gets a copy of the template with the lengths, IP id, sequence
+ * number, flags and checksums adjusted.
+ */
+
+
+static u_int
+uinet_tso_sum(const uint8_t *p, u_int len)
+{
+	uint16_t w;
+	u_int sum = 0;
+
+	for (; len > 1; len -= 2, p += 2) {
+		memcpy(&w, p, sizeof(w));
+		sum += w;
+	}
+
+	return (sum);
+}
+
+
+static int
+uinet_tso_l3off(struct mbuf *m, u_int *l3off)
+{
+	struct ether_header eh;
+
+	if (m->m_pkthdr.len < ETHER_HDR_LEN)
+		return (EINVAL);
+
+	m_copydata(m, 0, ETHER_HDR_LEN, (caddr_t)&eh);
+	switch (ntohs(eh.ether_type)) {
+	case ETHERTYPE_IP:
+		*l3off = ETHER_HDR_LEN;
+		break;
+	case ETHERTYPE_VLAN:
+		*l3off = ETHER_HDR_LEN + ETHER_VLAN_ENCAP_LEN;
+		break;
+	default:
+		return (EINVAL);
+	}
+
+	return (0);
+}
+
+
+void
+uinet_tso_attach(struct ifnet *ifp)
+{
+	ifp->if_capabilities |= IFCAP_TXCSUM | IFCAP_TSO4;
+	ifp->if_capenable |= IFCAP_TXCSUM | IFCAP_TSO4;
+	ifp->if_hwassist |= CSUM_TCP | CSUM_TSO;
+}
+
+
+/*
+ * Complete a TCP checksum that the stack left for the interface.  Clears
+ * the request from the mbuf, so calling this more than once is harmless.
+ */
+void
+uinet_tso_txcsum(struct mbuf *m)
+{
+	struct ip ip;
+	u_int l3off;
+	u_int hlen;
+	uint16_t csum;
+
+	if (!(m->m_pkthdr.csum_flags & CSUM_TCP))
+		return;
+
+	m->m_pkthdr.csum_flags &= ~CSUM_TCP;
+
+	if ((0 != uinet_tso_l3off(m, &l3off)) ||
+	    (m->m_pkthdr.len < l3off + sizeof(struct ip)))
+		return;
+
+	m_copydata(m, l3off, sizeof(ip), (caddr_t)&ip);
+	hlen = ip.ip_hl << 2;
+	if (m->m_pkthdr.len < l3off + ntohs(ip.ip_len))
+		return;
+
+	/* th_sum already holds the pseudo header sum */
+	csum = in_cksum_skip(m, l3off + ntohs(ip.ip_len), l3off + hlen);
+	m_copyback(m, l3off + hlen + m->m_pkthdr.csum_data, sizeof(csum), (caddr_t)&csum);
+}
+
+
+int
+uinet_tso_start(struct uinet_tso *ts, struct mbuf *m)
+{
+	struct ip *ip;
+	struct tcphdr *th;
+	u_int iphlen;
+	u_int thlen;
+
+	if (0 != uinet_tso_l3off(m, &ts->l3off))
+		return (EINVAL);
+
+	if (m->m_pkthdr.len < ts->l3off + sizeof(struct ip) + sizeof(struct tcphdr))
+		return (EINVAL);
+
+	m_copydata(m, 0, ts->l3off + sizeof(struct ip), (caddr_t)ts->hdr);
+	ip = (struct ip *)&ts->hdr[ts->l3off];
+	iphlen = ip->ip_hl << 2;
+	if ((IPPROTO_TCP != ip->ip_p) || (sizeof(struct ip) != iphlen))
+		return (EINVAL);
+
+	ts->l4off = ts->l3off + iphlen;
+	m_copydata(m, ts->l4off, sizeof(struct tcphdr), (caddr_t)&ts->hdr[ts->l4off]);
+	th = (struct tcphdr *)&ts->hdr[ts->l4off];
+	thlen = th->th_off << 2;
+	if ((thlen < sizeof(struct tcphdr)) ||
+	    (m->m_pkthdr.len < ts->l4off + thlen))
+		return (EINVAL);
+
+	m_copydata(m, ts->l4off, thlen, (caddr_t)&ts->hdr[ts->l4off]);
+
+	ts->m = m;
+	ts->hdrlen = ts->l4off + thlen;
+	ts->payload_off = ts->hdrlen;
+	ts->payload_end = m->m_pkthdr.len;
+	ts->mss = m->m_pkthdr.tso_segsz;
+	ts->seq = ntohl(th->th_seq);
+	ts->ip_id = ntohs(ip->ip_id);
+	ts->th_flags = th->th_flags;
+	ts->first = 1;
+
+	if (0 == ts->mss)
+		return (EINVAL);
+
+	/*
+	 * The part of the TCP checksum that is the same for every frame:
+	 * the header, less the checksum, sequence number, and the data
+	 * offset and flags word.
+	 */
+	th->th_sum = 0;
+	ts->th_sum_base = uinet_tso_sum(&ts->hdr[ts->l4off], 4) +
+	    uinet_tso_sum(&ts->hdr[ts->l4off + 8], 4) +
+	    uinet_tso_sum(&ts->hdr[ts->l4off + 14], thlen - 14);
+
+	return (0);
+}
+
+
+/*
+ * Length of the next frame, or 0 when the segment has been used up.
+ */
+u_int
+uinet_tso_seglen(const struct uinet_tso *ts)
+{
+	u_int len;
+
+	if (ts->payload_off >= ts->payload_end)
+		return (0);
+
+	len = ts->payload_end - ts->payload_off;
+	if (len > ts->mss)
+		len = ts->mss;
+
+	return (ts->hdrlen + len);
+}
+
+
+/*
+ * Write the next frame to buf, which must have room for
+ * uinet_tso_seglen() bytes.
+ */
+void
+uinet_tso_build(struct uinet_tso *ts, void *buf)
+{
+	struct ip *ip;
+	struct tcphdr *th;
+	uint8_t *p = buf;
+	uint32_t seq;
+	u_int len;
+	u_int tcplen;
+	u_int sum;
+	uint8_t flags;
+	int last;
+
+	len = ts->payload_end - ts->payload_off;
+	if (len > ts->mss)
+		len = ts->mss;
+	last = (ts->payload_off + len == ts->payload_end);
+	tcplen = ts->hdrlen - ts->l4off + len;
+
+	memcpy(p, ts->hdr, ts->hdrlen);
+	m_copydata(ts->m, ts->payload_off, len, (caddr_t)(p + ts->hdrlen));
+
+	ip = (struct ip *)(p + ts->l3off);
+	ip->ip_len = htons(ts->hdrlen - ts->l3off + len);
+	ip->ip_id = htons(ts->ip_id);
+	ip->ip_sum = 0;
+	ip->ip_sum = in_cksum_hdr(ip);
+
+	flags = ts->th_flags;
+	if (!last)
+		flags &= ~(TH_FIN | TH_PUSH);
+	if (!ts->first)
+		flags &= ~TH_CWR;
+
+	th = (struct tcphdr *)(p + ts->l4off);
+	seq = htonl(ts->seq);
+	memcpy(&th->th_seq, &seq, sizeof(seq));
+	th->th_flags = flags;
+
+	sum = ts->th_sum_base;
+	sum += in_pseudo(ip->ip_src.s_addr, ip->ip_dst.s_addr, htons(tcplen + IPPROTO_TCP));
+	sum += uinet_tso_sum((const uint8_t *)th + 4, 4);	/* th_seq */
+	sum += uinet_tso_sum((const uint8_t *)th + 12, 2);	/* th_off, th_flags */
+	sum += (~in_cksum_skip(ts->m, ts->payload_off + len, ts->payload_off)) & 0xffff;
+	sum = (sum >> 16) + (sum & 0xffff);
+	sum += (sum >> 16);
+	th->th_sum = ~sum & 0xffff;
+
+	ts->payload_off += len;
+	ts->seq += len;
+	ts->ip_id++;
+	ts->first = 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2014 Patrick Kelsey. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _UINET_TSO_H_
+#define _UINET_TSO_H_
+
+struct ifnet;
+struct mbuf;
+
+/* ethernet + vlan, IP without options, TCP with maximum options */
+#define UINET_TSO_MAX_HDRLEN	(14 + 4 + 20 + 60)
+
+struct uinet_tso {
+	struct mbuf *m;
+	uint8_t hdr[UINET_TSO_MAX_HDRLEN];	/* template */
+	u_int l3off;
+	u_int l4off;
+	u_int hdrlen;
+	u_int payload_off;
+	u_int payload_end;
+	u_int mss;
+	uint32_t seq;
+	uint16_t ip_id;
+	uint8_t th_flags;
+	int first;
+	u_int th_sum_base;
+};
+
+void uinet_tso_attach(struct ifnet *ifp);
+void uinet_tso_txcsum(struct mbuf *m);
+int uinet_tso_start(struct uinet_tso *ts, struct mbuf *m);
+u_int uinet_tso_seglen(const struct uinet_tso *ts);
+void uinet_tso_build(struct uinet_tso *ts, void *buf);
+
+#endif /* _UINET_TSO_H_ */
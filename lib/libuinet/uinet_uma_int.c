@@ -27,64 +27,106 @@
 #include <sys/lock.h>
 #include <sys/mutex.h>
 #include <sys/proc.h>
+#include <sys/systm.h>
 #include <vm/vm.h>
 #include <vm/vm_page.h>
 #include <vm/uma.h>
 #include <vm/uma_int.h>
 
+#include "uinet_host_interface.h"
+
 
 /*
  * XXX this should really be handled by SYSINIT I think.  Although it works
  * out with the current port, calling mtx_init() before mutex_init() is
  * called is technically wrong.
  */
-static void thread_bucket_lock_init(void) __attribute__((constructor));
-static void uma_page_slab_hash_lock_init(void) __attribute__((constructor));
+static void uma_page_lock_init(void) __attribute__((constructor));
 
 
-struct mtx bucket_lock;
-struct mtx page_slab_hash_lock;
-int uma_page_mask;
-struct uma_page_head *uma_page_slab_hash;
+static struct mtx uma_page_lock;
+struct uma_page_node *uma_page_root[UMA_PAGE_ROOT_SIZE];
 
 
 static void
-thread_bucket_lock_init(void)
+uma_page_lock_init(void)
 {
-	mtx_init(&bucket_lock, "bucket lock", NULL, MTX_DEF);
+	mtx_init(&uma_page_lock, "uma page lock", NULL, MTX_DEF);
 }
 
-void
-thread_bucket_lock(void)
+
+/*
+ * Tree nodes come from the host allocator, as malloc() itself may be the
+ * one allocating the slab.
+ */
+static void *
+uma_page_alloc_node(size_t size)
 {
+	void *node;
 
-        mtx_lock(&bucket_lock);
+	node = uhi_calloc(1, size);
+	if (node == NULL)
+		panic("uma page tree: out of memory\n");
+
+	return (node);
 }
 
+
 void
-thread_bucket_unlock(void)
+vsetslab(vm_offset_t va, uma_slab_t slab)
 {
+	struct uma_page_node *node;
+	struct uma_page_leaf *leaf;
+	unsigned long pageno = atop(va);
 
-        mtx_unlock(&bucket_lock);
-}
+	if (UMA_PAGE_ROOT_IDX(pageno) >= UMA_PAGE_ROOT_SIZE)
+		panic("vsetslab: address %p out of range\n", (void *)va);
 
+	mtx_lock(&uma_page_lock);
 
-static void
-uma_page_slab_hash_lock_init(void)
-{
-	mtx_init(&page_slab_hash_lock, "uma page slab hash lock", NULL, MTX_DEF);
-}
+	node = uma_page_root[UMA_PAGE_ROOT_IDX(pageno)];
+	if (node == NULL) {
+		node = uma_page_alloc_node(sizeof(*node));
+		atomic_store_rel_ptr((volatile uintptr_t *)&uma_page_root[UMA_PAGE_ROOT_IDX(pageno)],
+		    (uintptr_t)node);
+	}
 
-void
-uma_page_slab_hash_lock(void)
-{
+	leaf = node->upn_leaf[UMA_PAGE_NODE_IDX(pageno)];
+	if (leaf == NULL) {
+		leaf = uma_page_alloc_node(sizeof(*leaf));
+		atomic_store_rel_ptr((volatile uintptr_t *)&node->upn_leaf[UMA_PAGE_NODE_IDX(pageno)],
+		    (uintptr_t)leaf);
+	}
 
-        mtx_lock(&page_slab_hash_lock);
+	atomic_store_rel_ptr((volatile uintptr_t *)&leaf->upl_slab[UMA_PAGE_LEAF_IDX(pageno)],
+	    (uintptr_t)slab);
+
+	mtx_unlock(&uma_page_lock);
 }
 
+
+/*
+ * Stands in for vsetobj() when a page leaves UMA, so that a later lookup
+ * of the page doesn't find the stale slab.
+ */
 void
-uma_page_slab_hash_unlock(void)
+vclrslab(vm_offset_t va)
 {
+	struct uma_page_node *node;
+	struct uma_page_leaf *leaf;
+	unsigned long pageno = atop(va);
+
+	if (UMA_PAGE_ROOT_IDX(pageno) >= UMA_PAGE_ROOT_SIZE)
+		return;
+
+	mtx_lock(&uma_page_lock);
+
+	node = uma_page_root[UMA_PAGE_ROOT_IDX(pageno)];
+	if (node != NULL) {
+		leaf = node->upn_leaf[UMA_PAGE_NODE_IDX(pageno)];
+		if (leaf != NULL)
+			atomic_store_rel_ptr((volatile uintptr_t *)&leaf->upl_slab[UMA_PAGE_LEAF_IDX(pageno)], 0);
+	}
 
-        mtx_unlock(&page_slab_hash_lock);
+	mtx_unlock(&uma_page_lock);
 }
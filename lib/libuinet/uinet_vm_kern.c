@@ -31,8 +31,16 @@
 
 
 #include <sys/param.h>
+#include <sys/systm.h>
+#include <sys/kernel.h>
+#include <sys/lock.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/queue.h>
+#include <sys/sysctl.h>
 
 #include <vm/vm.h>
+#include <vm/uma.h>
 
 
 #include "uinet_host_interface.h"
@@ -58,3 +66,271 @@ kmem_free(void *map, vm_offset_t addr, vm_size_t size)
 
 	uhi_munmap((void *)addr, size);
 }
+
+
+/*
+ * Hugepage arena.
+ *
+ * When configured at uinet_init() time, a hugepage-backed region is
+ * reserved and slabs for the zones registered via uinet_hugepage_zone()
+ * are carved from it, so that the mbufs, clusters and connection state
+ * touched on every packet share a small number of TLB entries.  With more
+ * than one memory domain, the region is split between the domains and
+ * each part is bound to its domain's node.  Slabs returned by UMA are
+ * kept on per-size free lists for reuse; the arena itself is never
+ * returned to the host.  Once a domain's part is exhausted, slabs come
+ * from kmem_malloc() as usual.
+ */
+#define	HUGEPAGE_MAXPAGES	16	/* largest slab, in pages, carved from the arena */
+
+struct hugepage_free {
+	SLIST_ENTRY(hugepage_free) hf_link;
+};
+
+struct hugepage_arena {
+	caddr_t	ha_base;
+	caddr_t	ha_next;
+	caddr_t	ha_end;
+	SLIST_HEAD(, hugepage_free) ha_freelist[HUGEPAGE_MAXPAGES + 1];
+};
+
+static MALLOC_DEFINE(M_HUGEPAGE, "hugepage", "hugepage-backed zone slabs");
+
+static struct mtx hugepage_lock;
+MTX_SYSINIT(hugepage_lock, &hugepage_lock, "hugepage arena", MTX_DEF);
+
+static struct hugepage_arena hugepage_arenas[MAXMEMDOM];
+static int hugepage_enabled;
+
+static u_long hugepage_size;
+static u_long hugepage_inuse;
+static u_long hugepage_fallbacks;
+static char hugepage_backing[16] = "none";
+
+SYSCTL_NODE(_vm, OID_AUTO, hugepage, CTLFLAG_RW, 0, "Hugepage arena");
+SYSCTL_ULONG(_vm_hugepage, OID_AUTO, size, CTLFLAG_RD, &hugepage_size, 0,
+    "Bytes reserved for the hugepage arena");
+SYSCTL_ULONG(_vm_hugepage, OID_AUTO, inuse, CTLFLAG_RD, &hugepage_inuse, 0,
+    "Bytes of the hugepage arena held by zone slabs");
+SYSCTL_ULONG(_vm_hugepage, OID_AUTO, fallbacks, CTLFLAG_RD,
+    &hugepage_fallbacks, 0,
+    "Slab allocations that could not be satisfied from the hugepage arena");
+SYSCTL_STRING(_vm_hugepage, OID_AUTO, backing, CTLFLAG_RD, hugepage_backing,
+    0, "Host backing of the hugepage arena");
+
+/*
+ * Zones whose slabs must come from a particular memory domain.  Entries
+ * are only added while the zones are being created during startup, so
+ * the table is read without locking.
+ */
+#define	ZONE_DOMAIN_MAX		32
+
+static struct {
+	uma_zone_t	zone;
+	int		domain;
+} zone_domains[ZONE_DOMAIN_MAX];
+static int zone_domains_count;
+
+
+int
+uinet_hugepage_init(unsigned int npages)
+{
+	struct hugepage_arena *ha;
+	caddr_t base;
+	uint64_t len;
+	int backing;
+	int domain;
+
+	if (npages == 0)
+		return (0);
+
+	len = (uint64_t)npages * UHI_HUGEPAGE_SIZE;
+	base = uhi_hugepage_alloc(len, &backing);
+	if (base == NULL) {
+		printf("Failed to reserve %u hugepages, using base pages\n",
+		    npages);
+		return (ENOMEM);
+	}
+
+	for (domain = 0; domain < vm_ndomains; domain++) {
+		ha = &hugepage_arenas[domain];
+		len = (uint64_t)(npages / vm_ndomains +
+		    (domain < npages % vm_ndomains ? 1 : 0)) * UHI_HUGEPAGE_SIZE;
+		ha->ha_base = ha->ha_next = base;
+		ha->ha_end = base + len;
+		if ((vm_ndomains > 1) && (len > 0))
+			uhi_numa_bind(base, len, uinet_domain_node[domain]);
+		base += len;
+	}
+
+	hugepage_size = (u_long)npages * UHI_HUGEPAGE_SIZE;
+	hugepage_enabled = 1;
+
+	switch (backing) {
+	case UHI_HUGEPAGE_HUGETLB:
+		strlcpy(hugepage_backing, "hugetlb", sizeof(hugepage_backing));
+		break;
+	case UHI_HUGEPAGE_TRANSPARENT:
+		strlcpy(hugepage_backing, "transparent", sizeof(hugepage_backing));
+		break;
+	default:
+		strlcpy(hugepage_backing, "none", sizeof(hugepage_backing));
+		break;
+	}
+
+	printf("uinet hugepage arena: %u x %u bytes (%s)\n", npages,
+	    UHI_HUGEPAGE_SIZE, hugepage_backing);
+
+	return (0);
+}
+
+
+static int
+zone_domain(uma_zone_t zone)
+{
+	int i;
+
+	for (i = 0; i < zone_domains_count; i++)
+		if (zone_domains[i].zone == zone)
+			return (zone_domains[i].domain);
+
+	return (vm_ndomains > 1 ? uinet_curdomain() : 0);
+}
+
+
+static void *
+hugepage_arena_alloc(int domain, int bytes, int *wait)
+{
+	struct hugepage_arena *ha;
+	struct hugepage_free *hf;
+	int npages;
+	void *p;
+
+	npages = bytes / PAGE_SIZE;
+	if (npages > HUGEPAGE_MAXPAGES)
+		return (NULL);
+
+	p = NULL;
+	ha = &hugepage_arenas[domain];
+	mtx_lock(&hugepage_lock);
+	if ((hf = SLIST_FIRST(&ha->ha_freelist[npages])) != NULL) {
+		SLIST_REMOVE_HEAD(&ha->ha_freelist[npages], hf_link);
+		p = hf;
+	} else if (ha->ha_end - ha->ha_next >= bytes) {
+		p = ha->ha_next;
+		ha->ha_next += bytes;
+
+		/* fresh arena memory is already zero */
+		*wait &= ~M_ZERO;
+	}
+	if (p != NULL)
+		hugepage_inuse += bytes;
+	else
+		hugepage_fallbacks++;
+	mtx_unlock(&hugepage_lock);
+
+	return (p);
+}
+
+
+static void *
+uinet_slab_alloc(uma_zone_t zone, int bytes, u_int8_t *pflag, int wait)
+{
+	vm_offset_t p;
+	int domain;
+
+	domain = zone_domain(zone);
+	if (hugepage_enabled) {
+		p = (vm_offset_t)hugepage_arena_alloc(domain, bytes, &wait);
+		if (p != 0) {
+			malloc_type_allocated(M_HUGEPAGE, bytes);
+			if (wait & M_ZERO)
+				bzero((void *)p, bytes);
+			*pflag = UMA_SLAB_PRIV;
+			return ((void *)p);
+		}
+	}
+
+	*pflag = UMA_SLAB_KMEM;
+	p = kmem_malloc(kmem_map, bytes, wait);
+	if (vm_ndomains > 1)
+		uhi_numa_bind((void *)p, bytes, uinet_domain_node[domain]);
+
+	return ((void *)p);
+}
+
+
+static void
+uinet_slab_free(void *mem, int size, u_int8_t flags)
+{
+	struct hugepage_arena *ha;
+	struct hugepage_free *hf;
+	int domain;
+
+	if ((flags & UMA_SLAB_PRIV) == 0) {
+		kmem_free(kmem_map, (vm_offset_t)mem, size);
+		return;
+	}
+
+	ha = NULL;
+	for (domain = 0; domain < vm_ndomains; domain++) {
+		if (((caddr_t)mem >= hugepage_arenas[domain].ha_base) &&
+		    ((caddr_t)mem < hugepage_arenas[domain].ha_end)) {
+			ha = &hugepage_arenas[domain];
+			break;
+		}
+	}
+	if (ha == NULL)
+		panic("%s: %p not in hugepage arena", __func__, mem);
+
+	hf = mem;
+	mtx_lock(&hugepage_lock);
+	SLIST_INSERT_HEAD(&ha->ha_freelist[size / PAGE_SIZE], hf, hf_link);
+	hugepage_inuse -= size;
+	mtx_unlock(&hugepage_lock);
+
+	malloc_type_freed(M_HUGEPAGE, size);
+}
+
+
+/*
+ * Direct the slab allocations of the given zone's keg to the hugepage
+ * arena.  Must be called before the zone is first used.  A no-op when no
+ * arena was configured.
+ */
+void
+uinet_hugepage_zone(uma_zone_t zone)
+{
+
+	if (!hugepage_enabled)
+		return;
+
+	uma_zone_set_allocf(zone, uinet_slab_alloc);
+	uma_zone_set_freef(zone, uinet_slab_free);
+}
+
+
+/*
+ * Place the slabs of the given zone's keg in the given memory domain,
+ * from that domain's part of the hugepage arena if one is configured.
+ * Zones that are not registered here take their slabs from the domain
+ * of the allocating thread.  Must be called before the zone is first
+ * used.
+ */
+void
+uinet_zone_set_domain(uma_zone_t zone, int domain)
+{
+
+	if (vm_ndomains == 1)
+		return;
+
+	if (zone_domains_count == ZONE_DOMAIN_MAX)
+		panic("Too many per-domain zones");
+
+	zone_domains[zone_domains_count].zone = zone;
+	zone_domains[zone_domains_count].domain = domain;
+	zone_domains_count++;
+
+	uma_zone_set_allocf(zone, uinet_slab_alloc);
+	uma_zone_set_freef(zone, uinet_slab_free);
+}
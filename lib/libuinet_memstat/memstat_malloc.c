@@ -209,6 +209,8 @@ retry:
 			mtp->mt_numallocs += mtsp->mts_numallocs;
 			mtp->mt_numfrees += mtsp->mts_numfrees;
 			mtp->mt_sizemask |= mtsp->mts_size;
+			/* libuinet reports allocation failures here. */
+			mtp->mt_failures += mtsp->_mts_reserved1;
 
 			/*
 			 * Copies of per-CPU statistics.
@@ -123,17 +123,43 @@ tunable_mbinit(void *dummy)
 }
 SYSINIT(tunable_mbinit, SI_SUB_TUNABLES, SI_ORDER_MIDDLE, tunable_mbinit, NULL);
 
+#ifdef UINET
+/*
+ * The cluster limits are for the whole stack, so they are split between
+ * the domains' zones, with any remainder going to domain 0.
+ */
+static int
+mb_domain_limit(int limit, int domain)
+{
+	int share;
+
+	share = limit / vm_ndomains;
+	if (domain == 0)
+		share += limit % vm_ndomains;
+	return (share > 0 ? share : 1);
+}
+#endif
+
 static int
 sysctl_nmbclusters(SYSCTL_HANDLER_ARGS)
 {
 	int error, newnmbclusters;
+#ifdef UINET
+	int domain;
+#endif
 
 	newnmbclusters = nmbclusters;
 	error = sysctl_handle_int(oidp, &newnmbclusters, 0, req); 
 	if (error == 0 && req->newptr) {
 		if (newnmbclusters > nmbclusters) {
 			nmbclusters = newnmbclusters;
+#ifdef UINET
+			for (domain = 0; domain < vm_ndomains; domain++)
+				uma_zone_set_max(mb_domain_zones[domain].clust,
+				    mb_domain_limit(nmbclusters, domain));
+#else
 			uma_zone_set_max(zone_clust, nmbclusters);
+#endif
 			EVENTHANDLER_INVOKE(nmbclusters_change);
 		} else
 			error = EINVAL;
@@ -148,13 +174,22 @@ static int
 sysctl_nmbjumbop(SYSCTL_HANDLER_ARGS)
 {
 	int error, newnmbjumbop;
+#ifdef UINET
+	int domain;
+#endif
 
 	newnmbjumbop = nmbjumbop;
 	error = sysctl_handle_int(oidp, &newnmbjumbop, 0, req); 
 	if (error == 0 && req->newptr) {
 		if (newnmbjumbop> nmbjumbop) {
 			nmbjumbop = newnmbjumbop;
+#ifdef UINET
+			for (domain = 0; domain < vm_ndomains; domain++)
+				uma_zone_set_max(mb_domain_zones[domain].jumbop,
+				    mb_domain_limit(nmbjumbop, domain));
+#else
 			uma_zone_set_max(zone_jumbop, nmbjumbop);
+#endif
 		} else
 			error = EINVAL;
 	}
@@ -213,10 +248,21 @@ SYSCTL_STRUCT(_kern_ipc, OID_AUTO, mbstat, CTLFLAG_RD, &mbstat, mbstat,
 /*
  * Zones from which we allocate.
  */
+#ifdef UINET
+struct mb_domain_zones	mb_domain_zones[MAXMEMDOM];
+
+/*
+ * Kegs backing each domain's zones, used to find the home domain of an
+ * item being freed.  The packet zone shares the mbuf keg.
+ */
+static uma_keg_t	mb_domain_kegs[MAXMEMDOM][3];
+static char		mb_domain_names[MAXMEMDOM][4][32];
+#else
 uma_zone_t	zone_mbuf;
 uma_zone_t	zone_clust;
 uma_zone_t	zone_pack;
 uma_zone_t	zone_jumbop;
+#endif
 uma_zone_t	zone_jumbo9;
 uma_zone_t	zone_jumbo16;
 uma_zone_t	zone_ext_refcnt;
@@ -235,6 +281,9 @@ static void	mb_zfini_pack(void *, int);
 
 static void	mb_reclaim(void *);
 static void	mbuf_init(void *);
+#ifdef UINET
+static void	mb_domain_init(int);
+#endif
 static void    *mbuf_jumbo_alloc(uma_zone_t, int, uint8_t *, int);
 
 /* Ensure that MSIZE doesn't break dtom() - it must be a power of 2 */
@@ -247,7 +296,12 @@ SYSINIT(mbuf, SI_SUB_MBUF, SI_ORDER_FIRST, mbuf_init, NULL);
 static void
 mbuf_init(void *dummy)
 {
+#ifdef UINET
+	int domain;
 
+	for (domain = 0; domain < vm_ndomains; domain++)
+		mb_domain_init(domain);
+#else
 	/*
 	 * Configure UMA zones for Mbufs, Clusters, and Packets.
 	 */
@@ -285,6 +339,7 @@ mbuf_init(void *dummy)
 	    UMA_ALIGN_PTR, UMA_ZONE_REFCNT);
 	if (nmbjumbop > 0)
 		uma_zone_set_max(zone_jumbop, nmbjumbop);
+#endif
 
 	zone_jumbo9 = uma_zcreate(MBUF_JUMBO9_MEM_NAME, MJUM9BYTES,
 	    mb_ctor_clust, mb_dtor_clust,
@@ -345,6 +400,106 @@ mbuf_init(void *dummy)
 	mbstat.sf_allocwait = mbstat.sf_allocfail = 0;
 }
 
+#ifdef UINET
+/*
+ * Create the mbuf, cluster, packet and page-size jumbo zones for one
+ * memory domain.  Domain 0 keeps the usual zone names so existing
+ * consumers of the statistics find them; the others are suffixed with the
+ * domain number.  The mbuf keg uses vtoslab() so that mb_homezones() can
+ * find the keg of any item.
+ */
+static void
+mb_domain_init(int domain)
+{
+	struct mb_domain_zones *mdz;
+	const char *names[4] = { MBUF_MEM_NAME, MBUF_CLUSTER_MEM_NAME,
+				 MBUF_PACKET_MEM_NAME, MBUF_JUMBOP_MEM_NAME };
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		if (domain == 0)
+			strlcpy(mb_domain_names[domain][i], names[i],
+			    sizeof(mb_domain_names[domain][i]));
+		else
+			snprintf(mb_domain_names[domain][i],
+			    sizeof(mb_domain_names[domain][i]), "%s_%d",
+			    names[i], domain);
+	}
+
+	mdz = &mb_domain_zones[domain];
+	mdz->mbuf = uma_zcreate(mb_domain_names[domain][0], MSIZE,
+	    mb_ctor_mbuf, mb_dtor_mbuf,
+#ifdef INVARIANTS
+	    trash_init, trash_fini,
+#else
+	    NULL, NULL,
+#endif
+	    MSIZE - 1, UMA_ZONE_MAXBUCKET | UMA_ZONE_VTOSLAB);
+
+	mdz->clust = uma_zcreate(mb_domain_names[domain][1], MCLBYTES,
+	    mb_ctor_clust, mb_dtor_clust,
+#ifdef INVARIANTS
+	    trash_init, trash_fini,
+#else
+	    NULL, NULL,
+#endif
+	    UMA_ALIGN_PTR, UMA_ZONE_REFCNT);
+	if (nmbclusters > 0)
+		uma_zone_set_max(mdz->clust,
+		    mb_domain_limit(nmbclusters, domain));
+
+	mdz->pack = uma_zsecond_create(mb_domain_names[domain][2],
+	    mb_ctor_pack, mb_dtor_pack, mb_zinit_pack, mb_zfini_pack,
+	    mdz->mbuf);
+
+	mdz->jumbop = uma_zcreate(mb_domain_names[domain][3], MJUMPAGESIZE,
+	    mb_ctor_clust, mb_dtor_clust,
+#ifdef INVARIANTS
+	    trash_init, trash_fini,
+#else
+	    NULL, NULL,
+#endif
+	    UMA_ALIGN_PTR, UMA_ZONE_REFCNT);
+	if (nmbjumbop > 0)
+		uma_zone_set_max(mdz->jumbop,
+		    mb_domain_limit(nmbjumbop, domain));
+
+	uinet_hugepage_zone(mdz->mbuf);
+	uinet_hugepage_zone(mdz->clust);
+	uinet_hugepage_zone(mdz->jumbop);
+	uinet_zone_set_domain(mdz->mbuf, domain);
+	uinet_zone_set_domain(mdz->clust, domain);
+	uinet_zone_set_domain(mdz->jumbop, domain);
+
+	mb_domain_kegs[domain][0] = LIST_FIRST(&mdz->mbuf->uz_kegs)->kl_keg;
+	mb_domain_kegs[domain][1] = LIST_FIRST(&mdz->clust->uz_kegs)->kl_keg;
+	mb_domain_kegs[domain][2] = LIST_FIRST(&mdz->jumbop->uz_kegs)->kl_keg;
+}
+
+/*
+ * Returns the zones of the memory domain the given mbuf or cluster was
+ * allocated from.
+ */
+struct mb_domain_zones *
+mb_homezones(void *item)
+{
+	uma_slab_t slab;
+	int domain;
+
+	slab = vtoslab((vm_offset_t)item);
+	if (slab != NULL) {
+		for (domain = 0; domain < vm_ndomains; domain++) {
+			if (slab->us_keg == mb_domain_kegs[domain][0] ||
+			    slab->us_keg == mb_domain_kegs[domain][1] ||
+			    slab->us_keg == mb_domain_kegs[domain][2])
+				return (&mb_domain_zones[domain]);
+		}
+	}
+
+	panic("%s: %p is not from an mbuf zone", __func__, item);
+}
+#endif /* UINET */
+
 /*
  * UMA backend page allocator for the jumbo frame zones.
  *
@@ -474,8 +629,8 @@ mb_dtor_pack(void *mem, int size, void *arg)
 	 * is deliberate. We don't want to acquire the zone lock for every
 	 * mbuf free.
 	 */
-	if (uma_zone_exhausted_nolock(zone_clust))
-		zone_drain(zone_pack);
+	if (uma_zone_exhausted_nolock(MB_ZONE_HOME(clust, m->m_ext.ext_buf)))
+		zone_drain(MB_ZONE_HOME(pack, m));
 }
 
 /*
@@ -590,7 +745,8 @@ mb_zfini_pack(void *mem, int size)
 #ifdef INVARIANTS
 	trash_fini(m->m_ext.ext_buf, MCLBYTES);
 #endif
-	uma_zfree_arg(zone_clust, m->m_ext.ext_buf, NULL);
+	uma_zfree_arg(MB_ZONE_HOME(clust, m->m_ext.ext_buf), m->m_ext.ext_buf,
+	    NULL);
 #ifdef INVARIANTS
 	trash_dtor(mem, size, NULL);
 #endif
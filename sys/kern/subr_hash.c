@@ -50,7 +50,9 @@ hashinit_flags(int elements, struct malloc_type *type, u_long *hashmask,
 {
 	long hashsize;
 	LIST_HEAD(generic, generic) *hashtbl;
+#ifndef UINET
 	int i;
+#endif
 
 	KASSERT(elements > 0, ("%s: bad elements", __func__));
 	/* Exactly one of HASH_WAITOK and HASH_NOWAIT must be set. */
@@ -61,6 +63,22 @@ hashinit_flags(int elements, struct malloc_type *type, u_long *hashmask,
 		continue;
 	hashsize >>= 1;
 
+#ifdef UINET
+	/*
+	 * An empty LIST_HEAD is all zeroes, and large tables come from
+	 * zero-filled anonymous memory, so asking for zeroed memory leaves
+	 * the pages of a big table untouched until its buckets are used.
+	 */
+	if (flags & HASH_NOWAIT)
+		hashtbl = malloc((u_long)hashsize * sizeof(*hashtbl),
+		    type, M_NOWAIT | M_ZERO);
+	else
+		hashtbl = malloc((u_long)hashsize * sizeof(*hashtbl),
+		    type, M_WAITOK | M_ZERO);
+
+	if (hashtbl != NULL)
+		*hashmask = hashsize - 1;
+#else
 	if (flags & HASH_NOWAIT)
 		hashtbl = malloc((u_long)hashsize * sizeof(*hashtbl),
 		    type, M_NOWAIT);
@@ -73,6 +91,7 @@ hashinit_flags(int elements, struct malloc_type *type, u_long *hashmask,
 			LIST_INIT(&hashtbl[i]);
 		*hashmask = hashsize - 1;
 	}
+#endif
 	return (hashtbl);
 }
 
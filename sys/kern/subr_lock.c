@@ -125,7 +125,10 @@ DB_SHOW_COMMAND(lock, db_show_lock)
 }
 #endif
 
-#ifdef LOCK_PROFILING
+/*
+ * uinet provides its own per-thread implementation in uinet_subr_lock.c.
+ */
+#if defined(LOCK_PROFILING) && !defined(UINET)
 
 /*
  * One object per-thread for each lock the thread owns.  Tracks individual
@@ -258,6 +258,9 @@ domaininit(void *dummy)
 	socket_zone = uma_zcreate("socket", sizeof(struct socket), NULL, NULL,
 	    NULL, NULL, UMA_ALIGN_PTR, UMA_ZONE_NOFREE);
 	uma_zone_set_max(socket_zone, maxsockets);
+#ifdef UINET
+	uinet_hugepage_zone(socket_zone);
+#endif
 	EVENTHANDLER_REGISTER(maxsockets_change, socket_zone_change, NULL,
 		EVENTHANDLER_PRI_FIRST);
 
@@ -228,13 +228,15 @@ mb_free_ext(struct mbuf *m)
 		case EXT_PACKET:	/* The packet zone is special. */
 			if (*(m->m_ext.ref_cnt) == 0)
 				*(m->m_ext.ref_cnt) = 1;
-			uma_zfree(zone_pack, m);
+			uma_zfree(MB_ZONE_HOME(pack, m), m);
 			return;		/* Job done. */
 		case EXT_CLUSTER:
-			uma_zfree(zone_clust, m->m_ext.ext_buf);
+			uma_zfree(MB_ZONE_HOME(clust, m->m_ext.ext_buf),
+			    m->m_ext.ext_buf);
 			break;
 		case EXT_JUMBOP:
-			uma_zfree(zone_jumbop, m->m_ext.ext_buf);
+			uma_zfree(MB_ZONE_HOME(jumbop, m->m_ext.ext_buf),
+			    m->m_ext.ext_buf);
 			break;
 		case EXT_JUMBO9:
 			uma_zfree(zone_jumbo9, m->m_ext.ext_buf);
@@ -276,7 +278,7 @@ mb_free_ext(struct mbuf *m)
 	m->m_ext.ext_size = 0;
 	m->m_ext.ext_type = 0;
 	m->m_flags &= ~M_EXT;
-	uma_zfree(zone_mbuf, m);
+	uma_zfree(MB_ZONE_HOME(mbuf, m), m);
 }
 
 /*
@@ -494,6 +494,9 @@ if_alloc(u_char type)
 			return (NULL);
 		}
 	}
+#ifdef UINET
+	ifp->if_pcpustat = pcpustat_alloc(sizeof(struct if_pcpustat), M_WAITOK);
+#endif
 
 	IF_ADDR_LOCK_INIT(ifp);
 	TASK_INIT(&ifp->if_linktask, 0, do_link_state_change, ifp);
@@ -537,9 +540,41 @@ if_free_internal(struct ifnet *ifp)
 	IF_AFDATA_DESTROY(ifp);
 	IF_ADDR_LOCK_DESTROY(ifp);
 	ifq_delete(&ifp->if_snd);
+#ifdef UINET
+	pcpustat_free(ifp->if_pcpustat);
+#endif
 	free(ifp, M_IFNET);
 }
 
+#ifdef UINET
+/*
+ * Copy out the interface data with the per-cpu traffic counters summed in.
+ */
+void
+if_data_fold(struct ifnet *ifp, struct if_data *ifd)
+{
+	struct if_pcpustat ifs;
+
+	*ifd = ifp->if_data;
+	pcpustat_fetch(&ifs, ifp->if_pcpustat, sizeof(ifs));
+	ifd->ifi_ipackets += ifs.ifs_ipackets;
+	ifd->ifi_ierrors += ifs.ifs_ierrors;
+	ifd->ifi_opackets += ifs.ifs_opackets;
+	ifd->ifi_oerrors += ifs.ifs_oerrors;
+	ifd->ifi_collisions += ifs.ifs_collisions;
+	ifd->ifi_ibytes += ifs.ifs_ibytes;
+	ifd->ifi_obytes += ifs.ifs_obytes;
+	ifd->ifi_imcasts += ifs.ifs_imcasts;
+	ifd->ifi_omcasts += ifs.ifs_omcasts;
+	ifd->ifi_iqdrops += ifs.ifs_iqdrops;
+	ifd->ifi_noproto += ifs.ifs_noproto;
+	ifd->ifi_icopies += ifs.ifs_icopies;
+	ifd->ifi_izcopies += ifs.ifs_izcopies;
+	ifd->ifi_ocopies += ifs.ifs_ocopies;
+	ifd->ifi_ozcopies += ifs.ifs_ozcopies;
+}
+#endif
+
 /*
  * This version should only be called by intefaces that switch their type
  * after calling if_alloc().  if_free_type() will go away again now that we
@@ -3427,9 +3462,9 @@ if_handoff(struct ifqueue *ifq, struct mbuf *m, struct ifnet *ifp, int adjust)
 		return (0);
 	}
 	if (ifp != NULL) {
-		ifp->if_obytes += m->m_pkthdr.len + adjust;
+		IF_STAT_ADD(ifp, obytes, m->m_pkthdr.len + adjust);
 		if (m->m_flags & (M_BCAST|M_MCAST))
-			ifp->if_omcasts++;
+			IF_STAT_INC(ifp, omcasts);
 		active = ifp->if_drv_flags & IFF_DRV_OACTIVE;
 	}
 	_IF_ENQUEUE(ifq, m);
@@ -442,7 +442,7 @@ linkhdr_added:
 					n->m_pkthdr.csum_data = 0xffff;
 				(void)if_simloop(ifp, n, dst->sa_family, hlen);
 			} else
-				ifp->if_iqdrops++;
+				IF_STAT_INC(ifp, iqdrops);
 		} else if (bcmp(eh->ether_dhost, eh->ether_shost,
 				ETHER_ADDR_LEN) == 0) {
 			m->m_pkthdr.csum_flags |= csum_flags;
@@ -650,7 +650,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 	 */
 	if ((m->m_flags & M_PKTHDR) == 0) {
 		if_printf(ifp, "discard frame w/o packet header\n");
-		ifp->if_ierrors++;
+		IF_STAT_INC(ifp, ierrors);
 		m_freem(m);
 		return;
 	}
@@ -659,7 +659,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 		if_printf(ifp, "discard frame w/o leading ethernet "
 				"header (len %u pkt len %u)\n",
 				m->m_len, m->m_pkthdr.len);
-		ifp->if_ierrors++;
+		IF_STAT_INC(ifp, ierrors);
 		m_freem(m);
 		return;
 	}
@@ -667,7 +667,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 	etype = ntohs(eh->ether_type);
 	if (m->m_pkthdr.rcvif == NULL) {
 		if_printf(ifp, "discard frame w/o interface pointer\n");
-		ifp->if_ierrors++;
+		IF_STAT_INC(ifp, ierrors);
 		m_freem(m);
 		return;
 	}
@@ -685,7 +685,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 			m->m_flags |= M_BCAST;
 		else
 			m->m_flags |= M_MCAST;
-		ifp->if_imcasts++;
+		IF_STAT_INC(ifp, imcasts);
 	}
 
 #ifdef MAC
@@ -712,7 +712,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 	}
 
 	if (!(ifp->if_capenable & IFCAP_HWSTATS))
-		ifp->if_ibytes += m->m_pkthdr.len;
+		IF_STAT_ADD(ifp, ibytes, m->m_pkthdr.len);
 
 	/* Allow monitor mode to claim this frame, after stats are updated. */
 	if (ifp->if_flags & IFF_MONITOR) {
@@ -746,7 +746,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 #ifdef DIAGNOSTIC
 			if_printf(ifp, "cannot allocate MTAG_PROMISCINET_L2INFO\n");
 #endif
-			ifp->if_ierrors++;
+			IF_STAT_INC(ifp, ierrors);
 			m_freem(m);
 			CURVNET_RESTORE();
 			return;
@@ -806,7 +806,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 #ifdef DIAGNOSTIC
 				if_printf(ifp, "cannot pullup VLAN header(s)\n");
 #endif
-				ifp->if_ierrors++;
+				IF_STAT_INC(ifp, ierrors);
 				m_freem(m);
 				CURVNET_RESTORE();
 				return;
@@ -837,7 +837,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 #ifdef DIAGNOSTIC
 				if_printf(ifp, "malformed packet or too many VLAN headers\n");
 #endif
-				ifp->if_ierrors++;
+				IF_STAT_INC(ifp, ierrors);
 				m_freem(m);
 				CURVNET_RESTORE();
 				return;
@@ -871,7 +871,7 @@ ether_input_internal(struct ifnet *ifp, struct mbuf *m)
 #ifdef DIAGNOSTIC
 			if_printf(ifp, "cannot pullup VLAN header\n");
 #endif
-			ifp->if_ierrors++;
+			IF_STAT_INC(ifp, ierrors);
 			m_freem(m);
 			CURVNET_RESTORE();
 			return;
@@ -1028,7 +1028,7 @@ ether_demux(struct ifnet *ifp, struct mbuf *m)
 	if ((m->m_flags & M_VLANTAG) &&
 	    EVL_VLANOFTAG(m->m_pkthdr.ether_vtag) != 0) {
 		if (ifp->if_vlantrunk == NULL) {
-			ifp->if_noproto++;
+			IF_STAT_INC(ifp, noproto);
 			m_freem(m);
 			return;
 		}
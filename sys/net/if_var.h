@@ -206,7 +206,12 @@ struct ifnet {
 	 */
 	char	if_cspare[3];
 	int	if_ispare[4];
+#ifdef UINET
+	void	*if_pspare[7];		/* 1 netmap, 6 TDB */
+	struct	if_pcpustat *if_pcpustat; /* per-cpu traffic counters */
+#else
 	void	*if_pspare[8];		/* 1 netmap, 7 TDB */
+#endif
 };
 
 typedef void if_init_f_t(void *);
@@ -243,6 +248,37 @@ typedef void if_init_f_t(void *);
 #define	if_ozcopies	if_data.ifi_ozcopies
 #endif
 
+#ifdef UINET
+/*
+ * Per-cpu copies of the traffic counters that are bumped on the packet
+ * path.  Each is accumulated on top of the corresponding if_data member by
+ * if_data_fold(), which readers of if_data must use.
+ */
+struct if_pcpustat {
+	u_long	ifs_ipackets;
+	u_long	ifs_ierrors;
+	u_long	ifs_opackets;
+	u_long	ifs_oerrors;
+	u_long	ifs_collisions;
+	u_long	ifs_ibytes;
+	u_long	ifs_obytes;
+	u_long	ifs_imcasts;
+	u_long	ifs_omcasts;
+	u_long	ifs_iqdrops;
+	u_long	ifs_noproto;
+	u_long	ifs_icopies;
+	u_long	ifs_izcopies;
+	u_long	ifs_ocopies;
+	u_long	ifs_ozcopies;
+};
+
+#define	IF_STAT_ADD(ifp, name, val)					\
+	PCPUSTAT_ADD(struct if_pcpustat, (ifp)->if_pcpustat, ifs_ ## name, (val))
+#else
+#define	IF_STAT_ADD(ifp, name, val)	((ifp)->if_ ## name += (val))
+#endif
+#define	IF_STAT_INC(ifp, name)		IF_STAT_ADD(ifp, name, 1)
+
 /* for compatibility with other BSDs */
 #define	if_addrlist	if_addrhead
 #define	if_list		if_link
@@ -529,9 +565,9 @@ do {									\
 	mflags = (m)->m_flags;						\
 	IFQ_ENQUEUE(&(ifp)->if_snd, m, err);				\
 	if ((err) == 0) {						\
-		(ifp)->if_obytes += len + (adj);			\
+		IF_STAT_ADD((ifp), obytes, len + (adj));		\
 		if (mflags & M_MCAST)					\
-			(ifp)->if_omcasts++;				\
+			IF_STAT_INC((ifp), omcasts);			\
 		if (((ifp)->if_drv_flags & IFF_DRV_OACTIVE) == 0)	\
 			if_start(ifp);					\
 	}								\
@@ -871,6 +907,9 @@ int	if_addmulti(struct ifnet *, struct sockaddr *, struct ifmultiaddr **);
 int	if_allmulti(struct ifnet *, int);
 struct	ifnet* if_alloc(u_char);
 void	if_attach(struct ifnet *);
+#ifdef UINET
+void	if_data_fold(struct ifnet *, struct if_data *);
+#endif
 void	if_dead(struct ifnet *);
 int	if_delmulti(struct ifnet *, struct sockaddr *);
 void	if_delmulti_ifma(struct ifmultiaddr *);
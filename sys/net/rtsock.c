@@ -1264,7 +1264,11 @@ rt_ifmsg(struct ifnet *ifp)
 	ifm = mtod(m, struct if_msghdr *);
 	ifm->ifm_index = ifp->if_index;
 	ifm->ifm_flags = ifp->if_flags | ifp->if_drv_flags;
+#ifdef UINET
+	if_data_fold(ifp, &ifm->ifm_data);
+#else
 	ifm->ifm_data = ifp->if_data;
+#endif
 	ifm->ifm_addrs = 0;
 	rt_dispatch(m, AF_UNSPEC);
 }
@@ -1607,7 +1611,11 @@ sysctl_iflist_ifml(struct ifnet *ifp, struct rt_addrinfo *info,
 	ifm->ifm_len = sizeof(*ifm);
 	ifm->ifm_data_off = offsetof(struct if_msghdrl, ifm_data);
 
+#ifdef UINET
+	if_data_fold(ifp, &ifm->ifm_data);
+#else
 	ifm->ifm_data = ifp->if_data;
+#endif
 
 	return (SYSCTL_OUT(w->w_req, (caddr_t)ifm, len));
 }
@@ -1637,7 +1645,11 @@ sysctl_iflist_ifm(struct ifnet *ifp, struct rt_addrinfo *info,
 	ifm->ifm_flags = ifp->if_flags | ifp->if_drv_flags;
 	ifm->ifm_index = ifp->if_index;
 
+#ifdef UINET
+	if_data_fold(ifp, &ifm->ifm_data);
+#else
 	ifm->ifm_data = ifp->if_data;
+#endif
 
 	return (SYSCTL_OUT(w->w_req, (caddr_t)ifm, len));
 }
@@ -504,6 +504,32 @@ vnet_sysctl_handle_uint(SYSCTL_HANDLER_ARGS)
 	return (sysctl_handle_int(oidp, arg1, arg2, req));
 }
 
+#ifdef UINET
+/*
+ * 'arg1' is the offset of a virtualized per-cpu statistics block pointer
+ * and 'arg2' the size of the statistics structure.  Reads return the sum
+ * over all cpus, and writes (e.g. netstat -z) replace it.
+ */
+int
+vnet_sysctl_handle_pcpustat(SYSCTL_HANDLER_ARGS)
+{
+	void *base, *stat;
+	int error;
+
+	base = *(void **)(curvnet->vnet_data_base + (uintptr_t)arg1);
+	stat = malloc(arg2, M_TEMP, M_WAITOK);
+	pcpustat_fetch(stat, base, arg2);
+	error = SYSCTL_OUT(req, stat, arg2);
+	if (error == 0 && req->newptr != NULL) {
+		error = SYSCTL_IN(req, stat, arg2);
+		if (error == 0)
+			pcpustat_store(base, stat, arg2);
+	}
+	free(stat, M_TEMP);
+	return (error);
+}
+#endif
+
 /*
  * Support for special SYSINIT handlers registered via VNET_SYSINIT()
  * and VNET_SYSUNINIT().
@@ -230,6 +230,18 @@ extern struct sx vnet_sxlock;
 #define	VNET_PTR(n)		VNET_VNET_PTR(curvnet, n)
 #define	VNET(n)			VNET_VNET(curvnet, n)
 
+#ifdef UINET
+/*
+ * Virtualized per-cpu statistics.  The virtualized variable is a pointer to
+ * a per-cpu statistics block (see PCPUSTAT_PTR() in <sys/pcpu.h>), which
+ * VNET_PCPUSTAT_SYSINIT() allocates for each vnet.
+ */
+#define	VNET_PCPUSTAT_DECLARE(t, n)	VNET_DECLARE(t *, n)
+#define	VNET_PCPUSTAT_DEFINE(t, n)	VNET_DEFINE(t *, n)
+#define	VNET_PCPUSTAT_ADD(t, n, f, v)	PCPUSTAT_ADD(t, VNET(n), f, v)
+#define	VNET_PCPUSTAT_FETCH(t, n, dst)	pcpustat_fetch((dst), VNET(n), sizeof(t))
+#endif
+
 /*
  * Virtual network stack allocator interfaces from the kernel linker.
  */
@@ -249,6 +261,9 @@ int	vnet_sysctl_handle_int(SYSCTL_HANDLER_ARGS);
 int	vnet_sysctl_handle_opaque(SYSCTL_HANDLER_ARGS);
 int	vnet_sysctl_handle_string(SYSCTL_HANDLER_ARGS);
 int	vnet_sysctl_handle_uint(SYSCTL_HANDLER_ARGS);
+#ifdef UINET
+int	vnet_sysctl_handle_pcpustat(SYSCTL_HANDLER_ARGS);
+#endif
 
 #define	SYSCTL_VNET_INT(parent, nbr, name, access, ptr, val, descr)	\
 	SYSCTL_OID(parent, nbr, name,					\
@@ -277,6 +292,13 @@ int	vnet_sysctl_handle_uint(SYSCTL_HANDLER_ARGS);
 	SYSCTL_OID(parent, nbr, name,					\
 	    CTLTYPE_UINT|CTLFLAG_MPSAFE|CTLFLAG_VNET|(access),		\
 	    ptr, val, vnet_sysctl_handle_uint, "IU", descr)
+#ifdef UINET
+#define	SYSCTL_VNET_PCPUSTAT(parent, nbr, name, access, ptr, type, descr) \
+	SYSCTL_OID(parent, nbr, name,					\
+	    CTLTYPE_OPAQUE|CTLFLAG_VNET|(access), ptr,			\
+	    sizeof(struct type), vnet_sysctl_handle_pcpustat, "S," #type, \
+	    descr)
+#endif
 #define	VNET_SYSCTL_ARG(req, arg1) do {					\
 	if (arg1 != NULL)						\
 		arg1 = (void *)(TD_TO_VNET((req)->td)->vnet_data_base +	\
@@ -327,6 +349,30 @@ struct vnet_sysinit {
 	SYSUNINIT(vnet_uninit_ ## ident, subsystem, order,		\
 	    vnet_deregister_sysuninit, &ident ## _vnet_uninit)
 
+#ifdef UINET
+/*
+ * Allocate and free a virtualized per-cpu statistics block.  This happens
+ * before any protocol is initialized and after all have been torn down.
+ */
+#define	VNET_PCPUSTAT_SYSINIT(n)					\
+	static void							\
+	vnet_ ## n ## _init(const void *unused __unused)		\
+	{								\
+		VNET(n) = pcpustat_alloc(sizeof(*VNET(n)), M_WAITOK);	\
+	}								\
+	VNET_SYSINIT(vnet_ ## n ## _init, SI_SUB_PROTO_BEGIN,		\
+	    SI_ORDER_ANY, vnet_ ## n ## _init, NULL)
+#define	VNET_PCPUSTAT_SYSUNINIT(n)					\
+	static void							\
+	vnet_ ## n ## _uninit(const void *unused __unused)		\
+	{								\
+		pcpustat_free(VNET(n));					\
+		VNET(n) = NULL;						\
+	}								\
+	VNET_SYSUNINIT(vnet_ ## n ## _uninit, SI_SUB_PROTO_BEGIN,	\
+	    SI_ORDER_ANY, vnet_ ## n ## _uninit, NULL)
+#endif
+
 /*
  * Run per-vnet sysinits or sysuninits during vnet creation/destruction.
  */
@@ -2219,6 +2219,107 @@ in_pcblookup_mbuf(struct inpcbinfo *pcbinfo, struct in_addr faddr,
 }
 #endif /* INET */
 
+#if defined(INET) && defined(UINET)
+/*
+ * Receive batches are delivered to the stack grouped by flow, so
+ * consecutive segments very often belong to the same connection.  Between
+ * in_pcblastflow_begin() and in_pcblastflow_end(), the current thread
+ * keeps a reference to the last connected inpcb found by
+ * in_pcblookup_mbuf_lastflow() and reuses it for the next segment with
+ * the same 4-tuple instead of walking the hash.  Only exact matches are
+ * cached, and the cached inpcb is revalidated under its lock, so the
+ * result is the same as that of a full lookup.
+ */
+void
+in_pcblastflow_begin(struct inpcb_lastflow *ilf)
+{
+
+	bzero(ilf, sizeof(*ilf));
+	curthread->td_pcblastflow = ilf;
+}
+
+static void
+in_pcblastflow_drop(struct inpcb_lastflow *ilf)
+{
+	struct inpcb *inp;
+
+	inp = ilf->ilf_inp;
+	if (inp != NULL) {
+		ilf->ilf_inp = NULL;
+		INP_WLOCK(inp);
+		if (!in_pcbrele_wlocked(inp))
+			INP_WUNLOCK(inp);
+	}
+}
+
+void
+in_pcblastflow_end(struct inpcb_lastflow *ilf)
+{
+
+	KASSERT(curthread->td_pcblastflow == ilf,
+	    ("%s: lastflow cache not active", __func__));
+
+	curthread->td_pcblastflow = NULL;
+	in_pcblastflow_drop(ilf);
+}
+
+struct inpcb *
+in_pcblookup_mbuf_lastflow(struct inpcbinfo *pcbinfo, struct in_addr faddr,
+    u_int fport, struct in_addr laddr, u_int lport, int lookupflags,
+    struct ifnet *ifp, struct mbuf *m)
+{
+	struct inpcb_lastflow *ilf;
+	struct inpcb *inp;
+
+	ilf = curthread->td_pcblastflow;
+	if ((ilf == NULL) || !(lookupflags & INPLOOKUP_WLOCKPCB)
+#ifdef PROMISCUOUS_INET
+	    || (ifp && (ifp->if_flags & IFF_PROMISCINET))
+#endif
+	    )
+		return (in_pcblookup_mbuf(pcbinfo, faddr, fport, laddr, lport,
+		    lookupflags, ifp, m));
+
+	inp = ilf->ilf_inp;
+	if (inp != NULL) {
+		if (ilf->ilf_pcbinfo == pcbinfo &&
+		    ilf->ilf_faddr.s_addr == faddr.s_addr &&
+		    ilf->ilf_laddr.s_addr == laddr.s_addr &&
+		    ilf->ilf_fport == fport && ilf->ilf_lport == lport) {
+			INP_WLOCK(inp);
+			if (((inp->inp_flags & (INP_INHASHLIST | INP_TIMEWAIT |
+			    INP_DROPPED)) == INP_INHASHLIST) &&
+			    inp->inp_faddr.s_addr == faddr.s_addr &&
+			    inp->inp_laddr.s_addr == laddr.s_addr &&
+			    inp->inp_fport == fport &&
+			    inp->inp_lport == lport)
+				return (inp);
+
+			/* Stale - the connection has moved on. */
+			ilf->ilf_inp = NULL;
+			if (!in_pcbrele_wlocked(inp))
+				INP_WUNLOCK(inp);
+		} else
+			in_pcblastflow_drop(ilf);
+	}
+
+	inp = in_pcblookup_mbuf(pcbinfo, faddr, fport, laddr, lport,
+	    lookupflags, ifp, m);
+	if (inp != NULL && inp->inp_faddr.s_addr != INADDR_ANY &&
+	    !(inp->inp_flags & (INP_TIMEWAIT | INP_DROPPED))) {
+		in_pcbref(inp);
+		ilf->ilf_pcbinfo = pcbinfo;
+		ilf->ilf_inp = inp;
+		ilf->ilf_faddr = faddr;
+		ilf->ilf_laddr = laddr;
+		ilf->ilf_fport = fport;
+		ilf->ilf_lport = lport;
+	}
+
+	return (inp);
+}
+#endif /* INET && UINET */
+
 /*
  * Insert PCB onto various hash lists.
  */
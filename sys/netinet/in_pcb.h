@@ -191,8 +191,14 @@ struct inpcb {
 #else
 	void	*inp_pspare[5];		/* (x) route caching / general use */
 #endif
+#ifdef UINET
+	u_int	inp_ispare[5];		/* (x) route caching / user cookie /
+					 *     general use */
+	u_int	inp_rxcpu;		/* (i) receiving cpu + 1, or 0 */
+#else
 	u_int	inp_ispare[6];		/* (x) route caching / user cookie /
 					 *     general use */
+#endif
 
 	/* Local and foreign ports, local and foreign addr. */
 	struct	in_conninfo inp_inc;	/* (i/p) list for PCB's local port */
@@ -662,6 +668,26 @@ struct inpcb *
 struct inpcb *
 	in_pcblookup_mbuf(struct inpcbinfo *, struct in_addr, u_int,
 	    struct in_addr, u_int, int, struct ifnet *, struct mbuf *);
+#ifdef UINET
+/*
+ * Per-thread cache of the last connected inpcb matched while a receive
+ * batch is being delivered.  See in_pcblastflow_begin().
+ */
+struct inpcb_lastflow {
+	struct inpcbinfo	*ilf_pcbinfo;
+	struct inpcb		*ilf_inp;	/* referenced via in_pcbref() */
+	struct in_addr		 ilf_faddr;
+	struct in_addr		 ilf_laddr;
+	u_short			 ilf_fport;
+	u_short			 ilf_lport;
+};
+
+void	in_pcblastflow_begin(struct inpcb_lastflow *);
+void	in_pcblastflow_end(struct inpcb_lastflow *);
+struct inpcb *
+	in_pcblookup_mbuf_lastflow(struct inpcbinfo *, struct in_addr, u_int,
+	    struct in_addr, u_int, int, struct ifnet *, struct mbuf *);
+#endif
 void	in_pcbnotifyall(struct inpcbinfo *pcbinfo, struct in_addr,
 	    int, struct inpcb *(*)(struct inpcb *, int));
 void	in_pcbref(struct inpcb *);
@@ -156,10 +156,19 @@ VNET_DEFINE(struct in_ifaddrhead, in_ifaddrhead);  /* first inet address */
 VNET_DEFINE(struct in_ifaddrhashhead *, in_ifaddrhashtbl); /* inet addr hash table  */
 VNET_DEFINE(u_long, in_ifaddrhmask);		/* mask for hash table */
 
+#ifdef UINET
+VNET_PCPUSTAT_DEFINE(struct ipstat, ipstat);
+VNET_PCPUSTAT_SYSINIT(ipstat);
+VNET_PCPUSTAT_SYSUNINIT(ipstat);
+SYSCTL_VNET_PCPUSTAT(_net_inet_ip, IPCTL_STATS, stats, CTLFLAG_RW,
+    &VNET_NAME(ipstat), ipstat,
+    "IP statistics (struct ipstat, netinet/ip_var.h)");
+#else
 VNET_DEFINE(struct ipstat, ipstat);
 SYSCTL_VNET_STRUCT(_net_inet_ip, IPCTL_STATS, stats, CTLFLAG_RW,
     &VNET_NAME(ipstat), ipstat,
     "IP statistics (struct ipstat, netinet/ip_var.h)");
+#endif
 
 static VNET_DEFINE(uma_zone_t, ipq_zone);
 static VNET_DEFINE(TAILQ_HEAD(ipqhead, ipq), ipq[IPREASS_NHASH]);
@@ -226,14 +235,22 @@ void
 kmod_ipstat_inc(int statnum)
 {
 
+#ifdef UINET
+	(*((u_long *)PCPUSTAT_PTR(struct ipstat, V_ipstat, curcpu) + statnum))++;
+#else
 	(*((u_long *)&V_ipstat + statnum))++;
+#endif
 }
 
 void
 kmod_ipstat_dec(int statnum)
 {
 
+#ifdef UINET
+	(*((u_long *)PCPUSTAT_PTR(struct ipstat, V_ipstat, curcpu) + statnum))--;
+#else
 	(*((u_long *)&V_ipstat + statnum))--;
+#endif
 }
 
 static int
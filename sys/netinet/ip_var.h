@@ -135,8 +135,15 @@ struct	ipstat {
  * In-kernel consumers can use these accessor macros directly to update
  * stats.
  */
+#ifdef UINET
+#define	IPSTAT_ADD(name, val)						\
+	VNET_PCPUSTAT_ADD(struct ipstat, ipstat, name, (val))
+#define	IPSTAT_SUB(name, val)						\
+	VNET_PCPUSTAT_ADD(struct ipstat, ipstat, name, -(val))
+#else
 #define	IPSTAT_ADD(name, val)	V_ipstat.name += (val)
 #define	IPSTAT_SUB(name, val)	V_ipstat.name -= (val)
+#endif
 #define	IPSTAT_INC(name)	IPSTAT_ADD(name, 1)
 #define	IPSTAT_DEC(name)	IPSTAT_SUB(name, 1)
 
@@ -174,7 +181,11 @@ struct inpcb;
 struct route;
 struct sockopt;
 
+#ifdef UINET
+VNET_PCPUSTAT_DECLARE(struct ipstat, ipstat);
+#else
 VNET_DECLARE(struct ipstat, ipstat);
+#endif
 VNET_DECLARE(u_short, ip_id);			/* ip packet ctr, for ids */
 VNET_DECLARE(int, ip_defttl);			/* default IP ttl */
 VNET_DECLARE(int, ipforwarding);		/* ip forwarding */
@@ -124,10 +124,19 @@ __FBSDID("$FreeBSD: release/9.1.0/sys/netinet/tcp_input.c 238247 2012-07-08 14:2
 
 const int tcprexmtthresh = 3;
 
+#ifdef UINET
+VNET_PCPUSTAT_DEFINE(struct tcpstat, tcpstat);
+VNET_PCPUSTAT_SYSINIT(tcpstat);
+VNET_PCPUSTAT_SYSUNINIT(tcpstat);
+SYSCTL_VNET_PCPUSTAT(_net_inet_tcp, TCPCTL_STATS, stats, CTLFLAG_RW,
+    &VNET_NAME(tcpstat), tcpstat,
+    "TCP statistics (struct tcpstat, netinet/tcp_var.h)");
+#else
 VNET_DEFINE(struct tcpstat, tcpstat);
 SYSCTL_VNET_STRUCT(_net_inet_tcp, TCPCTL_STATS, stats, CTLFLAG_RW,
     &VNET_NAME(tcpstat), tcpstat,
     "TCP statistics (struct tcpstat, netinet/tcp_var.h)");
+#endif
 
 int tcp_log_in_vain = 0;
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, log_in_vain, CTLFLAG_RW,
@@ -249,7 +258,11 @@ void
 kmod_tcpstat_inc(int statnum)
 {
 
+#ifdef UINET
+	(*((u_long *)PCPUSTAT_PTR(struct tcpstat, V_tcpstat, curcpu) + statnum))++;
+#else
 	(*((u_long *)&V_tcpstat + statnum))++;
+#endif
 }
 
 /*
@@ -877,10 +890,17 @@ findpcb:
 		m_tag_delete(m, fwd_tag);
 	} else
 #endif /* IPFIREWALL_FORWARD */
+#ifdef UINET
+		inp = in_pcblookup_mbuf_lastflow(&V_tcbinfo, ip->ip_src,
+		    th->th_sport, ip->ip_dst, th->th_dport,
+		    INPLOOKUP_WILDCARD | INPLOOKUP_WLOCKPCB,
+		    m->m_pkthdr.rcvif, m);
+#else
 		inp = in_pcblookup_mbuf(&V_tcbinfo, ip->ip_src,
 		    th->th_sport, ip->ip_dst, th->th_dport,
 		    INPLOOKUP_WILDCARD | INPLOOKUP_WLOCKPCB,
 		    m->m_pkthdr.rcvif, m);
+#endif
 #ifdef PASSIVE_INET
 	/*
 	 * Ensure SYN|ACKs originating from an endpoint that we are
@@ -952,6 +972,13 @@ findpcb:
 		inp->inp_flags &= ~INP_SW_FLOWID;
 		inp->inp_flowid = m->m_pkthdr.flowid;
 	}
+#ifdef UINET
+	/*
+	 * Record which cpu's receive thread handles this connection so its
+	 * timers are run from that cpu's callout wheel.
+	 */
+	inp->inp_rxcpu = curcpu + 1;
+#endif
 #ifdef IPSEC
 #ifdef INET6
 	if (isipv6 && ipsec6_in_reject(m, inp)) {
@@ -321,6 +321,10 @@ tcp_init(void)
 	V_tcpcb_zone = uma_zcreate("tcpcb", sizeof(struct tcpcb_mem),
 	    NULL, NULL, NULL, NULL, UMA_ALIGN_PTR, UMA_ZONE_NOFREE);
 	uma_zone_set_max(V_tcpcb_zone, maxsockets);
+#ifdef UINET
+	uinet_hugepage_zone(V_tcbinfo.ipi_zone);
+	uinet_hugepage_zone(V_tcpcb_zone);
+#endif
 
 	tcp_tw_init();
 	syncache_init();
@@ -735,14 +739,19 @@ tcp_newtcpcb(struct inpcb *inp)
 		V_tcp_mssdflt;
 
 	/* Set up our timeouts. */
-	callout_init(&tp->t_timers->tt_rexmt, CALLOUT_MPSAFE);
-	callout_init(&tp->t_timers->tt_persist, CALLOUT_MPSAFE);
-	callout_init(&tp->t_timers->tt_keep, CALLOUT_MPSAFE);
-	callout_init(&tp->t_timers->tt_2msl, CALLOUT_MPSAFE);
-	callout_init(&tp->t_timers->tt_delack, CALLOUT_MPSAFE);
+	if (tcp_lazy_timers) {
+		tp->t_timers->tt_flags |= TTF_LAZY;
+		callout_init(&tp->t_timers->tt_lazy, CALLOUT_MPSAFE);
+	} else {
+		callout_init(&tp->t_timers->tt_callouts.tt_rexmt, CALLOUT_MPSAFE);
+		callout_init(&tp->t_timers->tt_callouts.tt_persist, CALLOUT_MPSAFE);
+		callout_init(&tp->t_timers->tt_callouts.tt_keep, CALLOUT_MPSAFE);
+		callout_init(&tp->t_timers->tt_callouts.tt_2msl, CALLOUT_MPSAFE);
+		callout_init(&tp->t_timers->tt_callouts.tt_delack, CALLOUT_MPSAFE);
 #ifdef PASSIVE_INET
-	callout_init(&tp->t_timers->tt_reassdl, CALLOUT_MPSAFE);
+		callout_init(&tp->t_timers->tt_callouts.tt_reassdl, CALLOUT_MPSAFE);
 #endif
+	}
 
 	if (V_tcp_do_rfc1323)
 		tp->t_flags = (TF_REQ_SCALE|TF_REQ_TSTMP);
@@ -886,14 +895,19 @@ tcp_discardcb(struct tcpcb *tp)
 	 * will be required to ensure that no further processing takes place
 	 * on the tcpcb, even though it hasn't been freed (a flag?).
 	 */
-	callout_stop(&tp->t_timers->tt_rexmt);
-	callout_stop(&tp->t_timers->tt_persist);
-	callout_stop(&tp->t_timers->tt_keep);
-	callout_stop(&tp->t_timers->tt_2msl);
-	callout_stop(&tp->t_timers->tt_delack);
+	if (tp->t_timers->tt_flags & TTF_LAZY) {
+		callout_stop(&tp->t_timers->tt_lazy);
+		tp->t_timers->tt_active = 0;
+	} else {
+		callout_stop(&tp->t_timers->tt_callouts.tt_rexmt);
+		callout_stop(&tp->t_timers->tt_callouts.tt_persist);
+		callout_stop(&tp->t_timers->tt_callouts.tt_keep);
+		callout_stop(&tp->t_timers->tt_callouts.tt_2msl);
+		callout_stop(&tp->t_timers->tt_callouts.tt_delack);
 #ifdef PASSIVE_INET
-	callout_stop(&tp->t_timers->tt_reassdl);
+		callout_stop(&tp->t_timers->tt_callouts.tt_reassdl);
 #endif
+	}
 
 	/*
 	 * If we got enough samples through the srtt filter,
@@ -125,12 +125,27 @@ SYSCTL_INT(_net_inet_tcp, OID_AUTO, keepcnt, CTLFLAG_RW, &tcp_keepcnt, 0,
 	/* max idle probes */
 int	tcp_maxpersistidle;
 
+#ifdef UINET
+/*
+ * Run each connection's timers on the callout wheel of the cpu whose
+ * receive thread handles it.  That thread runs the wheel between receive
+ * batches, so timer processing stays on the cpu already working on the
+ * connection.
+ */
+static int	per_cpu_timers = 1;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, per_cpu_timers, CTLFLAG_RW,
+    &per_cpu_timers , 0, "run tcp timers on the receiving cpu");
+
+#define	INP_CPU(inp)	((per_cpu_timers && (inp)->inp_rxcpu) ? \
+		(inp)->inp_rxcpu - 1 : 0)
+#else
 static int	per_cpu_timers = 0;
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, per_cpu_timers, CTLFLAG_RW,
     &per_cpu_timers , 0, "run tcp timers on all cpus");
 
 #define	INP_CPU(inp)	(per_cpu_timers ? (!CPU_ABSENT(((inp)->inp_flowid % (mp_maxid+1))) ? \
 		((inp)->inp_flowid % (mp_maxid+1)) : curcpu) : 0)
+#endif
 
 /*
  * Tcp protocol timeout routine called every 500 ms.
@@ -165,6 +180,107 @@ static int tcp_timer_race;
 SYSCTL_INT(_net_inet_tcp, OID_AUTO, timer_race, CTLFLAG_RD, &tcp_timer_race,
     0, "Count of t_inpcb races on tcp_discardcb");
 
+/*
+ * Lazy timer mode.  Rather than one callout per timer, each connection
+ * keeps a single callout armed for no later than its earliest timer, and
+ * the timers themselves are just expiry ticks.  Stopping a timer, or
+ * moving it later (as happens to the retransmit timer on nearly every
+ * ACK), doesn't touch the callout.  When the callout fires it runs a timer
+ * that has expired, if any, and rearms for whatever is left.  This trades
+ * an occasional early wakeup for far fewer callout operations per segment,
+ * which matters with very many mostly idle connections.  The mode is
+ * chosen when a connection is created.
+ */
+int	tcp_lazy_timers = 0;
+SYSCTL_INT(_net_inet_tcp, OID_AUTO, lazy_timers, CTLFLAG_RW,
+    &tcp_lazy_timers, 0,
+    "Use a single lazily re-evaluated callout per connection for new connections");
+
+#define	TT_INDEX(timer_type)	(ffs(timer_type) - 1)
+
+static void	tcp_timer_delack_locked(struct tcpcb *);
+static void	tcp_timer_rexmt_locked(struct tcpcb *);
+static void	tcp_timer_persist_locked(struct tcpcb *);
+static void	tcp_timer_keep_locked(struct tcpcb *);
+static void	tcp_timer_2msl_locked(struct tcpcb *);
+#ifdef PASSIVE_INET
+static void	tcp_timer_reassdl_locked(struct tcpcb *);
+#endif
+
+/*
+ * The expiry processing of each timer, called by the lazy mode callout
+ * with the locks the timer's handler would have taken.
+ */
+static void (*tcp_timer_funcs[TT_NTIMERS])(struct tcpcb *) = {
+	tcp_timer_delack_locked,
+	tcp_timer_rexmt_locked,
+	tcp_timer_persist_locked,
+	tcp_timer_keep_locked,
+	tcp_timer_2msl_locked,
+#ifdef PASSIVE_INET
+	tcp_timer_reassdl_locked,
+#endif
+};
+
+/*
+ * Called with the inpcb locked when a timer fires.  Returns non-zero if
+ * the timer has been stopped or rescheduled since it fired, otherwise
+ * marks it no longer active and returns zero.  c is the timer's own
+ * callout, and is unused in lazy mode.
+ */
+static int
+tcp_timer_stale(struct tcpcb *tp, int timer_type, struct callout *c)
+{
+	struct tcp_timer *tt = tp->t_timers;
+
+	if (tt->tt_flags & TTF_LAZY) {
+		if (!(tt->tt_active & timer_type) ||
+		    (tt->tt_deadline[TT_INDEX(timer_type)] - ticks > 0))
+			return (1);
+		tt->tt_active &= ~timer_type;
+		return (0);
+	}
+
+	if (callout_pending(c) || !callout_active(c))
+		return (1);
+	callout_deactivate(c);
+	return (0);
+}
+
+/*
+ * Make sure the lazy callout will fire no later than the earliest active
+ * timer other than those in exclude.
+ */
+static void
+tcp_timer_lazy_arm(struct tcpcb *tp, int exclude)
+{
+	struct tcp_timer *tt = tp->t_timers;
+	int pending;
+	int earliest;
+	int delta;
+	int i;
+
+	pending = tt->tt_active & ~exclude;
+	if (0 == pending)
+		return;
+
+	earliest = tt->tt_deadline[TT_INDEX(pending)];
+	for (i = TT_INDEX(pending) + 1; i < TT_NTIMERS; i++) {
+		if ((pending & (1 << i)) && (tt->tt_deadline[i] - earliest < 0))
+			earliest = tt->tt_deadline[i];
+	}
+
+	if (callout_pending(&tt->tt_lazy) && (tt->tt_lazy_time - earliest <= 0))
+		return;
+
+	delta = earliest - ticks;
+	if (delta < 1)
+		delta = 1;
+	tt->tt_lazy_time = ticks + delta;
+	callout_reset_on(&tt->tt_lazy, delta, tcp_timer_lazy, tp,
+	    INP_CPU(tp->t_inpcb));
+}
+
 /*
  * TCP timer processing.
  */
@@ -190,19 +306,28 @@ tcp_timer_delack(void *xtp)
 		return;
 	}
 	INP_WLOCK(inp);
-	if ((inp->inp_flags & INP_DROPPED) || callout_pending(&tp->t_timers->tt_delack)
-	    || !callout_active(&tp->t_timers->tt_delack)) {
+	if ((inp->inp_flags & INP_DROPPED) ||
+	    tcp_timer_stale(tp, TT_DELACK,
+	    &tp->t_timers->tt_callouts.tt_delack)) {
 		INP_WUNLOCK(inp);
 		CURVNET_RESTORE();
 		return;
 	}
-	callout_deactivate(&tp->t_timers->tt_delack);
+	tcp_timer_delack_locked(tp);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Called with the inpcb locked, which is released.
+ */
+static void
+tcp_timer_delack_locked(struct tcpcb *tp)
+{
 
 	tp->t_flags |= TF_ACKNOW;
 	TCPSTAT_INC(tcps_delack);
 	(void) tcp_output(tp);
-	INP_WUNLOCK(inp);
-	CURVNET_RESTORE();
+	INP_WUNLOCK(tp->t_inpcb);
 }
 
 void
@@ -211,11 +336,7 @@ tcp_timer_2msl(void *xtp)
 	struct tcpcb *tp = xtp;
 	struct inpcb *inp;
 	CURVNET_SET(tp->t_vnet);
-#ifdef TCPDEBUG
-	int ostate;
 
-	ostate = tp->t_state;
-#endif
 	/*
 	 * XXXRW: Does this actually happen?
 	 */
@@ -235,15 +356,33 @@ tcp_timer_2msl(void *xtp)
 		return;
 	}
 	INP_WLOCK(inp);
-	tcp_free_sackholes(tp);
-	if ((inp->inp_flags & INP_DROPPED) || callout_pending(&tp->t_timers->tt_2msl) ||
-	    !callout_active(&tp->t_timers->tt_2msl)) {
+	if ((inp->inp_flags & INP_DROPPED) ||
+	    tcp_timer_stale(tp, TT_2MSL,
+	    &tp->t_timers->tt_callouts.tt_2msl)) {
 		INP_WUNLOCK(tp->t_inpcb);
 		INP_INFO_WUNLOCK(&V_tcbinfo);
 		CURVNET_RESTORE();
 		return;
 	}
-	callout_deactivate(&tp->t_timers->tt_2msl);
+	tcp_timer_2msl_locked(tp);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Called with the pcbinfo and inpcb write locked, both of which are
+ * released.
+ */
+static void
+tcp_timer_2msl_locked(struct tcpcb *tp)
+{
+	struct inpcb *inp = tp->t_inpcb;
+#ifdef TCPDEBUG
+	int ostate;
+
+	ostate = tp->t_state;
+#endif
+
+	tcp_free_sackholes(tp);
 	/*
 	 * 2 MSL timeout in shutdown went off.  If we're closed but
 	 * still waiting for peer to close and connection has been idle
@@ -262,8 +401,7 @@ tcp_timer_2msl(void *xtp)
 	} else {
 		if (tp->t_state != TCPS_TIME_WAIT &&
 		   ticks - tp->t_rcvtime <= TP_MAXIDLE(tp))
-		       callout_reset_on(&tp->t_timers->tt_2msl,
-			   TP_KEEPINTVL(tp), tcp_timer_2msl, tp, INP_CPU(inp));
+		       tcp_timer_activate(tp, TT_2MSL, TP_KEEPINTVL(tp));
 	       else
 		       tp = tcp_close(tp);
        }
@@ -276,21 +414,15 @@ tcp_timer_2msl(void *xtp)
 	if (tp != NULL)
 		INP_WUNLOCK(inp);
 	INP_INFO_WUNLOCK(&V_tcbinfo);
-	CURVNET_RESTORE();
 }
 
 void
 tcp_timer_keep(void *xtp)
 {
 	struct tcpcb *tp = xtp;
-	struct tcptemp *t_template;
 	struct inpcb *inp;
 	CURVNET_SET(tp->t_vnet);
-#ifdef TCPDEBUG
-	int ostate;
 
-	ostate = tp->t_state;
-#endif
 	INP_INFO_WLOCK(&V_tcbinfo);
 	inp = tp->t_inpcb;
 	/*
@@ -307,14 +439,33 @@ tcp_timer_keep(void *xtp)
 		return;
 	}
 	INP_WLOCK(inp);
-	if ((inp->inp_flags & INP_DROPPED) || callout_pending(&tp->t_timers->tt_keep)
-	    || !callout_active(&tp->t_timers->tt_keep)) {
+	if ((inp->inp_flags & INP_DROPPED) ||
+	    tcp_timer_stale(tp, TT_KEEP,
+	    &tp->t_timers->tt_callouts.tt_keep)) {
 		INP_WUNLOCK(inp);
 		INP_INFO_WUNLOCK(&V_tcbinfo);
 		CURVNET_RESTORE();
 		return;
 	}
-	callout_deactivate(&tp->t_timers->tt_keep);
+	tcp_timer_keep_locked(tp);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Called with the pcbinfo and inpcb write locked, both of which are
+ * released.
+ */
+static void
+tcp_timer_keep_locked(struct tcpcb *tp)
+{
+	struct tcptemp *t_template;
+	struct inpcb *inp = tp->t_inpcb;
+#ifdef TCPDEBUG
+	int ostate;
+
+	ostate = tp->t_state;
+#endif
+
 	/*
 	 * Keep-alive timer went off; send something
 	 * or drop connection if idle for too long.
@@ -346,11 +497,9 @@ tcp_timer_keep(void *xtp)
 				    tp->rcv_nxt, tp->snd_una - 1, 0);
 			free(t_template, M_TEMP);
 		}
-		callout_reset_on(&tp->t_timers->tt_keep, TP_KEEPINTVL(tp),
-		    tcp_timer_keep, tp, INP_CPU(inp));
+		tcp_timer_activate(tp, TT_KEEP, TP_KEEPINTVL(tp));
 	} else
-		callout_reset_on(&tp->t_timers->tt_keep, TP_KEEPIDLE(tp),
-		    tcp_timer_keep, tp, INP_CPU(inp));
+		tcp_timer_activate(tp, TT_KEEP, TP_KEEPIDLE(tp));
 
 #ifdef TCPDEBUG
 	if (inp->inp_socket->so_options & SO_DEBUG)
@@ -359,7 +508,6 @@ tcp_timer_keep(void *xtp)
 #endif
 	INP_WUNLOCK(inp);
 	INP_INFO_WUNLOCK(&V_tcbinfo);
-	CURVNET_RESTORE();
 	return;
 
 dropit:
@@ -374,7 +522,6 @@ dropit:
 	if (tp != NULL)
 		INP_WUNLOCK(tp->t_inpcb);
 	INP_INFO_WUNLOCK(&V_tcbinfo);
-	CURVNET_RESTORE();
 }
 
 void
@@ -383,11 +530,7 @@ tcp_timer_persist(void *xtp)
 	struct tcpcb *tp = xtp;
 	struct inpcb *inp;
 	CURVNET_SET(tp->t_vnet);
-#ifdef TCPDEBUG
-	int ostate;
 
-	ostate = tp->t_state;
-#endif
 	INP_INFO_WLOCK(&V_tcbinfo);
 	inp = tp->t_inpcb;
 	/*
@@ -404,14 +547,32 @@ tcp_timer_persist(void *xtp)
 		return;
 	}
 	INP_WLOCK(inp);
-	if ((inp->inp_flags & INP_DROPPED) || callout_pending(&tp->t_timers->tt_persist)
-	    || !callout_active(&tp->t_timers->tt_persist)) {
+	if ((inp->inp_flags & INP_DROPPED) ||
+	    tcp_timer_stale(tp, TT_PERSIST,
+	    &tp->t_timers->tt_callouts.tt_persist)) {
 		INP_WUNLOCK(inp);
 		INP_INFO_WUNLOCK(&V_tcbinfo);
 		CURVNET_RESTORE();
 		return;
 	}
-	callout_deactivate(&tp->t_timers->tt_persist);
+	tcp_timer_persist_locked(tp);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Called with the pcbinfo and inpcb write locked, both of which are
+ * released.
+ */
+static void
+tcp_timer_persist_locked(struct tcpcb *tp)
+{
+	struct inpcb *inp = tp->t_inpcb;
+#ifdef TCPDEBUG
+	int ostate;
+
+	ostate = tp->t_state;
+#endif
+
 	/*
 	 * Persistance timer into zero window.
 	 * Force a byte to be output, if possible.
@@ -444,7 +605,6 @@ out:
 	if (tp != NULL)
 		INP_WUNLOCK(inp);
 	INP_INFO_WUNLOCK(&V_tcbinfo);
-	CURVNET_RESTORE();
 }
 
 void
@@ -452,14 +612,8 @@ tcp_timer_rexmt(void * xtp)
 {
 	struct tcpcb *tp = xtp;
 	CURVNET_SET(tp->t_vnet);
-	int rexmt;
-	int headlocked;
 	struct inpcb *inp;
-#ifdef TCPDEBUG
-	int ostate;
 
-	ostate = tp->t_state;
-#endif
 	INP_INFO_RLOCK(&V_tcbinfo);
 	inp = tp->t_inpcb;
 	/*
@@ -476,14 +630,34 @@ tcp_timer_rexmt(void * xtp)
 		return;
 	}
 	INP_WLOCK(inp);
-	if ((inp->inp_flags & INP_DROPPED) || callout_pending(&tp->t_timers->tt_rexmt)
-	    || !callout_active(&tp->t_timers->tt_rexmt)) {
+	if ((inp->inp_flags & INP_DROPPED) ||
+	    tcp_timer_stale(tp, TT_REXMT,
+	    &tp->t_timers->tt_callouts.tt_rexmt)) {
 		INP_WUNLOCK(inp);
 		INP_INFO_RUNLOCK(&V_tcbinfo);
 		CURVNET_RESTORE();
 		return;
 	}
-	callout_deactivate(&tp->t_timers->tt_rexmt);
+	tcp_timer_rexmt_locked(tp);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Called with the pcbinfo read locked and the inpcb write locked, both of
+ * which are released.
+ */
+static void
+tcp_timer_rexmt_locked(struct tcpcb *tp)
+{
+	int rexmt;
+	int headlocked;
+	struct inpcb *inp = tp->t_inpcb;
+#ifdef TCPDEBUG
+	int ostate;
+
+	ostate = tp->t_state;
+#endif
+
 	tcp_free_sackholes(tp);
 	/*
 	 * Retransmission timer went off.  Message has not
@@ -500,13 +674,11 @@ tcp_timer_rexmt(void * xtp)
 		INP_WLOCK(inp);
 		if (in_pcbrele_wlocked(inp)) {
 			INP_INFO_WUNLOCK(&V_tcbinfo);
-			CURVNET_RESTORE();
 			return;
 		}
 		if (inp->inp_flags & INP_DROPPED) {
 			INP_WUNLOCK(inp);
 			INP_INFO_WUNLOCK(&V_tcbinfo);
-			CURVNET_RESTORE();
 			return;
 		}
 
@@ -598,7 +770,6 @@ out:
 		INP_WUNLOCK(inp);
 	if (headlocked)
 		INP_INFO_WUNLOCK(&V_tcbinfo);
-	CURVNET_RESTORE();
 }
 
 #ifdef PASSIVE_INET
@@ -623,21 +794,133 @@ tcp_timer_reassdl(void *xtp)
 		return;
 	}
 	INP_WLOCK(inp);
-	if ((inp->inp_flags & INP_DROPPED) || callout_pending(&tp->t_timers->tt_reassdl)
-	    || !callout_active(&tp->t_timers->tt_reassdl)) {
+	if ((inp->inp_flags & INP_DROPPED) ||
+	    tcp_timer_stale(tp, TT_REASSDL,
+	    &tp->t_timers->tt_callouts.tt_reassdl)) {
 		INP_WUNLOCK(inp);
 		CURVNET_RESTORE();
 		return;
 	}
-	callout_deactivate(&tp->t_timers->tt_reassdl);
+	tcp_timer_reassdl_locked(tp);
+	CURVNET_RESTORE();
+}
+
+/*
+ * Called with the inpcb locked, which is released.
+ */
+static void
+tcp_timer_reassdl_locked(struct tcpcb *tp)
+{
 
 	tcp_reass_deliver_holes(tp);
 	
-	INP_WUNLOCK(inp);
-	CURVNET_RESTORE();
+	INP_WUNLOCK(tp->t_inpcb);
 }
 #endif /* PASSIVE_INET */
 
+/*
+ * Timers whose handlers take the pcbinfo lock, write and read locked.
+ */
+#define	TT_INFO_WLOCKED	(TT_PERSIST | TT_KEEP | TT_2MSL)
+#define	TT_INFO_RLOCKED	TT_REXMT
+
+static void
+tcp_timer_info_unlock(int timer_type)
+{
+
+	if (timer_type & TT_INFO_WLOCKED)
+		INP_INFO_WUNLOCK(&V_tcbinfo);
+	else if (timer_type & TT_INFO_RLOCKED)
+		INP_INFO_RUNLOCK(&V_tcbinfo);
+}
+
+/*
+ * Lazy mode callout.  Runs the first expired timer, if any, after
+ * rearming for the rest.  Any other timers that have also expired are run
+ * on the next tick.  The timer is run with the locks its handler would
+ * take.  When that includes the pcbinfo lock, which comes before the inpcb
+ * lock, the inpcb is unlocked to take it and then rechecked, as
+ * tcp_timer_rexmt() does when it upgrades.
+ */
+void
+tcp_timer_lazy(void *xtp)
+{
+	struct tcpcb *tp = xtp;
+	struct tcp_timer *tt;
+	struct inpcb *inp;
+	int timer_type;
+	int i;
+	CURVNET_SET(tp->t_vnet);
+
+	inp = tp->t_inpcb;
+	if (inp == NULL) {
+		tcp_timer_race++;
+		CURVNET_RESTORE();
+		return;
+	}
+	INP_WLOCK(inp);
+	tt = tp->t_timers;
+	/*
+	 * A tcpcb reused for a connection in the other mode has callouts
+	 * where tt_lazy was.
+	 */
+	if ((inp->inp_flags & INP_DROPPED) || !(tt->tt_flags & TTF_LAZY) ||
+	    callout_pending(&tt->tt_lazy) || !callout_active(&tt->tt_lazy)) {
+		INP_WUNLOCK(inp);
+		CURVNET_RESTORE();
+		return;
+	}
+	callout_deactivate(&tt->tt_lazy);
+
+	timer_type = 0;
+	for (i = 0; i < TT_NTIMERS; i++) {
+		if ((tt->tt_active & (1 << i)) &&
+		    (tt->tt_deadline[i] - ticks <= 0)) {
+			timer_type = 1 << i;
+			break;
+		}
+	}
+
+	if (timer_type & (TT_INFO_WLOCKED | TT_INFO_RLOCKED)) {
+		in_pcbref(inp);
+		INP_WUNLOCK(inp);
+		if (timer_type & TT_INFO_WLOCKED)
+			INP_INFO_WLOCK(&V_tcbinfo);
+		else
+			INP_INFO_RLOCK(&V_tcbinfo);
+		INP_WLOCK(inp);
+		if (in_pcbrele_wlocked(inp)) {
+			tcp_timer_info_unlock(timer_type);
+			CURVNET_RESTORE();
+			return;
+		}
+		if (inp->inp_flags & INP_DROPPED) {
+			INP_WUNLOCK(inp);
+			tcp_timer_info_unlock(timer_type);
+			CURVNET_RESTORE();
+			return;
+		}
+	}
+
+	/*
+	 * The timer may have been stopped or moved while the inpcb was
+	 * unlocked.
+	 */
+	if ((timer_type != 0) && tcp_timer_stale(tp, timer_type, NULL)) {
+		tcp_timer_info_unlock(timer_type);
+		timer_type = 0;
+	}
+	tcp_timer_lazy_arm(tp, 0);
+	if (timer_type == 0) {
+		INP_WUNLOCK(inp);
+		CURVNET_RESTORE();
+		return;
+	}
+
+	tcp_timer_funcs[TT_INDEX(timer_type)](tp);
+	CURVNET_RESTORE();
+}
+
 void
 tcp_timer_activate(struct tcpcb *tp, int timer_type, u_int delta)
 {
@@ -646,30 +929,42 @@ tcp_timer_activate(struct tcpcb *tp, int timer_type, u_int delta)
 	struct inpcb *inp = tp->t_inpcb;
 	int cpu = INP_CPU(inp);
 
+	if (tp->t_timers->tt_flags & TTF_LAZY) {
+		if (delta == 0) {
+			tp->t_timers->tt_active &= ~timer_type;
+		} else {
+			tp->t_timers->tt_deadline[TT_INDEX(timer_type)] =
+			    ticks + delta;
+			tp->t_timers->tt_active |= timer_type;
+			tcp_timer_lazy_arm(tp, 0);
+		}
+		return;
+	}
+
 	switch (timer_type) {
 		case TT_DELACK:
-			t_callout = &tp->t_timers->tt_delack;
+			t_callout = &tp->t_timers->tt_callouts.tt_delack;
 			f_callout = tcp_timer_delack;
 			break;
 		case TT_REXMT:
-			t_callout = &tp->t_timers->tt_rexmt;
+			t_callout = &tp->t_timers->tt_callouts.tt_rexmt;
 			f_callout = tcp_timer_rexmt;
 			break;
 		case TT_PERSIST:
-			t_callout = &tp->t_timers->tt_persist;
+			t_callout = &tp->t_timers->tt_callouts.tt_persist;
 			f_callout = tcp_timer_persist;
 			break;
 		case TT_KEEP:
-			t_callout = &tp->t_timers->tt_keep;
+			t_callout = &tp->t_timers->tt_callouts.tt_keep;
 			f_callout = tcp_timer_keep;
 			break;
 		case TT_2MSL:
-			t_callout = &tp->t_timers->tt_2msl;
+			t_callout = &tp->t_timers->tt_callouts.tt_2msl;
 			f_callout = tcp_timer_2msl;
 			break;
 #ifdef PASSIVE_INET
 		case TT_REASSDL:
-			t_callout = &tp->t_timers->tt_reassdl;
+			t_callout = &tp->t_timers->tt_callouts.tt_reassdl;
 			f_callout = tcp_timer_reassdl;
 			break;
 #endif
@@ -688,25 +983,28 @@ tcp_timer_active(struct tcpcb *tp, int timer_type)
 {
 	struct callout *t_callout;
 
+	if (tp->t_timers->tt_flags & TTF_LAZY)
+		return ((tp->t_timers->tt_active & timer_type) != 0);
+
 	switch (timer_type) {
 		case TT_DELACK:
-			t_callout = &tp->t_timers->tt_delack;
+			t_callout = &tp->t_timers->tt_callouts.tt_delack;
 			break;
 		case TT_REXMT:
-			t_callout = &tp->t_timers->tt_rexmt;
+			t_callout = &tp->t_timers->tt_callouts.tt_rexmt;
 			break;
 		case TT_PERSIST:
-			t_callout = &tp->t_timers->tt_persist;
+			t_callout = &tp->t_timers->tt_callouts.tt_persist;
 			break;
 		case TT_KEEP:
-			t_callout = &tp->t_timers->tt_keep;
+			t_callout = &tp->t_timers->tt_callouts.tt_keep;
 			break;
 		case TT_2MSL:
-			t_callout = &tp->t_timers->tt_2msl;
+			t_callout = &tp->t_timers->tt_callouts.tt_2msl;
 			break;
 #ifdef PASSIVE_INET
 		case TT_REASSDL:
-			t_callout = &tp->t_timers->tt_reassdl;
+			t_callout = &tp->t_timers->tt_callouts.tt_reassdl;
 			break;
 #endif
 		default:
@@ -717,21 +1015,39 @@ tcp_timer_active(struct tcpcb *tp, int timer_type)
 
 #define	ticks_to_msecs(t)	(1000*(t) / hz)
 
+static int
+tcp_timer_lazy_msecs(struct tcp_timer *tt, int timer_type)
+{
+
+	if (!(tt->tt_active & timer_type))
+		return (0);
+	return (ticks_to_msecs(tt->tt_deadline[TT_INDEX(timer_type)] - ticks));
+}
+
 void
 tcp_timer_to_xtimer(struct tcpcb *tp, struct tcp_timer *timer, struct xtcp_timer *xtimer)
 {
 	bzero(xtimer, sizeof(struct xtcp_timer));
 	if (timer == NULL)
 		return;
-	if (callout_active(&timer->tt_delack))
-		xtimer->tt_delack = ticks_to_msecs(timer->tt_delack.c_time - ticks);
-	if (callout_active(&timer->tt_rexmt))
-		xtimer->tt_rexmt = ticks_to_msecs(timer->tt_rexmt.c_time - ticks);
-	if (callout_active(&timer->tt_persist))
-		xtimer->tt_persist = ticks_to_msecs(timer->tt_persist.c_time - ticks);
-	if (callout_active(&timer->tt_keep))
-		xtimer->tt_keep = ticks_to_msecs(timer->tt_keep.c_time - ticks);
-	if (callout_active(&timer->tt_2msl))
-		xtimer->tt_2msl = ticks_to_msecs(timer->tt_2msl.c_time - ticks);
+	if (timer->tt_flags & TTF_LAZY) {
+		xtimer->tt_delack = tcp_timer_lazy_msecs(timer, TT_DELACK);
+		xtimer->tt_rexmt = tcp_timer_lazy_msecs(timer, TT_REXMT);
+		xtimer->tt_persist = tcp_timer_lazy_msecs(timer, TT_PERSIST);
+		xtimer->tt_keep = tcp_timer_lazy_msecs(timer, TT_KEEP);
+		xtimer->tt_2msl = tcp_timer_lazy_msecs(timer, TT_2MSL);
+		xtimer->t_rcvtime = ticks_to_msecs(ticks - tp->t_rcvtime);
+		return;
+	}
+	if (callout_active(&timer->tt_callouts.tt_delack))
+		xtimer->tt_delack = ticks_to_msecs(timer->tt_callouts.tt_delack.c_time - ticks);
+	if (callout_active(&timer->tt_callouts.tt_rexmt))
+		xtimer->tt_rexmt = ticks_to_msecs(timer->tt_callouts.tt_rexmt.c_time - ticks);
+	if (callout_active(&timer->tt_callouts.tt_persist))
+		xtimer->tt_persist = ticks_to_msecs(timer->tt_callouts.tt_persist.c_time - ticks);
+	if (callout_active(&timer->tt_callouts.tt_keep))
+		xtimer->tt_keep = ticks_to_msecs(timer->tt_callouts.tt_keep.c_time - ticks);
+	if (callout_active(&timer->tt_callouts.tt_2msl))
+		xtimer->tt_2msl = ticks_to_msecs(timer->tt_callouts.tt_2msl.c_time - ticks);
 	xtimer->t_rcvtime = ticks_to_msecs(ticks - tp->t_rcvtime);
 }
@@ -144,16 +144,45 @@ static const char *tcptimers[] =
 
 struct xtcp_timer;
 
+#ifdef PASSIVE_INET
+#define	TT_NTIMERS	6
+#else
+#define	TT_NTIMERS	5
+#endif
+
+/*
+ * A connection uses either one callout per timer, or in lazy mode
+ * (TTF_LAZY) a single callout armed for no later than the earliest timer,
+ * with each timer an expiry tick in tt_deadline.  The mode is fixed when
+ * the connection is created, so the two share storage.
+ */
 struct tcp_timer {
-	struct	callout tt_rexmt;	/* retransmit timer */
-	struct	callout tt_persist;	/* retransmit persistence */
-	struct	callout tt_keep;	/* keepalive */
-	struct	callout tt_2msl;	/* 2*msl TIME_WAIT timer */
-	struct	callout tt_delack;	/* delayed ACK timer */
+	union {
+		struct {
+			struct	callout tt_rexmt;	/* retransmit timer */
+			struct	callout tt_persist;	/* retransmit persistence */
+			struct	callout tt_keep;	/* keepalive */
+			struct	callout tt_2msl;	/* 2*msl TIME_WAIT timer */
+			struct	callout tt_delack;	/* delayed ACK timer */
 #ifdef PASSIVE_INET
-	struct	callout tt_reassdl;	/* reassmbly deadline timer */
+			struct	callout tt_reassdl;	/* reassmbly deadline timer */
 #endif
+		} tu_callouts;
+		struct {
+			struct	callout tu_lazy;	/* single callout for all timers */
+			int	tu_active;		/* TT_* timers armed */
+			int	tu_lazy_time;		/* tick tt_lazy is armed for */
+			int	tu_deadline[TT_NTIMERS]; /* expiry tick of each timer */
+		} tu_lazy;
+	} tt_u;
+	int	tt_flags;		/* TTF_* */
 };
+#define	tt_callouts	tt_u.tu_callouts
+#define	tt_lazy		tt_u.tu_lazy.tu_lazy
+#define	tt_active	tt_u.tu_lazy.tu_active
+#define	tt_lazy_time	tt_u.tu_lazy.tu_lazy_time
+#define	tt_deadline	tt_u.tu_lazy.tu_deadline
+
 #define TT_DELACK	0x01
 #define TT_REXMT	0x02
 #define TT_PERSIST	0x04
@@ -163,6 +192,8 @@ struct tcp_timer {
 #define TT_REASSDL	0x20
 #endif
 
+#define	TTF_LAZY	0x01		/* one callout, lazily re-evaluated */
+
 #define	TP_KEEPINIT(tp)	((tp)->t_keepinit ? (tp)->t_keepinit : tcp_keepinit)
 #define	TP_KEEPIDLE(tp)	((tp)->t_keepidle ? (tp)->t_keepidle : tcp_keepidle)
 #define	TP_KEEPINTVL(tp) ((tp)->t_keepintvl ? (tp)->t_keepintvl : tcp_keepintvl)
@@ -189,6 +220,7 @@ extern int tcp_reassdl;			/* deadline for segment delivery from reass. q */
 
 extern int tcp_finwait2_timeout;
 extern int tcp_fast_finwait2_recycle;
+extern int tcp_lazy_timers;
 
 void	tcp_timer_init(void);
 void	tcp_timer_2msl(void *xtp);
@@ -198,6 +230,7 @@ void	tcp_timer_keep(void *xtp);
 void	tcp_timer_persist(void *xtp);
 void	tcp_timer_rexmt(void *xtp);
 void	tcp_timer_delack(void *xtp);
+void	tcp_timer_lazy(void *xtp);
 void	tcp_timer_to_xtimer(struct tcpcb *tp, struct tcp_timer *timer,
 	struct xtcp_timer *xtimer);
 #ifdef PASSIVE_INET
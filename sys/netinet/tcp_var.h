@@ -524,7 +524,12 @@ struct	tcpstat {
  * In-kernel consumers can use these accessor macros directly to update
  * stats.
  */
+#ifdef UINET
+#define	TCPSTAT_ADD(name, val)						\
+	VNET_PCPUSTAT_ADD(struct tcpstat, tcpstat, name, (val))
+#else
 #define	TCPSTAT_ADD(name, val)	V_tcpstat.name += (val)
+#endif
 #define	TCPSTAT_INC(name)	TCPSTAT_ADD(name, 1)
 
 /*
@@ -625,7 +630,11 @@ MALLOC_DECLARE(M_TCPLOG);
 
 VNET_DECLARE(struct inpcbhead, tcb);		/* queue of active tcpcb's */
 VNET_DECLARE(struct inpcbinfo, tcbinfo);
+#ifdef UINET
+VNET_PCPUSTAT_DECLARE(struct tcpstat, tcpstat);	/* tcp statistics */
+#else
 VNET_DECLARE(struct tcpstat, tcpstat);		/* tcp statistics */
+#endif
 extern	int tcp_log_in_vain;
 VNET_DECLARE(int, tcp_mssdflt);	/* XXX */
 VNET_DECLARE(int, tcp_minmss);
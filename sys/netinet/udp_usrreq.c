@@ -145,10 +145,19 @@ static VNET_DEFINE(uma_zone_t, udpcb_zone);
 #define	UDBHASHSIZE	128
 #endif
 
+#ifdef UINET
+VNET_PCPUSTAT_DEFINE(struct udpstat, udpstat);		/* from udp_var.h */
+VNET_PCPUSTAT_SYSINIT(udpstat);
+VNET_PCPUSTAT_SYSUNINIT(udpstat);
+SYSCTL_VNET_PCPUSTAT(_net_inet_udp, UDPCTL_STATS, stats, CTLFLAG_RW,
+    &VNET_NAME(udpstat), udpstat,
+    "UDP statistics (struct udpstat, netinet/udp_var.h)");
+#else
 VNET_DEFINE(struct udpstat, udpstat);		/* from udp_var.h */
 SYSCTL_VNET_STRUCT(_net_inet_udp, UDPCTL_STATS, stats, CTLFLAG_RW,
     &VNET_NAME(udpstat), udpstat,
     "UDP statistics (struct udpstat, netinet/udp_var.h)");
+#endif
 
 #ifdef INET
 static void	udp_detach(struct socket *so);
@@ -208,7 +217,11 @@ void
 kmod_udpstat_inc(int statnum)
 {
 
+#ifdef UINET
+	(*((u_long *)PCPUSTAT_PTR(struct udpstat, V_udpstat, curcpu) + statnum))++;
+#else
 	(*((u_long *)&V_udpstat + statnum))++;
+#endif
 }
 
 int
@@ -95,7 +95,12 @@ struct udpstat {
  * In-kernel consumers can use these accessor macros directly to update
  * stats.
  */
+#ifdef UINET
+#define	UDPSTAT_ADD(name, val)						\
+	VNET_PCPUSTAT_ADD(struct udpstat, udpstat, name, (val))
+#else
 #define	UDPSTAT_ADD(name, val)	V_udpstat.name += (val)
+#endif
 #define	UDPSTAT_INC(name)	UDPSTAT_ADD(name, 1)
 
 /*
@@ -137,7 +142,11 @@ VNET_DECLARE(struct inpcbinfo, udbinfo);
 extern u_long			udp_sendspace;
 extern u_long			udp_recvspace;
 VNET_DECLARE(int, udp_cksum);
+#ifdef UINET
+VNET_PCPUSTAT_DECLARE(struct udpstat, udpstat);
+#else
 VNET_DECLARE(struct udpstat, udpstat);
+#endif
 VNET_DECLARE(int, udp_blackhole);
 #define	V_udp_cksum		VNET(udp_cksum)
 #define	V_udpstat		VNET(udpstat)
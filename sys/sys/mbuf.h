@@ -399,10 +399,44 @@ struct mbstat {
  * The rest of it is defined in kern/kern_mbuf.c
  */
 
+#ifdef UINET
+/*
+ * The mbuf, cluster, packet and page-size jumbo zones are replicated per
+ * memory domain.  Allocations are made from the current cpu's domain and
+ * frees must go back to the domain the item came from, which is what
+ * MB_ZONE_HOME() looks up.
+ */
+struct mb_domain_zones {
+	uma_zone_t	mbuf;
+	uma_zone_t	clust;
+	uma_zone_t	pack;
+	uma_zone_t	jumbop;
+};
+
+extern struct mb_domain_zones	mb_domain_zones[];
+
+struct mb_domain_zones	*mb_homezones(void *item);
+
+static __inline struct mb_domain_zones *
+mb_curzones(void)
+{
+
+	return (&mb_domain_zones[vm_ndomains > 1 ? uinet_curdomain() : 0]);
+}
+
+#define	zone_mbuf	(mb_curzones()->mbuf)
+#define	zone_clust	(mb_curzones()->clust)
+#define	zone_pack	(mb_curzones()->pack)
+#define	zone_jumbop	(mb_curzones()->jumbop)
+#define	MB_ZONE_HOME(name, item)					\
+	((vm_ndomains > 1 ? mb_homezones(item) : &mb_domain_zones[0])->name)
+#else
 extern uma_zone_t	zone_mbuf;
 extern uma_zone_t	zone_clust;
 extern uma_zone_t	zone_pack;
 extern uma_zone_t	zone_jumbop;
+#define	MB_ZONE_HOME(name, item)	(zone_ ## name)
+#endif
 extern uma_zone_t	zone_jumbo9;
 extern uma_zone_t	zone_jumbo16;
 extern uma_zone_t	zone_ext_refcnt;
@@ -594,7 +628,7 @@ m_getjcl(int how, short type, int flags, int size)
 	zone = m_getzone(size);
 	n = uma_zalloc_arg(zone, m, how);
 	if (n == NULL) {
-		uma_zfree(zone_mbuf, m);
+		uma_zfree(MB_ZONE_HOME(mbuf, m), m);
 		return (NULL);
 	}
 	return (m);
@@ -608,7 +642,7 @@ m_free_fast(struct mbuf *m)
 		KASSERT(SLIST_EMPTY(&m->m_pkthdr.tags), ("doing fast free of mbuf with tags"));
 #endif
 
-	uma_zfree_arg(zone_mbuf, m, (void *)MB_NOTAGS);
+	uma_zfree_arg(MB_ZONE_HOME(mbuf, m), m, (void *)MB_NOTAGS);
 }
 
 static __inline struct mbuf *
@@ -619,7 +653,7 @@ m_free(struct mbuf *m)
 	if (m->m_flags & M_EXT)
 		mb_free_ext(m);
 	else if ((m->m_flags & M_NOFREE) == 0)
-		uma_zfree(zone_mbuf, m);
+		uma_zfree(MB_ZONE_HOME(mbuf, m), m);
 	return (n);
 }
 
@@ -202,6 +202,19 @@ struct thread_stop_req {
 	struct cv	tsr_cv;
 	int		tsr_ack;
 };
+
+/*
+ * Sleep queue linkage used by the uinet _sleep()/wakeup() implementation.
+ * Protected by the lock of the sleep queue chain the thread is sleeping
+ * on.
+ */
+struct thread_sleep {
+	TAILQ_ENTRY(thread_sleep) ts_link;
+	void		*ts_chan;	/* Sleep channel. */
+	const char	*ts_wmesg;	/* Reason for sleep. */
+	int		ts_woken;	/* Removed by wakeup(). */
+	struct cv	ts_cv;
+};
 #endif
 
 /*
@@ -230,6 +243,10 @@ struct thread {
 	struct thread_stop_req *td_stop_req; /* (t) Stop request */
 	int		td_last_stop_check; /* (k) To rate limit stop-checking */
 	int		td_stop_check_ticks; /* (k) Min. stop check interval */
+	struct inpcb_lastflow *td_pcblastflow; /* (k) RX batch inpcb cache */
+	struct thread_sleep td_sleep;	/* (k) _sleep() state */
+	struct lock_prof_thread *td_lprof_thread; /* (k) Lock profiling buffer */
+	struct rm_priotracker *td_rmtrackers; /* (k) Held rmlock read locks */
 #endif
 
 /* Cleared during fork1() */